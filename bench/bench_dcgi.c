@@ -0,0 +1,48 @@
+/* DCGI module answering every request with a short plain text body */
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct st_string_pair {
+  char *first;
+  char *second;
+} StringPair;
+
+static char *copyString(const char *src) {
+  size_t len = strlen(src);
+  char *ret = (char*)malloc(len + 1);
+  memcpy(ret, src, len + 1);
+  return ret;
+}
+
+int dcgi_main(int method,
+              const char *queryPath,
+              const StringPair *headers,
+              const StringPair *params,
+              const char *body,
+              StringPair **headerDest,
+              char **dataDest,
+              char **errDest) {
+  (void)method;
+  (void)queryPath;
+  (void)headers;
+  (void)params;
+  (void)body;
+  (void)errDest;
+
+  StringPair *responseHeaders = (StringPair*)malloc(2 * sizeof(StringPair));
+  responseHeaders[0].first = copyString("Content-Type");
+  responseHeaders[0].second = copyString("text/plain");
+  responseHeaders[1].first = NULL;
+  responseHeaders[1].second = NULL;
+
+  *headerDest = responseHeaders;
+  *dataDest = copyString("hello from chttpd bench\n");
+  return 200;
+}
+
+void dcgi_dealloc(void *ptr, int size, int align) {
+  (void)size;
+  (void)align;
+  free(ptr);
+}
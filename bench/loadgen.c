@@ -0,0 +1,420 @@
+/*
+ * HTTP load generator for benchmarking chttpd
+ *
+ *   loadgen [-c CONCURRENCY] [-d SECONDS] [-k] [-l LABEL] [-o OUTPUT]
+ *           HOST PORT PATH
+ *
+ * Keeps CONCURRENCY connections busy sending GET PATH for SECONDS
+ * seconds from a single epoll loop. With -k connections are reused
+ * for as long as the server keeps them open, otherwise every request
+ * goes on a fresh connection. Prints requests per second and latency
+ * percentiles, and appends the same line to OUTPUT if given.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define HEAD_BUFFER_SIZE 8192
+#define READ_BUFFER_SIZE 65536
+#define MAX_EVENTS       256
+
+typedef enum e_conn_state {
+  CONN_IDLE       = 0,
+  CONN_CONNECTING = 1,
+  CONN_SENDING    = 2,
+  CONN_RECEIVING  = 3
+} ConnState;
+
+typedef struct st_bench_conn {
+  int fd;
+  ConnState state;
+  size_t sent;
+  uint64_t startNs;
+
+  char head[HEAD_BUFFER_SIZE];
+  size_t headLen;
+  _Bool headDone;
+  long long contentLength;
+  long long bodyRead;
+  _Bool serverClose;
+} BenchConn;
+
+typedef struct st_latencies {
+  uint32_t *values;
+  size_t len;
+  size_t cap;
+} Latencies;
+
+static struct sockaddr_in serverAddr;
+static char *request;
+static size_t requestLen;
+static _Bool keepAlive;
+static int epfd;
+static Latencies latencies;
+static size_t errors;
+
+static uint64_t nowNs(void);
+static void startRequest(BenchConn *conn);
+static void closeConn(BenchConn *conn);
+static void onWritable(BenchConn *conn);
+static void onReadable(BenchConn *conn, char *buffer);
+static void finishRequest(BenchConn *conn);
+static void failRequest(BenchConn *conn);
+static _Bool parseHead(BenchConn *conn, size_t *bodyStart);
+static void pushLatency(uint32_t us);
+static int compareU32(const void *lhs, const void *rhs);
+static uint32_t percentile(double p);
+
+int main(int argc, char *argv[]) {
+  int concurrency = 64;
+  double duration = 5.0;
+  const char *label = NULL;
+  const char *output = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:d:kl:o:")) != -1) {
+    switch (opt) {
+    case 'c': concurrency = atoi(optarg); break;
+    case 'd': duration = atof(optarg); break;
+    case 'k': keepAlive = 1; break;
+    case 'l': label = optarg; break;
+    case 'o': output = optarg; break;
+    default:
+      fprintf(stderr, "usage: loadgen [-c CONCURRENCY] [-d SECONDS] [-k] "
+                      "[-l LABEL] [-o OUTPUT] HOST PORT PATH\n");
+      return -1;
+    }
+  }
+  if (argc - optind != 3 || concurrency <= 0 || duration <= 0) {
+    fprintf(stderr, "usage: loadgen [-c CONCURRENCY] [-d SECONDS] [-k] "
+                    "[-l LABEL] [-o OUTPUT] HOST PORT PATH\n");
+    return -1;
+  }
+
+  const char *host = argv[optind];
+  const char *path = argv[optind + 2];
+  memset(&serverAddr, 0, sizeof(serverAddr));
+  serverAddr.sin_family = AF_INET;
+  serverAddr.sin_port = htons((uint16_t)atoi(argv[optind + 1]));
+  if (inet_pton(AF_INET, host, &serverAddr.sin_addr) != 1) {
+    fprintf(stderr, "invalid IPv4 address: %s\n", host);
+    return -1;
+  }
+
+  requestLen = (size_t)asprintf(&request,
+                                "GET %s HTTP/1.1\r\n"
+                                "Host: %s\r\n"
+                                "User-Agent: chttpd-loadgen\r\n"
+                                "Connection: %s\r\n\r\n",
+                                path,
+                                host,
+                                keepAlive ? "keep-alive" : "close");
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    perror("epoll_create1");
+    return -1;
+  }
+
+  BenchConn *conns = (BenchConn*)calloc(concurrency, sizeof(BenchConn));
+  char *buffer = (char*)malloc(READ_BUFFER_SIZE);
+  if (conns == NULL || buffer == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return -1;
+  }
+
+  uint64_t beginNs = nowNs();
+  uint64_t endNs = beginNs + (uint64_t)(duration * 1e9);
+  for (int i = 0; i < concurrency; i++) {
+    conns[i].fd = -1;
+    startRequest(&conns[i]);
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  while (nowNs() < endNs) {
+    int n = epoll_wait(epfd, events, MAX_EVENTS, 100);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      BenchConn *conn = (BenchConn*)events[i].data.ptr;
+      if (conn->state == CONN_CONNECTING || conn->state == CONN_SENDING) {
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+          failRequest(conn);
+        } else {
+          onWritable(conn);
+        }
+      } else if (conn->state == CONN_RECEIVING) {
+        onReadable(conn, buffer);
+      }
+    }
+
+    /* failed connections are restarted here rather than recursively */
+    for (int i = 0; i < concurrency; i++) {
+      if (conns[i].state == CONN_IDLE) {
+        startRequest(&conns[i]);
+      }
+    }
+  }
+  double elapsed = (double)(nowNs() - beginNs) / 1e9;
+
+  for (int i = 0; i < concurrency; i++) {
+    closeConn(&conns[i]);
+  }
+
+  qsort(latencies.values, latencies.len, sizeof(uint32_t), compareU32);
+  char line[512];
+  snprintf(line, sizeof(line),
+           "%-24s c=%-4d %8.0f req/s  p50 %6uus  p99 %6uus  "
+           "p999 %6uus  (%zu requests, %zu errors)",
+           label != NULL ? label : path,
+           concurrency,
+           (double)latencies.len / elapsed,
+           percentile(0.5),
+           percentile(0.99),
+           percentile(0.999),
+           latencies.len,
+           errors);
+  puts(line);
+
+  if (output != NULL) {
+    FILE *fp = fopen(output, "a");
+    if (fp == NULL) {
+      perror(output);
+      return -1;
+    }
+    fprintf(fp, "%s\n", line);
+    fclose(fp);
+  }
+
+  free(conns);
+  free(buffer);
+  free(request);
+  free(latencies.values);
+  close(epfd);
+  return latencies.len == 0 ? -1 : 0;
+}
+
+static uint64_t nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void startRequest(BenchConn *conn) {
+  conn->sent = 0;
+  conn->headLen = 0;
+  conn->headDone = 0;
+  conn->contentLength = -1;
+  conn->bodyRead = 0;
+  conn->serverClose = 0;
+  conn->startNs = nowNs();
+
+  if (conn->fd >= 0) {
+    conn->state = CONN_SENDING;
+    struct epoll_event event = { EPOLLOUT, { .ptr = conn } };
+    epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &event);
+    onWritable(conn);
+    return;
+  }
+
+  conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (conn->fd < 0) {
+    perror("socket");
+    exit(-1);
+  }
+  int one = 1;
+  setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  conn->state = CONN_CONNECTING;
+  struct epoll_event event = { EPOLLOUT, { .ptr = conn } };
+  epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &event);
+  if (connect(conn->fd, (struct sockaddr*)&serverAddr,
+              sizeof(serverAddr)) < 0
+      && errno != EINPROGRESS) {
+    failRequest(conn);
+  }
+}
+
+static void closeConn(BenchConn *conn) {
+  if (conn->fd >= 0) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+  }
+  conn->state = CONN_IDLE;
+}
+
+static void onWritable(BenchConn *conn) {
+  if (conn->state == CONN_CONNECTING) {
+    int err = 0;
+    socklen_t errLen = sizeof(err);
+    getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &errLen);
+    if (err != 0) {
+      failRequest(conn);
+      return;
+    }
+    conn->state = CONN_SENDING;
+  }
+
+  while (conn->sent < requestLen) {
+    ssize_t res = send(conn->fd, request + conn->sent,
+                       requestLen - conn->sent, MSG_NOSIGNAL);
+    if (res < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      failRequest(conn);
+      return;
+    }
+    conn->sent += (size_t)res;
+  }
+
+  conn->state = CONN_RECEIVING;
+  struct epoll_event event = { EPOLLIN, { .ptr = conn } };
+  epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+static void onReadable(BenchConn *conn, char *buffer) {
+  for (;;) {
+    ssize_t res = recv(conn->fd, buffer, READ_BUFFER_SIZE, 0);
+    if (res < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      failRequest(conn);
+      return;
+    }
+
+    if (res == 0) {
+      /* without Content-Length the body runs until the server closes */
+      if (conn->headDone && conn->contentLength < 0) {
+        conn->serverClose = 1;
+        finishRequest(conn);
+      } else {
+        failRequest(conn);
+      }
+      return;
+    }
+
+    size_t offset = 0;
+    if (!conn->headDone) {
+      size_t room = sizeof(conn->head) - conn->headLen;
+      size_t chunk = (size_t)res < room ? (size_t)res : room;
+      memcpy(conn->head + conn->headLen, buffer, chunk);
+      size_t oldLen = conn->headLen;
+      conn->headLen += chunk;
+
+      size_t bodyStart;
+      if (!parseHead(conn, &bodyStart)) {
+        if (conn->headLen == sizeof(conn->head)) {
+          failRequest(conn);
+          return;
+        }
+        continue;
+      }
+      offset = bodyStart - oldLen;
+    }
+
+    conn->bodyRead += (long long)((size_t)res - offset);
+    if (conn->contentLength >= 0 && conn->bodyRead >= conn->contentLength) {
+      finishRequest(conn);
+      return;
+    }
+  }
+}
+
+static void finishRequest(BenchConn *conn) {
+  pushLatency((uint32_t)((nowNs() - conn->startNs) / 1000));
+  if (!keepAlive || conn->serverClose) {
+    closeConn(conn);
+  }
+  startRequest(conn);
+}
+
+static void failRequest(BenchConn *conn) {
+  errors++;
+  closeConn(conn);
+}
+
+static _Bool parseHead(BenchConn *conn, size_t *bodyStart) {
+  char *end = (char*)memmem(conn->head, conn->headLen, "\r\n\r\n", 4);
+  if (end == NULL) {
+    return 0;
+  }
+  *end = '\0';
+  *bodyStart = (size_t)(end + 4 - conn->head);
+  conn->headDone = 1;
+
+  if (conn->headLen < 12 || strncmp(conn->head, "HTTP/1.", 7) != 0
+      || conn->head[9] == '5') {
+    errors++;
+  }
+
+  char *line = strstr(conn->head, "\r\n");
+  while (line != NULL) {
+    line += 2;
+    if (!strncasecmp(line, "Content-Length:", 15)) {
+      conn->contentLength = atoll(line + 15);
+    } else if (!strncasecmp(line, "Connection:", 11)
+               && strcasestr(line + 11, "close") != NULL) {
+      conn->serverClose = 1;
+    }
+    line = strstr(line, "\r\n");
+  }
+  return 1;
+}
+
+static void pushLatency(uint32_t us) {
+  if (latencies.len == latencies.cap) {
+    size_t cap = latencies.cap == 0 ? 65536 : latencies.cap * 2;
+    uint32_t *values = (uint32_t*)realloc(latencies.values,
+                                          cap * sizeof(uint32_t));
+    if (values == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(-1);
+    }
+    latencies.values = values;
+    latencies.cap = cap;
+  }
+  latencies.values[latencies.len++] = us;
+}
+
+static int compareU32(const void *lhs, const void *rhs) {
+  uint32_t a = *(const uint32_t*)lhs;
+  uint32_t b = *(const uint32_t*)rhs;
+  return (a > b) - (a < b);
+}
+
+static uint32_t percentile(double p) {
+  if (latencies.len == 0) {
+    return 0;
+  }
+  size_t index = (size_t)(p * (double)latencies.len);
+  if (index >= latencies.len) {
+    index = latencies.len - 1;
+  }
+  return latencies.values[index];
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Runs chttpd with bench/bench.cfg and loads each route with out/loadgen,
+# with and without keep-alive. Results go to bench_output.txt.
+#
+#   BENCH_CONCURRENCY  connections kept busy (default 64)
+#   BENCH_DURATION     seconds per run (default 5)
+
+CONCURRENCY=${BENCH_CONCURRENCY:-64}
+DURATION=${BENCH_DURATION:-5}
+OUTPUT=bench_output.txt
+PORT=18480
+
+./chttpd bench/bench.cfg >/dev/null 2>out/bench_chttpd.log &
+CHTTPD_PID=$!
+trap 'kill $CHTTPD_PID 2>/dev/null' EXIT INT TERM
+
+tries=0
+until out/loadgen -c 1 -d 0.1 127.0.0.1 $PORT /intern >/dev/null 2>&1; do
+  tries=$((tries + 1))
+  if [ $tries -ge 50 ] || ! kill -0 $CHTTPD_PID 2>/dev/null; then
+    echo "chttpd did not come up, see out/bench_chttpd.log" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+{
+  echo "chttpd benchmark $(date -u '+%Y-%m-%dT%H:%M:%SZ')"
+  echo "commit $(git rev-parse --short HEAD 2>/dev/null || echo unknown)," \
+       "concurrency $CONCURRENCY, ${DURATION}s per run"
+} > $OUTPUT
+
+status=0
+for path in /static /dcgi /intern; do
+  for mode in close keepalive; do
+    flag=
+    [ $mode = keepalive ] && flag=-k
+    out/loadgen -c "$CONCURRENCY" -d "$DURATION" $flag \
+      -l "$path $mode" -o $OUTPUT 127.0.0.1 $PORT $path || status=1
+  done
+done
+exit $status
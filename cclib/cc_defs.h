@@ -14,6 +14,6 @@
 #define CC_VPTR_ADD(ptr, delta) \
     ((void *)((size_t)(ptr) + (size_t)(delta)))
 #define CC_VPTR_SUB(ptr, delta) \
-    ((void *)((size_t)(ptr) + (size_t)(delta)))
+    ((void *)((size_t)(ptr) - (size_t)(delta)))
 
 #endif /* CCLIB_DEFS_H */
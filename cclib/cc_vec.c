@@ -11,10 +11,26 @@
 
 static void cc_vec_grow(CC_VEC *vec) {
     assert(vec->end == vec->usage);
+    const CCTY(cc_allocator) *allocator = vec->allocator;
     size_t length = CC_VPTR_DIFF(vec->end, vec->start);
     size_t target =
         (length == 0) ? CC_VEC_INIT_SIZE * vec->elem_size : length * 2;
-    void * start = realloc (vec->start, target);
+    void * start;
+    if (vec->start != NULL && vec->start == vec->inline_buf) {
+        start = allocator ? allocator->alloc(allocator->ctx, target)
+                          : malloc(target);
+        assert(start != NULL);
+        memcpy(start, vec->start, length);
+    } else if (allocator != NULL) {
+        start = vec->start == NULL
+                ? allocator->alloc(allocator->ctx, target)
+                : allocator->realloc(allocator->ctx,
+                                     vec->start,
+                                     length,
+                                     target);
+    } else {
+        start = realloc (vec->start, target);
+    }
     assert(start != NULL);
     vec->start = start;
     vec->usage = CC_VPTR_ADD(start, length);
@@ -23,20 +39,55 @@ static void cc_vec_grow(CC_VEC *vec) {
 
 void
 CCFN(cc_vec_init) (CC_VEC *vec, size_t elem_size) {
+    CCFN(cc_vec_init_alloc) (vec, elem_size, NULL);
+}
+
+void
+CCFN(cc_vec_init_alloc) (CC_VEC *vec,
+                         size_t elem_size,
+                         const CCTY(cc_allocator) *allocator) {
+    assert(elem_size > 0);
+    vec->start      = NULL;
+    vec->usage      = NULL;
+    vec->end        = NULL;
+    vec->elem_size  = elem_size;
+    vec->allocator  = allocator;
+    vec->inline_buf = NULL;
+}
+
+void
+CCFN(cc_vec_init_inline) (CC_VEC *vec,
+                          size_t elem_size,
+                          void *storage,
+                          size_t capacity,
+                          const CCTY(cc_allocator) *allocator) {
     assert(elem_size > 0);
-    vec->start     = NULL;
-    vec->usage     = NULL;
-    vec->end       = NULL;
-    vec->elem_size = elem_size;
+    assert(storage != NULL && capacity > 0);
+    vec->start      = storage;
+    vec->usage      = storage;
+    vec->end        = CC_VPTR_ADD(storage, capacity * elem_size);
+    vec->elem_size  = elem_size;
+    vec->allocator  = allocator;
+    vec->inline_buf = storage;
 }
 
 void
 CCFN(cc_vec_destroy) (CC_VEC *vec) {
-    free(vec->start);
-    vec->start     = NULL;
-    vec->usage     = NULL;
-    vec->end       = NULL;
-    vec->elem_size = 0;
+    if (vec->start != NULL && vec->start != vec->inline_buf) {
+        if (vec->allocator != NULL) {
+            vec->allocator->free(vec->allocator->ctx,
+                                 vec->start,
+                                 CC_VPTR_DIFF(vec->end, vec->start));
+        } else {
+            free(vec->start);
+        }
+    }
+    vec->start      = NULL;
+    vec->usage      = NULL;
+    vec->end        = NULL;
+    vec->elem_size  = 0;
+    vec->allocator  = NULL;
+    vec->inline_buf = NULL;
 }
 
 void
@@ -118,9 +169,10 @@ CCFN(cc_vec_remove) (CC_VEC *vec, size_t idx) {
     assert(CC_VPTR_ADD(vec->start, idx * vec->elem_size)
               <= vec->usage);
     void *start_pos = CC_VPTR_ADD(vec->start, idx * vec->elem_size);
-    memmove(CC_VPTR_SUB(start_pos, vec->elem_size),
-               start_pos,
-               CC_VPTR_DIFF(vec->usage, start_pos));
+    void *next_pos  = CC_VPTR_ADD(start_pos, vec->elem_size);
+    memmove(start_pos,
+               next_pos,
+               CC_VPTR_DIFF(vec->usage, next_pos));
     vec->usage = CC_VPTR_SUB(vec->usage, vec->elem_size);
 }
 
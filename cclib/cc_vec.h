@@ -11,16 +11,41 @@ extern "C" {
 #endif
 
 #define CC_VEC_INIT_SIZE 8
+#define CC_VEC_INLINE_SIZE 16
+
+/* NULL means plain malloc/realloc/free */
+typedef struct st_cc_allocator {
+    void *(*alloc) (void *ctx, size_t size);
+    void *(*realloc) (void *ctx, void *ptr, size_t old_size, size_t size);
+    void (*free) (void *ctx, void *ptr, size_t size);
+    void *ctx;
+} CCTY(cc_allocator);
+
 typedef struct st_cc_vec {
     void *start;
     void *usage;
     void *end;
     size_t elem_size;
+    const CCTY(cc_allocator) *allocator;
+    void *inline_buf;
 } CCTY(cc_vec);
 
 void
 CCFN(cc_vec_init) (CCTY(cc_vec) *vec, size_t elem_size);
 
+void
+CCFN(cc_vec_init_alloc) (CCTY(cc_vec) *vec,
+                         size_t elem_size,
+                         const CCTY(cc_allocator) *allocator);
+
+/* `storage` is used until it fills up, and never freed by the vector */
+void
+CCFN(cc_vec_init_inline) (CCTY(cc_vec) *vec,
+                          size_t elem_size,
+                          void *storage,
+                          size_t capacity,
+                          const CCTY(cc_allocator) *allocator);
+
 void
 CCFN(cc_vec_destroy) (CCTY(cc_vec) *vec);
 
@@ -0,0 +1,38 @@
+#ifndef CHTTPD_ACCEPTOR_H
+#define CHTTPD_ACCEPTOR_H
+
+#include <signal.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define IO_MAX_LISTEN_SOCKETS 64
+
+/*
+ * Accepts connections off up to IO_MAX_LISTEN_SOCKETS listening
+ * sockets, which are made non-blocking. All sockets are polled, and
+ * those ready take turns being accepted from; as another process
+ * sharing a socket may have been faster, that can fail with EAGAIN.
+ *
+ * While waiting, the signal mask is `waitMask` if given (as with
+ * ppoll), and a signal makes acceptConnection fail with EINTR. The
+ * accepted sockets are close-on-exec.
+ */
+typedef struct st_io_acceptor {
+  const int *fdsSock;
+  size_t sockCount;
+  size_t nextSock; /* where the next accept takes up its turns */
+  const sigset_t *waitMask;
+} IoAcceptor;
+
+void initAcceptor(IoAcceptor *acceptor,
+                  const int *fdsSock,
+                  size_t sockCount,
+                  const sigset_t *waitMask);
+/* as accept(2) */
+int acceptConnection(IoAcceptor *acceptor,
+                     struct sockaddr *addr,
+                     socklen_t *addrSize);
+
+#endif /* CHTTPD_ACCEPTOR_H */
@@ -0,0 +1,61 @@
+#ifndef CHTTPD_ACCESS_LOG_H
+#define CHTTPD_ACCESS_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "error.h"
+
+#define ACCESS_LOG_MAGIC       "CHTTPDAL"
+#define ACCESS_LOG_VERSION     1
+#define ACCESS_LOG_HEADER_SIZE 256
+#define ACCESS_LOG_ADDR_SIZE   48
+#define ACCESS_LOG_PATH_SIZE   176
+
+#define ACCESS_LOG_DEFAULT_SEGMENT (64 * 1024 * 1024)
+#define ACCESS_LOG_DEFAULT_KEEP    8
+
+/*
+ * Segment files start with an AccessLogHeader padded to
+ * ACCESS_LOG_HEADER_SIZE bytes, followed by fixed-size records. A
+ * record whose timestamp is still 0 was never written, readers stop at
+ * the first one. Paths and addresses are cut short to fit and are not
+ * necessarily NUL-terminated.
+ */
+typedef struct st_access_log_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  uint64_t createdNs;
+} AccessLogHeader;
+
+typedef struct st_access_record {
+  uint64_t timeNs;        /* CLOCK_REALTIME when the request came in */
+  uint64_t bytesOut;
+  uint64_t workerId;
+  uint32_t latencyUs;
+  uint16_t status;
+  uint8_t method;
+  uint8_t reserved;
+  /* cut short to fit and NUL terminated; readers still bound them */
+  char clientAddr[ACCESS_LOG_ADDR_SIZE];
+  char path[ACCESS_LOG_PATH_SIZE];
+} AccessRecord;
+
+_Static_assert(sizeof(AccessRecord) == 256, "AccessRecord is 256 bytes");
+
+/*
+ * Records go to mmap'd files named `prefix`.000001, `prefix`.000002
+ * and so on, each `segmentSize` bytes large. When one fills up the
+ * next is created, and only the last `keep` segments are kept.
+ */
+void startAccessLog(const char *prefix,
+                    size_t segmentSize,
+                    int keep,
+                    Error *error);
+void stopAccessLog(void);
+_Bool accessLogEnabled(void);
+
+void writeAccessRecord(const AccessRecord *record);
+
+#endif /* CHTTPD_ACCESS_LOG_H */
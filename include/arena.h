@@ -0,0 +1,34 @@
+#ifndef CHTTPD_ARENA_H
+#define CHTTPD_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cc_vec.h"
+#include "error.h"
+
+#define ARENA_BLOCK_SIZE 16384
+#define ARENA_KEEP_BLOCKS 4
+#define ARENA_POOL_SIZE 256
+
+typedef struct st_arena Arena;
+
+/*
+ * An arena hands out memory living as long as one request. Nothing is
+ * freed individually: resetArena rewinds the arena in O(1), keeping
+ * its blocks for the next request. Handler threads take an arena from
+ * a shared pool on start and put it back when the connection is done,
+ * so steady-state requests never reach malloc for their bookkeeping.
+ */
+Arena *acquireArena(void);
+void releaseArena(Arena *arena);
+void resetArena(Arena *arena);
+
+void *arenaAlloc(Arena *arena, size_t size);
+char *arenaStrndup(Arena *arena, const char *src, size_t size);
+Error *arenaErrorBuffer(Arena *arena, uint16_t bufferSize);
+
+/* for ccVec: growth copies into the arena, frees are no-ops */
+const ccAllocator *arenaAllocator(Arena *arena);
+
+#endif /* CHTTPD_ARENA_H */
@@ -3,24 +3,64 @@
  *   configuration ::= lines
  *   lines ::= lines line | NIL
  *   line ::= router-line | filter-line | config-line | cors-line
+ *          | upstream-line | rate-limit-line | error-page-line
+ *          | server-line
  *   cors-line ::= "cors" method PATH
  *   router-line ::= method PATH handler-type HANDLER
  *   method ::= "get" | "post"
- *   handler-type ::= "dcgi" | "static" | "intern"
- *   config-line ::= "listen-address" ADDRESS
+ *   handler-type ::= "dcgi" | "static" | "intern" | "fcgi" | "proxy"
+ *   rate-limit-line ::= "rate-limit" RATE BURST
+ *                     | "route-rate-limit" PATH RATE BURST
+ *   error-page-line ::= "error-page" CODE FILE
+ *   server-line ::= "server" HOSTNAME... "{"
+ *                 | "}"
+ *   upstream-line ::= "upstream" NAME ADDRESS...
+ *                   | "upstream-balance" NAME BALANCE
+ *                   | "upstream-keepalive" NAME MAX-IDLE
+ *   config-line ::= "listen" LISTEN-ADDRESS
+ *                 | "listen-address" ADDRESS
  *                 | "listen-port" PORT
  *                 | "max-pending" MAX-PENDING
  *                 | "preload"     PRELOAD
  *                 | "cache-time"  CACHE-TIME
  *                 | "ignore-case" IGNORE-CASE
+ *                 | "dcgi-isolate" DCGI-ISOLATE
+ *                 | "dcgi-workers" DCGI-WORKERS
+ *                 | "dcgi-timeout" SECONDS
+ *                 | "fcgi-connections" FCGI-CONNECTIONS
+ *                 | "fcgi-multiplex" FCGI-MULTIPLEX
+ *                 | "max-body-size" MAX-BODY-SIZE
+ *                 | "log-level" LOG-LEVEL
+ *                 | "log-file" LOG-FILE
+ *                 | "access-log" PATH-PREFIX
+ *                 | "access-log-segment-size" SEGMENT-SIZE
+ *                 | "access-log-keep" SEGMENT-COUNT
+ *                 | "server-timing" SERVER-TIMING
+ *                 | "idle-timeout" SECONDS
+ *                 | "header-timeout" SECONDS
+ *                 | "body-timeout" SECONDS
+ *                 | "write-timeout" SECONDS
+ *                 | "upstream-timeout" SECONDS
+ *                 | "shutdown-timeout" SECONDS
+ *                 | "max-connections" MAX-CONNECTIONS
+ *                 | "max-connections-per-ip" MAX-CONNECTIONS
+ *                 | "worker-processes" WORKER-PROCESSES
+ *                 | "reuse-port" REUSE-PORT
+ *                 | "cpu-affinity" CPU-AFFINITY
  */
 
 #ifndef CHTTPD_CONFIG_H
 #define CHTTPD_CONFIG_H
 
+#include "acceptor.h"
+#include "access_log.h"
 #include "cc_vec.h"
+#include "fcgi.h"
 #include "http_base.h"
+#include "net_util.h"
 #include "pl2b.h"
+#include "proxy.h"
+#include "rate_limit.h"
 #include "util.h"
 
 #define CHTTPD_VER_MAJOR 0
@@ -34,40 +74,129 @@ typedef enum e_handler_type {
   HDLR_STATIC = 1,
   HDLR_DCGI   = 2,
   HDLR_INTERN = 3,
-  HDLR_DIR    = 4
+  HDLR_DIR    = 4,
+  HDLR_FCGI   = 5,
+  HDLR_PROXY  = 6
 } HandlerType;
 
 extern const char *HANDLER_TYPE_NAMES[];
 
+#define MAX_LISTENERS IO_MAX_LISTEN_SOCKETS
+
+#define WORKER_PROCESSES_AUTO 0
+#define MAX_WORKER_PROCESSES  1024
+
+typedef enum e_cpu_affinity {
+  CPU_AFFINITY_NONE = 0,
+  CPU_AFFINITY_CPU  = 1, /* each worker process on a CPU of its own */
+  CPU_AFFINITY_NODE = 2  /* each on the CPUs of one NUMA node */
+} CpuAffinity;
+
 typedef struct st_route {
   HttpMethod httpMethod;
   const char *path;
   HandlerType handlerType;
   const char *handlerPath;
+  RateLimit rateLimit;
+  const char *host; /* of its server block, NULL outside one */
 
   void *extra;
 } Route;
 
+/* a server block, or the routes outside any for hosts[0] */
+typedef struct st_virtual_host {
+  const char *name;
+  ccVec TP(size_t) routes; /* indices into Config.routes */
+} VirtualHost;
+
+typedef struct st_host_slot {
+  const char *name;        /* NULL for an empty slot */
+  size_t host;
+} HostSlot;
+
 typedef struct st_cors_config {
   HttpMethod httpMethod;
   const char *path;
 } CorsConfig;
 
+typedef struct st_error_page_config {
+  int code;
+  const char *path;
+} ErrorPageConfig;
+
 typedef struct st_config {
+  /* the listener without any "listen" lines */
   const char *address;
   int port;
   int maxPending;
   _Bool preloadDynamic;
   _Bool ignoreCase;
   int cacheTime;
+  _Bool isolateDynamic;
+  int dcgiWorkers;
+  int dcgiTimeout;
+  int fcgiMaxConns;
+  int fcgiMaxMpx;
+  size_t maxBodySize;
+  LogLevel logLevel;
+  const char *logFile;
+  const char *accessLog;
+  size_t accessLogSegmentSize;
+  int accessLogKeep;
+  _Bool serverTiming;
+  int idleTimeout;
+  int headerTimeout;
+  int bodyTimeout;
+  int writeTimeout;
+  int upstreamTimeout;
+  int shutdownTimeout;
+  int maxConnections;
+  int maxConnectionsPerIp;
+  RateLimit rateLimit;
+  int workerProcesses;
+  _Bool reusePort;
+  CpuAffinity cpuAffinity;
 
+  ccVec TP(SockAddress) listeners;
   ccVec TP(Route) routes;
+  ccVec TP(VirtualHost) hosts;
+  ccVec TP(HostSlot) serverNames;
+  /* serverNames hashed, open addressing, sized a power of two */
+  HostSlot *hostTable;
+  size_t hostTableSize;
+  /* the server block being read */
+  size_t currentHost;
   ccVec TP(CorsConfig) corsConfig;
+  ccVec TP(ErrorPageConfig) errorPages;
+  ccVec TP(ProxyUpstream*) proxyUpstreams;
+  ccVec TP(FCGIUpstream*) fcgiUpstreams;
+
+  /* per-route counters, set up by whoever puts the config to use */
+  struct st_metrics *metrics;
+
+  /* the config file, which the strings above point into */
+  char *source;
+  pl2b_Program program;
 } Config;
 
 void initConfig(Config *config);
 void dropConfig(Config *config);
 
+/*
+ * Reads and evaluates the config file at `path` into `config`, which is
+ * left for dropConfig to clean up whether or not that succeeds. DCGI
+ * modules are loaded right away if preloading is on, and unloaded by
+ * dropConfig.
+ */
+void loadConfig(Config *config, const char *path, Error *error);
+
 const pl2b_Language *getCfgLanguage(void);
 
+/*
+ * The virtual host for the Host header `host`, compared without port and
+ * trailing dot, ignoring case. Requests without one, or for a name no
+ * server block has, get hosts[0].
+ */
+const VirtualHost *findVirtualHost(const Config *config, const char *host);
+
 #endif /* CHTTPD_CONFIG_H */
@@ -0,0 +1,22 @@
+#ifndef CHTTPD_CONN_LIMIT_H
+#define CHTTPD_CONN_LIMIT_H
+
+#include <stddef.h>
+
+#define CONN_LIMIT_BUCKETS 1024
+
+/*
+ * Counts open connections, in total and per client address. A limit of
+ * 0 means no limit. Per-client counts are only kept when that limit is
+ * set.
+ */
+void initConnLimits(int maxConnections, int maxPerClient);
+
+/* returns 0, taking no slot, if either limit is reached */
+_Bool acquireConnSlot(const char *clientAddr);
+void releaseConnSlot(const char *clientAddr);
+
+size_t activeConnections(void);
+size_t rejectedConnections(void);
+
+#endif /* CHTTPD_CONN_LIMIT_H */
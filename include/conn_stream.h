@@ -0,0 +1,79 @@
+#ifndef CHTTPD_CONN_STREAM_H
+#define CHTTPD_CONN_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "timer_wheel.h"
+
+/*
+ * Renders extra header lines, each ending with CRLF, into `buffer` and
+ * returns their length.
+ */
+typedef size_t (ConnHeadHook)(void *context, char *buffer, size_t size);
+
+#define CONN_HEAD_HOOK_SIZE 256
+
+/* milliseconds, 0 disables the timeout */
+typedef struct st_conn_timeouts {
+  uint32_t idle;    /* until the first byte of the request arrives */
+  uint32_t header;  /* from there until the end of the request head */
+  uint32_t body;    /* for each read of the request body */
+  uint32_t write;   /* for the response to make no progress */
+} ConnTimeouts;
+
+typedef enum e_conn_phase {
+  CONN_PHASE_IDLE   = 0,
+  CONN_PHASE_HEADER = 1,
+  CONN_PHASE_BODY   = 2
+} ConnPhase;
+
+typedef struct st_conn_stats {
+  size_t bytesIn;
+  size_t bytesOut;
+  int status;     /* taken from the status line, 0 if none was sent */
+
+  char head[16];
+  size_t headLen;
+
+  ConnHeadHook *headHook;
+  void *headHookContext;
+  _Bool headHookDone;
+
+  ConnTimeouts timeouts;
+  ConnPhase phase;
+  Timer timer;
+} ConnStats;
+
+struct st_out_buf;
+
+/*
+ * Wraps a connected socket in a stdio stream that counts the bytes
+ * going through it, and sets up the OutBuf in `out` for writing the
+ * response, which picks the status code out of it. Whatever is written
+ * to the stream goes through that OutBuf as well, so the two keep their
+ * order as long as the stream is flushed before the OutBuf is used.
+ * `stats` must outlive the stream; fclose flushes the OutBuf and closes
+ * the socket as well.
+ *
+ * The stream also keeps the connection's deadline on the timer wheel.
+ * Read timeouts shut down the reading side only, so that the request
+ * sees an early end of input and a 408 can still be sent.
+ */
+FILE *openConnStream(int fd,
+                     ConnStats *stats,
+                     const ConnTimeouts *timeouts,
+                     struct st_out_buf **out);
+
+/* called once the request head is read, switches to body timeouts */
+void setConnPhase(ConnStats *stats, ConnPhase phase);
+_Bool connTimedOut(ConnStats *stats);
+
+/*
+ * Has `hook` called when the status line goes out, and sends what it
+ * renders right after the status line.
+ */
+void setConnHeadHook(ConnStats *stats, ConnHeadHook *hook, void *context);
+
+#endif /* CHTTPD_CONN_STREAM_H */
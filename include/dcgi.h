@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include "error.h"
 #include "http.h"
+#include "out_buf.h"
 
 typedef int (DCGIMain)(int requestMethod,
 		                   const char *queryPath,
@@ -26,10 +27,17 @@ DCGIModule *loadDCGIModule(const char *dcgiLib, Error *error);
 
 void unloadDCGIModule(DCGIModule *module, Error *error);
 
+void dropDCGIOutput(const DCGIModule *module,
+                    StringPair *headerDest,
+                    char *dataDest,
+                    char *errDest);
+
+/* `timeout` bounds each request to an isolated worker, in seconds */
 void handleDCGI(const char *dcgiLib,
                 DCGIModule *preloaded,
+                int timeout,
                 HttpRequest *httpRequest,
-                FILE *response,
+                OutBuf *response,
                 Error *error);
 
 #endif /* CHTTPD_DCGI_H */
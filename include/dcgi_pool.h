@@ -0,0 +1,65 @@
+#ifndef CHTTPD_DCGI_POOL_H
+#define CHTTPD_DCGI_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "error.h"
+#include "http.h"
+
+/*
+ * Isolated DCGI mode: modules run inside a pool of pre-forked worker
+ * processes instead of the server process. Requests and responses are
+ * framed over a Unix domain socket pair, bodies larger than
+ * DCGI_SHM_THRESHOLD travel through a memfd/shm segment whose file
+ * descriptor is passed alongside the frame (SCM_RIGHTS).
+ */
+
+#define DCGI_FRAME_MAGIC    0x44434749 /* "DCGI" */
+#define DCGI_SHM_THRESHOLD  65536
+
+#define DCGI_FRAME_REQUEST  1
+#define DCGI_FRAME_RESPONSE 2
+
+#define DCGI_FLAG_SHM_BODY  0x01
+#define DCGI_FLAG_PRELOAD   0x02
+
+typedef struct st_dcgi_frame {
+  uint32_t magic;
+  uint16_t kind;
+  uint16_t flags;
+  int32_t code;        /* HTTP method for requests, status otherwise */
+  uint32_t pairCount;  /* headers in responses, headers + params else */
+  uint32_t paramCount;
+  uint32_t stringsLen;
+  uint64_t bodyLen;
+} DCGIFrame;
+
+typedef struct st_dcgi_result {
+  int code;
+  StringPair *headers; /* NULL terminated, points into `block` */
+  char *data;
+  char *err;
+
+  char *block;
+  size_t dataMapLen;   /* non-zero when `data` is mmap'ed */
+} DCGIResult;
+
+void startDCGIPool(const Config *config, Error *error);
+void stopDCGIPool(void);
+_Bool dcgiPoolEnabled(void);
+
+/*
+ * Runs the request on an idle worker, waiting for one if need be. Past
+ * `timeout` seconds in all, 0 for none, it gives up with a 504; a worker
+ * still busy by then is killed and replaced.
+ */
+void dcgiPoolInvoke(const char *dcgiLib,
+                    HttpRequest *request,
+                    int timeout,
+                    DCGIResult *result,
+                    Error *error);
+void dropDCGIResult(DCGIResult *result);
+
+#endif /* CHTTPD_DCGI_POOL_H */
@@ -0,0 +1,39 @@
+#ifndef CHTTPD_FCGI_H
+#define CHTTPD_FCGI_H
+
+#include <stdio.h>
+
+#include "error.h"
+#include "http.h"
+
+#define FCGI_MAX_CONNS 64
+#define FCGI_MAX_MPX   32
+
+typedef struct st_fcgi_upstream FCGIUpstream;
+
+/*
+ * Upstreams belong to a Config, shared by every route in it naming the
+ * same address, and keep up to `maxConns` persistent connections open.
+ * Each connection carries up to `maxMpx` concurrent requests
+ * (FCGI_MPXS_CONNS), so `maxMpx` should stay 1 unless the backend
+ * supports multiplexing.
+ */
+FCGIUpstream *createFCGIUpstream(const char *address,
+                                 int maxConns,
+                                 int maxMpx,
+                                 Error *error);
+const char *fcgiUpstreamAddress(const FCGIUpstream *upstream);
+void dropFCGIUpstream(FCGIUpstream *upstream);
+
+/*
+ * `timeout` bounds, in seconds, connecting to the upstream, each write
+ * to it and the wait for the response, 0 for no bound. Running out of
+ * it answers 504.
+ */
+void handleFCGI(FCGIUpstream *upstream,
+                int timeout,
+                HttpRequest *request,
+                FILE *response,
+                Error *error);
+
+#endif /* CHTTPD_FCGI_H */
@@ -6,4 +6,7 @@
 
 ssize_t readAll(FILE *fp, char *buffer, size_t bufSize);
 
+/* for a freshly forked child, async-signal-safe */
+void closeDescriptorsFrom(int lowFd);
+
 #endif /* CHTTPD_FILE_UTIL_H */
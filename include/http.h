@@ -3,7 +3,9 @@
 
 #include <stdio.h>
 
+#include "arena.h"
 #include "cc_vec.h"
+#include "error.h"
 #include "http_base.h"
 #include "util.h"
 
@@ -15,19 +17,47 @@ typedef enum e_http_error {
   HTTP_ERR_INTERNAL = 3
 } HttpError;
 
+/*
+ * readHttpRequest only consumes the request line and headers. The body
+ * stays in the connection until a handler pulls it with readHttpBody,
+ * or collects it at once with readHttpBodyAll. Either way no more than
+ * `maxBodySize` bytes are accepted, past that the read fails with 413.
+ */
 typedef struct st_http_request {
   HttpMethod method;
-  size_t contentLength;
+  size_t contentLength; /* declared length, actual one once collected */
+  _Bool chunked;
   char *requestPath;
   char *queryString;
+  const char *host;     /* the Host header, NULL without one */
   ccVec TP(StringPair) params;
   ccVec TP(StringPair) headers;
-  char body[0];
+
+  FILE *fp;
+  size_t maxBodySize;
+  size_t bodyRead;
+  size_t bodyRemaining; /* of the whole body, or of the current chunk */
+  _Bool bodyDone;
+  char *body;           /* NULL until readHttpBodyAll */
+  char *lineBuffer;
+  size_t lineBufferSize;
+
+  /* typical requests never need more than these */
+  StringPair paramStorage[CC_VEC_INLINE_SIZE];
+  StringPair headerStorage[CC_VEC_INLINE_SIZE];
 } HttpRequest;
 
-HttpRequest *readHttpRequest(FILE *fp);
+HttpRequest *readHttpRequest(FILE *fp,
+                             size_t maxBodySize,
+                             Arena *arena);
 void dropHttpRequest(HttpRequest *request);
 
+ssize_t readHttpBody(HttpRequest *request,
+                     char *buffer,
+                     size_t size,
+                     Error *error);
+const char *readHttpBodyAll(HttpRequest *request, Error *error);
+
 typedef struct st_http_response {
   HttpCode code;
   const char *statusText;
@@ -0,0 +1,40 @@
+#ifndef CHTTPD_HTTP_HEAD_H
+#define CHTTPD_HTTP_HEAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "out_buf.h"
+
+#define UINT_DIGITS_MAX  20
+#define STATUS_LINE_MAX  32
+#define DATE_HEADER_SIZE 37
+
+/*
+ * Builds response heads without going through printf. Status lines
+ * come from a table rendered at compile time, numbers are formatted by
+ * hand, and the Date header is rendered once a second by the timer
+ * thread rather than once per response.
+ */
+
+/* writes the decimal digits of `value`, unterminated, returns the count */
+size_t formatUint(char *buffer, uint64_t value);
+
+/*
+ * "HTTP/1.1 404 Not Found\r\n". Unregistered codes between 100 and 599
+ * are rendered into `buffer` (of STATUS_LINE_MAX bytes), which is
+ * returned then; anything else gets the line of 500.
+ */
+const char *httpStatusLine(int code, char *buffer);
+
+void outStatusLine(OutBuf *out, int code);
+void outHeader(OutBuf *out, const char *name, const char *value);
+void outHeaderUint(OutBuf *out, const char *name, uint64_t value);
+void outDateHeader(OutBuf *out);
+/* "Date: ...\r\n", DATE_HEADER_SIZE bytes, unterminated */
+const char *currentDateHeader(void);
+
+/* renders the Date header if the second has changed since last time */
+void refreshDateHeader(void);
+
+#endif /* CHTTPD_HTTP_HEAD_H */
@@ -3,29 +3,68 @@
 
 #include <stdio.h>
 
+#include "config.h"
 #include "error.h"
+#include "out_buf.h"
 
+extern const char *ERROR_PAGE_400_CONTENT;
 extern const char *ERROR_PAGE_403_CONTENT;
 extern const char *ERROR_PAGE_404_CONTENT;
 extern const char *ERROR_PAGE_405_CONTENT;
+extern const char *ERROR_PAGE_408_CONTENT;
+extern const char *ERROR_PAGE_413_CONTENT;
+extern const char *ERROR_PAGE_429_CONTENT;
+extern const char *ERROR_PAGE_502_CONTENT;
+extern const char *ERROR_PAGE_503_CONTENT;
+extern const char *ERROR_PAGE_504_CONTENT;
 extern const char *ERROR_PAGE_500_CONTENT_PART1;
 extern const char *ERROR_PAGE_500_CONTENT_PART2;
 
 extern const char *GENERAL_HEADERS;
 
+extern const char *ERROR_PAGE_400_HEAD;
 extern const char *ERROR_PAGE_403_HEAD;
 extern const char *ERROR_PAGE_404_HEAD;
 extern const char *ERROR_PAGE_405_HEAD;
+extern const char *ERROR_PAGE_408_HEAD;
+extern const char *ERROR_PAGE_413_HEAD;
+extern const char *ERROR_PAGE_429_HEAD;
+extern const char *ERROR_PAGE_502_HEAD;
+extern const char *ERROR_PAGE_503_HEAD;
+extern const char *ERROR_PAGE_504_HEAD;
 extern const char *ERROR_PAGE_500_HEAD;
 
-void send403Page(FILE *fp);
-void send404Page(FILE *fp);
-void send405Page(FILE *fp);
-void send500Page(FILE *fp, Error *reason);
+void send400Page(OutBuf *out);
+void send403Page(OutBuf *out);
+void send404Page(OutBuf *out);
+void send405Page(OutBuf *out);
+void send408Page(OutBuf *out);
+void send413Page(OutBuf *out);
+void send429Page(OutBuf *out);
+void send502Page(OutBuf *out);
+void send503Page(OutBuf *out);
+void send504Page(OutBuf *out);
+void send500Page(OutBuf *out, Error *reason);
 
-void sendOptionsAcceptedPage(FILE *fp, unsigned allowedMethods);
+/*
+ * The fixed error pages (400, 403, 404, 405, 408, 413, 429, 502, 503 and
+ * 504) are rendered once at startup, headers and body, from the built-in pages
+ * or from files given with `error-page`. Sending one costs no more than
+ * slipping in the Date header, and it goes out with a single sendmsg.
+ * Under overload, connections are answered with the 503 written
+ * straight to the socket, without spawning a thread.
+ */
+_Bool hasErrorPage(int code);
+void prerenderErrorPages(const Config *config, Error *error);
+void dropErrorPages(void);
+void sendOverloadPage(int fd);
 
-void handleIntern(const char *handlerPath, Error *error);
+void sendOptionsAcceptedPage(OutBuf *out, unsigned allowedMethods);
+
+void handleIntern(const Config *config,
+                  const char *handlerPath,
+                  OutBuf *out,
+                  Error *error);
 
 #endif /* CHTTPD_INTERN_H */
 
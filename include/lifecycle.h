@@ -0,0 +1,64 @@
+#ifndef CHTTPD_LIFECYCLE_H
+#define CHTTPD_LIFECYCLE_H
+
+#include <signal.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+
+#define LISTEN_FD_ENV "CHTTPD_LISTEN_FD"
+#define READY_FD_ENV  "CHTTPD_READY_FD"
+
+#define UPGRADE_READY_TIMEOUT_MS 10000
+
+typedef enum e_lifecycle_event {
+  LIFECYCLE_NONE    = 0,
+  LIFECYCLE_STOP    = 1, /* SIGTERM or SIGINT: drain and exit */
+  LIFECYCLE_UPGRADE = 2, /* SIGUSR2: hand over to a new binary */
+  LIFECYCLE_RELOAD  = 3  /* SIGHUP: read the config file again */
+} LifecycleEvent;
+
+/*
+ * Signals are only taken by the accepting thread, while it waits for
+ * connections: initLifecycle blocks them before any other thread is
+ * started, and the waits unblock them atomically with the mask from
+ * lifecycleWaitMask, so that none can slip in between checking for an
+ * event and going to sleep. The handlers merely record the event, and
+ * the wait returns EINTR. Several may have come in by then, so
+ * takeLifecycleEvent is called until it returns LIFECYCLE_NONE.
+ */
+void initLifecycle(int argc, const char *argv[]);
+const sigset_t *lifecycleWaitMask(void);
+LifecycleEvent takeLifecycleEvent(void);
+/* for forked children, which should die of these signals as usual */
+void resetLifecycleSignals(void);
+
+/*
+ * Binary upgrade. startUpgrade runs the binary chttpd was started as
+ * again, with the same arguments, passing it the listening sockets in
+ * LISTEN_FD_ENV, as a comma separated list, and a pipe in READY_FD_ENV.
+ * The new process takes the sockets over instead of binding them, and
+ * reports on the pipe once it accepts connections; only then does
+ * startUpgrade return 1, and the old process goes on to drain. If the
+ * new binary fails to come up within UPGRADE_READY_TIMEOUT_MS, it is
+ * killed and the old process carries on as before.
+ */
+const int *inheritedListenFds(size_t *count);
+void notifyUpgradeReady(void);
+_Bool startUpgrade(const int *fdsListen, size_t count);
+
+/*
+ * For a worker process freshly forked by `master`: it ignores SIGUSR2,
+ * stops when the master dies, and reports readiness on `fdReady`
+ * instead, if that is not -1.
+ */
+void becomeWorkerProcess(pid_t master, int fdReady);
+
+/*
+ * Waits for the connections in flight to finish, up to `timeoutSec`
+ * seconds. Returns 0 if some are still open by then, or if another
+ * stop request cuts the wait short.
+ */
+_Bool drainConnections(int timeoutSec);
+
+#endif /* CHTTPD_LIFECYCLE_H */
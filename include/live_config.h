@@ -0,0 +1,42 @@
+#ifndef CHTTPD_LIVE_CONFIG_H
+#define CHTTPD_LIVE_CONFIG_H
+
+#include "config.h"
+
+#define RELOAD_POLL_MS 10
+
+typedef struct st_config_pin {
+  unsigned epoch;
+} ConfigPin;
+
+/*
+ * The configuration in use, which SIGHUP replaces with a fresh one read
+ * from the same file.
+ *
+ * Connections pin the configuration once, when they start, and keep it
+ * to the end, so a request is served by one configuration throughout.
+ * Pinning takes no lock: readers announce themselves on a counter for
+ * the current epoch, and read the pointer only once the epoch is known
+ * not to have moved on. A reload builds the new configuration on a
+ * thread of its own, swaps the pointer, advances the epoch and waits
+ * for the readers of the previous epoch to go away before dropping the
+ * old configuration. Since a connection can pin for as long as it
+ * lives, the old configuration may stay around for a while; reloads
+ * requested meanwhile are done one after the other.
+ *
+ * What is set up once for the whole process (listening socket, I/O
+ * backend, worker processes, logging, access log, DCGI worker pool,
+ * connection limits, error pages) keeps the values chttpd was started
+ * with; a SIGUSR2 upgrade picks up changes to those.
+ */
+void initLiveConfig(const char *path, Config *config);
+const Config *pinConfig(ConfigPin *pin);
+void unpinConfig(const ConfigPin *pin);
+
+/* called by the accepting thread, the reload runs in the background */
+void requestConfigReload(void);
+
+/* waits for a reload in progress, then drops the current config */
+void dropLiveConfig(void);
+
+#endif /* CHTTPD_LIVE_CONFIG_H */
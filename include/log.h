@@ -0,0 +1,28 @@
+#ifndef CHTTPD_LOG_H
+#define CHTTPD_LOG_H
+
+#include "error.h"
+#include "util.h"
+
+#define LOG_LINE_SIZE 2048
+#define LOG_RING_SIZE 16384
+#define LOG_MAX_RINGS 512
+#define LOG_BATCH_SIZE 65536
+
+/*
+ * Until startLogger is called, and in forked children, every message
+ * is written synchronously. Once started, each thread formats its
+ * messages into a ring of its own, and a logger thread collects the
+ * rings and writes them out in batches. A thread finding its ring
+ * full drops the message; the drop count is reported later on.
+ */
+void setLogLevel(LogLevel logLevel);
+_Bool parseLogLevel(const char *name, LogLevel *dest);
+
+/* `path` == NULL keeps stderr, colors are only used on terminals */
+void setLogOutput(const char *path, Error *error);
+
+void startLogger(Error *error);
+void stopLogger(void);
+
+#endif /* CHTTPD_LOG_H */
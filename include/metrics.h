@@ -0,0 +1,65 @@
+#ifndef CHTTPD_METRICS_H
+#define CHTTPD_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "error.h"
+
+#define CACHE_LINE_SIZE 64
+
+#define METRICS_SHARDS     64
+#define METRICS_SUB_BITS   3
+#define METRICS_SUB_COUNT  (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BITS   32
+#define METRICS_BUCKETS    \
+  ((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) * METRICS_SUB_COUNT)
+
+typedef enum e_request_phase {
+  PHASE_READ    = 0, /* accepting up to a parsed request head */
+  PHASE_ROUTE   = 1, /* looking up the route */
+  PHASE_HANDLER = 2, /* running the handler */
+  PHASE_WRITE   = 3, /* sending error pages and flushing the response */
+  PHASE_COUNT   = 4
+} RequestPhase;
+
+extern const char *REQUEST_PHASE_NAMES[];
+
+typedef struct st_metrics Metrics;
+
+/*
+ * Counters live in METRICS_SHARDS cache-line aligned shards, each with
+ * one block of counters per route plus one for unmatched requests. A
+ * thread recording a request owns a shard for the duration, so updates
+ * are plain stores and no two threads write to the same cache line.
+ * Shards are only summed up when the metrics page is scraped.
+ *
+ * Latencies go into log-linear (HDR-style) histograms in microseconds:
+ * METRICS_SUB_COUNT buckets per power of two, up to 2^METRICS_MAX_BITS,
+ * one for the whole request and one for each phase of it. The shards
+ * are mapped lazily, so routes nobody requests cost no memory.
+ *
+ * The counters belong to route labels ("GET /path") rather than to a
+ * configuration: createMetrics looks up those of each route, creating
+ * them the first time a label shows up, so a reloaded configuration
+ * carries on counting for the routes it keeps. The counters themselves
+ * are dropped by dropMetricSeries, at exit.
+ */
+Metrics *createMetrics(const Config *config, Error *error);
+void dropMetrics(Metrics *metrics);
+void dropMetricSeries(void);
+
+/* `routeIndex` == number of routes for requests matching no route */
+void recordRequest(const Metrics *metrics,
+                   size_t routeIndex,
+                   int status,
+                   size_t bytesOut,
+                   uint64_t latencyNs,
+                   const uint64_t phaseNs[PHASE_COUNT]);
+
+/* Prometheus text exposition format, version 0.0.4 */
+void writeMetrics(const Metrics *metrics, FILE *fp);
+
+#endif /* CHTTPD_METRICS_H */
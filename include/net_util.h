@@ -0,0 +1,53 @@
+#ifndef CHTTPD_NET_UTIL_H
+#define CHTTPD_NET_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/socket.h>
+
+#include "error.h"
+
+typedef struct st_sock_address {
+  struct sockaddr_storage addr;
+  socklen_t addrLen;
+} SockAddress;
+
+/* fits any address formatSockAddress turns out */
+#define SOCK_ADDRESS_STR_SIZE 128
+
+/*
+ * Accepted forms: "unix:/path/to/socket", "host:port" and
+ * "[v6-address]:port". Host names are resolved once, here.
+ */
+void parseSockAddress(const char *spec, SockAddress *dest, Error *error);
+/* `timeoutMs` as for setSocketTimeout, and left set on the socket */
+int connectSockAddress(const SockAddress *address,
+                       uint32_t timeoutMs,
+                       Error *error);
+
+/*
+ * Formats `addr` as parseSockAddress takes it, or with `withPort` 0 as
+ * just the host: "1.2.3.4", "::1". IPv4 peers on IPv6 sockets come out
+ * as IPv4, unnamed Unix domain peers as "unix:". Thread safe, unlike
+ * inet_ntoa.
+ */
+void formatSockAddress(const struct sockaddr *addr,
+                       socklen_t addrLen,
+                       _Bool withPort,
+                       char *buffer,
+                       size_t size);
+/* same family, address, port or path */
+_Bool sameSockAddress(const struct sockaddr *a, const struct sockaddr *b);
+
+/*
+ * Bounds every blocking send, receive and connect on `fd` to `timeoutMs`,
+ * 0 lifts the bound. A call running out of it fails with EAGAIN, or
+ * with EINPROGRESS for connect.
+ */
+_Bool setSocketTimeout(int fd, uint32_t timeoutMs);
+
+_Bool writeAllFd(int fd, const void *buffer, size_t size);
+_Bool readAllFd(int fd, void *buffer, size_t size);
+
+#endif /* CHTTPD_NET_UTIL_H */
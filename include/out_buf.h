@@ -0,0 +1,59 @@
+#ifndef CHTTPD_OUT_BUF_H
+#define CHTTPD_OUT_BUF_H
+
+#include <stddef.h>
+
+#include <sys/types.h>
+
+#include "conn_stream.h"
+
+#define OUT_BUF_PIECES    32
+#define OUT_BUF_COPY_SIZE 4096
+
+/* a piece of the response: memory, or a range of an open file */
+typedef struct st_out_piece {
+  const char *data; /* NULL for a file range */
+  int fd;
+  off_t offset;
+  size_t size;
+} OutPiece;
+
+/*
+ * The output side of a connection. A response is collected as a list
+ * of pieces and goes out in as few system calls as possible: runs of
+ * memory pieces in one gathering sendmsg, file ranges with sendfile.
+ *
+ * Pieces are either referenced or copied. outStatic and outRef only
+ * keep a pointer, so the memory must stay valid until the next
+ * outFlush; outFile likewise keeps the file descriptor. outWrite and
+ * outPrintf copy into a small buffer of the OutBuf. When the pieces or
+ * the copy buffer run out, the collected part is sent ahead.
+ *
+ * The status code and the head hook of ConnStats are taken care of
+ * here, as is the write timeout, which fires once no part of the
+ * response could be sent for that long. After a failed send, the rest
+ * of the response is dropped and outFlush keeps returning 0.
+ */
+typedef struct st_out_buf {
+  int fd;
+  ConnStats *stats;
+
+  OutPiece pieces[OUT_BUF_PIECES];
+  size_t pieceCount;
+  char copy[OUT_BUF_COPY_SIZE];
+  size_t copyUsed;
+  _Bool failed;
+} OutBuf;
+
+void initOutBuf(OutBuf *out, int fd, ConnStats *stats);
+
+/* for string literals and other strings living forever */
+void outStatic(OutBuf *out, const char *str);
+void outRef(OutBuf *out, const char *data, size_t size);
+void outFile(OutBuf *out, int fd, off_t offset, size_t size);
+void outWrite(OutBuf *out, const char *data, size_t size);
+void outPrintf(OutBuf *out, const char *fmt, ...);
+
+_Bool outFlush(OutBuf *out);
+
+#endif /* CHTTPD_OUT_BUF_H */
@@ -0,0 +1,38 @@
+#ifndef CHTTPD_PROXY_H
+#define CHTTPD_PROXY_H
+
+#include <stdio.h>
+
+#include "error.h"
+#include "http.h"
+
+#define PROXY_MAX_SERVERS 32
+
+typedef enum e_proxy_balance {
+  PROXY_ROUND_ROBIN = 0,
+  PROXY_LEAST_CONN  = 1
+} ProxyBalance;
+
+typedef struct st_proxy_upstream ProxyUpstream;
+
+ProxyUpstream *createProxyUpstream(const char *name, Error *error);
+void addProxyServer(ProxyUpstream *upstream,
+                    const char *address,
+                    Error *error);
+void setProxyBalance(ProxyUpstream *upstream, ProxyBalance balance);
+void setProxyKeepAlive(ProxyUpstream *upstream, int maxIdle);
+const char *proxyUpstreamName(const ProxyUpstream *upstream);
+void dropProxyUpstream(ProxyUpstream *upstream);
+
+/*
+ * `timeout` bounds, in seconds, connecting to the upstream and each read
+ * and write on the connection, 0 for no bound. Running out of it before
+ * the response has begun answers 504.
+ */
+void handleProxy(ProxyUpstream *upstream,
+                 int timeout,
+                 HttpRequest *request,
+                 FILE *response,
+                 Error *error);
+
+#endif /* CHTTPD_PROXY_H */
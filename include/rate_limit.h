@@ -0,0 +1,37 @@
+#ifndef CHTTPD_RATE_LIMIT_H
+#define CHTTPD_RATE_LIMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RATE_LIMIT_SHARDS 64
+#define RATE_LIMIT_SLOTS  1024 /* per shard */
+#define RATE_LIMIT_PROBES 16
+
+/*
+ * A token bucket refilled with one token every `intervalNs`, holding up
+ * to `burst` tokens. An interval of 0 means no limit.
+ */
+typedef struct st_rate_limit {
+  uint64_t intervalNs;
+  uint32_t burst;
+} RateLimit;
+
+/*
+ * Takes a token from the bucket of `clientAddr` under `key`, which tells
+ * apart the buckets one client has for different routes. Returns 0 if
+ * the bucket is empty.
+ *
+ * Buckets are kept in RATE_LIMIT_SHARDS fixed-size open-addressed
+ * tables, each behind its own lock, and are refilled lazily when next
+ * touched. A bucket that has refilled completely is as good as no
+ * bucket, so its slot is free for reuse; if all slots within
+ * RATE_LIMIT_PROBES of a key are in use, the fullest bucket is given
+ * up. The tables never allocate, whatever the number of clients.
+ */
+void initRateLimits(void);
+_Bool takeToken(const char *clientAddr, size_t key, const RateLimit *limit);
+
+size_t rateLimitedRequests(void);
+
+#endif /* CHTTPD_RATE_LIMIT_H */
@@ -3,15 +3,18 @@
 
 #include <stdio.h>
 #include "error.h"
+#include "out_buf.h"
 
 void handleStatic(const char *filePath,
-                  FILE *fp,
+                  OutBuf *out,
                   int cacheTime,
                   Error *error);
 
+const char *mimeGuess(const char *filePath);
+
 void handleDir(const char *route,
                const char *dirPath,
-               FILE *fp,
+               OutBuf *out,
                int cacheTime,
                Error *error);
 
@@ -0,0 +1,51 @@
+#ifndef CHTTPD_TIMER_WHEEL_H
+#define CHTTPD_TIMER_WHEEL_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "error.h"
+
+#define TIMER_WHEEL_TICK_MS 100
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SLOTS   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS  4
+
+/*
+ * A connection deadline. When it expires, the timer thread shuts down
+ * `fd` in direction `how` (as for shutdown(2)), which wakes up whoever
+ * is blocked on the socket, and sets `fired`.
+ *
+ * Timers are embedded in their owners and linked into the wheel in
+ * place, so arming and cancelling are O(1) and never allocate. A timer
+ * must be cancelled before its fd is closed or its memory goes away.
+ */
+typedef struct st_timer {
+  struct st_timer *next;
+  struct st_timer **pprev;
+  uint64_t expires;
+
+  int fd;
+  int how;
+  _Atomic _Bool fired;
+} Timer;
+
+/* run by the timer thread on every tick, outside the wheel's lock */
+typedef void (TickHook)(void);
+
+/*
+ * One wheel per level, each with TIMER_WHEEL_SLOTS slots and every
+ * level TIMER_WHEEL_SLOTS times coarser than the one below; timers
+ * cascade down as their time comes closer. Four levels of 64 slots at
+ * 100ms reach out to about 19 days.
+ */
+void startTimerWheel(TickHook *tickHook, Error *error);
+void stopTimerWheel(void);
+_Bool timerWheelRunning(void);
+
+void initTimer(Timer *timer, int fd);
+/* (re-)arms `timer`, `timeoutMs` == 0 just cancels it */
+void armTimer(Timer *timer, uint32_t timeoutMs, int how);
+void cancelTimer(Timer *timer);
+
+#endif /* CHTTPD_TIMER_WHEEL_H */
@@ -33,6 +33,9 @@ typedef enum e_log_level {
   LL_FATAL = 4
 } LogLevel;
 
+/* messages below this level are skipped before any formatting */
+extern LogLevel chttpdLogLevel;
+
 void setWorkerId(size_t workerId);
 void chttpdLog(LogLevel logLevel,
                const char *fileName,
@@ -42,7 +45,11 @@ void chttpdLog(LogLevel logLevel,
                ...);
 
 #define LOG(LL, FMT, ...) \
-  { chttpdLog(LL, __FILE__, __LINE__, __func__, FMT, ##__VA_ARGS__); }
+  { \
+    if ((LL) >= chttpdLogLevel) { \
+      chttpdLog(LL, __FILE__, __LINE__, __func__, FMT, ##__VA_ARGS__); \
+    } \
+  }
 
 #define LOG_DBG(FMT, ...) { LOG(LL_DEBUG, FMT, ##__VA_ARGS__); }
 #define LOG_INFO(FMT, ...) { LOG(LL_INFO, FMT, ##__VA_ARGS__); }
@@ -0,0 +1,48 @@
+#ifndef CHTTPD_WORKERS_H
+#define CHTTPD_WORKERS_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+#define WORKER_POLL_MS          200
+#define WORKER_RESPAWN_DELAY_MS 1000
+#define MAX_NUMA_NODES          1024
+
+/* worker-processes, with "auto" standing for the CPUs we may run on */
+size_t workerProcessCount(const Config *config);
+
+/*
+ * Master/worker mode, for more than one worker process. The master
+ * forks the workers, each of which goes on to serve just as a single
+ * process would: its own threads, DCGI pool, access log files and
+ * limits. `fdsListen` holds one socket per listener, which the workers
+ * all share, or with reuse-port `listenCount / listenerCount` such sets
+ * of sockets, one set each, so the kernel spreads connections over them.
+ *
+ * The master serves nothing. It respawns workers that die, at most once
+ * every WORKER_RESPAWN_DELAY_MS each, and passes SIGTERM, SIGINT and
+ * SIGHUP on to them, reloading its own copy of the config on SIGHUP for
+ * the workers it forks later. On SIGUSR2 it upgrades, passing on all of
+ * `fdsListen`, and the new master reports readiness once all its workers
+ * accept connections.
+ *
+ * With cpu-affinity, a worker is pinned before it sets anything up,
+ * either to one CPU or to the CPUs of one NUMA node, round robin over
+ * those chttpd was allowed to run on. On machines with more than one
+ * node, its memory is then preferably taken from the node it runs on.
+ *
+ * Returns in each worker, with the index into `fdsListen` where the
+ * `listenerCount` sockets it is to accept on start; it closed the rest.
+ * In the master it only returns once the workers are gone, with -1 and
+ * the status to exit with in `*status`; `*config` is replaced by
+ * reloads.
+ */
+int runWorkerProcesses(Config **config,
+                       const char *configPath,
+                       const int *fdsListen,
+                       size_t listenCount,
+                       size_t listenerCount,
+                       int *status);
+
+#endif /* CHTTPD_WORKERS_H */
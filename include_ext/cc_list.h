@@ -0,0 +1,118 @@
+#ifndef CCLIB_LIST_H
+#define CCLIB_LIST_H
+
+#include <stddef.h>
+
+#include "cc_defs.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct st_cc_list {
+    void *p1;
+    void *p2;
+    size_t elem_size;
+} ccList;
+
+typedef struct st_cc_list_iter {
+    void *node;
+} ccListIter;
+
+void
+ccListInit (ccList *list, size_t elem_size);
+
+void
+ccListDestroy (ccList *list);
+
+void
+ccListPushBack (ccList *list, const void *data);
+
+void
+ccListPushFront (ccList *list, const void *data);
+
+void
+ccListPopBack (ccList *list);
+
+void
+ccListPopFront (ccList *list);
+
+void*
+ccListFront (const ccList *list);
+
+void*
+ccListBack (const ccList *list);
+
+size_t
+ccListLen (const ccList *list);
+
+size_t
+ccListSize (const ccList *list);
+
+_Bool
+ccListEmpty (const ccList *list);
+
+ccListIter
+ccListBegin (const ccList *list);
+
+ccListIter
+ccListEnd (const ccList *list);
+
+void
+ccListInsert (const ccList *list,
+                      ccListIter pos,
+                      const void *data);
+
+void
+ccListInsertAfter (const ccList *list,
+                            ccListIter pos,
+                            const void *data);
+
+void
+ccListRemove (const ccList *list,
+                      ccListIter pos);
+
+void
+ccListRemoveRange (const ccList *list,
+                            ccListIter first,
+                            ccListIter last);
+
+void*
+ccListIterDeref (ccListIter iter);
+
+ccListIter
+ccListIterPrev (ccListIter iter);
+
+ccListIter
+ccListIterNext (ccListIter iter);
+
+_Bool
+ccListIterEq (ccListIter iter1,
+                       ccListIter iter2);
+
+ccListIter
+ccListFind (const ccList *list,
+                    const void *value,
+                    _Bool (*cmp)(const void*, const void*));
+
+ccListIter
+ccListFindValue (const ccList *list,
+                          const void *value);
+
+ccListIter
+ccListIterFind (ccList *list,
+                         ccListIter first,
+                         ccListIter last,
+                         const void *value,
+                         _Bool (*cmp)(const void*, const void*));
+
+ccListIter
+ccListIterFindValue (ccList *list,
+                               ccListIter first,
+                               ccListIter last,
+                               const void *value);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* CCLIB_LIST_H */
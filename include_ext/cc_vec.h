@@ -0,0 +1,130 @@
+#ifndef CCLIB_VEC_H
+#define CCLIB_VEC_H
+
+#include <stddef.h>
+#include <unistd.h>
+
+#include "cc_defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CC_VEC_INIT_SIZE 8
+#define CC_VEC_INLINE_SIZE 16
+
+/* NULL means plain malloc/realloc/free */
+typedef struct st_cc_allocator {
+    void *(*alloc) (void *ctx, size_t size);
+    void *(*realloc) (void *ctx, void *ptr, size_t old_size, size_t size);
+    void (*free) (void *ctx, void *ptr, size_t size);
+    void *ctx;
+} ccAllocator;
+
+typedef struct st_cc_vec {
+    void *start;
+    void *usage;
+    void *end;
+    size_t elem_size;
+    const ccAllocator *allocator;
+    void *inline_buf;
+} ccVec;
+
+void
+ccVecInit (ccVec *vec, size_t elem_size);
+
+void
+ccVecInitAlloc (ccVec *vec,
+                         size_t elem_size,
+                         const ccAllocator *allocator);
+
+/* `storage` is used until it fills up, and never freed by the vector */
+void
+ccVecInitInline (ccVec *vec,
+                          size_t elem_size,
+                          void *storage,
+                          size_t capacity,
+                          const ccAllocator *allocator);
+
+void
+ccVecDestroy (ccVec *vec);
+
+void
+ccVecPushBack (ccVec *vec, const void *data);
+
+void
+ccVecPushFront (ccVec *vec, const void *data);
+
+void
+ccVecPopBack (ccVec *vec);
+
+void
+ccVecPopFront (ccVec *vec);
+
+void*
+ccVecFront (const ccVec *vec);
+
+void*
+ccVecBack (const ccVec *vec);
+
+void*
+ccVecNth (const ccVec *vec, size_t idx);
+
+void
+ccVecInsert (ccVec *vec,
+                     size_t idx,
+                     const void *data);
+
+void
+ccVecRemove (ccVec *vec, size_t idx);
+
+void
+ccVecRemoveN (ccVec *vec,
+                       size_t first,
+                       size_t n);
+
+ssize_t
+ccVecFindIn (const ccVec *vec,
+                      size_t first,
+                      ssize_t last,
+                      const void *data,
+                      _Bool (*cmp)(const void*, const void*));
+
+ssize_t
+ccVecFind (const ccVec *vec,
+                   const void *data,
+                   _Bool (*cmp)(const void*, const void*));
+
+ssize_t
+ccVecFindValueIn (const ccVec *vec,
+                            size_t first,
+                            ssize_t last,
+                            const void *data);
+
+ssize_t
+ccVecFindValue (const ccVec *vec,
+                         const void *data);
+
+size_t
+ccVecLen (const ccVec *vec);
+
+size_t
+ccVecSize (const ccVec *vec);
+
+_Bool
+ccVecEmpty (const ccVec *vec);
+
+void
+ccVecShrink (ccVec *vec);
+
+void*
+ccVecData (ccVec *vec);
+
+const void*
+ccVecDataConst (const ccVec *vec);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* CCLIB_VEC_H */
@@ -643,7 +643,7 @@ static _Bool cmdHandler(RunContext *context,
     formatError(error, cmd->sourceInfo, PL2B_ERR_UNKNOWN_CMD,
                 "`%s` is not recognized as an internal or external "
                 "command, operable program or batch file",
-                cmd->cmd);
+                cmd->cmd.str);
     return 0;
   }
 
@@ -0,0 +1,60 @@
+#define _GNU_SOURCE
+
+#include "acceptor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "util.h"
+
+void initAcceptor(IoAcceptor *acceptor,
+                  const int *fdsSock,
+                  size_t sockCount,
+                  const sigset_t *waitMask) {
+  acceptor->fdsSock = fdsSock;
+  acceptor->sockCount = sockCount;
+  acceptor->nextSock = 0;
+  acceptor->waitMask = waitMask;
+  /* a socket polled ready may be drained by the time we accept */
+  for (size_t i = 0; i < sockCount; i++) {
+    int flags = fcntl(fdsSock[i], F_GETFL);
+    if (flags < 0 || fcntl(fdsSock[i], F_SETFL, flags | O_NONBLOCK) < 0) {
+      LOG_WARN("cannot make listening socket non-blocking: %d", errno);
+    }
+  }
+}
+
+int acceptConnection(IoAcceptor *acceptor,
+                     struct sockaddr *addr,
+                     socklen_t *addrSize) {
+  struct pollfd pfds[IO_MAX_LISTEN_SOCKETS];
+  size_t count = acceptor->sockCount;
+  for (size_t i = 0; i < count; i++) {
+    pfds[i].fd = acceptor->fdsSock[i];
+    pfds[i].events = POLLIN;
+    pfds[i].revents = 0;
+  }
+  if (ppoll(pfds, count, NULL, acceptor->waitMask) < 0) {
+    return -1;
+  }
+
+  /* in turns, so that a busy socket cannot starve the others */
+  socklen_t size = addrSize != NULL ? *addrSize : 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t index = (acceptor->nextSock + i) % count;
+    if (pfds[index].revents == 0) {
+      continue;
+    }
+    if (addrSize != NULL) {
+      *addrSize = size;
+    }
+    int fd = accept4(pfds[index].fd, addr, addrSize, SOCK_CLOEXEC);
+    if (fd >= 0 || errno != EAGAIN) {
+      acceptor->nextSock = index + 1;
+      return fd;
+    }
+  }
+  errno = EAGAIN;
+  return -1;
+}
@@ -0,0 +1,232 @@
+#include "access_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "util.h"
+
+#define ACCESS_LOG_NAME_SIZE 4096
+
+typedef struct st_segment {
+  char *map;
+  size_t mapSize;
+  size_t capacity;
+  int fd;
+  unsigned seq;
+
+  _Atomic size_t next;
+  _Atomic int writers;
+} Segment;
+
+static _Atomic(Segment*) current;
+static pthread_mutex_t rotateLock = PTHREAD_MUTEX_INITIALIZER;
+static char *logPrefix;
+static size_t logSegmentSize;
+static int logKeep;
+static unsigned nextSeq;
+
+static Segment *openSegment(Error *error);
+static void closeSegment(Segment *segment);
+static void rotate(Segment *full);
+static void segmentName(char *buffer, unsigned seq);
+
+void startAccessLog(const char *prefix,
+                    size_t segmentSize,
+                    int keep,
+                    Error *error) {
+  if (segmentSize < ACCESS_LOG_HEADER_SIZE + sizeof(AccessRecord)) {
+    QUICK_ERROR2(error, 500, "access log segment size %zu too small",
+                 segmentSize);
+    return;
+  }
+
+  logPrefix = copyString(prefix);
+  logSegmentSize = segmentSize;
+  logKeep = keep;
+
+  /* carry on after the segments left by an earlier run */
+  char name[ACCESS_LOG_NAME_SIZE];
+  nextSeq = 1;
+  for (;;) {
+    segmentName(name, nextSeq);
+    if (access(name, F_OK) != 0) {
+      break;
+    }
+    nextSeq++;
+  }
+
+  Segment *segment = openSegment(error);
+  if (segment == NULL) {
+    free(logPrefix);
+    logPrefix = NULL;
+    return;
+  }
+  atomic_store(&current, segment);
+}
+
+void stopAccessLog(void) {
+  pthread_mutex_lock(&rotateLock);
+  Segment *segment = atomic_exchange(&current, NULL);
+  pthread_mutex_unlock(&rotateLock);
+
+  if (segment != NULL) {
+    closeSegment(segment);
+  }
+  free(logPrefix);
+  logPrefix = NULL;
+}
+
+_Bool accessLogEnabled(void) {
+  return atomic_load_explicit(&current, memory_order_relaxed) != NULL;
+}
+
+void writeAccessRecord(const AccessRecord *record) {
+  for (;;) {
+    Segment *segment = atomic_load(&current);
+    if (segment == NULL) {
+      return;
+    }
+
+    /* announce ourselves before checking the segment is still live,
+       so that rotation waits for us before unmapping it */
+    atomic_fetch_add(&segment->writers, 1);
+    if (atomic_load(&current) != segment) {
+      atomic_fetch_sub(&segment->writers, 1);
+      continue;
+    }
+
+    size_t slot = atomic_fetch_add(&segment->next, 1);
+    if (slot < segment->capacity) {
+      AccessRecord *dest = (AccessRecord*)(segment->map
+                                           + ACCESS_LOG_HEADER_SIZE
+                                           + slot * sizeof(AccessRecord));
+      memcpy((char*)dest + sizeof(uint64_t),
+             (const char*)record + sizeof(uint64_t),
+             sizeof(AccessRecord) - sizeof(uint64_t));
+      /* the timestamp goes last and marks the record complete */
+      uint64_t timeNs = record->timeNs != 0 ? record->timeNs : 1;
+      __atomic_store_n(&dest->timeNs, timeNs, __ATOMIC_RELEASE);
+      atomic_fetch_sub(&segment->writers, 1);
+      return;
+    }
+
+    atomic_fetch_sub(&segment->writers, 1);
+    rotate(segment);
+  }
+}
+
+static void rotate(Segment *full) {
+  pthread_mutex_lock(&rotateLock);
+  if (atomic_load(&current) != full) {
+    pthread_mutex_unlock(&rotateLock);
+    return;
+  }
+
+  Error *error = errorBuffer(256);
+  Segment *segment = openSegment(error);
+  if (segment == NULL) {
+    LOG_ERR("access log disabled: %s", error->errorBuffer);
+  }
+  dropError(error);
+  atomic_store(&current, segment);
+  pthread_mutex_unlock(&rotateLock);
+
+  closeSegment(full);
+}
+
+static Segment *openSegment(Error *error) {
+  char name[ACCESS_LOG_NAME_SIZE];
+  unsigned seq;
+  int fd;
+  /* while an upgrade hands over, two processes are writing segments */
+  do {
+    seq = nextSeq++;
+    segmentName(name, seq);
+    fd = open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  } while (fd < 0 && errno == EEXIST);
+  if (fd < 0) {
+    QUICK_ERROR2(error, 500, "cannot open access log \"%s\": %d",
+                 name, errno);
+    return NULL;
+  }
+  if (ftruncate(fd, logSegmentSize) < 0) {
+    QUICK_ERROR2(error, 500, "cannot size access log \"%s\": %d",
+                 name, errno);
+    close(fd);
+    return NULL;
+  }
+
+  char *map = (char*)mmap(NULL, logSegmentSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    QUICK_ERROR2(error, 500, "cannot map access log \"%s\": %d",
+                 name, errno);
+    close(fd);
+    return NULL;
+  }
+
+  Segment *segment = (Segment*)malloc(sizeof(Segment));
+  if (segment == NULL) {
+    QUICK_ERROR(error, 500, "failed allocating access log segment");
+    munmap(map, logSegmentSize);
+    close(fd);
+    return NULL;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  AccessLogHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ACCESS_LOG_MAGIC, sizeof(header.magic));
+  header.version = ACCESS_LOG_VERSION;
+  header.recordSize = sizeof(AccessRecord);
+  header.createdNs = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+  memcpy(map, &header, sizeof(header));
+
+  segment->map = map;
+  segment->mapSize = logSegmentSize;
+  segment->capacity =
+    (logSegmentSize - ACCESS_LOG_HEADER_SIZE) / sizeof(AccessRecord);
+  segment->fd = fd;
+  segment->seq = seq;
+  atomic_init(&segment->next, 0);
+  atomic_init(&segment->writers, 0);
+
+  if (logKeep > 0 && seq > (unsigned)logKeep) {
+    segmentName(name, seq - logKeep);
+    unlink(name);
+  }
+  return segment;
+}
+
+static void closeSegment(Segment *segment) {
+  while (atomic_load(&segment->writers) != 0) {
+    sched_yield();
+  }
+
+  size_t used = atomic_load(&segment->next);
+  if (used > segment->capacity) {
+    used = segment->capacity;
+  }
+  munmap(segment->map, segment->mapSize);
+  if (ftruncate(segment->fd,
+                ACCESS_LOG_HEADER_SIZE + used * sizeof(AccessRecord)) < 0) {
+    LOG_WARN("cannot trim access log segment %u: %d", segment->seq, errno);
+  }
+  close(segment->fd);
+  free(segment);
+}
+
+static void segmentName(char *buffer, unsigned seq) {
+  snprintf(buffer, ACCESS_LOG_NAME_SIZE, "%s.%06u", logPrefix, seq);
+}
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "access_log.h"
+#include "http_base.h"
+
+static void printRecord(const AccessRecord *record, _Bool csv);
+static const char *methodName(uint8_t method);
+static void printField(const char *field, size_t maxSize, _Bool csv);
+
+int main(int argc, const char *argv[]) {
+  _Bool csv = 0;
+  int first = 1;
+  if (argc > 1 && !strcmp(argv[1], "--csv")) {
+    csv = 1;
+    first = 2;
+  }
+
+  if (first >= argc) {
+    fprintf(stderr, "usage: chttpd_alog [--csv] SEGMENT...\n");
+    return -1;
+  }
+
+  if (csv) {
+    puts("time,client,method,path,status,bytes,latency_us,worker");
+  }
+
+  int ret = 0;
+  for (int i = first; i < argc; i++) {
+    FILE *fp = fopen(argv[i], "rb");
+    if (fp == NULL) {
+      fprintf(stderr, "cannot open \"%s\"\n", argv[i]);
+      ret = -1;
+      continue;
+    }
+
+    char headerBytes[ACCESS_LOG_HEADER_SIZE];
+    AccessLogHeader header;
+    if (fread(headerBytes, 1, sizeof(headerBytes), fp)
+          != sizeof(headerBytes)
+        || (memcpy(&header, headerBytes, sizeof(header)),
+            memcmp(header.magic, ACCESS_LOG_MAGIC, sizeof(header.magic)))
+        || header.version != ACCESS_LOG_VERSION
+        || header.recordSize != sizeof(AccessRecord)) {
+      fprintf(stderr, "\"%s\" is not a chttpd access log\n", argv[i]);
+      fclose(fp);
+      ret = -1;
+      continue;
+    }
+
+    AccessRecord record;
+    while (fread(&record, sizeof(record), 1, fp) == 1
+           && record.timeNs != 0) {
+      printRecord(&record, csv);
+    }
+    fclose(fp);
+  }
+
+  return ret;
+}
+
+static void printRecord(const AccessRecord *record, _Bool csv) {
+  time_t seconds = (time_t)(record->timeNs / 1000000000ull);
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  char timeStr[32];
+  strftime(timeStr, sizeof(timeStr), "%Y-%m-%dT%H:%M:%S", &tm);
+  unsigned millis = (unsigned)(record->timeNs / 1000000ull % 1000);
+
+  if (csv) {
+    printf("%s.%03uZ,", timeStr, millis);
+    printField(record->clientAddr, ACCESS_LOG_ADDR_SIZE, 1);
+    printf(",%s,", methodName(record->method));
+    printField(record->path, ACCESS_LOG_PATH_SIZE, 1);
+    printf(",%u,%llu,%u,%llu\n",
+           record->status,
+           (unsigned long long)record->bytesOut,
+           record->latencyUs,
+           (unsigned long long)record->workerId);
+  } else {
+    printf("%s.%03uZ ", timeStr, millis);
+    printField(record->clientAddr, ACCESS_LOG_ADDR_SIZE, 0);
+    printf(" %s ", methodName(record->method));
+    printField(record->path, ACCESS_LOG_PATH_SIZE, 0);
+    printf(" %u %lluB %uus <%llu>\n",
+           record->status,
+           (unsigned long long)record->bytesOut,
+           record->latencyUs,
+           (unsigned long long)record->workerId);
+  }
+}
+
+static const char *methodName(uint8_t method) {
+  switch (method) {
+  case HTTP_GET: return "GET";
+  case HTTP_POST: return "POST";
+  case HTTP_OPTIONS: return "OPTIONS";
+  default: return "-";
+  }
+}
+
+static void printField(const char *field, size_t maxSize, _Bool csv) {
+  size_t len = strnlen(field, maxSize);
+  if (len == 0) {
+    fputs("-", stdout);
+    return;
+  }
+
+  if (csv) {
+    putchar('"');
+    for (size_t i = 0; i < len; i++) {
+      if (field[i] == '"') {
+        putchar('"');
+      }
+      putchar(field[i]);
+    }
+    putchar('"');
+  } else {
+    fwrite(field, 1, len, stdout);
+  }
+}
@@ -0,0 +1,187 @@
+#include "arena.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+
+typedef struct st_arena_block {
+  struct st_arena_block *next;
+  size_t size;
+  _Alignas(ARENA_ALIGN) char data[0];
+} ArenaBlock;
+
+struct st_arena {
+  ArenaBlock *current;
+  size_t used;
+  Arena *nextFree;
+  ccAllocator allocator;
+  ArenaBlock first;
+};
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static Arena *freeArenas;
+static size_t freeArenaCount;
+
+static void freeBlocksAfter(ArenaBlock *block);
+static void *arenaVecAlloc(void *ctx, size_t size);
+static void *arenaVecRealloc(void *ctx,
+                             void *ptr,
+                             size_t oldSize,
+                             size_t size);
+static void arenaVecFree(void *ctx, void *ptr, size_t size);
+
+Arena *acquireArena(void) {
+  pthread_mutex_lock(&poolLock);
+  Arena *arena = freeArenas;
+  if (arena != NULL) {
+    freeArenas = arena->nextFree;
+    freeArenaCount--;
+  }
+  pthread_mutex_unlock(&poolLock);
+
+  if (arena != NULL) {
+    return arena;
+  }
+
+  arena = (Arena*)malloc(sizeof(Arena) + ARENA_BLOCK_SIZE);
+  if (arena == NULL) {
+    return NULL;
+  }
+  arena->first.next = NULL;
+  arena->first.size = ARENA_BLOCK_SIZE;
+  arena->current = &arena->first;
+  arena->used = 0;
+  arena->nextFree = NULL;
+  arena->allocator = (ccAllocator) {
+    arenaVecAlloc, arenaVecRealloc, arenaVecFree, arena
+  };
+  return arena;
+}
+
+void releaseArena(Arena *arena) {
+  if (arena == NULL) {
+    return;
+  }
+
+  resetArena(arena);
+
+  /* don't let one huge request pin its memory forever */
+  ArenaBlock *block = &arena->first;
+  for (size_t i = 1; i < ARENA_KEEP_BLOCKS && block->next != NULL; i++) {
+    block = block->next;
+  }
+  freeBlocksAfter(block);
+  block->next = NULL;
+
+  pthread_mutex_lock(&poolLock);
+  if (freeArenaCount < ARENA_POOL_SIZE) {
+    arena->nextFree = freeArenas;
+    freeArenas = arena;
+    freeArenaCount++;
+    arena = NULL;
+  }
+  pthread_mutex_unlock(&poolLock);
+
+  if (arena != NULL) {
+    freeBlocksAfter(&arena->first);
+    free(arena);
+  }
+}
+
+void resetArena(Arena *arena) {
+  arena->current = &arena->first;
+  arena->used = 0;
+}
+
+void *arenaAlloc(Arena *arena, size_t size) {
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  ArenaBlock *block = arena->current;
+  if (block->size - arena->used >= size) {
+    void *ret = block->data + arena->used;
+    arena->used += size;
+    return ret;
+  }
+
+  /* blocks kept from earlier requests are reused first */
+  if (block->next != NULL && block->next->size >= size) {
+    arena->current = block->next;
+    arena->used = size;
+    return arena->current->data;
+  }
+
+  size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+  ArenaBlock *newBlock =
+    (ArenaBlock*)malloc(sizeof(ArenaBlock) + blockSize);
+  if (newBlock == NULL) {
+    return NULL;
+  }
+  newBlock->size = blockSize;
+  newBlock->next = block->next;
+  block->next = newBlock;
+
+  arena->current = newBlock;
+  arena->used = size;
+  return newBlock->data;
+}
+
+char *arenaStrndup(Arena *arena, const char *src, size_t size) {
+  char *ret = (char*)arenaAlloc(arena, size + 1);
+  if (ret == NULL) {
+    return NULL;
+  }
+  memcpy(ret, src, size);
+  ret[size] = '\0';
+  return ret;
+}
+
+Error *arenaErrorBuffer(Arena *arena, uint16_t bufferSize) {
+  Error *ret = (Error*)arenaAlloc(arena, sizeof(Error) + bufferSize);
+  if (ret == NULL) {
+    return NULL;
+  }
+  ret->sourceInfo = (SourceInfo) { NULL, -1 };
+  ret->errCode = 0;
+  ret->bufferSize = bufferSize;
+  /* formatError always terminates what it writes */
+  if (bufferSize != 0) {
+    ret->errorBuffer[0] = '\0';
+  }
+  return ret;
+}
+
+const ccAllocator *arenaAllocator(Arena *arena) {
+  return &arena->allocator;
+}
+
+static void *arenaVecAlloc(void *ctx, size_t size) {
+  return arenaAlloc((Arena*)ctx, size);
+}
+
+static void *arenaVecRealloc(void *ctx,
+                             void *ptr,
+                             size_t oldSize,
+                             size_t size) {
+  void *ret = arenaAlloc((Arena*)ctx, size);
+  if (ret != NULL && ptr != NULL) {
+    memcpy(ret, ptr, oldSize < size ? oldSize : size);
+  }
+  return ret;
+}
+
+static void arenaVecFree(void *ctx, void *ptr, size_t size) {
+  (void)ctx;
+  (void)ptr;
+  (void)size;
+}
+
+static void freeBlocksAfter(ArenaBlock *block) {
+  ArenaBlock *it = block->next;
+  while (it != NULL) {
+    ArenaBlock *next = it->next;
+    free(it);
+    it = next;
+  }
+}
@@ -1,25 +1,58 @@
 #include "config.h"
 #include "dcgi.h"
+#include "fcgi.h"
+#include "file_util.h"
 #include "http_base.h"
+#include "intern.h"
+#include "log.h"
 
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
 #define DEFAULT_ADDRESS         "127.0.0.1"
 #define DEFAULT_PORT            8080
 #define DEFAULT_MAX_PENDING     16
 #define DEFAULT_PRELOAD_DYNAMIC 0
 #define DEFAULT_IGNORE_CASE     1
 #define DEFAULT_CACHE_TIME      (-1)
+#define DEFAULT_ISOLATE_DYNAMIC 0
+#define DEFAULT_DCGI_WORKERS    4
+#define DEFAULT_DCGI_TIMEOUT    30
+#define DEFAULT_FCGI_CONNS      4
+#define DEFAULT_FCGI_MPX        1
+#define DEFAULT_MAX_BODY_SIZE   (8 * 1024 * 1024)
+#define DEFAULT_LOG_LEVEL       LL_INFO
+#define DEFAULT_IDLE_TIMEOUT    30
+#define DEFAULT_HEADER_TIMEOUT  15
+#define DEFAULT_BODY_TIMEOUT    15
+#define DEFAULT_WRITE_TIMEOUT   30
+#define DEFAULT_UPSTREAM_TIMEOUT 60
+#define DEFAULT_SHUTDOWN_TIMEOUT 30
+#define MAX_TIMEOUT             86400
+#define DEFAULT_MAX_CONNECTIONS 1024
+#define DEFAULT_MAX_CONNECTIONS_PER_IP 0
+#define DEFAULT_WORKER_PROCESSES 1
+
+#define HOST_TABLE_MIN     16
+
+#define CONFIG_SOURCE_SIZE 65536
+#define CONFIG_PARSE_SIZE  4096
 
 const char *HANDLER_TYPE_NAMES[] = {
   [HDLR_STATIC] = "STATIC",
   [HDLR_DCGI]   = "DCGI",
   [HDLR_INTERN] = "INTERN",
-  [HDLR_DIR]    = "DIR"
+  [HDLR_DIR]    = "DIR",
+  [HDLR_FCGI]   = "FCGI",
+  [HDLR_PROXY]  = "PROXY"
 };
 
 void initConfig(Config *config) {
@@ -29,15 +62,261 @@ void initConfig(Config *config) {
   config->preloadDynamic = DEFAULT_PRELOAD_DYNAMIC;
   config->ignoreCase = DEFAULT_IGNORE_CASE;
   config->cacheTime = DEFAULT_CACHE_TIME;
+  config->isolateDynamic = DEFAULT_ISOLATE_DYNAMIC;
+  config->dcgiWorkers = DEFAULT_DCGI_WORKERS;
+  config->dcgiTimeout = DEFAULT_DCGI_TIMEOUT;
+  config->fcgiMaxConns = DEFAULT_FCGI_CONNS;
+  config->fcgiMaxMpx = DEFAULT_FCGI_MPX;
+  config->maxBodySize = DEFAULT_MAX_BODY_SIZE;
+  config->logLevel = DEFAULT_LOG_LEVEL;
+  config->logFile = NULL;
+  config->accessLog = NULL;
+  config->accessLogSegmentSize = ACCESS_LOG_DEFAULT_SEGMENT;
+  config->accessLogKeep = ACCESS_LOG_DEFAULT_KEEP;
+  config->serverTiming = 0;
+  config->idleTimeout = DEFAULT_IDLE_TIMEOUT;
+  config->headerTimeout = DEFAULT_HEADER_TIMEOUT;
+  config->bodyTimeout = DEFAULT_BODY_TIMEOUT;
+  config->writeTimeout = DEFAULT_WRITE_TIMEOUT;
+  config->upstreamTimeout = DEFAULT_UPSTREAM_TIMEOUT;
+  config->shutdownTimeout = DEFAULT_SHUTDOWN_TIMEOUT;
+  config->maxConnections = DEFAULT_MAX_CONNECTIONS;
+  config->maxConnectionsPerIp = DEFAULT_MAX_CONNECTIONS_PER_IP;
+  config->rateLimit = (RateLimit) { 0, 0 };
+  config->workerProcesses = DEFAULT_WORKER_PROCESSES;
+  config->reusePort = 0;
+  config->cpuAffinity = CPU_AFFINITY_NONE;
+  ccVecInit(&config->listeners, sizeof(SockAddress));
   ccVecInit(&config->routes, sizeof(Route));
+  ccVecInit(&config->hosts, sizeof(VirtualHost));
+  VirtualHost defaultHost;
+  defaultHost.name = NULL;
+  ccVecInit(&defaultHost.routes, sizeof(size_t));
+  ccVecPushBack(&config->hosts, &defaultHost);
+  ccVecInit(&config->serverNames, sizeof(HostSlot));
+  config->hostTable = NULL;
+  config->hostTableSize = 0;
+  config->currentHost = 0;
   ccVecInit(&config->corsConfig, sizeof(CorsConfig));
+  ccVecInit(&config->errorPages, sizeof(ErrorPageConfig));
+  ccVecInit(&config->proxyUpstreams, sizeof(ProxyUpstream*));
+  ccVecInit(&config->fcgiUpstreams, sizeof(FCGIUpstream*));
+  config->metrics = NULL;
+  config->source = NULL;
+  pl2b_initProgram(&config->program);
 }
 
 void dropConfig(Config *config) {
+  Error *error = errorBuffer(256);
+  for (size_t i = 0; i < ccVecLen(&config->routes); i++) {
+    Route *route = (Route*)ccVecNth(&config->routes, i);
+    if (route->handlerType == HDLR_DCGI && route->extra != NULL) {
+      unloadDCGIModule((DCGIModule*)route->extra, error);
+      if (isError(error)) {
+        LOG_WARN("%s", error->errorBuffer);
+        error->errCode = 0;
+      }
+    }
+  }
+  dropError(error);
+
+  ccVecDestroy(&config->listeners);
   ccVecDestroy(&config->routes);
+  for (size_t i = 0; i < ccVecLen(&config->hosts); i++) {
+    ccVecDestroy(&((VirtualHost*)ccVecNth(&config->hosts, i))->routes);
+  }
+  ccVecDestroy(&config->hosts);
+  ccVecDestroy(&config->serverNames);
+  free(config->hostTable);
   ccVecDestroy(&config->corsConfig);
+  ccVecDestroy(&config->errorPages);
+  for (size_t i = 0; i < ccVecLen(&config->proxyUpstreams); i++) {
+    dropProxyUpstream(
+      *(ProxyUpstream**)ccVecNth(&config->proxyUpstreams, i)
+    );
+  }
+  ccVecDestroy(&config->proxyUpstreams);
+  for (size_t i = 0; i < ccVecLen(&config->fcgiUpstreams); i++) {
+    dropFCGIUpstream(
+      *(FCGIUpstream**)ccVecNth(&config->fcgiUpstreams, i)
+    );
+  }
+  ccVecDestroy(&config->fcgiUpstreams);
+  pl2b_dropProgram(&config->program);
+  free(config->source);
+}
+
+static void wrapConfigError(Error *error,
+                            const char *action,
+                            const char *path);
+static void addDefaultListener(Config *config, Error *error);
+static void buildHostTable(Config *config, Error *error);
+static size_t hostNameLength(const char *host);
+static size_t hashHostName(const char *host, size_t len);
+
+void loadConfig(Config *config, const char *path, Error *error) {
+  initConfig(config);
+
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    QUICK_ERROR2(error, 500, "cannot open config file \"%s\"", path);
+    return;
+  }
+  config->source = (char*)malloc(CONFIG_SOURCE_SIZE);
+  if (config->source == NULL) {
+    fclose(fp);
+    QUICK_ERROR(error, 500, "failed allocating read buffer");
+    return;
+  }
+
+  memset(config->source, 0, CONFIG_SOURCE_SIZE);
+  ssize_t bytesRead = readAll(fp, config->source, CONFIG_SOURCE_SIZE - 1);
+  fclose(fp);
+  if (bytesRead < 0) {
+    QUICK_ERROR2(error, 500, "cannot read config file \"%s\"", path);
+    return;
+  }
+
+  config->program = pl2b_parse(config->source, CONFIG_PARSE_SIZE, error);
+  if (isError(error)) {
+    wrapConfigError(error, "parse", path);
+    return;
+  }
+
+  pl2b_runWithLanguage(&config->program, getCfgLanguage(), config, error);
+  if (!isError(error)) {
+    addDefaultListener(config, error);
+  }
+  if (!isError(error)) {
+    buildHostTable(config, error);
+  }
+  if (isError(error)) {
+    wrapConfigError(error, "evaluate", path);
+  }
+}
+
+const VirtualHost *findVirtualHost(const Config *config, const char *host) {
+  const VirtualHost *defaultHost =
+    (const VirtualHost*)ccVecNth(&config->hosts, 0);
+  if (config->hostTableSize == 0 || host == NULL) {
+    return defaultHost;
+  }
+
+  size_t len = hostNameLength(host);
+  size_t mask = config->hostTableSize - 1;
+  for (size_t i = hashHostName(host, len) & mask;
+       config->hostTable[i].name != NULL;
+       i = (i + 1) & mask) {
+    const char *name = config->hostTable[i].name;
+    size_t j = 0;
+    while (j < len && name[j] == tolower((unsigned char)host[j])) {
+      j++;
+    }
+    if (j == len && name[len] == '\0') {
+      return (const VirtualHost*)ccVecNth(&config->hosts,
+                                          config->hostTable[i].host);
+    }
+  }
+  return defaultHost;
 }
 
+/* listen-address and listen-port, unless there are "listen" lines */
+static void addDefaultListener(Config *config, Error *error) {
+  if (ccVecLen(&config->listeners) != 0) {
+    if (strcmp(config->address, DEFAULT_ADDRESS)
+        || config->port != DEFAULT_PORT) {
+      LOG_WARN("listen-address and listen-port are ignored along with "
+               "listen");
+    }
+    return;
+  }
+
+  SockAddress listener;
+  memset(&listener, 0, sizeof(listener));
+  struct sockaddr_in *in = (struct sockaddr_in*)&listener.addr;
+  if (inet_aton(config->address, &in->sin_addr) == 0) {
+    QUICK_ERROR2(error, 500,
+                 "invalid listening address: %s", config->address);
+    return;
+  }
+  in->sin_family = AF_INET;
+  in->sin_port = htons((uint16_t)config->port);
+  listener.addrLen = sizeof(struct sockaddr_in);
+  ccVecPushBack(&config->listeners, &listener);
+}
+
+static void buildHostTable(Config *config, Error *error) {
+  size_t count = ccVecLen(&config->serverNames);
+  if (count == 0) {
+    return;
+  }
+
+  /* at most half full, so that probes stay short */
+  size_t size = HOST_TABLE_MIN;
+  while (size < 2 * count) {
+    size *= 2;
+  }
+  config->hostTable = (HostSlot*)calloc(size, sizeof(HostSlot));
+  if (config->hostTable == NULL) {
+    QUICK_ERROR(error, 500, "failed allocating host table");
+    return;
+  }
+  config->hostTableSize = size;
+
+  for (size_t i = 0; i < count; i++) {
+    const HostSlot *entry =
+      (const HostSlot*)ccVecNth(&config->serverNames, i);
+    size_t slot =
+      hashHostName(entry->name, strlen(entry->name)) & (size - 1);
+    while (config->hostTable[slot].name != NULL) {
+      slot = (slot + 1) & (size - 1);
+    }
+    config->hostTable[slot] = *entry;
+  }
+}
+
+/* "Example.COM.:8080" names "example.com", as does "example.com" */
+static size_t hostNameLength(const char *host) {
+  size_t len;
+  if (host[0] == '[') {
+    const char *end = strchr(host, ']');
+    len = end != NULL ? (size_t)(end - host) + 1 : strlen(host);
+  } else {
+    len = strcspn(host, ":");
+  }
+  while (len > 0
+         && (host[len - 1] == '.' || host[len - 1] == ' '
+             || host[len - 1] == '\t')) {
+    len--;
+  }
+  return len;
+}
+
+/* FNV-1a over the name in lower case */
+static size_t hashHostName(const char *host, size_t len) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ (unsigned char)tolower((unsigned char)host[i]))
+           * 1099511628211ull;
+  }
+  return (size_t)(hash ^ (hash >> 32));
+}
+
+static void wrapConfigError(Error *error,
+                            const char *action,
+                            const char *path) {
+  char reason[512];
+  snprintf(reason, sizeof(reason), "%s", error->errorBuffer);
+  formatError(error, error->sourceInfo, error->errCode,
+              "cannot %s config file \"%s\": %d: %s",
+              action, path, error->errCode, reason);
+}
+
+static pl2b_Cmd *configListen(pl2b_Program *program,
+                              void *context,
+                              pl2b_Cmd *command,
+                              Error *error);
+
 static pl2b_Cmd* configAddr(pl2b_Program *program,
                             void *context,
                             pl2b_Cmd *command,
@@ -80,6 +359,126 @@ static pl2b_Cmd *configCacheTime(pl2b_Program *program,
                                  pl2b_Cmd *command,
                                  Error *error);
 
+static pl2b_Cmd *configServerTiming(pl2b_Program *program,
+                                    void *context,
+                                    pl2b_Cmd *command,
+                                    Error *error);
+
+static pl2b_Cmd *configTimeout(pl2b_Program *program,
+                               void *context,
+                               pl2b_Cmd *command,
+                               Error *error);
+
+static pl2b_Cmd *configMaxConns(pl2b_Program *program,
+                                void *context,
+                                pl2b_Cmd *command,
+                                Error *error);
+
+static pl2b_Cmd *configIsolateDyn(pl2b_Program *program,
+                                  void *context,
+                                  pl2b_Cmd *command,
+                                  Error *error);
+
+static pl2b_Cmd *configDcgiWorkers(pl2b_Program *program,
+                                   void *context,
+                                   pl2b_Cmd *command,
+                                   Error *error);
+
+static pl2b_Cmd *configFcgiConns(pl2b_Program *program,
+                                 void *context,
+                                 pl2b_Cmd *command,
+                                 Error *error);
+
+static pl2b_Cmd *configFcgiMpx(pl2b_Program *program,
+                               void *context,
+                               pl2b_Cmd *command,
+                               Error *error);
+
+static pl2b_Cmd *configMaxBodySize(pl2b_Program *program,
+                                   void *context,
+                                   pl2b_Cmd *command,
+                                   Error *error);
+
+static pl2b_Cmd *configLogLevel(pl2b_Program *program,
+                                void *context,
+                                pl2b_Cmd *command,
+                                Error *error);
+
+static pl2b_Cmd *configLogFile(pl2b_Program *program,
+                               void *context,
+                               pl2b_Cmd *command,
+                               Error *error);
+
+static pl2b_Cmd *configAccessLog(pl2b_Program *program,
+                                 void *context,
+                                 pl2b_Cmd *command,
+                                 Error *error);
+
+static pl2b_Cmd *configAccessLogSize(pl2b_Program *program,
+                                     void *context,
+                                     pl2b_Cmd *command,
+                                     Error *error);
+
+static pl2b_Cmd *configAccessLogKeep(pl2b_Program *program,
+                                     void *context,
+                                     pl2b_Cmd *command,
+                                     Error *error);
+
+static pl2b_Cmd *addUpstream(pl2b_Program *program,
+                             void *context,
+                             pl2b_Cmd *command,
+                             Error *error);
+
+static pl2b_Cmd *configUpstreamBalance(pl2b_Program *program,
+                                       void *context,
+                                       pl2b_Cmd *command,
+                                       Error *error);
+
+static pl2b_Cmd *configUpstreamKeepAlive(pl2b_Program *program,
+                                         void *context,
+                                         pl2b_Cmd *command,
+                                         Error *error);
+
+static pl2b_Cmd *configWorkerProcs(pl2b_Program *program,
+                                   void *context,
+                                   pl2b_Cmd *command,
+                                   Error *error);
+
+static pl2b_Cmd *configReusePort(pl2b_Program *program,
+                                 void *context,
+                                 pl2b_Cmd *command,
+                                 Error *error);
+
+static pl2b_Cmd *configCpuAffinity(pl2b_Program *program,
+                                   void *context,
+                                   pl2b_Cmd *command,
+                                   Error *error);
+
+static pl2b_Cmd *configRateLimit(pl2b_Program *program,
+                                 void *context,
+                                 pl2b_Cmd *command,
+                                 Error *error);
+
+static pl2b_Cmd *configRouteRateLimit(pl2b_Program *program,
+                                      void *context,
+                                      pl2b_Cmd *command,
+                                      Error *error);
+
+static pl2b_Cmd *configErrorPage(pl2b_Program *program,
+                                 void *context,
+                                 pl2b_Cmd *command,
+                                 Error *error);
+
+static pl2b_Cmd *beginServer(pl2b_Program *program,
+                             void *context,
+                             pl2b_Cmd *command,
+                             Error *error);
+
+static pl2b_Cmd *endServer(pl2b_Program *program,
+                           void *context,
+                           pl2b_Cmd *command,
+                           Error *error);
+
 static pl2b_Cmd *addRoute(pl2b_Program *program,
                           void *context,
                           pl2b_Cmd *command,
@@ -92,12 +491,44 @@ static pl2b_Cmd *addCorsConfig(pl2b_Program *program,
 
 const pl2b_Language *getCfgLanguage(void) {
   static pl2b_PCallCmd pCallCmds[] = {
+    { "listen",         NULL, configListen,     0, 0 },
     { "listen-address", NULL, configAddr,       0, 0 },
     { "listen-port",    NULL, configPort,       0, 0 },
     { "max-pending",    NULL, configPend,       0, 0 },
     { "preload",        NULL, configPreloadDyn, 0, 0 },
     { "ignore-case",    NULL, configIgnoreCase, 0, 0 },
     { "cache-time",     NULL, configCacheTime,  0, 0 },
+    { "dcgi-isolate",   NULL, configIsolateDyn, 0, 0 },
+    { "dcgi-workers",   NULL, configDcgiWorkers, 0, 0 },
+    { "dcgi-timeout",   NULL, configTimeout,    0, 0 },
+    { "fcgi-connections", NULL, configFcgiConns, 0, 0 },
+    { "fcgi-multiplex", NULL, configFcgiMpx,    0, 0 },
+    { "max-body-size",  NULL, configMaxBodySize, 0, 0 },
+    { "log-level",      NULL, configLogLevel,   0, 0 },
+    { "log-file",       NULL, configLogFile,    0, 0 },
+    { "access-log",     NULL, configAccessLog,  0, 0 },
+    { "access-log-segment-size", NULL, configAccessLogSize, 0, 0 },
+    { "access-log-keep", NULL, configAccessLogKeep, 0, 0 },
+    { "server-timing",  NULL, configServerTiming, 0, 0 },
+    { "idle-timeout",   NULL, configTimeout,    0, 0 },
+    { "header-timeout", NULL, configTimeout,    0, 0 },
+    { "body-timeout",   NULL, configTimeout,    0, 0 },
+    { "write-timeout",  NULL, configTimeout,    0, 0 },
+    { "upstream-timeout", NULL, configTimeout,  0, 0 },
+    { "shutdown-timeout", NULL, configTimeout,  0, 0 },
+    { "max-connections", NULL, configMaxConns,  0, 0 },
+    { "max-connections-per-ip", NULL, configMaxConns, 0, 0 },
+    { "worker-processes", NULL, configWorkerProcs, 0, 0 },
+    { "reuse-port",     NULL, configReusePort,  0, 0 },
+    { "cpu-affinity",   NULL, configCpuAffinity, 0, 0 },
+    { "rate-limit",     NULL, configRateLimit,  0, 0 },
+    { "route-rate-limit", NULL, configRouteRateLimit, 0, 0 },
+    { "error-page",     NULL, configErrorPage,  0, 0 },
+    { "upstream",       NULL, addUpstream,      0, 0 },
+    { "upstream-balance", NULL, configUpstreamBalance, 0, 0 },
+    { "upstream-keepalive", NULL, configUpstreamKeepAlive, 0, 0 },
+    { "server",         NULL, beginServer,      0, 0 },
+    { "}",              NULL, endServer,        0, 0 },
     { "post",           NULL, addRoute,         0, 0 },
     { "POST",           NULL, addRoute,         0, 0 },
     { "Post",           NULL, addRoute,         0, 0 },
@@ -120,6 +551,47 @@ const pl2b_Language *getCfgLanguage(void) {
   return &language;
 }
 
+static pl2b_Cmd *configListen(pl2b_Program *program,
+                              void *context,
+                              pl2b_Cmd *command,
+                              Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) != 1) {
+    formatError(error, command->sourceInfo, -1,
+                "listen: expects exactly one argument");
+    return NULL;
+  }
+  if (ccVecLen(&config->listeners) >= MAX_LISTENERS) {
+    formatError(error, command->sourceInfo, -1,
+                "listen: at most %d listeners are supported",
+                MAX_LISTENERS);
+    return NULL;
+  }
+
+  SockAddress listener;
+  parseSockAddress(command->args[0].str, &listener, error);
+  if (isError(error)) {
+    error->sourceInfo = command->sourceInfo;
+    return NULL;
+  }
+  for (size_t i = 0; i < ccVecLen(&config->listeners); i++) {
+    const SockAddress *other =
+      (const SockAddress*)ccVecNth(&config->listeners, i);
+    if (sameSockAddress((const struct sockaddr*)&other->addr,
+                        (const struct sockaddr*)&listener.addr)) {
+      formatError(error, command->sourceInfo, -1,
+                  "listen: already listening on %s",
+                  command->args[0].str);
+      return NULL;
+    }
+  }
+
+  ccVecPushBack(&config->listeners, &listener);
+  return command->next;
+}
+
 static pl2b_Cmd* configAddr(pl2b_Program *program,
                             void *context,
                             pl2b_Cmd *command,
@@ -167,6 +639,44 @@ static pl2b_Cmd *configIntAttr(pl2b_Program *program,
   return command->next;
 }
 
+/* plain bytes, or with a k/m/g suffix */
+static pl2b_Cmd *configSizeAttr(pl2b_Program *program,
+                                size_t *dest,
+                                pl2b_Cmd *command,
+                                Error *error) {
+  (void)program;
+
+  if (pl2b_argsLen(command) != 1) {
+    formatError(error, command->sourceInfo, -1,
+                "%s: expects exactly one argument",
+                command->cmd.str);
+    return NULL;
+  }
+
+  const char *str = command->args[0].str;
+  char *end = NULL;
+  errno = 0;
+  unsigned long long value = strtoull(str, &end, 10);
+  unsigned long long unit = 1;
+  switch (*end) {
+  case 'k': case 'K': unit = 1024ull; end++; break;
+  case 'm': case 'M': unit = 1024ull * 1024; end++; break;
+  case 'g': case 'G': unit = 1024ull * 1024 * 1024; end++; break;
+  }
+
+  if (!isdigit(*str) || errno == ERANGE || *end != '\0'
+      || value == 0 || value > SSIZE_MAX / unit) {
+    formatError(error, command->sourceInfo, -1,
+                "%s: invalid value: %s",
+                command->cmd.str,
+                str);
+    return NULL;
+  }
+
+  *dest = (size_t)(value * unit);
+  return command->next;
+}
+
 static pl2b_Cmd *configBoolAttr(pl2b_Program *program,
                                 _Bool *dest,
                                 pl2b_Cmd *command,
@@ -244,6 +754,63 @@ static pl2b_Cmd *configIgnoreCase(pl2b_Program *program,
                         error);
 }
 
+static pl2b_Cmd *configServerTiming(pl2b_Program *program,
+                                    void *context,
+                                    pl2b_Cmd *command,
+                                    Error *error) {
+  Config *config = (Config*)context;
+  return configBoolAttr(program,
+                        &config->serverTiming,
+                        command,
+                        error);
+}
+
+static pl2b_Cmd *configTimeout(pl2b_Program *program,
+                               void *context,
+                               pl2b_Cmd *command,
+                               Error *error) {
+  Config *config = (Config*)context;
+  int *dest;
+  if (!strcmp(command->cmd.str, "idle-timeout")) {
+    dest = &config->idleTimeout;
+  } else if (!strcmp(command->cmd.str, "header-timeout")) {
+    dest = &config->headerTimeout;
+  } else if (!strcmp(command->cmd.str, "body-timeout")) {
+    dest = &config->bodyTimeout;
+  } else if (!strcmp(command->cmd.str, "shutdown-timeout")) {
+    dest = &config->shutdownTimeout;
+  } else if (!strcmp(command->cmd.str, "dcgi-timeout")) {
+    dest = &config->dcgiTimeout;
+  } else if (!strcmp(command->cmd.str, "upstream-timeout")) {
+    dest = &config->upstreamTimeout;
+  } else {
+    dest = &config->writeTimeout;
+  }
+
+  return configIntAttr(program,
+                       dest,
+                       command,
+                       error,
+                       -1,
+                       MAX_TIMEOUT + 1);
+}
+
+static pl2b_Cmd *configMaxConns(pl2b_Program *program,
+                                void *context,
+                                pl2b_Cmd *command,
+                                Error *error) {
+  Config *config = (Config*)context;
+  int *dest = !strcmp(command->cmd.str, "max-connections")
+              ? &config->maxConnections
+              : &config->maxConnectionsPerIp;
+  return configIntAttr(program,
+                       dest,
+                       command,
+                       error,
+                       -1,
+                       INT_MIN);
+}
+
 static pl2b_Cmd *configCacheTime(pl2b_Program *program,
                                  void *context,
                                  pl2b_Cmd *command,
@@ -257,6 +824,556 @@ static pl2b_Cmd *configCacheTime(pl2b_Program *program,
                        31536000);
 }
 
+static pl2b_Cmd *configIsolateDyn(pl2b_Program *program,
+                                  void *context,
+                                  pl2b_Cmd *command,
+                                  Error *error) {
+  Config *config = (Config*)context;
+  return configBoolAttr(program,
+                        &config->isolateDynamic,
+                        command,
+                        error);
+}
+
+static pl2b_Cmd *configDcgiWorkers(pl2b_Program *program,
+                                   void *context,
+                                   pl2b_Cmd *command,
+                                   Error *error) {
+  Config *config = (Config*)context;
+  return configIntAttr(program,
+                       &config->dcgiWorkers,
+                       command,
+                       error,
+                       0,
+                       1025);
+}
+
+static pl2b_Cmd *configFcgiConns(pl2b_Program *program,
+                                 void *context,
+                                 pl2b_Cmd *command,
+                                 Error *error) {
+  Config *config = (Config*)context;
+  return configIntAttr(program,
+                       &config->fcgiMaxConns,
+                       command,
+                       error,
+                       0,
+                       FCGI_MAX_CONNS + 1);
+}
+
+static pl2b_Cmd *configFcgiMpx(pl2b_Program *program,
+                               void *context,
+                               pl2b_Cmd *command,
+                               Error *error) {
+  Config *config = (Config*)context;
+  return configIntAttr(program,
+                       &config->fcgiMaxMpx,
+                       command,
+                       error,
+                       0,
+                       FCGI_MAX_MPX + 1);
+}
+
+static pl2b_Cmd *configMaxBodySize(pl2b_Program *program,
+                                   void *context,
+                                   pl2b_Cmd *command,
+                                   Error *error) {
+  Config *config = (Config*)context;
+  return configSizeAttr(program,
+                        &config->maxBodySize,
+                        command,
+                        error);
+}
+
+static pl2b_Cmd *configLogLevel(pl2b_Program *program,
+                                void *context,
+                                pl2b_Cmd *command,
+                                Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) != 1) {
+    formatError(error, command->sourceInfo, -1,
+                "log-level: expects exactly one argument");
+    return NULL;
+  }
+
+  if (!parseLogLevel(command->args[0].str, &config->logLevel)) {
+    formatError(error, command->sourceInfo, -1,
+                "log-level: expects 'debug', 'info', 'warn', 'error' "
+                "or 'fatal'");
+    return NULL;
+  }
+  return command->next;
+}
+
+static pl2b_Cmd *configLogFile(pl2b_Program *program,
+                               void *context,
+                               pl2b_Cmd *command,
+                               Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) != 1) {
+    formatError(error, command->sourceInfo, -1,
+                "log-file: expects exactly one argument");
+    return NULL;
+  }
+
+  config->logFile = command->args[0].str;
+  return command->next;
+}
+
+static pl2b_Cmd *configAccessLog(pl2b_Program *program,
+                                 void *context,
+                                 pl2b_Cmd *command,
+                                 Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) != 1) {
+    formatError(error, command->sourceInfo, -1,
+                "access-log: expects exactly one argument");
+    return NULL;
+  }
+
+  config->accessLog = command->args[0].str;
+  return command->next;
+}
+
+static pl2b_Cmd *configAccessLogSize(pl2b_Program *program,
+                                     void *context,
+                                     pl2b_Cmd *command,
+                                     Error *error) {
+  Config *config = (Config*)context;
+  return configSizeAttr(program,
+                        &config->accessLogSegmentSize,
+                        command,
+                        error);
+}
+
+static pl2b_Cmd *configAccessLogKeep(pl2b_Program *program,
+                                     void *context,
+                                     pl2b_Cmd *command,
+                                     Error *error) {
+  Config *config = (Config*)context;
+  return configIntAttr(program,
+                       &config->accessLogKeep,
+                       command,
+                       error,
+                       -1,
+                       65536);
+}
+
+static FCGIUpstream *findFCGIUpstream(Config *config,
+                                      const char *address) {
+  for (size_t i = 0; i < ccVecLen(&config->fcgiUpstreams); i++) {
+    FCGIUpstream *upstream =
+      *(FCGIUpstream**)ccVecNth(&config->fcgiUpstreams, i);
+    if (!strcmp(fcgiUpstreamAddress(upstream), address)) {
+      return upstream;
+    }
+  }
+  return NULL;
+}
+
+static ProxyUpstream *findUpstream(Config *config, const char *name) {
+  for (size_t i = 0; i < ccVecLen(&config->proxyUpstreams); i++) {
+    ProxyUpstream *upstream =
+      *(ProxyUpstream**)ccVecNth(&config->proxyUpstreams, i);
+    if (!strcmp(proxyUpstreamName(upstream), name)) {
+      return upstream;
+    }
+  }
+  return NULL;
+}
+
+static pl2b_Cmd *addUpstream(pl2b_Program *program,
+                             void *context,
+                             pl2b_Cmd *command,
+                             Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) < 2) {
+    formatError(error, command->sourceInfo, -1,
+                "upstream: expects a name and at least one address");
+    return NULL;
+  }
+
+  const char *name = command->args[0].str;
+  ProxyUpstream *upstream = findUpstream(config, name);
+  if (upstream == NULL) {
+    upstream = createProxyUpstream(name, error);
+    if (isError(error)) {
+      return NULL;
+    }
+    ccVecPushBack(&config->proxyUpstreams, &upstream);
+  }
+
+  for (uint16_t i = 1; i < pl2b_argsLen(command); i++) {
+    addProxyServer(upstream, command->args[i].str, error);
+    if (isError(error)) {
+      error->sourceInfo = command->sourceInfo;
+      return NULL;
+    }
+  }
+
+  return command->next;
+}
+
+static pl2b_Cmd *configUpstreamBalance(pl2b_Program *program,
+                                       void *context,
+                                       pl2b_Cmd *command,
+                                       Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) != 2) {
+    formatError(error, command->sourceInfo, -1,
+                "upstream-balance: expects exactly two arguments");
+    return NULL;
+  }
+
+  ProxyUpstream *upstream = findUpstream(config, command->args[0].str);
+  if (upstream == NULL) {
+    formatError(error, command->sourceInfo, -1,
+                "upstream-balance: unknown upstream: %s",
+                command->args[0].str);
+    return NULL;
+  }
+
+  const char *balance = command->args[1].str;
+  if (strcmp_icase(balance, "round-robin")) {
+    setProxyBalance(upstream, PROXY_ROUND_ROBIN);
+  } else if (strcmp_icase(balance, "least-conn")) {
+    setProxyBalance(upstream, PROXY_LEAST_CONN);
+  } else {
+    formatError(error, command->sourceInfo, -1,
+                "upstream-balance: expects 'round-robin' or 'least-conn'");
+    return NULL;
+  }
+
+  return command->next;
+}
+
+static pl2b_Cmd *configUpstreamKeepAlive(pl2b_Program *program,
+                                         void *context,
+                                         pl2b_Cmd *command,
+                                         Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) != 2) {
+    formatError(error, command->sourceInfo, -1,
+                "upstream-keepalive: expects exactly two arguments");
+    return NULL;
+  }
+
+  ProxyUpstream *upstream = findUpstream(config, command->args[0].str);
+  if (upstream == NULL) {
+    formatError(error, command->sourceInfo, -1,
+                "upstream-keepalive: unknown upstream: %s",
+                command->args[0].str);
+    return NULL;
+  }
+
+  int maxIdle = atoi(command->args[1].str);
+  if (maxIdle < 0) {
+    formatError(error, command->sourceInfo, -1,
+                "upstream-keepalive: invalid value: %s",
+                command->args[1].str);
+    return NULL;
+  }
+  setProxyKeepAlive(upstream, maxIdle);
+
+  return command->next;
+}
+
+static pl2b_Cmd *configWorkerProcs(pl2b_Program *program,
+                                   void *context,
+                                   pl2b_Cmd *command,
+                                   Error *error) {
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) == 1
+      && strcmp_icase(command->args[0].str, "auto")) {
+    config->workerProcesses = WORKER_PROCESSES_AUTO;
+    return command->next;
+  }
+  return configIntAttr(program,
+                       &config->workerProcesses,
+                       command,
+                       error,
+                       0,
+                       MAX_WORKER_PROCESSES + 1);
+}
+
+static pl2b_Cmd *configReusePort(pl2b_Program *program,
+                                 void *context,
+                                 pl2b_Cmd *command,
+                                 Error *error) {
+  Config *config = (Config*)context;
+  return configBoolAttr(program,
+                        &config->reusePort,
+                        command,
+                        error);
+}
+
+static pl2b_Cmd *configCpuAffinity(pl2b_Program *program,
+                                   void *context,
+                                   pl2b_Cmd *command,
+                                   Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) != 1) {
+    formatError(error, command->sourceInfo, -1,
+                "cpu-affinity: expects exactly one argument");
+    return NULL;
+  }
+
+  const char *affinity = command->args[0].str;
+  if (strcmp_icase(affinity, "none")) {
+    config->cpuAffinity = CPU_AFFINITY_NONE;
+  } else if (strcmp_icase(affinity, "cpu")) {
+    config->cpuAffinity = CPU_AFFINITY_CPU;
+  } else if (strcmp_icase(affinity, "node")) {
+    config->cpuAffinity = CPU_AFFINITY_NODE;
+  } else {
+    formatError(error, command->sourceInfo, -1,
+                "cpu-affinity: expects 'none', 'cpu' or 'node'");
+    return NULL;
+  }
+  return command->next;
+}
+
+/* RATE is a count per second, or per minute or hour as in 10/m */
+static _Bool parseRateLimit(const char *rateStr,
+                            const char *burstStr,
+                            RateLimit *dest) {
+  char *end;
+  unsigned long rate = strtoul(rateStr, &end, 10);
+  uint64_t periodNs = 1000000000ull;
+  if (!strcmp(end, "/m")) {
+    periodNs *= 60;
+  } else if (!strcmp(end, "/h")) {
+    periodNs *= 3600;
+  } else if (*end != '\0' && strcmp(end, "/s")) {
+    return 0;
+  }
+
+  int burst = atoi(burstStr);
+  if (!isdigit(*rateStr) || rate == 0 || rate > 1000000
+      || burst <= 0 || burst > 1000000) {
+    return 0;
+  }
+
+  dest->intervalNs = periodNs / rate;
+  dest->burst = (uint32_t)burst;
+  return 1;
+}
+
+static pl2b_Cmd *configRateLimit(pl2b_Program *program,
+                                 void *context,
+                                 pl2b_Cmd *command,
+                                 Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) != 2) {
+    formatError(error, command->sourceInfo, -1,
+                "rate-limit: expects exactly two arguments");
+    return NULL;
+  }
+
+  if (!parseRateLimit(command->args[0].str,
+                      command->args[1].str,
+                      &config->rateLimit)) {
+    formatError(error, command->sourceInfo, -1,
+                "rate-limit: invalid rate or burst: %s %s",
+                command->args[0].str,
+                command->args[1].str);
+    return NULL;
+  }
+
+  return command->next;
+}
+
+static pl2b_Cmd *configRouteRateLimit(pl2b_Program *program,
+                                      void *context,
+                                      pl2b_Cmd *command,
+                                      Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) != 3) {
+    formatError(error, command->sourceInfo, -1,
+                "route-rate-limit: expects exactly three arguments");
+    return NULL;
+  }
+
+  RateLimit rateLimit;
+  if (!parseRateLimit(command->args[1].str,
+                      command->args[2].str,
+                      &rateLimit)) {
+    formatError(error, command->sourceInfo, -1,
+                "route-rate-limit: invalid rate or burst: %s %s",
+                command->args[1].str,
+                command->args[2].str);
+    return NULL;
+  }
+
+  /* applies to every method routed on the path, in this server block */
+  const char *path = command->args[0].str;
+  const VirtualHost *host =
+    (const VirtualHost*)ccVecNth(&config->hosts, config->currentHost);
+  _Bool found = 0;
+  for (size_t i = 0; i < ccVecLen(&host->routes); i++) {
+    size_t index = *(size_t*)ccVecNth(&host->routes, i);
+    Route *route = (Route*)ccVecNth(&config->routes, index);
+    if (!strcmp(route->path, path)) {
+      route->rateLimit = rateLimit;
+      found = 1;
+    }
+  }
+  if (!found) {
+    formatError(error, command->sourceInfo, -1,
+                "route-rate-limit: no route for path \"%s\"",
+                path);
+    return NULL;
+  }
+
+  return command->next;
+}
+
+static pl2b_Cmd *configErrorPage(pl2b_Program *program,
+                                 void *context,
+                                 pl2b_Cmd *command,
+                                 Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) != 2) {
+    formatError(error, command->sourceInfo, -1,
+                "error-page: expects exactly two arguments");
+    return NULL;
+  }
+
+  const char *codeStr = command->args[0].str;
+  char *end;
+  long code = strtol(codeStr, &end, 10);
+  if (end == codeStr || *end != '\0' || !hasErrorPage((int)code)) {
+    formatError(error, command->sourceInfo, -1,
+                "error-page: not a pre-rendered error page: %s",
+                codeStr);
+    return NULL;
+  }
+
+  ErrorPageConfig pageConfig;
+  pageConfig.code = (int)code;
+  pageConfig.path = command->args[1].str;
+  ccVecPushBack(&config->errorPages, &pageConfig);
+
+  return command->next;
+}
+
+static _Bool allowedInServer(const pl2b_Cmd *command) {
+  const char *name = command->cmd.str;
+  return strcmp_icase(name, "get")
+         || strcmp_icase(name, "post")
+         || !strcmp(name, "route-rate-limit");
+}
+
+static pl2b_Cmd *beginServer(pl2b_Program *program,
+                             void *context,
+                             pl2b_Cmd *command,
+                             Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  uint16_t argc = pl2b_argsLen(command);
+  if (argc < 2 || strcmp(command->args[argc - 1].str, "{")) {
+    formatError(error, command->sourceInfo, -1,
+                "server: expects host names followed by '{'");
+    return NULL;
+  }
+  if (config->currentHost != 0) {
+    formatError(error, command->sourceInfo, -1,
+                "server: blocks cannot be nested");
+    return NULL;
+  }
+
+  /* settings inside would apply to every host, so only routes go in */
+  const pl2b_Cmd *inner = command->next;
+  for (; inner != NULL && strcmp(inner->cmd.str, "}"); inner = inner->next) {
+    if (!allowedInServer(inner)) {
+      formatError(error, inner->sourceInfo, -1,
+                  "%s: not allowed inside a server block",
+                  inner->cmd.str);
+      return NULL;
+    }
+  }
+  if (inner == NULL) {
+    formatError(error, command->sourceInfo, -1,
+                "server: block is not closed");
+    return NULL;
+  }
+
+  VirtualHost host;
+  host.name = command->args[0].str;
+  ccVecInit(&host.routes, sizeof(size_t));
+  ccVecPushBack(&config->hosts, &host);
+  config->currentHost = ccVecLen(&config->hosts) - 1;
+
+  /* names are kept the way findVirtualHost compares them */
+  for (uint16_t i = 0; i + 1 < argc; i++) {
+    char *name = command->args[i].str;
+    name[hostNameLength(name)] = '\0';
+    for (char *p = name; *p != '\0'; p++) {
+      *p = (char)tolower((unsigned char)*p);
+    }
+    if (*name == '\0') {
+      formatError(error, command->sourceInfo, -1,
+                  "server: invalid host name: %s",
+                  command->args[i].str);
+      return NULL;
+    }
+
+    for (size_t j = 0; j < ccVecLen(&config->serverNames); j++) {
+      const HostSlot *other =
+        (const HostSlot*)ccVecNth(&config->serverNames, j);
+      if (!strcmp(other->name, name)) {
+        formatError(error, command->sourceInfo, -1,
+                    "server: host \"%s\" already has a block",
+                    name);
+        return NULL;
+      }
+    }
+    HostSlot entry;
+    entry.name = name;
+    entry.host = config->currentHost;
+    ccVecPushBack(&config->serverNames, &entry);
+  }
+
+  return command->next;
+}
+
+static pl2b_Cmd *endServer(pl2b_Program *program,
+                           void *context,
+                           pl2b_Cmd *command,
+                           Error *error) {
+  (void)program;
+
+  Config *config = (Config*)context;
+  if (pl2b_argsLen(command) != 0 || config->currentHost == 0) {
+    formatError(error, command->sourceInfo, -1,
+                "}: does not close a server block");
+    return NULL;
+  }
+  config->currentHost = 0;
+  return command->next;
+}
+
 static pl2b_Cmd* addRoute(pl2b_Program *program,
                           void *context,
                           pl2b_Cmd *command,
@@ -289,6 +1406,12 @@ static pl2b_Cmd* addRoute(pl2b_Program *program,
   } else if (strcmp_icase(handlerTypeStr,
                           HANDLER_TYPE_NAMES[HDLR_DIR])) {
     handlerType = HDLR_DIR;
+  } else if (strcmp_icase(handlerTypeStr,
+                          HANDLER_TYPE_NAMES[HDLR_FCGI])) {
+    handlerType = HDLR_FCGI;
+  } else if (strcmp_icase(handlerTypeStr,
+                          HANDLER_TYPE_NAMES[HDLR_PROXY])) {
+    handlerType = HDLR_PROXY;
   } else {
     formatError(error, command->sourceInfo, -1,
                 "%s: incorrect handler type: %s",
@@ -297,9 +1420,11 @@ static pl2b_Cmd* addRoute(pl2b_Program *program,
   }
 
   const char *path = command->args[0].str;
-  size_t routeCount = ccVecSize(&config->routes);
-  for (size_t i = 0; i < routeCount; i++) {
-    Route *route = (Route*)ccVecNth(&config->routes, i);
+  VirtualHost *host =
+    (VirtualHost*)ccVecNth(&config->hosts, config->currentHost);
+  for (size_t i = 0; i < ccVecLen(&host->routes); i++) {
+    size_t index = *(size_t*)ccVecNth(&host->routes, i);
+    Route *route = (Route*)ccVecNth(&config->routes, index);
     if (!strcmp(route->path, path) && route->httpMethod == method) {
       formatError(error, command->sourceInfo, -1,
                   "%s: handler for path \"%s\" already exists",
@@ -315,6 +1440,8 @@ static pl2b_Cmd* addRoute(pl2b_Program *program,
   route.path = path;
   route.handlerType = handlerType;
   route.handlerPath = handler;
+  route.rateLimit = (RateLimit) { 0, 0 };
+  route.host = host->name;
 
   if (route.handlerType == HDLR_DCGI && config->preloadDynamic != 0) {
     LOG_DBG("preloading dynamic library \"%s\"", route.handlerPath);
@@ -322,11 +1449,42 @@ static pl2b_Cmd* addRoute(pl2b_Program *program,
     if (isError(error)) {
       return NULL;
     }
+  } else if (route.handlerType == HDLR_FCGI) {
+    FCGIUpstream *upstream = findFCGIUpstream(config, route.handlerPath);
+    if (upstream == NULL) {
+      upstream = createFCGIUpstream(route.handlerPath,
+                                    config->fcgiMaxConns,
+                                    config->fcgiMaxMpx,
+                                    error);
+      if (isError(error)) {
+        return NULL;
+      }
+      ccVecPushBack(&config->fcgiUpstreams, &upstream);
+    }
+    route.extra = upstream;
+  } else if (route.handlerType == HDLR_PROXY) {
+    ProxyUpstream *upstream = findUpstream(config, route.handlerPath);
+    if (upstream == NULL) {
+      /* a bare address stands for a single-server upstream */
+      upstream = createProxyUpstream(route.handlerPath, error);
+      if (isError(error)) {
+        return NULL;
+      }
+      ccVecPushBack(&config->proxyUpstreams, &upstream);
+      addProxyServer(upstream, route.handlerPath, error);
+      if (isError(error)) {
+        error->sourceInfo = command->sourceInfo;
+        return NULL;
+      }
+    }
+    route.extra = upstream;
   } else {
     route.extra = NULL;
   }
 
+  size_t index = ccVecLen(&config->routes);
   ccVecPushBack(&config->routes, &route);
+  ccVecPushBack(&host->routes, &index);
 
   return command->next;
 }
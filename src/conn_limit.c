@@ -0,0 +1,123 @@
+#include "conn_limit.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+typedef struct st_client_count {
+  struct st_client_count *next;
+  size_t count;
+  char addr[];
+} ClientCount;
+
+static size_t connLimit;
+static size_t clientLimit;
+static _Atomic size_t active;
+static _Atomic size_t rejected;
+
+static ClientCount *clients[CONN_LIMIT_BUCKETS];
+static pthread_mutex_t clientsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t hashAddr(const char *addr);
+static _Bool acquireClient(const char *addr);
+static void releaseClient(const char *addr);
+
+void initConnLimits(int maxConnections, int maxPerClient) {
+  connLimit = (size_t)maxConnections;
+  clientLimit = (size_t)maxPerClient;
+}
+
+_Bool acquireConnSlot(const char *clientAddr) {
+  size_t count = atomic_fetch_add(&active, 1);
+  if (connLimit != 0 && count >= connLimit) {
+    atomic_fetch_sub(&active, 1);
+    atomic_fetch_add(&rejected, 1);
+    return 0;
+  }
+
+  if (clientLimit != 0 && !acquireClient(clientAddr)) {
+    atomic_fetch_sub(&active, 1);
+    atomic_fetch_add(&rejected, 1);
+    return 0;
+  }
+  return 1;
+}
+
+void releaseConnSlot(const char *clientAddr) {
+  if (clientLimit != 0) {
+    releaseClient(clientAddr);
+  }
+  atomic_fetch_sub(&active, 1);
+}
+
+size_t activeConnections(void) {
+  return atomic_load_explicit(&active, memory_order_relaxed);
+}
+
+size_t rejectedConnections(void) {
+  return atomic_load_explicit(&rejected, memory_order_relaxed);
+}
+
+static size_t hashAddr(const char *addr) {
+  /* FNV-1a */
+  size_t hash = 2166136261u;
+  for (; *addr != '\0'; addr++) {
+    hash = (hash ^ (unsigned char)*addr) * 16777619u;
+  }
+  return hash % CONN_LIMIT_BUCKETS;
+}
+
+static _Bool acquireClient(const char *addr) {
+  size_t bucket = hashAddr(addr);
+  _Bool ret = 1;
+
+  pthread_mutex_lock(&clientsLock);
+  ClientCount *client = clients[bucket];
+  while (client != NULL && strcmp(client->addr, addr) != 0) {
+    client = client->next;
+  }
+
+  if (client == NULL) {
+    size_t len = strlen(addr);
+    client = (ClientCount*)malloc(sizeof(ClientCount) + len + 1);
+    if (client == NULL) {
+      LOG_ERR("failed allocating connection count for %s", addr);
+      ret = 0;
+      goto unlock_ret;
+    }
+    memcpy(client->addr, addr, len + 1);
+    client->count = 0;
+    client->next = clients[bucket];
+    clients[bucket] = client;
+  }
+
+  if (client->count >= clientLimit) {
+    ret = 0;
+  } else {
+    client->count++;
+  }
+
+unlock_ret:
+  pthread_mutex_unlock(&clientsLock);
+  return ret;
+}
+
+static void releaseClient(const char *addr) {
+  size_t bucket = hashAddr(addr);
+
+  pthread_mutex_lock(&clientsLock);
+  ClientCount **link = &clients[bucket];
+  while (*link != NULL && strcmp((*link)->addr, addr) != 0) {
+    link = &(*link)->next;
+  }
+
+  ClientCount *client = *link;
+  if (client != NULL && --client->count == 0) {
+    *link = client->next;
+    free(client);
+  }
+  pthread_mutex_unlock(&clientsLock);
+}
@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+
+#include "conn_stream.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "out_buf.h"
+
+typedef struct st_conn_cookie {
+  int fd;
+  ConnStats *stats;
+  OutBuf out;
+} ConnCookie;
+
+static ssize_t connRead(void *cookie, char *buffer, size_t size);
+static ssize_t connWrite(void *cookie, const char *buffer, size_t size);
+static int connClose(void *cookie);
+
+FILE *openConnStream(int fd,
+                     ConnStats *stats,
+                     const ConnTimeouts *timeouts,
+                     OutBuf **out) {
+  ConnCookie *cookie = (ConnCookie*)malloc(sizeof(ConnCookie));
+  if (cookie == NULL) {
+    return NULL;
+  }
+  cookie->fd = fd;
+  cookie->stats = stats;
+  initOutBuf(&cookie->out, fd, stats);
+  memset(stats, 0, sizeof(ConnStats));
+  stats->timeouts = *timeouts;
+  stats->phase = CONN_PHASE_IDLE;
+  initTimer(&stats->timer, fd);
+
+  cookie_io_functions_t functions = {
+    connRead, connWrite, NULL, connClose
+  };
+  FILE *fp = fopencookie(cookie, "r+", functions);
+  if (fp == NULL) {
+    free(cookie);
+    return NULL;
+  }
+  armTimer(&stats->timer, stats->timeouts.idle, SHUT_RD);
+  *out = &cookie->out;
+  return fp;
+}
+
+void setConnPhase(ConnStats *stats, ConnPhase phase) {
+  stats->phase = phase;
+  if (phase == CONN_PHASE_BODY) {
+    /* body reads arm their own timer */
+    cancelTimer(&stats->timer);
+  }
+}
+
+_Bool connTimedOut(ConnStats *stats) {
+  return atomic_load(&stats->timer.fired);
+}
+
+void setConnHeadHook(ConnStats *stats, ConnHeadHook *hook, void *context) {
+  stats->headHook = hook;
+  stats->headHookContext = context;
+  stats->headHookDone = 0;
+}
+
+static ssize_t connRead(void *cookie, char *buffer, size_t size) {
+  ConnCookie *conn = (ConnCookie*)cookie;
+  ConnStats *stats = conn->stats;
+  _Bool timed = stats->phase == CONN_PHASE_BODY && stats->timeouts.body != 0;
+  if (timed) {
+    armTimer(&stats->timer, stats->timeouts.body, SHUT_RD);
+  }
+
+  ssize_t bytesRead;
+  do {
+    bytesRead = recv(conn->fd, buffer, size, 0);
+  } while (bytesRead < 0 && errno == EINTR);
+
+  if (timed) {
+    cancelTimer(&stats->timer);
+  } else if (stats->phase == CONN_PHASE_IDLE && bytesRead > 0) {
+    /* the header timeout runs from the first byte to the end of head */
+    stats->phase = CONN_PHASE_HEADER;
+    armTimer(&stats->timer, stats->timeouts.header, SHUT_RD);
+  }
+
+  if (bytesRead > 0) {
+    stats->bytesIn += bytesRead;
+  }
+  return bytesRead;
+}
+
+static ssize_t connWrite(void *cookie, const char *buffer, size_t size) {
+  ConnCookie *conn = (ConnCookie*)cookie;
+  outWrite(&conn->out, buffer, size);
+  /* stdio treats 0 as an error for cookie writes */
+  return conn->out.failed ? 0 : (ssize_t)size;
+}
+
+static int connClose(void *cookie) {
+  ConnCookie *conn = (ConnCookie*)cookie;
+  outFlush(&conn->out);
+  /* the timer must not fire on a descriptor number reused elsewhere */
+  cancelTimer(&conn->stats->timer);
+  int ret = close(conn->fd);
+  free(conn);
+  return ret;
+}
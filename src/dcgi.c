@@ -4,6 +4,8 @@
 #include <errno.h>
 #include <string.h>
 #include "config.h"
+#include "dcgi_pool.h"
+#include "http_head.h"
 #include "util.h"
 
 DCGIModule *loadDCGIModule(const char *dcgiLib,
@@ -34,6 +36,7 @@ DCGIModule *loadDCGIModule(const char *dcgiLib,
   }
 
   DCGIModule *module = (DCGIModule*)malloc(sizeof(DCGIModule));
+  module->libHandle = libHandle;
   module->dcgiMain = (DCGIMain*)dcgiMain;
   module->dcgiDealloc = (DCGIDealloc*)dcgiDealloc;
   return module;
@@ -47,11 +50,32 @@ void unloadDCGIModule(DCGIModule *module, Error *error) {
   free(module);
 }
 
+static void writeDCGIResponse(OutBuf *response,
+                              int res,
+                              const StringPair *headerDest,
+                              const char *dataDest);
+static void handleDCGIIsolated(const char *dcgiLib,
+                               int timeout,
+                               HttpRequest *request,
+                               OutBuf *response,
+                               Error *error);
+
 void handleDCGI(const char *dcgiLib,
                 DCGIModule *preloaded,
+                int timeout,
                 HttpRequest *request,
-                FILE *response,
+                OutBuf *response,
                 Error *error) {
+  /* dcgi_main takes the whole body as one string */
+  if (readHttpBodyAll(request, error) == NULL) {
+    return;
+  }
+
+  if (dcgiPoolEnabled()) {
+    handleDCGIIsolated(dcgiLib, timeout, request, response, error);
+    return;
+  }
+
   DCGIModule *module = preloaded;
   if (preloaded == NULL) {
     module = loadDCGIModule(dcgiLib, error);
@@ -80,6 +104,9 @@ void handleDCGI(const char *dcgiLib,
               &dataDest,
               &errDest
             );
+  ccVecPopBack(&request->params);
+  ccVecPopBack(&request->headers);
+
   if (res == 500) {
     if (errDest != NULL) {
       QUICK_ERROR2(error, 500, "error running DCGI function: %s",
@@ -87,40 +114,24 @@ void handleDCGI(const char *dcgiLib,
     } else {
       QUICK_ERROR(error, 500, "error running DCGI function");
     }
-    goto unload_module_ret;
+  } else {
+    writeDCGIResponse(response, res, headerDest, dataDest);
   }
 
-  size_t contentLength = 0;
-  if (dataDest != NULL) {
-    contentLength = strlen(dataDest);
-  }
+  dropDCGIOutput(module, headerDest, dataDest, errDest);
 
-  fprintf(response,
-          "HTTP/1.1 %d %s\r\n"
-          "Content-Encoding: identity\r\n"
-          "Content-Length: %zu\r\n"
-          "Connection: close\r\n"
-          "Server: %s\r\n",
-          res,
-          httpCodeNameSafe(res),
-          contentLength,
-          CHTTPD_SERVER_NAME);
+  if (preloaded == NULL) {
+    unloadDCGIModule(module, error);
+  }
+}
 
+void dropDCGIOutput(const DCGIModule *module,
+                    StringPair *headerDest,
+                    char *dataDest,
+                    char *errDest) {
   size_t headerCount = 0;
-  for (; headerDest[headerCount].first != NULL; headerCount++) {
-    const char *headerKey = headerDest[headerCount].first;
-    const char *headerValue = headerDest[headerCount].second;
-    if (strcmp_icase(headerKey, "Content-Length")) {
-      LOG_WARN("Manually setting \"Content-Length\", ignored");
-    } else if (strcmp_icase(headerKey, "Connection")) {
-      LOG_WARN("Manually setting \"Connection\", ignored");
-    } else {
-      fprintf(response, "%s: %s\r\n", headerKey, headerValue);
-    }
-  }
-  
-  if (dataDest != NULL) {
-    fprintf(response, "\r\n%s", dataDest);
+  while (headerDest != NULL && headerDest[headerCount].first != NULL) {
+    headerCount++;
   }
 
   if (module->dcgiDealloc != NULL) {
@@ -131,34 +142,84 @@ void handleDCGI(const char *dcgiLib,
       dealloc(headerKey, strlen(headerKey) + 1, _Alignof(char));
       dealloc(headerValue, strlen(headerValue) + 1, _Alignof(char));
     }
-    dealloc(headerDest,
-            sizeof(StringPair) * (headerCount + 1),
-            _Alignof(StringPair));
+    if (headerDest) {
+      dealloc(headerDest,
+              sizeof(StringPair) * (headerCount + 1),
+              _Alignof(StringPair));
+    }
     if (dataDest) {
       dealloc(dataDest, strlen(dataDest) + 1, _Alignof(char));
     }
+    if (errDest) {
+      dealloc(errDest, strlen(errDest) + 1, _Alignof(char));
+    }
   } else {
     for (size_t i = 0; i < headerCount; i++) {
       free(headerDest[i].first);
       free(headerDest[i].second);
     }
     free(headerDest);
-    if (dataDest) {
-      free(dataDest);
-    }
+    free(dataDest);
+    free(errDest);
   }
+}
 
-unload_module_ret:
-  if (errDest) {
-    if (module->dcgiDealloc) {
-      module->dcgiDealloc(errDest, strlen(errDest) + 1, _Alignof(char));
+static void handleDCGIIsolated(const char *dcgiLib,
+                               int timeout,
+                               HttpRequest *request,
+                               OutBuf *response,
+                               Error *error) {
+  DCGIResult result;
+  dcgiPoolInvoke(dcgiLib, request, timeout, &result, error);
+  if (isError(error)) {
+    return;
+  }
+
+  if (result.code == 500) {
+    if (result.err != NULL) {
+      QUICK_ERROR2(error, 500, "error running DCGI function: %s",
+                   result.err);
     } else {
-      free(errDest);
+      QUICK_ERROR(error, 500, "error running DCGI function");
     }
+  } else {
+    writeDCGIResponse(response, result.code, result.headers, result.data);
   }
 
-  if (preloaded == NULL) {
-    unloadDCGIModule(module, error);
-  }
+  dropDCGIResult(&result);
 }
 
+static void writeDCGIResponse(OutBuf *response,
+                              int res,
+                              const StringPair *headerDest,
+                              const char *dataDest) {
+  size_t contentLength = 0;
+  if (dataDest != NULL) {
+    contentLength = strlen(dataDest);
+  }
+
+  outStatusLine(response, res);
+  outStatic(response,
+            "Content-Encoding: identity\r\n"
+            "Connection: close\r\n"
+            "Server: " CHTTPD_SERVER_NAME "\r\n");
+  outHeaderUint(response, "Content-Length", contentLength);
+  outDateHeader(response);
+
+  for (size_t i = 0; headerDest != NULL && headerDest[i].first; i++) {
+    const char *headerKey = headerDest[i].first;
+    const char *headerValue = headerDest[i].second;
+    if (strcmp_icase(headerKey, "Content-Length")) {
+      LOG_WARN("Manually setting \"Content-Length\", ignored");
+    } else if (strcmp_icase(headerKey, "Connection")) {
+      LOG_WARN("Manually setting \"Connection\", ignored");
+    } else {
+      outHeader(response, headerKey, headerValue);
+    }
+  }
+
+  outStatic(response, "\r\n");
+  /* the body belongs to the module, and is released right after */
+  outRef(response, dataDest, contentLength);
+  outFlush(response);
+}
@@ -0,0 +1,834 @@
+#define _GNU_SOURCE
+
+#include "dcgi_pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dcgi.h"
+#include "file_util.h"
+#include "lifecycle.h"
+#include "net_util.h"
+#include "util.h"
+
+#define DCGI_MAX_STRINGS_LEN (16 * 1024 * 1024)
+
+typedef struct st_dcgi_worker {
+  pid_t pid;
+  int fd;
+  _Bool busy;
+  _Bool lost;  /* busy until the supervisor has replaced it */
+} DCGIWorker;
+
+/*
+ * Request threads never fork: a worker they lose is left to the
+ * supervisor thread, which reaps and respawns it without the lock held.
+ */
+typedef struct st_dcgi_pool {
+  _Bool enabled;
+  _Bool preload;
+  size_t workerCount;
+  DCGIWorker *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t idle;
+  pthread_cond_t lost;
+} DCGIPool;
+
+typedef struct st_cached_module {
+  char *path;
+  DCGIModule *module;
+} CachedModule;
+
+static DCGIPool dcgiPool = {
+  0, 0, 0, NULL,
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+static pthread_t supervisorThread;
+static _Bool supervising;
+
+static void *supervisorMain(void *unused);
+static uint32_t msUntil(const struct timespec *deadline);
+static _Bool workerTimedOut(void);
+static _Bool spawnWorker(size_t idx, DCGIWorker *worker);
+static void reapWorker(size_t idx, DCGIWorker *worker);
+static void dcgiWorkerMain(int fd);
+
+static _Bool writeFull(int fd, struct iovec *iov, int iovCount);
+static _Bool sendFrame(int fd,
+                       const DCGIFrame *frame,
+                       const char *strings,
+                       const char *body,
+                       int shmFd);
+static int recvFrame(int fd, DCGIFrame *frame, int *shmFd);
+static int createShmSegment(const char *body, size_t bodyLen);
+static char *recvBody(int fd,
+                      const DCGIFrame *frame,
+                      int shmFd,
+                      size_t *mapLen);
+static size_t packPairs(char *dest, const StringPair *pairs, size_t count);
+static size_t pairsLen(const StringPair *pairs, size_t count);
+static _Bool unpackPairs(char *strings,
+                         size_t stringsLen,
+                         size_t *offset,
+                         StringPair *dest,
+                         size_t count);
+
+void startDCGIPool(const Config *config, Error *error) {
+  if (config->dcgiWorkers <= 0) {
+    QUICK_ERROR2(error, 500, "invalid DCGI worker count: %d",
+                 config->dcgiWorkers);
+    return;
+  }
+
+  dcgiPool.workerCount = (size_t)config->dcgiWorkers;
+  dcgiPool.preload = config->preloadDynamic;
+  dcgiPool.workers =
+    (DCGIWorker*)malloc(sizeof(DCGIWorker) * dcgiPool.workerCount);
+  if (dcgiPool.workers == NULL) {
+    QUICK_ERROR(error, 500, "failed allocating DCGI worker table");
+    return;
+  }
+  for (size_t i = 0; i < dcgiPool.workerCount; i++) {
+    dcgiPool.workers[i] = (DCGIWorker) { -1, -1, 0, 0 };
+  }
+
+  for (size_t i = 0; i < dcgiPool.workerCount; i++) {
+    if (!spawnWorker(i, &dcgiPool.workers[i])) {
+      QUICK_ERROR2(error, 500, "failed spawning DCGI worker %zu: %d",
+                   i, errno);
+      stopDCGIPool();
+      return;
+    }
+  }
+
+  dcgiPool.enabled = 1;
+  int res = pthread_create(&supervisorThread, NULL, supervisorMain, NULL);
+  if (res != 0) {
+    QUICK_ERROR2(error, 500, "cannot start DCGI supervisor thread: %d", res);
+    stopDCGIPool();
+    return;
+  }
+  supervising = 1;
+}
+
+void stopDCGIPool(void) {
+  if (dcgiPool.workers == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&dcgiPool.lock);
+  dcgiPool.enabled = 0;
+  pthread_cond_signal(&dcgiPool.lost);
+  pthread_mutex_unlock(&dcgiPool.lock);
+  if (supervising) {
+    pthread_join(supervisorThread, NULL);
+    supervising = 0;
+  }
+
+  pthread_mutex_lock(&dcgiPool.lock);
+  for (size_t i = 0; i < dcgiPool.workerCount; i++) {
+    reapWorker(i, &dcgiPool.workers[i]);
+  }
+  free(dcgiPool.workers);
+  dcgiPool.workers = NULL;
+  dcgiPool.workerCount = 0;
+  pthread_mutex_unlock(&dcgiPool.lock);
+}
+
+_Bool dcgiPoolEnabled(void) {
+  return dcgiPool.enabled;
+}
+
+void dcgiPoolInvoke(const char *dcgiLib,
+                    HttpRequest *request,
+                    int timeout,
+                    DCGIResult *result,
+                    Error *error) {
+  memset(result, 0, sizeof(DCGIResult));
+
+  /* the condition variables wait on CLOCK_REALTIME */
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout;
+
+  pthread_mutex_lock(&dcgiPool.lock);
+  size_t idx = 0;
+  for (;;) {
+    for (idx = 0; idx < dcgiPool.workerCount; idx++) {
+      if (!dcgiPool.workers[idx].busy) {
+        break;
+      }
+    }
+    if (idx < dcgiPool.workerCount) {
+      break;
+    }
+    if (timeout == 0) {
+      pthread_cond_wait(&dcgiPool.idle, &dcgiPool.lock);
+    } else if (pthread_cond_timedwait(&dcgiPool.idle,
+                                      &dcgiPool.lock,
+                                      &deadline) == ETIMEDOUT) {
+      pthread_mutex_unlock(&dcgiPool.lock);
+      QUICK_ERROR2(error, 504, "no DCGI worker free within %d seconds",
+                   timeout);
+      return;
+    }
+  }
+  DCGIWorker *worker = &dcgiPool.workers[idx];
+  worker->busy = 1;
+  int fd = worker->fd;
+  pthread_mutex_unlock(&dcgiPool.lock);
+
+  /* a hanging dcgi_main leaves the reads below to time out */
+  if (!setSocketTimeout(fd, timeout == 0 ? 0 : msUntil(&deadline))) {
+    QUICK_ERROR2(error, 500, "cannot set DCGI worker timeout: %d", errno);
+    goto release_ret;
+  }
+
+  size_t headerCount = ccVecLen(&request->headers);
+  size_t paramCount = ccVecLen(&request->params);
+  const StringPair *headers =
+    (const StringPair*)ccVecData(&request->headers);
+  const StringPair *params =
+    (const StringPair*)ccVecData(&request->params);
+  size_t libLen = strlen(dcgiLib) + 1;
+  size_t pathLen = strlen(request->requestPath) + 1;
+  size_t stringsLen = libLen
+                      + pathLen
+                      + pairsLen(headers, headerCount)
+                      + pairsLen(params, paramCount);
+
+  char *strings = (char*)malloc(stringsLen);
+  if (strings == NULL) {
+    QUICK_ERROR(error, 500, "failed allocating DCGI request frame");
+    goto release_ret;
+  }
+  memcpy(strings, dcgiLib, libLen);
+  memcpy(strings + libLen, request->requestPath, pathLen);
+  size_t offset = libLen + pathLen;
+  offset += packPairs(strings + offset, headers, headerCount);
+  packPairs(strings + offset, params, paramCount);
+
+  DCGIFrame frame;
+  frame.magic = DCGI_FRAME_MAGIC;
+  frame.kind = DCGI_FRAME_REQUEST;
+  frame.flags = dcgiPool.preload ? DCGI_FLAG_PRELOAD : 0;
+  frame.code = request->method;
+  frame.pairCount = headerCount;
+  frame.paramCount = paramCount;
+  frame.stringsLen = stringsLen;
+  frame.bodyLen = request->contentLength;
+
+  int shmFd = -1;
+  if (request->contentLength >= DCGI_SHM_THRESHOLD) {
+    shmFd = createShmSegment(request->body, request->contentLength);
+    if (shmFd >= 0) {
+      frame.flags |= DCGI_FLAG_SHM_BODY;
+    }
+  }
+
+  _Bool sent = sendFrame(fd, &frame, strings, request->body, shmFd);
+  if (shmFd >= 0) {
+    close(shmFd);
+  }
+  free(strings);
+  if (!sent) {
+    QUICK_ERROR2(error, workerTimedOut() ? 504 : 500,
+                 "DCGI worker %zu lost: %d", idx, errno);
+    goto reap_ret;
+  }
+
+  int respShmFd = -1;
+  errno = 0;
+  int res = recvFrame(fd, &frame, &respShmFd);
+  if (res <= 0 && workerTimedOut()) {
+    QUICK_ERROR2(error, 504, "DCGI worker %zu timed out after %d seconds",
+                 idx, timeout);
+    goto reap_ret;
+  }
+  if (res <= 0) {
+    QUICK_ERROR2(error, 500, "DCGI worker %zu terminated abnormally",
+                 idx);
+    goto reap_ret;
+  }
+  if (frame.kind != DCGI_FRAME_RESPONSE
+      || frame.stringsLen > DCGI_MAX_STRINGS_LEN
+      || frame.pairCount > frame.stringsLen / 2
+      || frame.paramCount != 0) {
+    QUICK_ERROR2(error, 500, "DCGI worker %zu: malformed response", idx);
+    if (respShmFd >= 0) {
+      close(respShmFd);
+    }
+    goto reap_ret;
+  }
+
+  size_t headerBytes = sizeof(StringPair) * (frame.pairCount + 1);
+  result->block = (char*)malloc(headerBytes + frame.stringsLen);
+  if (result->block == NULL
+      || !readAllFd(fd, result->block + headerBytes, frame.stringsLen)) {
+    QUICK_ERROR2(error, workerTimedOut() ? 504 : 500,
+                 "DCGI worker %zu: truncated response", idx);
+    if (respShmFd >= 0) {
+      close(respShmFd);
+    }
+    goto reap_ret;
+  }
+
+  result->code = frame.code;
+  result->headers = (StringPair*)result->block;
+  offset = 0;
+  if (!unpackPairs(result->block + headerBytes,
+                   frame.stringsLen,
+                   &offset,
+                   result->headers,
+                   frame.pairCount)) {
+    QUICK_ERROR2(error, 500, "DCGI worker %zu: malformed headers", idx);
+    if (respShmFd >= 0) {
+      close(respShmFd);
+    }
+    goto reap_ret;
+  }
+  if (offset < frame.stringsLen) {
+    result->err = result->block + headerBytes + offset;
+    result->block[headerBytes + frame.stringsLen - 1] = '\0';
+  }
+
+  if (frame.bodyLen != 0 || (frame.flags & DCGI_FLAG_SHM_BODY)) {
+    result->data = recvBody(fd, &frame, respShmFd, &result->dataMapLen);
+    if (result->data == NULL) {
+      QUICK_ERROR2(error, workerTimedOut() ? 504 : 500,
+                   "DCGI worker %zu: truncated body", idx);
+      goto reap_ret;
+    }
+  }
+
+  goto release_ret;
+
+reap_ret:
+  dropDCGIResult(result);
+  pthread_mutex_lock(&dcgiPool.lock);
+  LOG_WARN("DCGI worker %zu (pid %d) lost, respawning",
+           idx, (int)worker->pid);
+  worker->lost = 1;
+  pthread_cond_signal(&dcgiPool.lost);
+  pthread_mutex_unlock(&dcgiPool.lock);
+  return;
+
+release_ret:
+  pthread_mutex_lock(&dcgiPool.lock);
+  worker->busy = 0;
+  pthread_cond_signal(&dcgiPool.idle);
+  pthread_mutex_unlock(&dcgiPool.lock);
+}
+
+void dropDCGIResult(DCGIResult *result) {
+  if (result->dataMapLen != 0) {
+    munmap(result->data, result->dataMapLen);
+  } else {
+    free(result->data);
+  }
+  free(result->block);
+  memset(result, 0, sizeof(DCGIResult));
+}
+
+static void *supervisorMain(void *unused) {
+  (void)unused;
+
+  pthread_mutex_lock(&dcgiPool.lock);
+  while (dcgiPool.enabled) {
+    size_t idx;
+    for (idx = 0; idx < dcgiPool.workerCount; idx++) {
+      if (dcgiPool.workers[idx].lost) {
+        break;
+      }
+    }
+    if (idx == dcgiPool.workerCount) {
+      pthread_cond_wait(&dcgiPool.lost, &dcgiPool.lock);
+      continue;
+    }
+
+    /* the slot stays busy, nobody else touches it meanwhile */
+    DCGIWorker old = dcgiPool.workers[idx];
+    dcgiPool.workers[idx].pid = -1;
+    dcgiPool.workers[idx].fd = -1;
+    pthread_mutex_unlock(&dcgiPool.lock);
+
+    reapWorker(idx, &old);
+    DCGIWorker fresh = { -1, -1, 0, 0 };
+    _Bool spawned = spawnWorker(idx, &fresh);
+    if (!spawned) {
+      LOG_ERR("failed respawning DCGI worker %zu: %d", idx, errno);
+    }
+
+    pthread_mutex_lock(&dcgiPool.lock);
+    if (spawned) {
+      dcgiPool.workers[idx] = fresh;
+      pthread_cond_signal(&dcgiPool.idle);
+    } else {
+      /* try again in a while rather than spin on fork */
+      struct timespec retryAt;
+      clock_gettime(CLOCK_REALTIME, &retryAt);
+      retryAt.tv_sec += 1;
+      pthread_cond_timedwait(&dcgiPool.lost, &dcgiPool.lock, &retryAt);
+    }
+  }
+  pthread_mutex_unlock(&dcgiPool.lock);
+  return NULL;
+}
+
+static uint32_t msUntil(const struct timespec *deadline) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t ms = (int64_t)(deadline->tv_sec - now.tv_sec) * 1000
+               + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+  /* 0 would mean no timeout at all */
+  return ms > 0 ? (uint32_t)ms : 1;
+}
+
+static _Bool workerTimedOut(void) {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+static _Bool spawnWorker(size_t idx, DCGIWorker *worker) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    return 0;
+  }
+
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+  }
+
+  if (pid == 0) {
+    /* Do not keep client connections or sibling channels alive */
+    resetLifecycleSignals();
+    int channel = dup2(fds[1], STDERR_FILENO + 1);
+    closeDescriptorsFrom(channel + 1);
+    setWorkerId(idx);
+    dcgiWorkerMain(channel);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  worker->pid = pid;
+  worker->fd = fds[0];
+  LOG_DBG("spawned DCGI worker %zu as pid %d", idx, (int)pid);
+  return 1;
+}
+
+static void reapWorker(size_t idx, DCGIWorker *worker) {
+  if (worker->fd >= 0) {
+    close(worker->fd);
+    worker->fd = -1;
+  }
+  if (worker->pid > 0) {
+    int status = 0;
+    kill(worker->pid, SIGKILL);
+    waitpid(worker->pid, &status, 0);
+    if (WIFSIGNALED(status) && WTERMSIG(status) != SIGKILL) {
+      LOG_WARN("DCGI worker %zu killed by signal %d",
+               idx, WTERMSIG(status));
+    }
+    worker->pid = -1;
+  }
+}
+
+static DCGIModule *findModule(ccVec TP(CachedModule) *cache,
+                              const char *path,
+                              _Bool preload,
+                              Error *error) {
+  if (preload) {
+    for (size_t i = 0; i < ccVecLen(cache); i++) {
+      CachedModule *cached = (CachedModule*)ccVecNth(cache, i);
+      if (!strcmp(cached->path, path)) {
+        return cached->module;
+      }
+    }
+  }
+
+  DCGIModule *module = loadDCGIModule(path, error);
+  if (module != NULL && preload) {
+    CachedModule cached = (CachedModule) { copyString(path), module };
+    ccVecPushBack(cache, &cached);
+  }
+  return module;
+}
+
+static void dcgiWorkerMain(int fd) {
+  ccVec TP(CachedModule) cache;
+  ccVecInit(&cache, sizeof(CachedModule));
+  Error *error = errorBuffer(512);
+
+  for (;;) {
+    DCGIFrame frame;
+    int shmFd = -1;
+    if (recvFrame(fd, &frame, &shmFd) <= 0) {
+      break;
+    }
+    if (frame.kind != DCGI_FRAME_REQUEST
+        || frame.stringsLen > DCGI_MAX_STRINGS_LEN
+        || frame.pairCount + frame.paramCount > frame.stringsLen / 2) {
+      LOG_ERR("malformed DCGI request frame");
+      break;
+    }
+
+    char *strings = (char*)malloc(frame.stringsLen + 1);
+    StringPair *pairs = (StringPair*)malloc(
+      sizeof(StringPair) * (frame.pairCount + frame.paramCount + 2)
+    );
+    if (strings == NULL
+        || pairs == NULL
+        || !readAllFd(fd, strings, frame.stringsLen)) {
+      break;
+    }
+    strings[frame.stringsLen] = '\0';
+
+    size_t bodyMapLen = 0;
+    char *body = recvBody(fd, &frame, shmFd, &bodyMapLen);
+    if (body == NULL) {
+      break;
+    }
+
+    const char *libPath = strings;
+    size_t offset = strlen(libPath) + 1;
+    const char *queryPath = strings + offset;
+    offset += strlen(queryPath) + 1;
+    StringPair *headers = pairs;
+    StringPair *params = pairs + frame.pairCount + 1;
+    if (offset > frame.stringsLen
+        || !unpackPairs(strings, frame.stringsLen, &offset,
+                        headers, frame.pairCount)
+        || !unpackPairs(strings, frame.stringsLen, &offset,
+                        params, frame.paramCount)) {
+      LOG_ERR("malformed DCGI request strings");
+      break;
+    }
+
+    _Bool preload = (frame.flags & DCGI_FLAG_PRELOAD) != 0;
+    memset(error, 0, sizeof(Error));
+    error->bufferSize = 512;
+    DCGIModule *module = findModule(&cache, libPath, preload, error);
+
+    StringPair *headerDest = NULL;
+    char *dataDest = NULL;
+    char *errDest = NULL;
+    int res = 500;
+    if (module != NULL) {
+      res = module->dcgiMain(frame.code,
+                             queryPath,
+                             headers,
+                             params,
+                             body,
+                             &headerDest,
+                             &dataDest,
+                             &errDest);
+    }
+
+    size_t headerCount = 0;
+    while (headerDest != NULL && headerDest[headerCount].first != NULL) {
+      headerCount++;
+    }
+    const char *errStr = module == NULL ? error->errorBuffer : errDest;
+    size_t errLen = errStr != NULL ? strlen(errStr) + 1 : 0;
+    size_t respLen = pairsLen(headerDest, headerCount) + errLen;
+    char *respStrings = (char*)malloc(respLen + 1);
+    size_t respOffset = packPairs(respStrings, headerDest, headerCount);
+    if (errLen != 0) {
+      memcpy(respStrings + respOffset, errStr, errLen);
+    }
+
+    DCGIFrame resp;
+    resp.magic = DCGI_FRAME_MAGIC;
+    resp.kind = DCGI_FRAME_RESPONSE;
+    resp.flags = 0;
+    resp.code = res;
+    resp.pairCount = headerCount;
+    resp.paramCount = 0;
+    resp.stringsLen = respLen;
+    resp.bodyLen = dataDest != NULL ? strlen(dataDest) : 0;
+
+    int respShmFd = -1;
+    if (resp.bodyLen >= DCGI_SHM_THRESHOLD) {
+      respShmFd = createShmSegment(dataDest, resp.bodyLen);
+      if (respShmFd >= 0) {
+        resp.flags |= DCGI_FLAG_SHM_BODY;
+      }
+    }
+
+    _Bool sent = sendFrame(fd, &resp, respStrings, dataDest, respShmFd);
+    if (respShmFd >= 0) {
+      close(respShmFd);
+    }
+    free(respStrings);
+    if (module != NULL) {
+      dropDCGIOutput(module, headerDest, dataDest, errDest);
+      if (!preload) {
+        unloadDCGIModule(module, error);
+      }
+    }
+
+    if (bodyMapLen != 0) {
+      munmap(body, bodyMapLen);
+    } else {
+      free(body);
+    }
+    free(pairs);
+    free(strings);
+    if (!sent) {
+      break;
+    }
+  }
+
+  close(fd);
+  dropError(error);
+}
+
+static _Bool writeFull(int fd, struct iovec *iov, int iovCount) {
+  while (iovCount > 0) {
+    ssize_t written = writev(fd, iov, iovCount);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    while (iovCount > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      iovCount--;
+    }
+    if (iovCount > 0) {
+      iov->iov_base = (char*)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 1;
+}
+
+static _Bool sendFrame(int fd,
+                       const DCGIFrame *frame,
+                       const char *strings,
+                       const char *body,
+                       int shmFd) {
+  struct iovec iov[3];
+  int iovCount = 0;
+  iov[iovCount++] = (struct iovec) { (void*)frame, sizeof(DCGIFrame) };
+  if (frame->stringsLen != 0) {
+    iov[iovCount++] = (struct iovec) {
+      (void*)strings, frame->stringsLen
+    };
+  }
+  if (shmFd < 0 && frame->bodyLen != 0) {
+    iov[iovCount++] = (struct iovec) { (void*)body, frame->bodyLen };
+  }
+
+  if (shmFd < 0) {
+    return writeFull(fd, iov, iovCount);
+  }
+
+  /* The descriptor must ride on the first byte of the frame */
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &shmFd, sizeof(int));
+
+  ssize_t sent;
+  do {
+    sent = sendmsg(fd, &msg, 0);
+  } while (sent < 0 && errno == EINTR);
+  if (sent < 0) {
+    return 0;
+  }
+  iov[0].iov_base = (char*)iov[0].iov_base + sent;
+  iov[0].iov_len -= sent;
+  if (iov[0].iov_len == 0) {
+    return writeFull(fd, iov + 1, iovCount - 1);
+  }
+  return writeFull(fd, iov, iovCount);
+}
+
+static int recvFrame(int fd, DCGIFrame *frame, int *shmFd) {
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { frame, sizeof(DCGIFrame) };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t received;
+  do {
+    received = recvmsg(fd, &msg, 0);
+  } while (received < 0 && errno == EINTR);
+  if (received <= 0) {
+    return (int)received;
+  }
+
+  *shmFd = -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg != NULL
+      && cmsg->cmsg_level == SOL_SOCKET
+      && cmsg->cmsg_type == SCM_RIGHTS) {
+    memcpy(shmFd, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  int ret = 1;
+  if ((size_t)received < sizeof(DCGIFrame)
+      && !readAllFd(fd,
+                    (char*)frame + received,
+                    sizeof(DCGIFrame) - received)) {
+    ret = 0;
+  } else if (frame->magic != DCGI_FRAME_MAGIC) {
+    LOG_ERR("DCGI frame magic mismatch: %x", frame->magic);
+    ret = -1;
+  } else if (((frame->flags & DCGI_FLAG_SHM_BODY) != 0) != (*shmFd >= 0)) {
+    LOG_ERR("DCGI frame shared memory descriptor mismatch");
+    ret = -1;
+  }
+
+  /* The caller only takes ownership of the descriptor on success */
+  if (ret != 1 && *shmFd >= 0) {
+    close(*shmFd);
+    *shmFd = -1;
+  }
+  return ret;
+}
+
+static int createShmSegment(const char *body, size_t bodyLen) {
+#ifdef MFD_CLOEXEC
+  int fd = memfd_create("chttpd-dcgi", MFD_CLOEXEC);
+#else
+  static atomic_uint shmCounter;
+  char name[64];
+  snprintf(name, sizeof(name), "/chttpd-dcgi-%d-%u",
+           (int)getpid(), atomic_fetch_add(&shmCounter, 1));
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd >= 0) {
+    shm_unlink(name);
+  }
+#endif
+  if (fd < 0) {
+    LOG_WARN("cannot create shared memory segment: %d", errno);
+    return -1;
+  }
+
+  /* One extra zeroed byte so the receiver gets a terminated string */
+  if (ftruncate(fd, bodyLen + 1) < 0) {
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(NULL, bodyLen, PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  memcpy(map, body, bodyLen);
+  munmap(map, bodyLen);
+  return fd;
+}
+
+static char *recvBody(int fd,
+                      const DCGIFrame *frame,
+                      int shmFd,
+                      size_t *mapLen) {
+  *mapLen = 0;
+  if (shmFd >= 0) {
+    struct stat st;
+    char *map = NULL;
+    if (fstat(shmFd, &st) == 0
+        && (uint64_t)st.st_size == frame->bodyLen + 1) {
+      map = (char*)mmap(NULL, frame->bodyLen + 1, PROT_READ,
+                        MAP_SHARED, shmFd, 0);
+    }
+    close(shmFd);
+    if (map == NULL || map == MAP_FAILED) {
+      return NULL;
+    }
+    *mapLen = frame->bodyLen + 1;
+    return map;
+  }
+
+  char *body = (char*)malloc(frame->bodyLen + 1);
+  if (body == NULL) {
+    return NULL;
+  }
+  if (!readAllFd(fd, body, frame->bodyLen)) {
+    free(body);
+    return NULL;
+  }
+  body[frame->bodyLen] = '\0';
+  return body;
+}
+
+static size_t pairsLen(const StringPair *pairs, size_t count) {
+  size_t ret = 0;
+  for (size_t i = 0; i < count; i++) {
+    ret += strlen(pairs[i].first) + strlen(pairs[i].second) + 2;
+  }
+  return ret;
+}
+
+static size_t packPairs(char *dest, const StringPair *pairs, size_t count) {
+  size_t offset = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t firstLen = strlen(pairs[i].first) + 1;
+    size_t secondLen = strlen(pairs[i].second) + 1;
+    memcpy(dest + offset, pairs[i].first, firstLen);
+    memcpy(dest + offset + firstLen, pairs[i].second, secondLen);
+    offset += firstLen + secondLen;
+  }
+  return offset;
+}
+
+static _Bool unpackPairs(char *strings,
+                         size_t stringsLen,
+                         size_t *offset,
+                         StringPair *dest,
+                         size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    char *parts[2];
+    for (int j = 0; j < 2; j++) {
+      if (*offset >= stringsLen) {
+        return 0;
+      }
+      char *start = strings + *offset;
+      char *end = (char*)memchr(start, '\0', stringsLen - *offset);
+      if (end == NULL) {
+        return 0;
+      }
+      parts[j] = start;
+      *offset += end - start + 1;
+    }
+    dest[i] = (StringPair) { parts[0], parts[1] };
+  }
+  dest[count] = (StringPair) { NULL, NULL };
+  return 1;
+}
@@ -0,0 +1,711 @@
+#include "fcgi.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include "http_head.h"
+#include "net_util.h"
+#include "util.h"
+
+#define FCGI_VERSION_1         1
+
+#define FCGI_BEGIN_REQUEST     1
+#define FCGI_ABORT_REQUEST     2
+#define FCGI_END_REQUEST       3
+#define FCGI_PARAMS            4
+#define FCGI_STDIN             5
+#define FCGI_STDOUT            6
+#define FCGI_STDERR            7
+
+#define FCGI_RESPONDER         1
+#define FCGI_KEEP_CONN         1
+#define FCGI_REQUEST_COMPLETE  0
+
+#define FCGI_HEADER_LEN        8
+#define FCGI_MAX_CONTENT       65535
+
+typedef struct st_fcgi_buffer {
+  char *data;
+  size_t len;
+  size_t cap;
+} FCGIBuffer;
+
+typedef struct st_fcgi_slot {
+  _Bool inUse;
+  _Bool done;
+  _Bool abandoned; /* timed out, held until its END_REQUEST arrives */
+  int protocolStatus;
+  FCGIBuffer output;
+} FCGISlot;
+
+typedef struct st_fcgi_conn {
+  int fd;
+  _Bool connecting;
+  _Bool reading;
+  _Bool broken;
+  size_t inFlight;
+  size_t abandoned;
+  pthread_mutex_t writeLock;
+  FCGISlot slots[FCGI_MAX_MPX];
+} FCGIConn;
+
+struct st_fcgi_upstream {
+  char *address;
+  SockAddress sockAddress;
+  size_t maxConns;
+  size_t maxMpx;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  FCGIConn conns[FCGI_MAX_CONNS];
+};
+
+static FCGIConn *acquireConn(FCGIUpstream *upstream,
+                             uint32_t timeoutMs,
+                             uint16_t *requestId,
+                             Error *error);
+static void releaseConn(FCGIUpstream *upstream,
+                        FCGIConn *conn,
+                        uint16_t requestId,
+                        _Bool timedOut);
+static _Bool sendRequest(FCGIConn *conn,
+                         uint16_t requestId,
+                         HttpRequest *request,
+                         Error *error);
+static _Bool awaitResponse(FCGIUpstream *upstream,
+                           FCGIConn *conn,
+                           uint16_t requestId,
+                           int timeout);
+static int readRecord(FCGIUpstream *upstream,
+                      FCGIConn *conn,
+                      uint32_t timeoutMs);
+static uint32_t msUntil(const struct timespec *deadline);
+static void writeFCGIResponse(FILE *response,
+                              const FCGIBuffer *output,
+                              Error *error);
+
+static void bufferAppend(FCGIBuffer *buffer, const void *data, size_t len);
+static void bufferAppendRecordHead(FCGIBuffer *buffer,
+                                   uint8_t type,
+                                   uint16_t requestId,
+                                   uint16_t contentLen);
+static void bufferAppendParam(FCGIBuffer *buffer,
+                              const char *name,
+                              const char *value);
+
+FCGIUpstream *createFCGIUpstream(const char *address,
+                                 int maxConns,
+                                 int maxMpx,
+                                 Error *error) {
+  FCGIUpstream *upstream = (FCGIUpstream*)malloc(sizeof(FCGIUpstream));
+  if (upstream == NULL) {
+    QUICK_ERROR(error, 500, "failed allocating FastCGI upstream");
+    return NULL;
+  }
+  memset(upstream, 0, sizeof(FCGIUpstream));
+
+  parseSockAddress(address, &upstream->sockAddress, error);
+  if (isError(error)) {
+    free(upstream);
+    return NULL;
+  }
+
+  upstream->address = copyString(address);
+  upstream->maxConns = (size_t)maxConns;
+  upstream->maxMpx = (size_t)maxMpx;
+  pthread_mutex_init(&upstream->lock, NULL);
+  pthread_cond_init(&upstream->cond, NULL);
+  for (size_t i = 0; i < FCGI_MAX_CONNS; i++) {
+    upstream->conns[i].fd = -1;
+    pthread_mutex_init(&upstream->conns[i].writeLock, NULL);
+  }
+  return upstream;
+}
+
+const char *fcgiUpstreamAddress(const FCGIUpstream *upstream) {
+  return upstream->address;
+}
+
+void dropFCGIUpstream(FCGIUpstream *upstream) {
+  for (size_t i = 0; i < FCGI_MAX_CONNS; i++) {
+    FCGIConn *conn = &upstream->conns[i];
+    if (conn->fd >= 0) {
+      close(conn->fd);
+    }
+    pthread_mutex_destroy(&conn->writeLock);
+  }
+  pthread_cond_destroy(&upstream->cond);
+  pthread_mutex_destroy(&upstream->lock);
+  free(upstream->address);
+  free(upstream);
+}
+
+void handleFCGI(FCGIUpstream *upstream,
+                int timeout,
+                HttpRequest *request,
+                FILE *response,
+                Error *error) {
+  /* CONTENT_LENGTH must be known before STDIN starts */
+  if (request->chunked && readHttpBodyAll(request, error) == NULL) {
+    return;
+  }
+
+  uint16_t requestId = 0;
+  FCGIConn *conn = acquireConn(upstream,
+                               (uint32_t)timeout * 1000,
+                               &requestId,
+                               error);
+  if (conn == NULL) {
+    return;
+  }
+
+  if (!sendRequest(conn, requestId, request, error)) {
+    pthread_mutex_lock(&upstream->lock);
+    conn->broken = 1;
+    pthread_mutex_unlock(&upstream->lock);
+    QUICK_ERROR2(error,
+                 errno == EAGAIN || errno == EWOULDBLOCK ? 504 : 502,
+                 "cannot send request to FastCGI upstream %s: %d",
+                 upstream->address, errno);
+    releaseConn(upstream, conn, requestId, 0);
+    return;
+  }
+
+  _Bool timedOut = awaitResponse(upstream, conn, requestId, timeout);
+
+  FCGISlot *slot = &conn->slots[requestId - 1];
+  if (isError(error)) {
+    /* the client body broke off, the response is of no use */
+  } else if (timedOut) {
+    QUICK_ERROR2(error, 504, "FastCGI upstream %s timed out after %d "
+                 "seconds", upstream->address, timeout);
+  } else if (!slot->done) {
+    QUICK_ERROR2(error, 502, "FastCGI upstream %s closed connection",
+                 upstream->address);
+  } else if (slot->protocolStatus != FCGI_REQUEST_COMPLETE) {
+    QUICK_ERROR2(error, 502, "FastCGI upstream %s rejected request: %d",
+                 upstream->address, slot->protocolStatus);
+  } else {
+    writeFCGIResponse(response, &slot->output, error);
+  }
+
+  releaseConn(upstream, conn, requestId, timedOut);
+}
+
+static FCGIConn *acquireConn(FCGIUpstream *upstream,
+                             uint32_t timeoutMs,
+                             uint16_t *requestId,
+                             Error *error) {
+  pthread_mutex_lock(&upstream->lock);
+
+  FCGIConn *conn = NULL;
+  for (;;) {
+    FCGIConn *least = NULL;
+    FCGIConn *closed = NULL;
+    for (size_t i = 0; i < upstream->maxConns; i++) {
+      FCGIConn *iter = &upstream->conns[i];
+      if (iter->connecting || iter->broken) {
+        continue;
+      }
+      if (iter->fd < 0) {
+        if (closed == NULL) {
+          closed = iter;
+        }
+        continue;
+      }
+      if (iter->inFlight < upstream->maxMpx
+          && (least == NULL || iter->inFlight < least->inFlight)) {
+        least = iter;
+      }
+    }
+
+    /* Prefer an idle connection, then a new one, then multiplexing */
+    if (least != NULL && least->inFlight == 0) {
+      conn = least;
+      break;
+    }
+    if (closed != NULL) {
+      closed->connecting = 1;
+      pthread_mutex_unlock(&upstream->lock);
+      int fd = connectSockAddress(&upstream->sockAddress, timeoutMs, error);
+      pthread_mutex_lock(&upstream->lock);
+      closed->connecting = 0;
+      if (fd < 0) {
+        pthread_cond_broadcast(&upstream->cond);
+        pthread_mutex_unlock(&upstream->lock);
+        return NULL;
+      }
+      closed->fd = fd;
+      conn = closed;
+      break;
+    }
+    if (least != NULL) {
+      conn = least;
+      break;
+    }
+    pthread_cond_wait(&upstream->cond, &upstream->lock);
+  }
+
+  size_t idx = 0;
+  while (conn->slots[idx].inUse) {
+    idx++;
+  }
+  FCGISlot *slot = &conn->slots[idx];
+  slot->inUse = 1;
+  slot->done = 0;
+  slot->protocolStatus = FCGI_REQUEST_COMPLETE;
+  slot->output.len = 0;
+  conn->inFlight++;
+  *requestId = (uint16_t)(idx + 1);
+
+  pthread_mutex_unlock(&upstream->lock);
+  return conn;
+}
+
+/*
+ * A request that timed out keeps its id until the upstream ends it, so
+ * that a late response is not taken for that of the next request given
+ * the id. The connection goes once nothing but such requests is left.
+ */
+static void releaseConn(FCGIUpstream *upstream,
+                        FCGIConn *conn,
+                        uint16_t requestId,
+                        _Bool timedOut) {
+  pthread_mutex_lock(&upstream->lock);
+  FCGISlot *slot = &conn->slots[requestId - 1];
+  free(slot->output.data);
+  slot->output = (FCGIBuffer) { NULL, 0, 0 };
+  _Bool abandon = timedOut && !slot->done && !conn->broken;
+  if (abandon) {
+    slot->abandoned = 1;
+    conn->abandoned++;
+  } else {
+    slot->inUse = 0;
+    conn->inFlight--;
+  }
+
+  /* nobody is left to read what is still owed */
+  if (conn->abandoned != 0 && conn->inFlight == conn->abandoned) {
+    conn->broken = 1;
+  }
+  if (abandon && !conn->broken) {
+    unsigned char abort[FCGI_HEADER_LEN] = {
+      FCGI_VERSION_1, FCGI_ABORT_REQUEST,
+      (unsigned char)(requestId >> 8), (unsigned char)(requestId & 0xff),
+      0, 0, 0, 0
+    };
+    pthread_mutex_lock(&conn->writeLock);
+    writeAllFd(conn->fd, abort, FCGI_HEADER_LEN);
+    pthread_mutex_unlock(&conn->writeLock);
+  }
+
+  if (conn->broken && conn->inFlight == conn->abandoned) {
+    close(conn->fd);
+    conn->fd = -1;
+    conn->broken = 0;
+    for (size_t i = 0; i < upstream->maxMpx; i++) {
+      if (conn->slots[i].abandoned) {
+        conn->slots[i].abandoned = 0;
+        conn->slots[i].inUse = 0;
+      }
+    }
+    conn->inFlight = 0;
+    conn->abandoned = 0;
+  }
+  pthread_cond_broadcast(&upstream->cond);
+  pthread_mutex_unlock(&upstream->lock);
+}
+
+/*
+ * Returns false only when writing to the upstream fails. Should the
+ * client body break off midway, `error` is set and STDIN ends early,
+ * so the connection stays usable for the other requests on it.
+ */
+static _Bool sendRequest(FCGIConn *conn,
+                         uint16_t requestId,
+                         HttpRequest *request,
+                         Error *error) {
+  FCGIBuffer params = { NULL, 0, 0 };
+  char contentLength[32];
+  snprintf(contentLength, sizeof(contentLength), "%zu",
+           request->contentLength);
+
+  bufferAppendParam(&params, "GATEWAY_INTERFACE", "CGI/1.1");
+  bufferAppendParam(&params, "SERVER_SOFTWARE", CHTTPD_SERVER_NAME);
+  bufferAppendParam(&params, "SERVER_PROTOCOL", "HTTP/1.1");
+  bufferAppendParam(&params, "REQUEST_METHOD",
+                    HTTP_METHOD_NAMES[request->method]);
+  bufferAppendParam(&params, "SCRIPT_NAME", request->requestPath);
+  bufferAppendParam(&params, "DOCUMENT_URI", request->requestPath);
+  bufferAppendParam(&params, "QUERY_STRING",
+                    request->queryString ? request->queryString : "");
+  bufferAppendParam(&params, "CONTENT_LENGTH", contentLength);
+
+  char nameBuffer[256];
+  for (size_t i = 0; i < ccVecLen(&request->headers); i++) {
+    StringPair *header = (StringPair*)ccVecNth(&request->headers, i);
+    if (strcmp_icase(header->first, "Content-Length")) {
+      continue;
+    }
+    if (strcmp_icase(header->first, "Content-Type")) {
+      bufferAppendParam(&params, "CONTENT_TYPE", header->second);
+      continue;
+    }
+
+    size_t nameLen = strlen(header->first);
+    if (nameLen + 6 > sizeof(nameBuffer)) {
+      continue;
+    }
+    memcpy(nameBuffer, "HTTP_", 5);
+    for (size_t j = 0; j < nameLen; j++) {
+      char ch = header->first[j];
+      nameBuffer[5 + j] = ch == '-' ? '_' : (char)toupper(ch);
+    }
+    nameBuffer[5 + nameLen] = '\0';
+    bufferAppendParam(&params, nameBuffer, header->second);
+  }
+
+  FCGIBuffer head = { NULL, 0, 0 };
+  uint8_t beginBody[8] = {
+    0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0
+  };
+  bufferAppendRecordHead(&head, FCGI_BEGIN_REQUEST, requestId, 8);
+  bufferAppend(&head, beginBody, 8);
+  for (size_t offset = 0;
+       offset < params.len;
+       offset += FCGI_MAX_CONTENT) {
+    size_t chunk = params.len - offset;
+    if (chunk > FCGI_MAX_CONTENT) {
+      chunk = FCGI_MAX_CONTENT;
+    }
+    bufferAppendRecordHead(&head, FCGI_PARAMS, requestId, chunk);
+    bufferAppend(&head, params.data + offset, chunk);
+  }
+  bufferAppendRecordHead(&head, FCGI_PARAMS, requestId, 0);
+  free(params.data);
+
+  pthread_mutex_lock(&conn->writeLock);
+  _Bool ret = writeAllFd(conn->fd, head.data, head.len);
+  pthread_mutex_unlock(&conn->writeLock);
+  free(head.data);
+
+  /* the body is streamed from the client one record at a time */
+  char record[FCGI_HEADER_LEN + FCGI_MAX_CONTENT];
+  size_t offset = 0;
+  while (ret) {
+    size_t chunk = 0;
+    if (request->body != NULL) {
+      chunk = request->contentLength - offset;
+      if (chunk > FCGI_MAX_CONTENT) {
+        chunk = FCGI_MAX_CONTENT;
+      }
+      memcpy(record + FCGI_HEADER_LEN, request->body + offset, chunk);
+      offset += chunk;
+    } else {
+      ssize_t bytesRead = readHttpBody(request,
+                                       record + FCGI_HEADER_LEN,
+                                       FCGI_MAX_CONTENT,
+                                       error);
+      chunk = bytesRead > 0 ? (size_t)bytesRead : 0;
+    }
+
+    record[0] = FCGI_VERSION_1;
+    record[1] = FCGI_STDIN;
+    record[2] = (char)(requestId >> 8);
+    record[3] = (char)(requestId & 0xff);
+    record[4] = (char)(chunk >> 8);
+    record[5] = (char)(chunk & 0xff);
+    record[6] = 0;
+    record[7] = 0;
+
+    pthread_mutex_lock(&conn->writeLock);
+    ret = writeAllFd(conn->fd, record, FCGI_HEADER_LEN + chunk);
+    pthread_mutex_unlock(&conn->writeLock);
+
+    if (chunk == 0) {
+      break;
+    }
+  }
+
+  return ret;
+}
+
+/*
+ * Leader/follower demultiplexing: whichever waiter finds nobody
+ * reading the connection reads exactly one record, files it under its
+ * request id, then hands the role over so that every request finishes
+ * as soon as its own FCGI_END_REQUEST arrives.
+ */
+static _Bool awaitResponse(FCGIUpstream *upstream,
+                           FCGIConn *conn,
+                           uint16_t requestId,
+                           int timeout) {
+  FCGISlot *slot = &conn->slots[requestId - 1];
+
+  /* the condition variable waits on CLOCK_REALTIME */
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout;
+
+  _Bool timedOut = 0;
+  pthread_mutex_lock(&upstream->lock);
+  while (!slot->done && !conn->broken) {
+    uint32_t leftMs = timeout == 0 ? 0 : msUntil(&deadline);
+    if (timeout != 0 && leftMs == 0) {
+      timedOut = 1;
+      break;
+    }
+    if (conn->reading) {
+      if (timeout == 0) {
+        pthread_cond_wait(&upstream->cond, &upstream->lock);
+      } else {
+        pthread_cond_timedwait(&upstream->cond, &upstream->lock, &deadline);
+      }
+      continue;
+    }
+
+    conn->reading = 1;
+    pthread_mutex_unlock(&upstream->lock);
+    int res = readRecord(upstream, conn, leftMs);
+    pthread_mutex_lock(&upstream->lock);
+    conn->reading = 0;
+    if (res < 0) {
+      conn->broken = 1;
+    }
+    pthread_cond_broadcast(&upstream->cond);
+  }
+  pthread_mutex_unlock(&upstream->lock);
+  return timedOut;
+}
+
+/*
+ * Returns 1 for a record read, 0 when none began within `timeoutMs`,
+ * which leaves the connection usable, and -1 once it is not.
+ */
+static int readRecord(FCGIUpstream *upstream,
+                      FCGIConn *conn,
+                      uint32_t timeoutMs) {
+  /* only the reading request sets this, SO_SNDTIMEO stays as connected */
+  struct timeval tv = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+  if (setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+    return -1;
+  }
+
+  unsigned char head[FCGI_HEADER_LEN];
+  ssize_t bytesRead;
+  do {
+    bytesRead = read(conn->fd, head, FCGI_HEADER_LEN);
+  } while (bytesRead < 0 && errno == EINTR);
+  if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
+  }
+  if (bytesRead <= 0
+      || !readAllFd(conn->fd, head + bytesRead, FCGI_HEADER_LEN - bytesRead)
+      || head[0] != FCGI_VERSION_1) {
+    return -1;
+  }
+
+  uint8_t type = head[1];
+  uint16_t requestId = (uint16_t)((head[2] << 8) | head[3]);
+  size_t contentLen = (size_t)((head[4] << 8) | head[5]);
+  size_t paddingLen = head[6];
+
+  char content[FCGI_MAX_CONTENT + 256];
+  if (!readAllFd(conn->fd, content, contentLen + paddingLen)) {
+    return -1;
+  }
+
+  if (requestId == 0 || requestId > upstream->maxMpx) {
+    return 1;
+  }
+
+  pthread_mutex_lock(&upstream->lock);
+  FCGISlot *slot = &conn->slots[requestId - 1];
+  if (!slot->inUse || slot->done) {
+    pthread_mutex_unlock(&upstream->lock);
+    return 1;
+  }
+  if (slot->abandoned) {
+    if (type == FCGI_END_REQUEST) {
+      slot->abandoned = 0;
+      slot->inUse = 0;
+      conn->abandoned--;
+      conn->inFlight--;
+    }
+    pthread_mutex_unlock(&upstream->lock);
+    return 1;
+  }
+
+  switch (type) {
+  case FCGI_STDOUT:
+    bufferAppend(&slot->output, content, contentLen);
+    break;
+  case FCGI_STDERR:
+    if (contentLen != 0) {
+      LOG_WARN("FastCGI upstream %s: %.*s",
+               upstream->address, (int)contentLen, content);
+    }
+    break;
+  case FCGI_END_REQUEST:
+    slot->done = 1;
+    slot->protocolStatus = contentLen >= 5 ? (uint8_t)content[4] : -1;
+    break;
+  default:
+    break;
+  }
+  pthread_mutex_unlock(&upstream->lock);
+  return 1;
+}
+
+/* 0 once `deadline` has passed */
+static uint32_t msUntil(const struct timespec *deadline) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t ms = (int64_t)(deadline->tv_sec - now.tv_sec) * 1000
+               + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+  return ms > 0 ? (uint32_t)ms : 0;
+}
+
+static void writeFCGIResponse(FILE *response,
+                              const FCGIBuffer *output,
+                              Error *error) {
+  const char *data = output->data;
+  const char *end = data + output->len;
+
+  const char *bodyStart = NULL;
+  for (const char *it = data; it != NULL && it < end; ) {
+    const char *lineEnd = (const char*)memchr(it, '\n', end - it);
+    if (lineEnd == NULL) {
+      break;
+    }
+    if (lineEnd == it || (lineEnd == it + 1 && *it == '\r')) {
+      bodyStart = lineEnd + 1;
+      break;
+    }
+    it = lineEnd + 1;
+  }
+  if (bodyStart == NULL) {
+    QUICK_ERROR(error, 502, "malformed FastCGI response: no header end");
+    return;
+  }
+
+  int code = HTTP_CODE_OK;
+  _Bool hasStatus = 0;
+  _Bool hasLocation = 0;
+  for (const char *it = data; it < bodyStart; ) {
+    const char *lineEnd = (const char*)memchr(it, '\n', bodyStart - it);
+    const char *colon = (const char*)memchr(it, ':', lineEnd - it);
+    if (colon != NULL && slicecmp_icase(it, colon, "Status")) {
+      code = atoi(colon + 1);
+      hasStatus = 1;
+    } else if (colon != NULL && slicecmp_icase(it, colon, "Location")) {
+      hasLocation = 1;
+    }
+    it = lineEnd + 1;
+  }
+  if (!hasStatus && hasLocation) {
+    code = 302;
+  }
+  if (code < HTTP_CODE_MIN || code > HTTP_CODE_MAX) {
+    QUICK_ERROR2(error, 502, "FastCGI upstream returned status %d", code);
+    return;
+  }
+
+  char statusLine[STATUS_LINE_MAX];
+  char contentLength[UINT_DIGITS_MAX];
+  fputs(httpStatusLine(code, statusLine), response);
+  fputs("Content-Length: ", response);
+  fwrite(contentLength,
+         1,
+         formatUint(contentLength, (uint64_t)(end - bodyStart)),
+         response);
+  fputs("\r\n"
+        "Connection: close\r\n"
+        "Server: " CHTTPD_SERVER_NAME "\r\n",
+        response);
+
+  for (const char *it = data; it < bodyStart; ) {
+    const char *lineEnd = (const char*)memchr(it, '\n', bodyStart - it);
+    const char *colon = (const char*)memchr(it, ':', lineEnd - it);
+    const char *valueEnd = lineEnd;
+    if (valueEnd > it && valueEnd[-1] == '\r') {
+      valueEnd--;
+    }
+    if (colon != NULL
+        && !slicecmp_icase(it, colon, "Status")
+        && !slicecmp_icase(it, colon, "Content-Length")
+        && !slicecmp_icase(it, colon, "Connection")) {
+      fwrite(it, 1, valueEnd - it, response);
+      fputs("\r\n", response);
+    }
+    it = lineEnd + 1;
+  }
+
+  fputs("\r\n", response);
+  fwrite(bodyStart, 1, end - bodyStart, response);
+}
+
+static void bufferAppend(FCGIBuffer *buffer, const void *data, size_t len) {
+  if (buffer->len + len > buffer->cap) {
+    size_t cap = buffer->cap == 0 ? 1024 : buffer->cap;
+    while (cap < buffer->len + len) {
+      cap *= 2;
+    }
+    char *newData = (char*)realloc(buffer->data, cap);
+    if (newData == NULL) {
+      LOG_ERR("failed growing FastCGI buffer to %zu bytes", cap);
+      return;
+    }
+    buffer->data = newData;
+    buffer->cap = cap;
+  }
+  memcpy(buffer->data + buffer->len, data, len);
+  buffer->len += len;
+}
+
+static void bufferAppendRecordHead(FCGIBuffer *buffer,
+                                   uint8_t type,
+                                   uint16_t requestId,
+                                   uint16_t contentLen) {
+  unsigned char head[FCGI_HEADER_LEN] = {
+    FCGI_VERSION_1, type,
+    (unsigned char)(requestId >> 8), (unsigned char)(requestId & 0xff),
+    (unsigned char)(contentLen >> 8), (unsigned char)(contentLen & 0xff),
+    0, 0
+  };
+  bufferAppend(buffer, head, FCGI_HEADER_LEN);
+}
+
+static void bufferAppendLength(FCGIBuffer *buffer, size_t len) {
+  if (len < 128) {
+    unsigned char ch = (unsigned char)len;
+    bufferAppend(buffer, &ch, 1);
+  } else {
+    unsigned char bytes[4] = {
+      (unsigned char)(((len >> 24) & 0x7f) | 0x80),
+      (unsigned char)((len >> 16) & 0xff),
+      (unsigned char)((len >> 8) & 0xff),
+      (unsigned char)(len & 0xff)
+    };
+    bufferAppend(buffer, bytes, 4);
+  }
+}
+
+static void bufferAppendParam(FCGIBuffer *buffer,
+                              const char *name,
+                              const char *value) {
+  size_t nameLen = strlen(name);
+  size_t valueLen = strlen(value);
+  bufferAppendLength(buffer, nameLen);
+  bufferAppendLength(buffer, valueLen);
+  bufferAppend(buffer, name, nameLen);
+  bufferAppend(buffer, value, valueLen);
+}
@@ -1,8 +1,12 @@
+#define _GNU_SOURCE
+
 #include "file_util.h"
 #include "util.h"
 
 #include <stdio.h>
 
+#include <sys/syscall.h>
+
 ssize_t readAll(FILE *fp, char *buffer, size_t bufSize) {
   long res;
   if ((res = fseek(fp, 0, SEEK_END)) < 0) {
@@ -29,3 +33,18 @@ ssize_t readAll(FILE *fp, char *buffer, size_t bufSize) {
 
   return bytesRead;
 }
+
+void closeDescriptorsFrom(int lowFd) {
+#ifdef SYS_close_range
+  if (syscall(SYS_close_range, lowFd, ~0U, 0) == 0) {
+    return;
+  }
+#endif
+  long maxFd = sysconf(_SC_OPEN_MAX);
+  if (maxFd < 0 || maxFd > 65536) {
+    maxFd = 65536;
+  }
+  for (int fd = lowFd; fd < maxFd; fd++) {
+    close(fd);
+  }
+}
@@ -3,6 +3,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,14 +21,10 @@ const char *HTTP_METHOD_NAMES[] = {
   [HTTP_OPTIONS] = "OPTIONS"
 };
 
-const char *HTTP_CODE_NAMES[] = {
-  [HTTP_CODE_OK] = "Ok",
-  [HTTP_CODE_NO_CONTENT] = "No Content",
-  [HTTP_CODE_BAD_REQUEST] = "Bad Request",
-  [HTTP_CODE_UNAUTHORIZED] = "Unauthorised",
-  [HTTP_CODE_FORBIDDEN] = "Forbidden",
-  [HTTP_CODE_NOT_FOUND] = "Not Found",
-  [HTTP_CODE_SERVER_ERR] = "Internal Server Error",
+#define CODE_NAME(code, reason) [code] = reason,
+
+const char *HTTP_CODE_NAMES[HTTP_CODE_MAX + 1] = {
+  HTTP_STATUS_CODES(CODE_NAME)
 };
 
 const char *HTTP_CORS_HEADERS = 
@@ -69,177 +66,260 @@ HttpMethod parseHttpMethodSlice(const char *begin,
 }
 
 const char *httpCodeNameSafe(int httpCode) {
-  const char *ret = HTTP_CODE_NAMES[httpCode];
-  if (ret == NULL) {
-    ret = "Unknown";
+  if (httpCode < 0 || httpCode > HTTP_CODE_MAX
+      || HTTP_CODE_NAMES[httpCode] == NULL) {
+    return "Unknown";
   }
-  return ret;
+  return HTTP_CODE_NAMES[httpCode];
 }
 
 void dropHttpRequest(HttpRequest *request) {
-  for (size_t i = 0; i < ccVecLen(&request->headers); i++) {
-    StringPair *header = (StringPair*)ccVecNth(&request->headers, i);
-    dropStringPair(*header);
-  }
-  ccVecDestroy(&request->headers);
-
-  for (size_t i = 0; i < ccVecLen(&request->params); i++) {
-    StringPair *param = (StringPair*)ccVecNth(&request->params, i);
-    dropStringPair(*param);
-  }
-  ccVecDestroy(&request->params);
-
-  free(request->requestPath);
-  free(request->queryString);
-  free(request);
+  /* strings, vectors and the request itself go away with the arena */
+  free(request->lineBuffer);
+  free(request->body);
 }
 
-static char *readHttpLine(FILE *fp);
-static _Bool parseHttpFirstLine(const char *line,
+static char *readHttpLine(FILE *fp, char **buffer, size_t *bufferSize);
+static _Bool parseHttpFirstLine(Arena *arena,
+                                const char *line,
                                 HttpMethod *method,
                                 char **requestPath,
                                 char **queryString,
                                 ccVec TP(StringPair) *params);
-static _Bool parseHttpHeaderLine(const char *line,
+static _Bool parseHttpHeaderLine(Arena *arena,
+                                 const char *line,
                                  ccVec TP(StringPair) *headers);
 static const char *skipWhitespace(const char *start);
-static _Bool parseQueryPath(const char *start,
+static _Bool parseContentLength(const char *value, size_t *dest);
+static _Bool readChunkHead(HttpRequest *request, Error *error);
+static _Bool parseQueryPath(Arena *arena,
+                            const char *start,
                             const char *end,
                             char **requestPath,
                             char **queryString,
                             ccVec TP(StringPair) *params);
 
-HttpRequest *readHttpRequest(FILE *fp) {
-  char *line = readHttpLine(fp);
+HttpRequest *readHttpRequest(FILE *fp,
+                             size_t maxBodySize,
+                             Arena *arena) {
+  /* one line buffer serves the request line and every header */
+  char *lineBuffer = NULL;
+  size_t lineBufferSize = 0;
+  char *line = readHttpLine(fp, &lineBuffer, &lineBufferSize);
   if (line == NULL) {
+    free(lineBuffer);
     return NULL;
   }
 
-  HttpMethod method;
-  ccVec TP(StringPair) params;
-  ccVecInit(&params, sizeof(StringPair));
-  char *requestPath = NULL;
-  char *queryString = NULL;
+  /* vectors start out in the inline storage, then grow in the arena */
+  HttpRequest *ret = (HttpRequest*)arenaAlloc(arena, sizeof(HttpRequest));
+  if (ret == NULL) {
+    free(lineBuffer);
+    return NULL;
+  }
+  ccVecInitInline(&ret->params,
+                  sizeof(StringPair),
+                  ret->paramStorage,
+                  CC_VEC_INLINE_SIZE,
+                  arenaAllocator(arena));
+  ccVecInitInline(&ret->headers,
+                  sizeof(StringPair),
+                  ret->headerStorage,
+                  CC_VEC_INLINE_SIZE,
+                  arenaAllocator(arena));
+  ret->requestPath = NULL;
+  ret->queryString = NULL;
 
   if (!parseHttpFirstLine(
+        arena,
         line,
-        &method,
-        &requestPath,
-        &queryString,
-        &params
+        &ret->method,
+        &ret->requestPath,
+        &ret->queryString,
+        &ret->params
      )) {
-    goto free_params_ret;
+    goto free_line_ret;
   }
-  free(line);
-
-  ccVec TP(StringPair) headers;
-  ccVecInit(&headers, sizeof(StringPair));
 
   for (;;) {
-    line = readHttpLine(fp);
+    line = readHttpLine(fp, &lineBuffer, &lineBufferSize);
     if (line == NULL) {
-      goto free_headers_ret;
+      goto free_line_ret;
     }
 
     if (strlen(line) == 2) {
-      free(line);
       break;
     }
 
-    if (!parseHttpHeaderLine(line, &headers)) {
-      goto free_headers_ret;
+    if (!parseHttpHeaderLine(arena, line, &ret->headers)) {
+      goto free_line_ret;
     }
-    free(line);
   }
 
   size_t contentLength = 0;
-  for (size_t i = 0; i < ccVecLen(&headers); i++) {
-    const StringPair *header = (const StringPair*)ccVecNth(&headers, i);
+  _Bool chunked = 0;
+  ret->host = NULL;
+  for (size_t i = 0; i < ccVecLen(&ret->headers); i++) {
+    const StringPair *header =
+      (const StringPair*)ccVecNth(&ret->headers, i);
     if (strcmp_icase(header->first, "Content-Length")) {
-      int length = atoi(header->second);
-      if (length <= 0) {
-        LOG_WARN("invalid Content-Length header value \"%s\" ignored.",
-                 header->second);
-      } else {
-        contentLength = length;
+      if (!parseContentLength(header->second, &contentLength)) {
+        LOG_ERR("invalid Content-Length header value \"%s\"",
+                header->second);
+        goto free_line_ret;
       }
-      break;
+    } else if (strcmp_icase(header->first, "Transfer-Encoding")) {
+      if (!strcmp_icase(header->second, "chunked")) {
+        LOG_ERR("unsupported Transfer-Encoding \"%s\"", header->second);
+        goto free_line_ret;
+      }
+      chunked = 1;
+    } else if (strcmp_icase(header->first, "Host")) {
+      ret->host = header->second;
     }
   }
+  if (chunked) {
+    contentLength = 0;
+  }
 
-  HttpRequest *ret = 
-    (HttpRequest*)malloc(sizeof(HttpRequest) + contentLength + 1);
-  if (ret == NULL) {
-    goto free_headers_ret;
+  ret->contentLength = contentLength;
+  ret->chunked = chunked;
+  ret->fp = fp;
+  ret->maxBodySize = maxBodySize;
+  ret->bodyRead = 0;
+  ret->bodyRemaining = chunked ? 0 : contentLength;
+  ret->bodyDone = !chunked && contentLength == 0;
+  ret->body = NULL;
+  ret->lineBuffer = lineBuffer;
+  ret->lineBufferSize = lineBufferSize;
+  return ret;
+
+free_line_ret:
+  free(lineBuffer);
+  return NULL;
+}
+
+ssize_t readHttpBody(HttpRequest *request,
+                     char *buffer,
+                     size_t size,
+                     Error *error) {
+  if (request->bodyDone) {
+    return 0;
   }
 
-  if (contentLength != 0) {
-    ssize_t bytesRead = fread(ret->body, 1, contentLength, fp);
-    if (bytesRead < (ssize_t)contentLength) {
-      LOG_ERR("failed to read body of %zu length\n",
-              contentLength);
-      goto free_all_ret;
+  if (request->chunked && request->bodyRemaining == 0) {
+    if (!readChunkHead(request, error)) {
+      return -1;
+    }
+    if (request->bodyDone) {
+      return 0;
     }
   }
-  ret->body[contentLength] = '\0';
 
-  ret->method = method;
-  ret->contentLength = contentLength;
-  ret->requestPath = requestPath;
-  ret->queryString = queryString;
-  ret->params = params;
-  ret->headers = headers;
-  return ret;
+  size_t toRead = size < request->bodyRemaining
+                  ? size
+                  : request->bodyRemaining;
+  if (request->bodyRead + toRead > request->maxBodySize) {
+    QUICK_ERROR2(error, 413, "request body exceeds %zu bytes",
+                 request->maxBodySize);
+    return -1;
+  }
 
-free_all_ret:
-  free(ret);
-  /* fallthrough */
+  size_t bytesRead = fread(buffer, 1, toRead, request->fp);
+  if (bytesRead == 0) {
+    QUICK_ERROR2(error, 400, "request body truncated after %zu bytes",
+                 request->bodyRead);
+    return -1;
+  }
 
-free_headers_ret:
-  for (size_t i = 0; i < ccVecLen(&headers); i++) {
-    StringPair *header = (StringPair*)ccVecNth(&headers, i);
-    dropStringPair(*header);
+  request->bodyRead += bytesRead;
+  request->bodyRemaining -= bytesRead;
+  if (request->bodyRemaining == 0) {
+    if (!request->chunked) {
+      request->bodyDone = 1;
+    } else if (fgetc(request->fp) != '\r'
+               || fgetc(request->fp) != '\n') {
+      QUICK_ERROR(error, 400, "chunk data not followed by CRLF");
+      return -1;
+    }
   }
-  ccVecDestroy(&headers);
-  /* fallthrough */
+  return (ssize_t)bytesRead;
+}
 
-free_params_ret:
-  free(requestPath);
-  free(queryString);
-  for (size_t i = 0; i < ccVecLen(&params); i++) {
-    StringPair *param = (StringPair*)ccVecNth(&params, i);
-    dropStringPair(*param);
+const char *readHttpBodyAll(HttpRequest *request, Error *error) {
+  if (request->body != NULL) {
+    return request->body;
   }
-  ccVecDestroy(&params);
-  free(line);
-  return NULL;
+
+  size_t capacity = request->chunked
+                    || request->contentLength > request->maxBodySize
+                    ? 4096
+                    : request->contentLength + 1;
+  char *body = (char*)malloc(capacity);
+  if (body == NULL) {
+    QUICK_ERROR2(error, 500, "cannot allocate %zu bytes for body",
+                 capacity);
+    return NULL;
+  }
+
+  size_t length = 0;
+  /* a complete Content-Length body fits exactly; do not grow past it */
+  while (!request->bodyDone) {
+    if (length + 1 == capacity) {
+      capacity *= 2;
+      char *newBody = (char*)realloc(body, capacity);
+      if (newBody == NULL) {
+        QUICK_ERROR2(error, 500, "cannot allocate %zu bytes for body",
+                     capacity);
+        free(body);
+        return NULL;
+      }
+      body = newBody;
+    }
+
+    ssize_t bytesRead = readHttpBody(request,
+                                     body + length,
+                                     capacity - length - 1,
+                                     error);
+    if (bytesRead < 0) {
+      free(body);
+      return NULL;
+    }
+    if (bytesRead == 0) {
+      break;
+    }
+    length += bytesRead;
+  }
+
+  body[length] = '\0';
+  request->body = body;
+  request->contentLength = length;
+  return body;
 }
 
-static char *readHttpLine(FILE *fp) {
-  char *line = NULL;
-  size_t n = 0;
-  ssize_t lineSize = getdelim(&line, &n, '\n', fp);
+static char *readHttpLine(FILE *fp, char **buffer, size_t *bufferSize) {
+  ssize_t lineSize = getdelim(buffer, bufferSize, '\n', fp);
 
   if (lineSize == -1) {
     if (errno != 0) {
       LOG_ERR("error: getdelim: %d", errno);
     }
-    free(line);
     return NULL;
   }
 
+  char *line = *buffer;
   if (lineSize > 2
       && (line[lineSize - 1] != '\n'
           || line[lineSize - 2] != '\r')) {
     LOG_ERR("error: http line not ending with \"\\r\\n\"");
-    free(line);
     return NULL;
   }
 
   return line;
 }
 
-static _Bool parseHttpFirstLine(const char *line,
+static _Bool parseHttpFirstLine(Arena *arena,
+                                const char *line,
                                 HttpMethod *method,
                                 char **requestPath,
                                 char **queryString,
@@ -269,7 +349,7 @@ static _Bool parseHttpFirstLine(const char *line,
   it = it2;
   it2 = strchr(it2, ' ');
 
-  if (!parseQueryPath(it, it2, requestPath, queryString, params)) {
+  if (!parseQueryPath(arena, it, it2, requestPath, queryString, params)) {
     LOG_ERR("error parsing http request: \"%s\": invalid query path",
             line);
     return 0;
@@ -284,7 +364,8 @@ static _Bool parseHttpFirstLine(const char *line,
   return 1;
 }
 
-static _Bool parseHttpHeaderLine(const char *line,
+static _Bool parseHttpHeaderLine(Arena *arena,
+                                 const char *line,
                                  ccVec TP(StringPair) *headers) {
   const char *it = strchr(line, ':');
   if (it == NULL) {
@@ -292,20 +373,17 @@ static _Bool parseHttpHeaderLine(const char *line,
     return 0;
   }
 
-  size_t nameSize = it - line;
-  char *name = (char*)malloc(nameSize + 1);
-  strncpy(name, line, nameSize);
-  name[nameSize] = '\0';
+  char *name = arenaStrndup(arena, line, it - line);
 
   it++;
   it = skipWhitespace(it);
   const char *it2 = it;
   while (*it2 != '\r') it2++;
 
-  size_t valueSize = it2 - it;
-  char *value = (char*)malloc(valueSize + 1);
-  strncpy(value, it, valueSize);
-  value[valueSize] = '\0';
+  char *value = arenaStrndup(arena, it, it2 - it);
+  if (name == NULL || value == NULL) {
+    return 0;
+  }
 
   StringPair header = (StringPair) { name, value };
   ccVecPushBack(headers, &header);
@@ -313,6 +391,66 @@ static _Bool parseHttpHeaderLine(const char *line,
   return 1;
 }
 
+static _Bool parseContentLength(const char *value, size_t *dest) {
+  if (*value < '0' || *value > '9') {
+    return 0;
+  }
+
+  char *end = NULL;
+  errno = 0;
+  unsigned long long length = strtoull(value, &end, 10);
+  if (errno == ERANGE || *skipWhitespace(end) != '\0'
+      || length > (unsigned long long)SSIZE_MAX) {
+    return 0;
+  }
+
+  *dest = (size_t)length;
+  return 1;
+}
+
+static _Bool readChunkHead(HttpRequest *request, Error *error) {
+  char *line = readHttpLine(request->fp,
+                            &request->lineBuffer,
+                            &request->lineBufferSize);
+  if (line == NULL) {
+    QUICK_ERROR(error, 400, "missing chunk size line");
+    return 0;
+  }
+
+  char *end = NULL;
+  errno = 0;
+  unsigned long long chunkSize = strtoull(line, &end, 16);
+  if (!isxdigit(*line) || errno == ERANGE
+      || (*end != ';' && *end != '\r')) {
+    QUICK_ERROR(error, 400, "malformed chunk size line");
+    return 0;
+  }
+
+  if (chunkSize == 0) {
+    /* skip trailers up to the terminating empty line */
+    do {
+      line = readHttpLine(request->fp,
+                          &request->lineBuffer,
+                          &request->lineBufferSize);
+      if (line == NULL) {
+        QUICK_ERROR(error, 400, "unterminated chunked body");
+        return 0;
+      }
+    } while (strlen(line) != 2);
+    request->bodyDone = 1;
+    return 1;
+  }
+
+  if (chunkSize > request->maxBodySize - request->bodyRead) {
+    QUICK_ERROR2(error, 413, "request body exceeds %zu bytes",
+                 request->maxBodySize);
+    return 0;
+  }
+
+  request->bodyRemaining = (size_t)chunkSize;
+  return 1;
+}
+
 static const char *skipWhitespace(const char *str) {
   while (isspace(*str) && *str != '\r' && *str != '\n') {
     ++str;
@@ -320,7 +458,8 @@ static const char *skipWhitespace(const char *str) {
   return str;
 }
 
-static _Bool parseQueryPath(const char *it1,
+static _Bool parseQueryPath(Arena *arena,
+                            const char *it1,
                             const char *it2,
                             char **requestPath,
                             char **queryString,
@@ -330,10 +469,10 @@ static _Bool parseQueryPath(const char *it1,
     it3++;
   }
   
-  size_t pathSize = it3 - it1;
-  *requestPath = (char*)malloc(pathSize + 1);
-  strncpy(*requestPath, it1, pathSize);
-  (*requestPath)[pathSize] = '\0';
+  *requestPath = arenaStrndup(arena, it1, it3 - it1);
+  if (*requestPath == NULL) {
+    return 0;
+  }
 
   if (*it3 != '?') {
     return 1;
@@ -341,10 +480,10 @@ static _Bool parseQueryPath(const char *it1,
 
   it3++;
 
-  size_t queryStringSize = it2 - it3;
-  *queryString = (char*)malloc(queryStringSize + 1);
-  strncpy(*queryString, it3, queryStringSize);
-  (*queryString)[queryStringSize] = '\0';
+  *queryString = arenaStrndup(arena, it3, it2 - it3);
+  if (*queryString == NULL) {
+    return 0;
+  }
 
   for (;;) {
     it1 = it3;
@@ -361,15 +500,12 @@ static _Bool parseQueryPath(const char *it1,
       it4++;
     }
  
-    size_t keySize = it3 - it1;
-    size_t valueSize = it4 - it3 - 1;
-    char *key = (char*)malloc(keySize + 1);
-    char *value = (char*)malloc(valueSize + 1);
-    strncpy(key, it1, keySize);
-    key[keySize] = '\0';
-    strncpy(value, it3 + 1, valueSize);
-    value[valueSize] = '\0';
-    
+    char *key = arenaStrndup(arena, it1, it3 - it1);
+    char *value = arenaStrndup(arena, it3 + 1, it4 - it3 - 1);
+    if (key == NULL || value == NULL) {
+      return 0;
+    }
+
     StringPair param = (StringPair) { key, value };
     ccVecPushBack(params, &param);
 
@@ -0,0 +1,192 @@
+#include "http_head.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include "http_base.h"
+#include "util.h"
+
+typedef struct st_status_line {
+  const char *line;
+  size_t size;
+} StatusLine;
+
+#define STATUS_LINE(code, reason) \
+  [code] = { \
+    "HTTP/1.1 " #code " " reason "\r\n", \
+    sizeof("HTTP/1.1 " #code " " reason "\r\n") - 1 \
+  },
+
+static const StatusLine STATUS_LINES[HTTP_CODE_MAX + 1] = {
+  HTTP_STATUS_CODES(STATUS_LINE)
+};
+
+static const char DIGIT_PAIRS[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+size_t formatUint(char *buffer, uint64_t value) {
+  char digits[UINT_DIGITS_MAX];
+  char *p = digits + sizeof(digits);
+
+  /* two digits at a time, from the back */
+  while (value >= 100) {
+    const char *pair = DIGIT_PAIRS + (value % 100) * 2;
+    value /= 100;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  if (value >= 10) {
+    const char *pair = DIGIT_PAIRS + value * 2;
+    *--p = pair[1];
+    *--p = pair[0];
+  } else {
+    *--p = (char)('0' + value);
+  }
+
+  size_t size = (size_t)(digits + sizeof(digits) - p);
+  memcpy(buffer, p, size);
+  return size;
+}
+
+const char *httpStatusLine(int code, char *buffer) {
+  if (code >= HTTP_CODE_MIN && code <= HTTP_CODE_MAX
+      && STATUS_LINES[code].line != NULL) {
+    return STATUS_LINES[code].line;
+  }
+
+  if (code < HTTP_CODE_MIN || code > HTTP_CODE_MAX) {
+    LOG_WARN("invalid status code %d, sending 500 instead", code);
+    return STATUS_LINES[500].line;
+  }
+
+  size_t size = 9;
+  memcpy(buffer, "HTTP/1.1 ", 9);
+  size += formatUint(buffer + size, (uint64_t)code);
+  memcpy(buffer + size, " Unknown\r\n", 11);
+  return buffer;
+}
+
+void outStatusLine(OutBuf *out, int code) {
+  if (code >= HTTP_CODE_MIN && code <= HTTP_CODE_MAX
+      && STATUS_LINES[code].line != NULL) {
+    outRef(out, STATUS_LINES[code].line, STATUS_LINES[code].size);
+    return;
+  }
+
+  char buffer[STATUS_LINE_MAX];
+  const char *line = httpStatusLine(code, buffer);
+  outWrite(out, line, strlen(line));
+}
+
+void outHeader(OutBuf *out, const char *name, const char *value) {
+  outWrite(out, name, strlen(name));
+  outWrite(out, ": ", 2);
+  outWrite(out, value, strlen(value));
+  outWrite(out, "\r\n", 2);
+}
+
+void outHeaderUint(OutBuf *out, const char *name, uint64_t value) {
+  char buffer[128];
+  size_t nameSize = strlen(name);
+  if (nameSize > sizeof(buffer) - UINT_DIGITS_MAX - 4) {
+    char digits[UINT_DIGITS_MAX];
+    size_t digitCount = formatUint(digits, value);
+    outWrite(out, name, nameSize);
+    outWrite(out, ": ", 2);
+    outWrite(out, digits, digitCount);
+    outWrite(out, "\r\n", 2);
+    return;
+  }
+
+  size_t size = nameSize;
+  memcpy(buffer, name, nameSize);
+  buffer[size++] = ':';
+  buffer[size++] = ' ';
+  size += formatUint(buffer + size, value);
+  buffer[size++] = '\r';
+  buffer[size++] = '\n';
+  outWrite(out, buffer, size);
+}
+
+/*
+ * "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n". Readers copy whichever
+ * slot is current while the next one is rendered, and a slot is only
+ * rendered again DATE_SLOTS seconds after it was retired.
+ */
+#define DATE_SLOTS 4
+
+static char dateSlots[DATE_SLOTS][DATE_HEADER_SIZE];
+static _Atomic unsigned currentDateSlot;
+static time_t renderedSecond = -1;
+
+static const char WEEKDAY_NAMES[7][4] = {
+  "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+static const char MONTH_NAMES[12][4] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static char *putPair(char *p, int value) {
+  memcpy(p, DIGIT_PAIRS + value * 2, 2);
+  return p + 2;
+}
+
+void refreshDateHeader(void) {
+  time_t now = time(NULL);
+  if (now == renderedSecond) {
+    return;
+  }
+
+  struct tm tm;
+  gmtime_r(&now, &tm);
+
+  unsigned slot = (atomic_load_explicit(&currentDateSlot,
+                                        memory_order_relaxed) + 1)
+                  % DATE_SLOTS;
+  char *p = dateSlots[slot];
+  memcpy(p, "Date: ", 6);
+  p += 6;
+  memcpy(p, WEEKDAY_NAMES[tm.tm_wday], 3);
+  p += 3;
+  *p++ = ',';
+  *p++ = ' ';
+  p = putPair(p, tm.tm_mday);
+  *p++ = ' ';
+  memcpy(p, MONTH_NAMES[tm.tm_mon], 3);
+  p += 3;
+  *p++ = ' ';
+  p = putPair(p, (tm.tm_year + 1900) / 100 % 100);
+  p = putPair(p, (tm.tm_year + 1900) % 100);
+  *p++ = ' ';
+  p = putPair(p, tm.tm_hour);
+  *p++ = ':';
+  p = putPair(p, tm.tm_min);
+  *p++ = ':';
+  p = putPair(p, tm.tm_sec % 60);
+  memcpy(p, " GMT\r\n", 6);
+
+  renderedSecond = now;
+  atomic_store_explicit(&currentDateSlot, slot, memory_order_release);
+}
+
+void outDateHeader(OutBuf *out) {
+  outWrite(out, currentDateHeader(), DATE_HEADER_SIZE);
+}
+
+const char *currentDateHeader(void) {
+  unsigned slot = atomic_load_explicit(&currentDateSlot,
+                                       memory_order_acquire);
+  return dateSlots[slot];
+}
@@ -1,8 +1,22 @@
 #include "intern.h"
 #include "config.h"
+#include "http_head.h"
+#include "file_util.h"
+#include "metrics.h"
+#include "out_buf.h"
+#include "static.h"
 
+#include <stdlib.h>
 #include <string.h>
 
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+static void sendMetricsPage(const Metrics *metrics,
+                            OutBuf *out,
+                            Error *error);
+
 #define ERROR_PAGE_COMMON_START \
   "<html>\n" \
   "  <meta charset=\"utf-8\">\n" \
@@ -21,6 +35,9 @@
   "      <h2>" ERROR "</h2>\n" \
   ERROR_PAGE_COMMON_END
 
+extern const char *ERROR_PAGE_400_CONTENT =
+  MAKE_ERROR_PAGE("400 Bad Request") ;
+
 extern const char *ERROR_PAGE_403_CONTENT =
   MAKE_ERROR_PAGE("403 Forbidden") ;
 
@@ -30,6 +47,24 @@ extern const char *ERROR_PAGE_404_CONTENT =
 extern const char *ERROR_PAGE_405_CONTENT =
   MAKE_ERROR_PAGE("405 Method Not Allowed") ;
 
+extern const char *ERROR_PAGE_408_CONTENT =
+  MAKE_ERROR_PAGE("408 Request Timeout") ;
+
+extern const char *ERROR_PAGE_413_CONTENT =
+  MAKE_ERROR_PAGE("413 Payload Too Large") ;
+
+extern const char *ERROR_PAGE_429_CONTENT =
+  MAKE_ERROR_PAGE("429 Too Many Requests") ;
+
+extern const char *ERROR_PAGE_502_CONTENT =
+  MAKE_ERROR_PAGE("502 Bad Gateway") ;
+
+extern const char *ERROR_PAGE_503_CONTENT =
+  MAKE_ERROR_PAGE("503 Service Unavailable") ;
+
+extern const char *ERROR_PAGE_504_CONTENT =
+  MAKE_ERROR_PAGE("504 Gateway Timeout") ;
+
 extern const char *ERROR_PAGE_500_CONTENT_PART1 =
 ERROR_PAGE_COMMON_START
 "      <h2>500 Internal Server Error</h2>\n"
@@ -49,6 +84,9 @@ extern const char *GENERAL_HEADERS =
 "Cache-Control: public, max-age=1800\r\n"
 "Connection: close\r\n\r\n";
 
+extern const char *ERROR_PAGE_400_HEAD =
+"HTTP/1.1 400 Bad Request\r\n";
+
 extern const char *ERROR_PAGE_403_HEAD =
 "HTTP/1.1 403 Forbidden\r\n";
 
@@ -58,50 +96,292 @@ extern const char *ERROR_PAGE_404_HEAD =
 extern const char *ERROR_PAGE_405_HEAD =
 "HTTP/1.1 405 Method Not Allowed\r\n";
 
+extern const char *ERROR_PAGE_408_HEAD =
+"HTTP/1.1 408 Request Timeout\r\n";
+
+extern const char *ERROR_PAGE_413_HEAD =
+"HTTP/1.1 413 Payload Too Large\r\n";
+
+extern const char *ERROR_PAGE_429_HEAD =
+"HTTP/1.1 429 Too Many Requests\r\n";
+
+extern const char *ERROR_PAGE_502_HEAD =
+"HTTP/1.1 502 Bad Gateway\r\n";
+
+extern const char *ERROR_PAGE_503_HEAD =
+"HTTP/1.1 503 Service Unavailable\r\n";
+
+extern const char *ERROR_PAGE_504_HEAD =
+"HTTP/1.1 504 Gateway Timeout\r\n";
+
 extern const char *ERROR_PAGE_500_HEAD =
 "HTTP/1.1 500 Internal Server Error\r\n";
 
-void send403Page(FILE *fp) {
-  fputs(ERROR_PAGE_403_HEAD, fp);
-  fprintf(fp, "Content-Length: %zu\r\n",
-          strlen(ERROR_PAGE_403_CONTENT));
-  fprintf(fp, "Server: %s\r\n", CHTTPD_SERVER_NAME);
-  fputs(GENERAL_HEADERS, fp);
-  fputs(ERROR_PAGE_403_CONTENT, fp);
-}
-
-void send404Page(FILE *fp) {
-  fputs(ERROR_PAGE_404_HEAD, fp);
-  fprintf(fp, "Content-Length: %zu\r\n",
-          strlen(ERROR_PAGE_404_CONTENT));
-  fprintf(fp, "Server: %s\r\n", CHTTPD_SERVER_NAME);
-  fputs(GENERAL_HEADERS, fp);
-  fputs(ERROR_PAGE_404_CONTENT, fp);
-}
-
-void send405Page(FILE *fp) {
-  fputs(ERROR_PAGE_405_HEAD, fp);
-  fprintf(fp, "Content-Length: %zu\r\n",
-          strlen(ERROR_PAGE_405_CONTENT));
-  fprintf(fp, "Server: %s\r\n", CHTTPD_SERVER_NAME);
-  fputs(GENERAL_HEADERS, fp);
-  fputs(ERROR_PAGE_405_CONTENT, fp);
-}
-
-void send500Page(FILE *fp, Error *error) {
-  fputs(ERROR_PAGE_500_HEAD, fp);
-  fprintf(fp, "Server: %s\r\n", CHTTPD_SERVER_NAME);
-  fputs(GENERAL_HEADERS, fp);
-  fputs(ERROR_PAGE_500_CONTENT_PART1, fp);
-  fprintf(fp, "%s:%zi: %s",
-          error->sourceInfo.sourceFile,
-          error->sourceInfo.line,
-          error->errorBuffer);
-  fputs(ERROR_PAGE_500_CONTENT_PART2, fp);
-}
-
-void handleIntern(const char *handlerPath, Error *error) {
-  if (!strcmp(handlerPath, "403")) {
+/*
+ * An error response rendered whole at startup, all but the Date header,
+ * which goes in at `dateAt` when the page is sent.
+ */
+typedef struct st_error_page {
+  int code;
+  const char **head;
+  const char **content;
+  _Bool retryAfter;
+
+  char *data;
+  size_t size;
+  size_t dateAt;
+} ErrorPage;
+
+static ErrorPage errorPages[] = {
+  { 400, &ERROR_PAGE_400_HEAD, &ERROR_PAGE_400_CONTENT, 0, NULL, 0, 0 },
+  { 403, &ERROR_PAGE_403_HEAD, &ERROR_PAGE_403_CONTENT, 0, NULL, 0, 0 },
+  { 404, &ERROR_PAGE_404_HEAD, &ERROR_PAGE_404_CONTENT, 0, NULL, 0, 0 },
+  { 405, &ERROR_PAGE_405_HEAD, &ERROR_PAGE_405_CONTENT, 0, NULL, 0, 0 },
+  { 408, &ERROR_PAGE_408_HEAD, &ERROR_PAGE_408_CONTENT, 0, NULL, 0, 0 },
+  { 413, &ERROR_PAGE_413_HEAD, &ERROR_PAGE_413_CONTENT, 0, NULL, 0, 0 },
+  { 429, &ERROR_PAGE_429_HEAD, &ERROR_PAGE_429_CONTENT, 1, NULL, 0, 0 },
+  { 502, &ERROR_PAGE_502_HEAD, &ERROR_PAGE_502_CONTENT, 0, NULL, 0, 0 },
+  { 503, &ERROR_PAGE_503_HEAD, &ERROR_PAGE_503_CONTENT, 1, NULL, 0, 0 },
+  { 504, &ERROR_PAGE_504_HEAD, &ERROR_PAGE_504_CONTENT, 0, NULL, 0, 0 },
+};
+
+#define ERROR_PAGE_COUNT (sizeof(errorPages) / sizeof(errorPages[0]))
+
+static ErrorPage *findErrorPage(int code);
+static void renderErrorPage(ErrorPage *page,
+                            const char *contentType,
+                            const char *content,
+                            size_t contentSize,
+                            Error *error);
+static char *loadErrorPageFile(const char *path,
+                               size_t *size,
+                               Error *error);
+static void sendErrorPage(OutBuf *out, int code);
+
+_Bool hasErrorPage(int code) {
+  return findErrorPage(code) != NULL;
+}
+
+void prerenderErrorPages(const Config *config, Error *error) {
+  for (size_t i = 0; i < ERROR_PAGE_COUNT; i++) {
+    ErrorPage *page = &errorPages[i];
+
+    /* the last one configured for a code wins */
+    const char *path = NULL;
+    for (size_t j = 0; j < ccVecLen(&config->errorPages); j++) {
+      const ErrorPageConfig *pageConfig =
+        (const ErrorPageConfig*)ccVecNth(&config->errorPages, j);
+      if (pageConfig->code == page->code) {
+        path = pageConfig->path;
+      }
+    }
+
+    if (path == NULL) {
+      renderErrorPage(page,
+                      "text/html",
+                      *page->content,
+                      strlen(*page->content),
+                      error);
+    } else {
+      size_t contentSize = 0;
+      char *content = loadErrorPageFile(path, &contentSize, error);
+      if (isError(error)) {
+        return;
+      }
+      renderErrorPage(page, mimeGuess(path), content, contentSize, error);
+      free(content);
+    }
+    if (isError(error)) {
+      return;
+    }
+  }
+}
+
+void dropErrorPages(void) {
+  for (size_t i = 0; i < ERROR_PAGE_COUNT; i++) {
+    free(errorPages[i].data);
+    errorPages[i].data = NULL;
+    errorPages[i].size = 0;
+  }
+}
+
+void send400Page(OutBuf *out) {
+  sendErrorPage(out, 400);
+}
+
+void send403Page(OutBuf *out) {
+  sendErrorPage(out, 403);
+}
+
+void send404Page(OutBuf *out) {
+  sendErrorPage(out, 404);
+}
+
+void send405Page(OutBuf *out) {
+  sendErrorPage(out, 405);
+}
+
+void send408Page(OutBuf *out) {
+  sendErrorPage(out, 408);
+}
+
+void send413Page(OutBuf *out) {
+  sendErrorPage(out, 413);
+}
+
+void send429Page(OutBuf *out) {
+  sendErrorPage(out, 429);
+}
+
+void send502Page(OutBuf *out) {
+  sendErrorPage(out, 502);
+}
+
+void send503Page(OutBuf *out) {
+  sendErrorPage(out, 503);
+}
+
+void send504Page(OutBuf *out) {
+  sendErrorPage(out, 504);
+}
+
+void sendOverloadPage(int fd) {
+  const ErrorPage *page = findErrorPage(503);
+  struct iovec iov[3] = {
+    { page->data, page->dateAt },
+    { (void*)currentDateHeader(), DATE_HEADER_SIZE },
+    { page->data + page->dateAt, page->size - page->dateAt }
+  };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 3;
+
+  /* best effort, the accepting thread must never block on a client */
+  if (sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+    return;
+  }
+
+  /* closing with unread input would reset the connection, and the
+     client might never see the response */
+  char drain[4096];
+  shutdown(fd, SHUT_WR);
+  while (recv(fd, drain, sizeof(drain), MSG_DONTWAIT) > 0) {
+  }
+}
+
+static ErrorPage *findErrorPage(int code) {
+  for (size_t i = 0; i < ERROR_PAGE_COUNT; i++) {
+    if (errorPages[i].code == code) {
+      return &errorPages[i];
+    }
+  }
+  return NULL;
+}
+
+static void renderErrorPage(ErrorPage *page,
+                            const char *contentType,
+                            const char *content,
+                            size_t contentSize,
+                            Error *error) {
+  char head[512];
+  int headSize = snprintf(head, sizeof(head),
+                          "%s"
+                          "Server: " CHTTPD_SERVER_NAME "\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Content-Type: %s\r\n"
+                          "Content-Encoding: identity\r\n"
+                          "Cache-Control: public, max-age=1800\r\n"
+                          "%s"
+                          "Connection: close\r\n",
+                          *page->head,
+                          contentSize,
+                          contentType,
+                          page->retryAfter ? "Retry-After: 1\r\n" : "");
+  if (headSize < 0 || (size_t)headSize >= sizeof(head)) {
+    QUICK_ERROR2(error, 500, "cannot render error page %d", page->code);
+    return;
+  }
+
+  size_t size = (size_t)headSize + 2 + contentSize;
+  char *data = (char*)malloc(size);
+  if (data == NULL) {
+    QUICK_ERROR2(error, 500, "cannot allocate error page %d", page->code);
+    return;
+  }
+  memcpy(data, head, (size_t)headSize);
+  memcpy(data + headSize, "\r\n", 2);
+  memcpy(data + headSize + 2, content, contentSize);
+
+  free(page->data);
+  page->data = data;
+  page->size = size;
+  page->dateAt = (size_t)headSize;
+}
+
+static char *loadErrorPageFile(const char *path,
+                               size_t *size,
+                               Error *error) {
+  *size = 0;
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    QUICK_ERROR2(error, 500, "cannot open error page file: %s", path);
+    return NULL;
+  }
+
+  struct stat fileStat;
+  if (fstat(fileno(fp), &fileStat) < 0) {
+    QUICK_ERROR2(error, 500, "cannot get size of error page file: %s",
+                 path);
+    fclose(fp);
+    return NULL;
+  }
+
+  *size = (size_t)fileStat.st_size;
+  char *content = (char*)malloc(*size + 1);
+  if (content == NULL) {
+    QUICK_ERROR2(error, 500, "cannot allocate error page file: %s", path);
+    fclose(fp);
+    return NULL;
+  }
+  if (readAll(fp, content, *size) != (ssize_t)*size) {
+    QUICK_ERROR2(error, 500, "cannot read error page file: %s", path);
+    free(content);
+    content = NULL;
+    *size = 0;
+  }
+  fclose(fp);
+  return content;
+}
+
+/* three pieces, which still go out in one sendmsg */
+static void sendErrorPage(OutBuf *out, int code) {
+  const ErrorPage *page = findErrorPage(code);
+  outRef(out, page->data, page->dateAt);
+  outDateHeader(out);
+  outRef(out, page->data + page->dateAt, page->size - page->dateAt);
+}
+
+void send500Page(OutBuf *out, Error *error) {
+  outStatic(out, ERROR_PAGE_500_HEAD);
+  outStatic(out, "Server: " CHTTPD_SERVER_NAME "\r\n");
+  outDateHeader(out);
+  outStatic(out, GENERAL_HEADERS);
+  outStatic(out, ERROR_PAGE_500_CONTENT_PART1);
+  outPrintf(out, "%s:%zi: %s",
+            error->sourceInfo.sourceFile,
+            error->sourceInfo.line,
+            error->errorBuffer);
+  outStatic(out, ERROR_PAGE_500_CONTENT_PART2);
+}
+
+void handleIntern(const Config *config,
+                  const char *handlerPath,
+                  OutBuf *out,
+                  Error *error) {
+  if (!strcmp(handlerPath, "metrics")) {
+    sendMetricsPage(config->metrics, out, error);
+  } else if (!strcmp(handlerPath, "403")) {
     QUICK_ERROR(error, 403, "user appointed");
   } else if (!strcmp(handlerPath, "404")) {
     QUICK_ERROR(error, 404, "user appointed");
@@ -113,3 +393,33 @@ void handleIntern(const char *handlerPath, Error *error) {
   }
 }
 
+
+static void sendMetricsPage(const Metrics *metrics,
+                            OutBuf *out,
+                            Error *error) {
+  char *body = NULL;
+  size_t bodySize = 0;
+  FILE *fpBody = open_memstream(&body, &bodySize);
+  if (fpBody == NULL) {
+    QUICK_ERROR(error, 500, "cannot open metrics buffer");
+    return;
+  }
+  writeMetrics(metrics, fpBody);
+  if (fclose(fpBody) != 0) {
+    QUICK_ERROR(error, 500, "cannot render metrics");
+    free(body);
+    return;
+  }
+
+  outStatic(out, "HTTP/1.1 200 OK\r\n");
+  outStatic(out, "Server: " CHTTPD_SERVER_NAME "\r\n");
+  outHeaderUint(out, "Content-Length", bodySize);
+  outDateHeader(out);
+  outStatic(out,
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Connection: close\r\n\r\n");
+  outRef(out, body, bodySize);
+  outFlush(out);
+  free(body);
+}
@@ -0,0 +1,384 @@
+#define _GNU_SOURCE
+
+#include "lifecycle.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "conn_limit.h"
+#include "file_util.h"
+#include "util.h"
+
+#define DRAIN_POLL_MS 50
+#define FD_DIGITS_MAX 10
+
+extern char **environ;
+
+#define LIFECYCLE_SIGNAL_COUNT 4
+
+static const int LIFECYCLE_SIGNALS[LIFECYCLE_SIGNAL_COUNT] = {
+  SIGTERM, SIGINT, SIGUSR2, SIGHUP
+};
+
+static volatile sig_atomic_t stopRequested;
+static volatile sig_atomic_t upgradeRequested;
+static volatile sig_atomic_t reloadRequested;
+static sigset_t waitMask;
+
+static const char **savedArgv;
+static char exePath[PATH_MAX];
+static int *listenFds;
+static size_t listenFdCount;
+static int readyFd = -1;
+
+static void onSignal(int sig);
+static _Bool parseFd(const char *value, int *fd);
+static int takeEnvFd(const char *name);
+static void takeListenFds(void);
+static char **upgradeEnviron(char *listenVar);
+static char *listenFdVar(size_t count);
+static _Bool waitReady(int fd, pid_t pid);
+
+void initLifecycle(int argc, const char *argv[]) {
+  (void)argc;
+  savedArgv = argv;
+
+  /* started through a path, that path is where the new binary lands */
+  if (strchr(argv[0], '/') != NULL) {
+    strncpy(exePath, argv[0], sizeof(exePath) - 1);
+  } else {
+    ssize_t len = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+    exePath[len > 0 ? len : 0] = '\0';
+  }
+
+  takeListenFds();
+  readyFd = takeEnvFd(READY_FD_ENV);
+
+  sigset_t blocked;
+  sigemptyset(&blocked);
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onSignal;
+  sigemptyset(&action.sa_mask);
+  /* no SA_RESTART, the accepting thread's wait has to return */
+  action.sa_flags = 0;
+  for (size_t i = 0; i < LIFECYCLE_SIGNAL_COUNT; i++) {
+    sigaddset(&blocked, LIFECYCLE_SIGNALS[i]);
+    sigaction(LIFECYCLE_SIGNALS[i], &action, NULL);
+  }
+
+  pthread_sigmask(SIG_BLOCK, &blocked, &waitMask);
+  for (size_t i = 0; i < LIFECYCLE_SIGNAL_COUNT; i++) {
+    sigdelset(&waitMask, LIFECYCLE_SIGNALS[i]);
+  }
+}
+
+const sigset_t *lifecycleWaitMask(void) {
+  return &waitMask;
+}
+
+LifecycleEvent takeLifecycleEvent(void) {
+  if (stopRequested) {
+    stopRequested = 0;
+    return LIFECYCLE_STOP;
+  }
+  if (upgradeRequested) {
+    upgradeRequested = 0;
+    return LIFECYCLE_UPGRADE;
+  }
+  if (reloadRequested) {
+    reloadRequested = 0;
+    return LIFECYCLE_RELOAD;
+  }
+  return LIFECYCLE_NONE;
+}
+
+void resetLifecycleSignals(void) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = SIG_DFL;
+  sigemptyset(&action.sa_mask);
+
+  sigset_t unblocked;
+  sigemptyset(&unblocked);
+  for (size_t i = 0; i < LIFECYCLE_SIGNAL_COUNT; i++) {
+    sigaction(LIFECYCLE_SIGNALS[i], &action, NULL);
+    sigaddset(&unblocked, LIFECYCLE_SIGNALS[i]);
+  }
+  pthread_sigmask(SIG_UNBLOCK, &unblocked, NULL);
+}
+
+const int *inheritedListenFds(size_t *count) {
+  *count = listenFdCount;
+  return listenFds;
+}
+
+void becomeWorkerProcess(pid_t master, int fdReady) {
+  /* upgrades are the master's business */
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = SIG_IGN;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR2, &action, NULL);
+
+  /* delivered once the accepting thread waits, like any stop request */
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  if (getppid() != master) {
+    raise(SIGTERM);
+  }
+
+  if (readyFd >= 0) {
+    close(readyFd);
+  }
+  readyFd = fdReady;
+  free(listenFds);
+  listenFds = NULL;
+  listenFdCount = 0;
+}
+
+void notifyUpgradeReady(void) {
+  if (readyFd < 0) {
+    return;
+  }
+  char ready = 1;
+  if (write(readyFd, &ready, 1) != 1) {
+    LOG_WARN("cannot report readiness to the old process: %d", errno);
+  }
+  close(readyFd);
+  readyFd = -1;
+}
+
+_Bool startUpgrade(const int *fdsListen, size_t count) {
+  if (exePath[0] == '\0') {
+    LOG_ERR("cannot upgrade, the path of the binary is unknown");
+    return 0;
+  }
+
+  int readyPipe[2];
+  if (pipe2(readyPipe, O_CLOEXEC) < 0) {
+    LOG_ERR("cannot upgrade, failed creating pipe: %d", errno);
+    return 0;
+  }
+  /* nothing but async-signal-safe calls past fork */
+  char *listenVar = listenFdVar(count);
+  char **envp = listenVar != NULL ? upgradeEnviron(listenVar) : NULL;
+  int *fdsMoved = (int*)malloc((count + 1) * sizeof(int));
+  if (envp == NULL || fdsMoved == NULL) {
+    LOG_ERR("cannot upgrade, failed allocating environment");
+    free(listenVar);
+    free(envp);
+    free(fdsMoved);
+    close(readyPipe[0]);
+    close(readyPipe[1]);
+    return 0;
+  }
+
+  LOG_INFO("upgrading to %s", exePath);
+  pid_t pid = fork();
+  if (pid == 0) {
+    resetLifecycleSignals();
+    /* out of the way of 3 and up first, where they are to end up */
+    int lowFd = (int)(4 + count);
+    fdsMoved[0] = fcntl(readyPipe[1], F_DUPFD, lowFd);
+    for (size_t i = 0; i < count; i++) {
+      fdsMoved[i + 1] = fcntl(fdsListen[i], F_DUPFD, lowFd);
+    }
+    for (size_t i = 0; i <= count; i++) {
+      if (fdsMoved[i] < 0 || dup2(fdsMoved[i], (int)(3 + i)) < 0) {
+        _exit(127);
+      }
+    }
+    closeDescriptorsFrom(lowFd);
+    execve(exePath, (char* const*)savedArgv, envp);
+    _exit(127);
+  }
+
+  free(listenVar);
+  free(envp);
+  free(fdsMoved);
+  close(readyPipe[1]);
+  if (pid < 0) {
+    LOG_ERR("cannot upgrade, failed forking: %d", errno);
+    close(readyPipe[0]);
+    return 0;
+  }
+
+  _Bool ready = waitReady(readyPipe[0], pid);
+  close(readyPipe[0]);
+  if (!ready) {
+    return 0;
+  }
+  LOG_INFO("new binary up as pid %d", (int)pid);
+  return 1;
+}
+
+_Bool drainConnections(int timeoutSec) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeoutSec;
+
+  while (activeConnections() != 0) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > deadline.tv_sec
+        || (now.tv_sec == deadline.tv_sec
+            && now.tv_nsec >= deadline.tv_nsec)) {
+      return 0;
+    }
+
+    /* a second stop request means not to wait any longer */
+    struct timespec pause = { 0, DRAIN_POLL_MS * 1000000L };
+    ppoll(NULL, 0, &pause, &waitMask);
+    if (takeLifecycleEvent() == LIFECYCLE_STOP) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void onSignal(int sig) {
+  if (sig == SIGUSR2) {
+    upgradeRequested = 1;
+  } else if (sig == SIGHUP) {
+    reloadRequested = 1;
+  } else {
+    stopRequested = 1;
+  }
+}
+
+/* a descriptor number, which has to be open */
+static _Bool parseFd(const char *value, int *fd) {
+  char *end;
+  long number = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || number < 0 || number > INT_MAX
+      || fcntl((int)number, F_GETFD) < 0) {
+    return 0;
+  }
+  fcntl((int)number, F_SETFD, FD_CLOEXEC);
+  *fd = (int)number;
+  return 1;
+}
+
+static int takeEnvFd(const char *name) {
+  const char *value = getenv(name);
+  if (value == NULL) {
+    return -1;
+  }
+
+  int fd;
+  _Bool valid = parseFd(value, &fd);
+  unsetenv(name);
+  if (!valid) {
+    LOG_WARN("ignoring invalid %s", name);
+    return -1;
+  }
+  return fd;
+}
+
+/* comma separated, one descriptor per listening socket */
+static void takeListenFds(void) {
+  const char *value = getenv(LISTEN_FD_ENV);
+  if (value == NULL) {
+    return;
+  }
+
+  char *list = copyString(value);
+  unsetenv(LISTEN_FD_ENV);
+  size_t count = 1;
+  for (const char *p = list; p != NULL && *p != '\0'; p++) {
+    count += *p == ',';
+  }
+  listenFds = list != NULL ? (int*)malloc(count * sizeof(int)) : NULL;
+  if (listenFds == NULL) {
+    LOG_WARN("cannot take over listening sockets, out of memory");
+    free(list);
+    return;
+  }
+
+  char *saveptr;
+  for (char *item = strtok_r(list, ",", &saveptr);
+       item != NULL;
+       item = strtok_r(NULL, ",", &saveptr)) {
+    if (!parseFd(item, &listenFds[listenFdCount])) {
+      LOG_WARN("ignoring invalid %s entry: %s", LISTEN_FD_ENV, item);
+      continue;
+    }
+    listenFdCount++;
+  }
+  free(list);
+}
+
+/* "CHTTPD_LISTEN_FD=4,5,..." for `count` sockets from descriptor 4 on */
+static char *listenFdVar(size_t count) {
+  size_t size = sizeof(LISTEN_FD_ENV "=") + count * (FD_DIGITS_MAX + 1);
+  char *var = (char*)malloc(size);
+  if (var == NULL) {
+    return NULL;
+  }
+
+  size_t used = (size_t)snprintf(var, size, "%s=", LISTEN_FD_ENV);
+  for (size_t i = 0; i < count; i++) {
+    used += (size_t)snprintf(var + used, size - used,
+                             i == 0 ? "%zu" : ",%zu",
+                             4 + i);
+  }
+  return var;
+}
+
+/* the environment, with the descriptors for the new process */
+static char **upgradeEnviron(char *listenVar) {
+  size_t count = 0;
+  while (environ[count] != NULL) {
+    count++;
+  }
+
+  char **envp = (char**)malloc((count + 3) * sizeof(char*));
+  if (envp == NULL) {
+    return NULL;
+  }
+  size_t used = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (strncmp(environ[i], LISTEN_FD_ENV "=", sizeof(LISTEN_FD_ENV))
+        && strncmp(environ[i], READY_FD_ENV "=", sizeof(READY_FD_ENV))) {
+      envp[used++] = environ[i];
+    }
+  }
+  envp[used++] = (char*)(READY_FD_ENV "=3");
+  envp[used++] = listenVar;
+  envp[used] = NULL;
+  return envp;
+}
+
+static _Bool waitReady(int fd, pid_t pid) {
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  int res;
+  do {
+    res = poll(&pfd, 1, UPGRADE_READY_TIMEOUT_MS);
+  } while (res < 0 && errno == EINTR);
+
+  char ready = 0;
+  if (res > 0 && read(fd, &ready, 1) == 1) {
+    return 1;
+  }
+
+  if (res == 0) {
+    LOG_ERR("new binary not ready in %d ms, killing it",
+            UPGRADE_READY_TIMEOUT_MS);
+    kill(pid, SIGKILL);
+  } else {
+    LOG_ERR("new binary exited before taking over");
+  }
+  waitpid(pid, NULL, 0);
+  return 0;
+}
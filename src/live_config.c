@@ -0,0 +1,208 @@
+#include "live_config.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "util.h"
+
+#define RELOAD_ERROR_SIZE 4096
+
+static const char *configPath;
+static _Atomic(Config*) currentConfig;
+static _Atomic unsigned currentEpoch;
+/* readers pinned in even and odd epochs */
+static _Atomic size_t epochReaders[2];
+
+static pthread_mutex_t reloadLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t reloadThread;
+static _Bool reloadStarted;
+static _Bool reloadRunning;
+static _Bool reloadPending;
+
+static void *reloadMain(void *unused);
+static void reloadOnce(void);
+static void warnFixedChanges(const Config *old, const Config *config);
+static _Bool sameListeners(const Config *old, const Config *config);
+static _Bool sameErrorPages(const Config *old, const Config *config);
+static void freeConfig(Config *config);
+
+void initLiveConfig(const char *path, Config *config) {
+  configPath = path;
+  atomic_store(&currentConfig, config);
+}
+
+const Config *pinConfig(ConfigPin *pin) {
+  /*
+   * Once the epoch reads the same after announcing ourselves, a reload
+   * swapping the pointer from here on waits for us before dropping
+   * what we are about to read.
+   */
+  for (;;) {
+    unsigned epoch = atomic_load(&currentEpoch);
+    atomic_fetch_add(&epochReaders[epoch % 2], 1);
+    if (atomic_load(&currentEpoch) == epoch) {
+      pin->epoch = epoch;
+      return atomic_load(&currentConfig);
+    }
+    atomic_fetch_sub(&epochReaders[epoch % 2], 1);
+  }
+}
+
+void unpinConfig(const ConfigPin *pin) {
+  atomic_fetch_sub_explicit(&epochReaders[pin->epoch % 2],
+                            1,
+                            memory_order_release);
+}
+
+void requestConfigReload(void) {
+  pthread_mutex_lock(&reloadLock);
+  reloadPending = 1;
+  if (!reloadRunning) {
+    if (reloadStarted) {
+      pthread_join(reloadThread, NULL);
+    }
+    reloadStarted =
+      pthread_create(&reloadThread, NULL, reloadMain, NULL) == 0;
+    reloadRunning = reloadStarted;
+    if (!reloadStarted) {
+      LOG_ERR("cannot start config reload thread");
+      reloadPending = 0;
+    }
+  }
+  pthread_mutex_unlock(&reloadLock);
+}
+
+void dropLiveConfig(void) {
+  pthread_mutex_lock(&reloadLock);
+  reloadPending = 0;
+  _Bool started = reloadStarted;
+  reloadStarted = 0;
+  pthread_mutex_unlock(&reloadLock);
+  if (started) {
+    pthread_join(reloadThread, NULL);
+  }
+
+  freeConfig(atomic_exchange(&currentConfig, NULL));
+}
+
+static void *reloadMain(void *unused) {
+  (void)unused;
+
+  pthread_mutex_lock(&reloadLock);
+  while (reloadPending) {
+    reloadPending = 0;
+    pthread_mutex_unlock(&reloadLock);
+    reloadOnce();
+    pthread_mutex_lock(&reloadLock);
+  }
+  reloadRunning = 0;
+  pthread_mutex_unlock(&reloadLock);
+  return NULL;
+}
+
+static void reloadOnce(void) {
+  LOG_INFO("reloading config file \"%s\"", configPath);
+  Config *config = (Config*)malloc(sizeof(Config));
+  Error *error = errorBuffer(RELOAD_ERROR_SIZE);
+  if (config == NULL || error == NULL) {
+    LOG_ERR("cannot reload config, out of memory");
+    free(config);
+    dropError(error);
+    return;
+  }
+
+  loadConfig(config, configPath, error);
+  if (!isError(error)) {
+    config->metrics = createMetrics(config, error);
+  }
+  if (isError(error)) {
+    LOG_ERR("%s, keeping the running config", error->errorBuffer);
+    dropError(error);
+    freeConfig(config);
+    return;
+  }
+  dropError(error);
+
+  /* only this thread swaps, so the pointer cannot change under us */
+  Config *old = atomic_load(&currentConfig);
+  warnFixedChanges(old, config);
+  atomic_store(&currentConfig, config);
+  unsigned epoch = atomic_fetch_add(&currentEpoch, 1);
+  LOG_INFO("config reloaded, %zu routes", ccVecLen(&config->routes));
+
+  while (atomic_load_explicit(&epochReaders[epoch % 2],
+                              memory_order_acquire) != 0) {
+    poll(NULL, 0, RELOAD_POLL_MS);
+  }
+  freeConfig(old);
+  LOG_DBG("dropped the previous config");
+}
+
+/* changes to what is set up once can only be taken by an upgrade */
+static void warnFixedChanges(const Config *old, const Config *config) {
+  if (!sameListeners(old, config)
+      || old->maxPending != config->maxPending
+      || old->workerProcesses != config->workerProcesses
+      || old->reusePort != config->reusePort
+      || old->cpuAffinity != config->cpuAffinity
+      || old->isolateDynamic != config->isolateDynamic
+      || old->dcgiWorkers != config->dcgiWorkers
+      || old->maxConnections != config->maxConnections
+      || old->maxConnectionsPerIp != config->maxConnectionsPerIp
+      || old->logLevel != config->logLevel
+      || (old->logFile == NULL) != (config->logFile == NULL)
+      || (old->logFile != NULL && strcmp(old->logFile, config->logFile))
+      || (old->accessLog == NULL) != (config->accessLog == NULL)
+      || (old->accessLog != NULL
+          && strcmp(old->accessLog, config->accessLog))
+      || !sameErrorPages(old, config)) {
+    LOG_WARN("listening, I/O, worker process, logging, DCGI isolation, "
+             "connection limit and error page settings stay as they "
+             "were until an upgrade with SIGUSR2");
+  }
+}
+
+static _Bool sameListeners(const Config *old, const Config *config) {
+  if (ccVecLen(&old->listeners) != ccVecLen(&config->listeners)) {
+    return 0;
+  }
+  for (size_t i = 0; i < ccVecLen(&old->listeners); i++) {
+    const SockAddress *a = (const SockAddress*)ccVecNth(&old->listeners, i);
+    const SockAddress *b =
+      (const SockAddress*)ccVecNth(&config->listeners, i);
+    if (!sameSockAddress((const struct sockaddr*)&a->addr,
+                         (const struct sockaddr*)&b->addr)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static _Bool sameErrorPages(const Config *old, const Config *config) {
+  if (ccVecLen(&old->errorPages) != ccVecLen(&config->errorPages)) {
+    return 0;
+  }
+  for (size_t i = 0; i < ccVecLen(&old->errorPages); i++) {
+    const ErrorPageConfig *a =
+      (const ErrorPageConfig*)ccVecNth(&old->errorPages, i);
+    const ErrorPageConfig *b =
+      (const ErrorPageConfig*)ccVecNth(&config->errorPages, i);
+    if (a->code != b->code || strcmp(a->path, b->path)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void freeConfig(Config *config) {
+  if (config == NULL) {
+    return;
+  }
+  dropMetrics(config->metrics);
+  dropConfig(config);
+  free(config);
+}
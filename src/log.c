@@ -0,0 +1,366 @@
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_IDLE_SLEEP_NS 2000000
+
+typedef enum e_ring_state {
+  RING_FREE    = 0,
+  RING_OWNED   = 1,
+  RING_RETIRED = 2
+} RingState;
+
+/* single producer (the owning thread), single consumer (the logger) */
+typedef struct st_log_ring {
+  _Atomic int state;
+  _Atomic size_t head;
+  _Alignas(64) _Atomic size_t tail;
+  _Atomic size_t dropped;
+  char *data;
+} LogRing;
+
+const char *log_level_controls[] = {
+  [LL_DEBUG] = "96",
+  [LL_INFO] = "32",
+  [LL_WARN] = "93",
+  [LL_ERROR] = "91",
+  [LL_FATAL] = "97;41"
+};
+
+const char *log_level_texts[] = {
+  [LL_DEBUG] = "debug",
+  [LL_INFO] = "info",
+  [LL_WARN] = "warn",
+  [LL_ERROR] = "error",
+  [LL_FATAL] = "fatal"
+};
+
+LogLevel chttpdLogLevel = LL_INFO;
+
+static int logFd = STDERR_FILENO;
+static int logColored = -1;
+
+static LogRing rings[LOG_MAX_RINGS];
+static _Atomic size_t ringsUsed;
+static pthread_key_t ringKey;
+static pthread_t loggerThread;
+static _Atomic _Bool loggerRunning;
+static _Atomic _Bool loggerStopping;
+
+static _Thread_local LogRing *threadRing = NULL;
+static _Thread_local ssize_t workerId = -1;
+
+static size_t formatLine(char *buffer,
+                         LogLevel logLevel,
+                         const char *fileName,
+                         int line,
+                         const char *func,
+                         const char *fmt,
+                         va_list va);
+static LogRing *acquireRing(void);
+static void retireRing(void *ring);
+static void pushRing(LogRing *ring, const char *buffer, size_t len);
+static void *loggerMain(void *unused);
+static size_t drainRings(char *batch);
+static void writeLog(const char *buffer, size_t len);
+static void atforkChild(void);
+
+void setWorkerId(size_t newWorkerId) {
+  workerId = newWorkerId;
+}
+
+void setLogLevel(LogLevel logLevel) {
+  chttpdLogLevel = logLevel;
+}
+
+_Bool parseLogLevel(const char *name, LogLevel *dest) {
+  for (int i = LL_DEBUG; i <= LL_FATAL; i++) {
+    if (strcmp_icase(name, log_level_texts[i])) {
+      *dest = (LogLevel)i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void setLogOutput(const char *path, Error *error) {
+  if (path == NULL) {
+    logFd = STDERR_FILENO;
+    logColored = isatty(STDERR_FILENO);
+    return;
+  }
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    QUICK_ERROR2(error, 500, "cannot open log file \"%s\": %d",
+                 path, errno);
+    return;
+  }
+  logFd = fd;
+  logColored = 0;
+}
+
+void startLogger(Error *error) {
+  if (logColored < 0) {
+    logColored = isatty(logFd);
+  }
+
+  int res = pthread_key_create(&ringKey, retireRing);
+  if (res != 0) {
+    QUICK_ERROR2(error, 500, "cannot create log ring key: %d", res);
+    return;
+  }
+  pthread_atfork(NULL, NULL, atforkChild);
+
+  atomic_store(&loggerStopping, 0);
+  atomic_store(&loggerRunning, 1);
+  res = pthread_create(&loggerThread, NULL, loggerMain, NULL);
+  if (res != 0) {
+    atomic_store(&loggerRunning, 0);
+    QUICK_ERROR2(error, 500, "cannot create logger thread: %d", res);
+  }
+}
+
+void stopLogger(void) {
+  if (!atomic_load(&loggerRunning)) {
+    return;
+  }
+
+  atomic_store(&loggerRunning, 0);
+  atomic_store(&loggerStopping, 1);
+  pthread_join(loggerThread, NULL);
+}
+
+void chttpdLog(LogLevel logLevel,
+               const char *fileName,
+               int line,
+               const char *func,
+               const char *fmt,
+               ...) {
+  char buffer[LOG_LINE_SIZE];
+
+  va_list va;
+  va_start(va, fmt);
+  size_t len = formatLine(buffer, logLevel, fileName, line, func, fmt, va);
+  va_end(va);
+
+  LogRing *ring = NULL;
+  if (logLevel != LL_FATAL
+      && atomic_load_explicit(&loggerRunning, memory_order_relaxed)) {
+    ring = acquireRing();
+  }
+
+  if (ring == NULL) {
+    writeLog(buffer, len);
+  } else {
+    pushRing(ring, buffer, len);
+  }
+}
+
+static size_t formatLine(char *buffer,
+                         LogLevel logLevel,
+                         const char *fileName,
+                         int line,
+                         const char *func,
+                         const char *fmt,
+                         va_list va) {
+  const char *suffix = logColored > 0 ? " \033[0m\n" : "\n";
+  size_t suffixLen = strlen(suffix);
+  size_t room = LOG_LINE_SIZE - suffixLen;
+
+  int len = 0;
+  if (logColored > 0) {
+    len = snprintf(buffer, room, "\033[%sm ",
+                   log_level_controls[logLevel]);
+  }
+  if (workerId != -1) {
+    len += snprintf(buffer + len, room - len, "[ %s %s:%s:%d ] <%zi> ",
+                    log_level_texts[logLevel], fileName, func, line,
+                    workerId);
+  } else {
+    len += snprintf(buffer + len, room - len, "[ %s %s:%s:%d ] ",
+                    log_level_texts[logLevel], fileName, func, line);
+  }
+  if ((size_t)len >= room) {
+    len = room - 1;
+  }
+
+  int msgLen = vsnprintf(buffer + len, room - len, fmt, va);
+  if (msgLen < 0) {
+    msgLen = 0;
+  }
+  len += msgLen;
+  if ((size_t)len >= room) {
+    len = room - 1;
+  }
+
+  memcpy(buffer + len, suffix, suffixLen);
+  return len + suffixLen;
+}
+
+static LogRing *acquireRing(void) {
+  if (threadRing != NULL) {
+    return threadRing;
+  }
+
+  for (size_t i = 0; i < LOG_MAX_RINGS; i++) {
+    int expected = RING_FREE;
+    if (!atomic_compare_exchange_strong(&rings[i].state,
+                                        &expected,
+                                        RING_OWNED)) {
+      continue;
+    }
+
+    LogRing *ring = &rings[i];
+    if (ring->data == NULL) {
+      ring->data = (char*)malloc(LOG_RING_SIZE);
+      if (ring->data == NULL) {
+        atomic_store(&ring->state, RING_FREE);
+        return NULL;
+      }
+    }
+
+    size_t used = atomic_load(&ringsUsed);
+    while (used < i + 1
+           && !atomic_compare_exchange_weak(&ringsUsed, &used, i + 1)) {
+    }
+
+    pthread_setspecific(ringKey, ring);
+    threadRing = ring;
+    return ring;
+  }
+
+  /* every ring is taken, fall back to writing directly */
+  return NULL;
+}
+
+static void retireRing(void *ring) {
+  atomic_store_explicit(&((LogRing*)ring)->state,
+                        RING_RETIRED,
+                        memory_order_release);
+}
+
+static void pushRing(LogRing *ring, const char *buffer, size_t len) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (LOG_RING_SIZE - (head - tail) < len) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  size_t offset = head & (LOG_RING_SIZE - 1);
+  size_t first = LOG_RING_SIZE - offset;
+  if (first > len) {
+    first = len;
+  }
+  memcpy(ring->data + offset, buffer, first);
+  memcpy(ring->data, buffer + first, len - first);
+  atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+static void *loggerMain(void *unused) {
+  (void)unused;
+
+  static char batch[LOG_BATCH_SIZE];
+  for (;;) {
+    _Bool stopping = atomic_load(&loggerStopping);
+    if (drainRings(batch) == 0) {
+      if (stopping) {
+        break;
+      }
+      struct timespec ts = { 0, LOG_IDLE_SLEEP_NS };
+      nanosleep(&ts, NULL);
+    }
+  }
+  return NULL;
+}
+
+static size_t drainRings(char *batch) {
+  size_t total = 0;
+  size_t batchLen = 0;
+  size_t used = atomic_load(&ringsUsed);
+
+  for (size_t i = 0; i < used; i++) {
+    LogRing *ring = &rings[i];
+    int state = atomic_load_explicit(&ring->state, memory_order_acquire);
+    if (state == RING_FREE) {
+      continue;
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail != head) {
+      if (batchLen == LOG_BATCH_SIZE) {
+        writeLog(batch, batchLen);
+        batchLen = 0;
+      }
+
+      size_t offset = tail & (LOG_RING_SIZE - 1);
+      size_t chunk = head - tail;
+      if (chunk > LOG_RING_SIZE - offset) {
+        chunk = LOG_RING_SIZE - offset;
+      }
+      if (chunk > LOG_BATCH_SIZE - batchLen) {
+        chunk = LOG_BATCH_SIZE - batchLen;
+      }
+      memcpy(batch + batchLen, ring->data + offset, chunk);
+      batchLen += chunk;
+      tail += chunk;
+      total += chunk;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+    size_t dropped = atomic_exchange(&ring->dropped, 0);
+    if (dropped != 0) {
+      if (LOG_BATCH_SIZE - batchLen < 128) {
+        writeLog(batch, batchLen);
+        batchLen = 0;
+      }
+      batchLen += snprintf(batch + batchLen, 128,
+                           "[ warn log ring %zu ] %zu messages dropped\n",
+                           i, dropped);
+      total++;
+    }
+
+    /* the owner is gone and the ring is empty, so it can be reused */
+    if (state == RING_RETIRED) {
+      atomic_store(&ring->head, 0);
+      atomic_store(&ring->tail, 0);
+      atomic_store_explicit(&ring->state, RING_FREE, memory_order_release);
+    }
+  }
+
+  if (batchLen != 0) {
+    writeLog(batch, batchLen);
+  }
+  return total;
+}
+
+static void writeLog(const char *buffer, size_t len) {
+  while (len != 0) {
+    ssize_t written = write(logFd, buffer, len);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    buffer += written;
+    len -= written;
+  }
+}
+
+static void atforkChild(void) {
+  /* no logger thread in the child, so write directly */
+  atomic_store(&loggerRunning, 0);
+  threadRing = NULL;
+}
@@ -1,49 +1,108 @@
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "acceptor.h"
+#include "access_log.h"
+#include "arena.h"
 #include "config.h"
+#include "conn_limit.h"
+#include "conn_stream.h"
 #include "dcgi.h"
+#include "dcgi_pool.h"
+#include "fcgi.h"
 #include "file_util.h"
 #include "http.h"
+#include "http_head.h"
 #include "intern.h"
+#include "lifecycle.h"
+#include "live_config.h"
+#include "log.h"
+#include "metrics.h"
+#include "net_util.h"
+#include "out_buf.h"
+#include "proxy.h"
+#include "rate_limit.h"
 #include "static.h"
+#include "timer_wheel.h"
 #include "util.h"
+#include "workers.h"
 
-#define LARGE_BUFFER_SIZE 65536
 #define SMALL_BUFFER_SIZE 4096
+#define ACCEPT_BACKOFF_MS 10
 
 typedef struct st_http_input_context {
   size_t workerId;
-  const Config *config;
   int fdConnection;
   char *clientAddr;
 } HttpInputContext;
 
+/* marks[phase] is when that phase ended, the first one began at start */
+typedef struct st_request_timing {
+  struct timespec start;
+  struct timespec marks[PHASE_COUNT];
+} RequestTiming;
+
 typedef _Bool (UrlCompare)(const char*, const char*);
 
-static int httpMainLoop(const Config *config);
+static int httpMainLoop(const int *fdsListen, size_t listenCount);
+static int *listenSockets(const Config *config, size_t setCount);
+static int takeInheritedSocket(const SockAddress *listener,
+                               int *fdsInherited,
+                               size_t inherited);
+static int openListenSocket(const Config *config,
+                            const SockAddress *listener);
+static void removeStaleSocket(const SockAddress *listener);
+static _Bool handleLifecycleEvents(const int *fdsListen,
+                                   size_t listenCount);
+static _Bool shedConnection(const int *fdsListen,
+                            size_t listenCount,
+                            int *fdReserve);
+static void backOff(void);
 static void *httpHandler(void* context);
-static void routeAndHandle(const Config *config,
-                           HttpRequest *request,
-                           FILE *fp,
-                           Error *error);
+static size_t routeAndHandle(const Config *config,
+                             const char *clientAddr,
+                             HttpRequest *request,
+                             FILE *fp,
+                             OutBuf *out,
+                             RequestTiming *timing,
+                             Error *error);
 static _Bool isCorsRequest(const HttpRequest *request);
+static void logAccess(const HttpInputContext *inputContext,
+                      const HttpRequest *request,
+                      const ConnStats *stats,
+                      const struct timespec *startTime);
 static unsigned getAllowedCorsMethods(const Config *config,
                                       const char *path,
                                       UrlCompare *urlCompare);
+static uint64_t elapsedNs(const struct timespec *from,
+                          const struct timespec *to);
+static void markPhase(RequestTiming *timing, RequestPhase phase);
+static void recordTiming(const Metrics *metrics,
+                         size_t routeIndex,
+                         const ConnStats *stats,
+                         const RequestTiming *timing);
+static size_t renderServerTiming(void *context, char *buffer, size_t size);
 
 int main(int argc, const char *argv[]) {
   signal(SIGPIPE, SIG_IGN);
+  initLifecycle(argc, argv);
 
   if (argc != 2) {
     LOG_FATAL("expected 1 argument, got %d", argc - 1);
@@ -51,260 +110,792 @@ int main(int argc, const char *argv[]) {
     return -1;
   }
 
-  FILE *cfg_file = fopen(argv[1], "r");
-  if (cfg_file == NULL) {
-    LOG_FATAL("cannot open config file \"%s\"", argv[1]);
-    return -1;
-  }
-  char *buffer = (char*)malloc(LARGE_BUFFER_SIZE);
-  if (buffer == NULL) {
-    LOG_FATAL("failed allocating read buffer");
-    return -1;
-  }
-
-  memset(buffer, 0, LARGE_BUFFER_SIZE);
-  ssize_t bytesRead = readAll(cfg_file, buffer, LARGE_BUFFER_SIZE);
-  if (bytesRead < 0) {
-    LOG_FATAL("cannot read config file \"%s\"", argv[1]);
+  Error *error = errorBuffer(SMALL_BUFFER_SIZE);
+  Config *config = (Config*)malloc(sizeof(Config));
+  if (config == NULL) {
+    LOG_FATAL("failed allocating config");
     return -1;
   }
-
-  Config config;
-  initConfig(&config);
-
-  Error *error = errorBuffer(SMALL_BUFFER_SIZE);
-  pl2b_Program cfgProgram =
-    pl2b_parse(buffer, SMALL_BUFFER_SIZE, error);
+  loadConfig(config, argv[1], error);
   if (isError(error)) {
-    LOG_FATAL("cannot parse config file \"%s\": %d: %s",
-              argv[1], error->errCode, error->errorBuffer);
+    LOG_FATAL("%s", error->errorBuffer);
     return -1;
   }
 
-  const pl2b_Language *cfgLang = getCfgLanguage();
-  pl2b_runWithLanguage(&cfgProgram, cfgLang, &config, error);
+  setLogLevel(config->logLevel);
+  setLogOutput(config->logFile, error);
   if (isError(error)) {
-    LOG_FATAL("cannot evaluate config file \"%s\": %d: %s",
-              argv[1], error->errCode, error->errorBuffer);
+    LOG_FATAL("%s", error->errorBuffer);
     return -1;
   }
 
-  LOG_INFO("chttpd listening to: %s:%d", config.address, config.port);
-  LOG_INFO(" - max pending count set to %d", config.maxPending);
+  size_t listenerCount = ccVecLen(&config->listeners);
+  for (size_t i = 0; i < listenerCount; i++) {
+    const SockAddress *listener =
+      (const SockAddress*)ccVecNth(&config->listeners, i);
+    char addrStr[SOCK_ADDRESS_STR_SIZE];
+    formatSockAddress((const struct sockaddr*)&listener->addr,
+                      listener->addrLen,
+                      1,
+                      addrStr,
+                      sizeof(addrStr));
+    LOG_INFO("chttpd listening to: %s", addrStr);
+  }
+  LOG_INFO(" - max pending count set to %d", config->maxPending);
+  size_t processCount = workerProcessCount(config);
+  if (processCount > 1) {
+    LOG_INFO(" - %zu worker processes%s",
+             processCount,
+             config->reusePort ? ", one listening socket each" : "");
+  }
   LOG_INFO(" - DCGI preloading %s",
-           config.preloadDynamic ? "enabled" : "disabled");
-  if (config.cacheTime >= 0) {
-    LOG_INFO(" - cache expiration set to %d", config.cacheTime);
+           config->preloadDynamic ? "enabled" : "disabled");
+  if (config->cacheTime >= 0) {
+    LOG_INFO(" - cache expiration set to %d", config->cacheTime);
   } else {
     LOG_INFO(" - cache disabled");
   }
   LOG_INFO(" - case ignore set to %s",
-           config.ignoreCase ? "true" : "false");
-  for (size_t i = 0; i < ccVecLen(&config.routes); i++) {
-    Route *route = (Route*)ccVecNth(&config.routes, i);
-    LOG_INFO(" - route \"%s %s\" to \"%s %s\"",
+           config->ignoreCase ? "true" : "false");
+  if (config->isolateDynamic) {
+    LOG_INFO(" - DCGI isolated in %d worker processes",
+             config->dcgiWorkers);
+  }
+  for (size_t i = 0; i < ccVecLen(&config->routes); i++) {
+    Route *route = (Route*)ccVecNth(&config->routes, i);
+    LOG_INFO(" - route \"%s %s%s\" to \"%s %s\"",
              HTTP_METHOD_NAMES[route->httpMethod],
+             route->host != NULL ? route->host : "",
              route->path,
              HANDLER_TYPE_NAMES[route->handlerType],
              route->handlerPath);
   }
 
-  int ret = httpMainLoop(&config);
-
-  dropConfig(&config);
-  dropError(error);
-  pl2b_dropProgram(&cfgProgram);
-  free(buffer);
-
-  return ret;
-}
+  size_t setCount = config->reusePort ? processCount : 1;
+  int *fdsListen = listenSockets(config, setCount);
+  if (fdsListen == NULL) {
+    return -1;
+  }
+  int firstSock = 0;
+  if (processCount > 1) {
+    /* the master stays in here, the workers carry on below */
+    int status;
+    firstSock = runWorkerProcesses(&config,
+                                   argv[1],
+                                   fdsListen,
+                                   setCount * listenerCount,
+                                   listenerCount,
+                                   &status);
+    if (firstSock < 0) {
+      free(fdsListen);
+      dropConfig(config);
+      free(config);
+      dropError(error);
+      return status;
+    }
+  }
 
-static int httpMainLoop(const Config *config) {
-  int fdSock;
-  struct sockaddr_in serverAddr; 
+  if (config->isolateDynamic) {
+    startDCGIPool(config, error);
+    if (isError(error)) {
+      LOG_FATAL("cannot start DCGI worker pool: %s", error->errorBuffer);
+      return -1;
+    }
+  }
 
-  if ((fdSock = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-    LOG_FATAL("error on opening socket: %d", errno);
+  config->metrics = createMetrics(config, error);
+  if (isError(error)) {
+    LOG_FATAL("cannot set up metrics: %s", error->errorBuffer);
     return -1;
   }
 
-  int reuseAddr = 1;
-  if (setsockopt(fdSock,
-                 SOL_SOCKET,
-                 SO_REUSEADDR,
-                 &reuseAddr,
-                 sizeof(int)) < 0) {
-    LOG_FATAL("failed setting SO_REUSEADDR: %d", errno);
+  /* the DCGI workers are forked first, so that they log directly */
+  startLogger(error);
+  if (isError(error)) {
+    LOG_FATAL("%s", error->errorBuffer);
     return -1;
   }
 
-  struct in_addr listenAddress;
-  int res = inet_aton(config->address, &listenAddress);
-  if (res == 0) {
-    LOG_FATAL("invalid listening address: %s", config->address);
+  /* the timer thread keeps the Date header current from here on */
+  refreshDateHeader();
+  startTimerWheel(refreshDateHeader, error);
+  if (isError(error)) {
+    LOG_FATAL("%s", error->errorBuffer);
     return -1;
   }
 
-  memset(&serverAddr, 0, sizeof(serverAddr));
-  serverAddr.sin_family = AF_INET;
-  serverAddr.sin_port = htons(config->port);
-  serverAddr.sin_addr = listenAddress;
+  if (config->accessLog != NULL) {
+    startAccessLog(config->accessLog,
+                   config->accessLogSegmentSize,
+                   config->accessLogKeep,
+                   error);
+    if (isError(error)) {
+      LOG_FATAL("cannot start access log: %s", error->errorBuffer);
+      return -1;
+    }
+  }
 
-  if (bind(fdSock,
-           (struct sockaddr*)&serverAddr,
-           sizeof(serverAddr)) < 0) {
-    LOG_FATAL("error on binding: %d", errno);
+  initConnLimits(config->maxConnections, config->maxConnectionsPerIp);
+  initRateLimits();
+  prerenderErrorPages(config, error);
+  if (isError(error)) {
+    LOG_FATAL("cannot render error pages: %s", error->errorBuffer);
     return -1;
   }
 
+  /* reloads start from the accept loop, and may replace `config` */
+  initLiveConfig(argv[1], config);
+  int ret = httpMainLoop(fdsListen + firstSock, listenerCount);
+  free(fdsListen);
+
+  ConfigPin pin;
+  int shutdownTimeout = pinConfig(&pin)->shutdownTimeout;
+  unpinConfig(&pin);
+  if (ret == 0 && !drainConnections(shutdownTimeout)) {
+    /* the handlers still use everything torn down below */
+    LOG_WARN("%zu connections still open, exiting anyway",
+             activeConnections());
+    stopAccessLog();
+    stopLogger();
+    _exit(0);
+  }
+  LOG_INFO("stopped");
+
+  dropErrorPages();
+  stopAccessLog();
+  stopTimerWheel();
+  stopLogger();
+  stopDCGIPool();
+  dropLiveConfig();
+  dropMetricSeries();
+  dropError(error);
+
+  return ret;
+}
+
+static int httpMainLoop(const int *fdsListen, size_t listenCount) {
   size_t workerId = 0;
-  listen(fdSock, config->maxPending);
 
-  struct sockaddr_in clientAddr;
+  /* held back so that a connection can still be accepted and answered
+     when the process runs out of descriptors */
+  int fdReserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (fdReserve < 0) {
+    LOG_WARN("cannot open reserve descriptor: %d", errno);
+  }
+  _Bool outOfFds = 0;
+
+  /* Detaching a thread after creating it races with the thread exiting
+     first: the exiting thread may free its stack while pthread_detach
+     still reads from it */
+  pthread_attr_t threadAttr;
+  pthread_attr_init(&threadAttr);
+  pthread_attr_setdetachstate(&threadAttr, PTHREAD_CREATE_DETACHED);
+
+  IoAcceptor acceptor;
+  initAcceptor(&acceptor, fdsListen, listenCount, lifecycleWaitMask());
+  notifyUpgradeReady();
+
+  struct sockaddr_storage clientAddr;
   socklen_t clientAddrSize = sizeof(clientAddr);
-  for (;;) {
-    int fdConnection = accept(fdSock,
-                              (struct sockaddr*)&clientAddr,
-                              &clientAddrSize);
+  _Bool stopping = 0;
+  while (!stopping) {
+    clientAddrSize = sizeof(clientAddr);
+    int fdConnection = acceptConnection(&acceptor,
+                                        (struct sockaddr*)&clientAddr,
+                                        &clientAddrSize);
     if (fdConnection < 0) {
-      LOG_ERR("error on accepting connection: %d", errno);
-      return -1;
+      switch (errno) {
+        case EINTR:
+          stopping = handleLifecycleEvents(fdsListen, listenCount);
+          break;
+        case EAGAIN:
+        case ECONNABORTED:
+        case EPROTO:
+          break;
+        case EMFILE:
+        case ENFILE:
+          if (!outOfFds) {
+            LOG_WARN("out of file descriptors, shedding connections");
+            outOfFds = 1;
+          }
+          if (!shedConnection(fdsListen, listenCount, &fdReserve)) {
+            backOff();
+          }
+          break;
+        default:
+          LOG_ERR("error on accepting connection: %d", errno);
+          backOff();
+      }
+      continue;
+    }
+    if (outOfFds) {
+      LOG_INFO("file descriptors available again");
+      outOfFds = 0;
     }
 
-    char *addrStr = inet_ntoa(clientAddr.sin_addr);
+    char addrStr[SOCK_ADDRESS_STR_SIZE];
+    formatSockAddress((const struct sockaddr*)&clientAddr,
+                      clientAddrSize,
+                      0,
+                      addrStr,
+                      sizeof(addrStr));
+    if (!acquireConnSlot(addrStr)) {
+      LOG_WARN("too many connections, rejecting %s", addrStr);
+      sendOverloadPage(fdConnection);
+      close(fdConnection);
+      continue;
+    }
     LOG_INFO("accepting connection from: %s", addrStr);
-    
+
     HttpInputContext *inputContext =
       (HttpInputContext*)malloc(sizeof(HttpInputContext));
-    if (inputContext == NULL) {
+    char *clientAddrCopy = copyString(addrStr);
+    if (inputContext == NULL || clientAddrCopy == NULL) {
       LOG_ERR("failed allocating thread context buffer");
+      sendOverloadPage(fdConnection);
+      close(fdConnection);
+      releaseConnSlot(addrStr);
+      free(inputContext);
+      free(clientAddrCopy);
       continue;
     }
     inputContext->workerId = workerId++;
-    inputContext->config = config;
     inputContext->fdConnection = fdConnection;
-    inputContext->clientAddr = copyString(addrStr);
+    inputContext->clientAddr = clientAddrCopy;
 
     pthread_t thread;
-    int res = pthread_create(&thread, NULL, httpHandler, inputContext);
+    int res = pthread_create(&thread, &threadAttr, httpHandler, inputContext);
     if (res != 0) {
       LOG_ERR("error on pthread creation: %d", res);
+      sendOverloadPage(fdConnection);
+      close(fdConnection);
+      releaseConnSlot(clientAddrCopy);
+      free(clientAddrCopy);
+      free(inputContext);
       continue;
     }
+  }
 
-    res = pthread_detach(thread);
-    if (res != 0) {
-      LOG_ERR("error on pthread detach: %d", res);
+  pthread_attr_destroy(&threadAttr);
+  for (size_t i = 0; i < listenCount; i++) {
+    close(fdsListen[i]);
+  }
+  if (fdReserve >= 0) {
+    close(fdReserve);
+  }
+  return 0;
+}
+
+/*
+ * `setCount` sets of one socket per listener, taken over from the old
+ * process on upgrades, opened as needed.
+ */
+static int *listenSockets(const Config *config, size_t setCount) {
+  size_t listenerCount = ccVecLen(&config->listeners);
+  size_t count = setCount * listenerCount;
+  int *fds = (int*)malloc(count * sizeof(int));
+  size_t inherited;
+  const int *fdsInheritedConst = inheritedListenFds(&inherited);
+  int *fdsInherited = (int*)malloc((inherited + 1) * sizeof(int));
+  if (fds == NULL || fdsInherited == NULL) {
+    LOG_FATAL("failed allocating listening sockets");
+    free(fds);
+    free(fdsInherited);
+    return NULL;
+  }
+  if (inherited != 0) {
+    LOG_INFO("taking over %zu listening sockets from the old process",
+             inherited);
+    memcpy(fdsInherited, fdsInheritedConst, inherited * sizeof(int));
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const SockAddress *listener =
+      (const SockAddress*)ccVecNth(&config->listeners, i % listenerCount);
+    fds[i] = takeInheritedSocket(listener, fdsInherited, inherited);
+    if (fds[i] < 0 && listener->addr.ss_family == AF_UNIX
+        && i >= listenerCount) {
+      /* one path takes one socket, reuse-port or not */
+      fds[i] = fcntl(fds[i % listenerCount], F_DUPFD_CLOEXEC, 0);
+    } else if (fds[i] < 0) {
+      fds[i] = openListenSocket(config, listener);
+    }
+    if (fds[i] < 0) {
+      for (size_t j = 0; j < i; j++) {
+        close(fds[j]);
+      }
+      free(fds);
+      fds = NULL;
+      break;
     }
   }
 
-  return 0;
+  for (size_t i = 0; i < inherited; i++) {
+    if (fdsInherited[i] >= 0) {
+      LOG_WARN("closing listening socket %zu, not needed any more", i);
+      close(fdsInherited[i]);
+    }
+  }
+  free(fdsInherited);
+  return fds;
+}
+
+/*
+ * An inherited socket bound to `listener`, marked taken in the list.
+ * Matched by address, since listeners may have come or gone since.
+ */
+static int takeInheritedSocket(const SockAddress *listener,
+                               int *fdsInherited,
+                               size_t inherited) {
+  for (size_t i = 0; i < inherited; i++) {
+    struct sockaddr_storage bound;
+    socklen_t boundSize = sizeof(bound);
+    if (fdsInherited[i] < 0
+        || getsockname(fdsInherited[i],
+                       (struct sockaddr*)&bound,
+                       &boundSize) < 0) {
+      continue;
+    }
+    if (sameSockAddress((const struct sockaddr*)&bound,
+                        (const struct sockaddr*)&listener->addr)) {
+      int fd = fdsInherited[i];
+      fdsInherited[i] = -1;
+      return fd;
+    }
+  }
+  return -1;
+}
+
+static int openListenSocket(const Config *config,
+                            const SockAddress *listener) {
+  int family = listener->addr.ss_family;
+  char addrStr[SOCK_ADDRESS_STR_SIZE];
+  formatSockAddress((const struct sockaddr*)&listener->addr,
+                    listener->addrLen,
+                    1,
+                    addrStr,
+                    sizeof(addrStr));
+
+  int fdSock = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fdSock == -1) {
+    LOG_FATAL("error on opening socket for %s: %d", addrStr, errno);
+    return -1;
+  }
+
+  int on = 1;
+  if (family != AF_UNIX
+      && setsockopt(fdSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)) < 0) {
+    LOG_FATAL("failed setting SO_REUSEADDR: %d", errno);
+    close(fdSock);
+    return -1;
+  }
+
+  /* each worker process gets a socket, the kernel balances them */
+  if (config->reusePort && family != AF_UNIX
+      && setsockopt(fdSock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(int)) < 0) {
+    LOG_FATAL("failed setting SO_REUSEPORT: %d", errno);
+    close(fdSock);
+    return -1;
+  }
+
+  /* so that [::] and 0.0.0.0 can be listened to side by side */
+  if (family == AF_INET6
+      && setsockopt(fdSock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(int)) < 0) {
+    LOG_FATAL("failed setting IPV6_V6ONLY: %d", errno);
+    close(fdSock);
+    return -1;
+  }
+
+  if (family == AF_UNIX) {
+    removeStaleSocket(listener);
+  }
+  if (bind(fdSock,
+           (const struct sockaddr*)&listener->addr,
+           listener->addrLen) < 0) {
+    LOG_FATAL("error on binding %s: %d", addrStr, errno);
+    close(fdSock);
+    return -1;
+  }
+
+  listen(fdSock, config->maxPending);
+  return fdSock;
+}
+
+/*
+ * A socket file left behind by a server that is gone would keep us
+ * from binding. One that still has a server accepting is left alone.
+ */
+static void removeStaleSocket(const SockAddress *listener) {
+  const struct sockaddr_un *un = (const struct sockaddr_un*)&listener->addr;
+  struct stat st;
+  if (stat(un->sun_path, &st) < 0 || !S_ISSOCK(st.st_mode)) {
+    return;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return;
+  }
+  if (connect(fd, (const struct sockaddr*)un, listener->addrLen) < 0
+      && errno == ECONNREFUSED) {
+    LOG_INFO("removing stale socket file %s", un->sun_path);
+    unlink(un->sun_path);
+  }
+  close(fd);
+}
+
+/* returns 1 when the loop should stop accepting connections */
+static _Bool handleLifecycleEvents(const int *fdsListen,
+                                   size_t listenCount) {
+  for (;;) {
+    switch (takeLifecycleEvent()) {
+      case LIFECYCLE_NONE:
+        return 0;
+      case LIFECYCLE_STOP:
+        LOG_INFO("stopping, %zu connections in flight",
+                 activeConnections());
+        return 1;
+      case LIFECYCLE_UPGRADE:
+        if (!startUpgrade(fdsListen, listenCount)) {
+          LOG_WARN("upgrade failed, carrying on");
+          break;
+        }
+        LOG_INFO("handed over, %zu connections in flight",
+                 activeConnections());
+        return 1;
+      case LIFECYCLE_RELOAD:
+        requestConfigReload();
+        break;
+    }
+  }
+}
+
+/*
+ * Frees the reserve descriptor for just long enough to take a pending
+ * connection off each queue and turn it away. Otherwise the connections
+ * would stay in the queues and keep the listening sockets readable.
+ */
+static _Bool shedConnection(const int *fdsListen,
+                            size_t listenCount,
+                            int *fdReserve) {
+  if (*fdReserve < 0) {
+    *fdReserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return 0;
+  }
+
+  close(*fdReserve);
+  _Bool shed = 0;
+  for (size_t i = 0; i < listenCount; i++) {
+    int fdConnection = accept4(fdsListen[i], NULL, NULL, SOCK_CLOEXEC);
+    if (fdConnection >= 0) {
+      sendOverloadPage(fdConnection);
+      close(fdConnection);
+      shed = 1;
+    }
+  }
+  *fdReserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  return shed;
+}
+
+/* keeps a persistent accept error from spinning the loop */
+static void backOff(void) {
+  poll(NULL, 0, ACCEPT_BACKOFF_MS);
 }
 
 static void* httpHandler(void *context) {
   HttpInputContext *inputContext = (HttpInputContext*)context;
   setWorkerId(inputContext->workerId);
-  const Config *config = inputContext->config;
+  ConfigPin pin;
+  const Config *config = pinConfig(&pin);
   int fd = inputContext->fdConnection;
 
-  FILE *fp = fdopen(fd, "a+");
+  RequestTiming timing;
+  clock_gettime(CLOCK_MONOTONIC, &timing.start);
+
+  ConnTimeouts timeouts = {
+    (uint32_t)config->idleTimeout * 1000,
+    (uint32_t)config->headerTimeout * 1000,
+    (uint32_t)config->bodyTimeout * 1000,
+    (uint32_t)config->writeTimeout * 1000
+  };
+  ConnStats stats;
+  OutBuf *out;
+  FILE *fp = openConnStream(fd, &stats, &timeouts, &out);
   if (fp == NULL) {
-    LOG_ERR("error calling fdopen: %d", errno);
+    LOG_ERR("error opening connection stream: %d", errno);
+    close(fd);
+    unpinConfig(&pin);
+    releaseConnSlot(inputContext->clientAddr);
+    free(inputContext->clientAddr);
+    free(inputContext);
+    return NULL;
   }
 
-  HttpRequest *request = readHttpRequest(fp);
+  HttpRequest *request = NULL;
+  size_t routeIndex = ccVecLen(&config->routes);
+  Arena *arena = acquireArena();
+  if (arena == NULL) {
+    LOG_ERR("cannot allocate request arena");
+    goto close_fp_ret;
+  }
+
+  request = readHttpRequest(fp, config->maxBodySize, arena);
   if (request == NULL) {
+    if (connTimedOut(&stats)) {
+      LOG_INFO("timed out reading request from %s",
+               inputContext->clientAddr);
+      send408Page(out);
+    }
     goto close_fp_ret;
   }
+  setConnPhase(&stats, CONN_PHASE_BODY);
+  markPhase(&timing, PHASE_READ);
+  if (config->serverTiming) {
+    setConnHeadHook(&stats, renderServerTiming, &timing);
+  }
 
   LOG_INFO("accepting HTTP request: %s %s",
            HTTP_METHOD_NAMES[request->method],
            request->requestPath);
-  LOG_INFO(" - ?%s", request->queryString);
-  for (size_t i = 0; i < ccVecLen(&request->params); i++) {
-    StringPair *param = (StringPair*)ccVecNth(&request->params, i);
-    LOG_INFO(" ?%s=%s", param->first, param->second);
-  }
+  if (chttpdLogLevel <= LL_DEBUG) {
+    LOG_DBG(" - ?%s", request->queryString);
+    for (size_t i = 0; i < ccVecLen(&request->params); i++) {
+      StringPair *param = (StringPair*)ccVecNth(&request->params, i);
+      LOG_DBG(" ?%s=%s", param->first, param->second);
+    }
 
-  for (size_t i = 0; i < ccVecLen(&request->headers); i++) {
-    StringPair *header = (StringPair*)ccVecNth(&request->headers, i);
-    LOG_INFO(" %s: \"%s\"", header->first, header->second);
-  }
-  if (request->contentLength != 0) {
-    LOG_INFO("body:\n\n%s", request->body);
+    for (size_t i = 0; i < ccVecLen(&request->headers); i++) {
+      StringPair *header = (StringPair*)ccVecNth(&request->headers, i);
+      LOG_DBG(" %s: \"%s\"", header->first, header->second);
+    }
   }
 
-  Error *error = errorBuffer(SMALL_BUFFER_SIZE);
+  Error *error = arenaErrorBuffer(arena, SMALL_BUFFER_SIZE);
+  if (error == NULL) {
+    dropHttpRequest(request);
+    goto close_fp_ret;
+  }
 
-  routeAndHandle(config, request, fp, error);
+  /* refuse rate limited clients and declared oversize bodies before
+     even routing the request */
+  if (!takeToken(inputContext->clientAddr, SIZE_MAX, &config->rateLimit)) {
+    markPhase(&timing, PHASE_ROUTE);
+    QUICK_ERROR(error, 429, "");
+  } else if (request->contentLength > config->maxBodySize) {
+    markPhase(&timing, PHASE_ROUTE);
+    QUICK_ERROR2(error, 413, "Content-Length %zu exceeds %zu bytes",
+                 request->contentLength, config->maxBodySize);
+  } else {
+    routeIndex = routeAndHandle(config,
+                                inputContext->clientAddr,
+                                request,
+                                fp,
+                                out,
+                                &timing,
+                                error);
+  }
+  markPhase(&timing, PHASE_HANDLER);
   dropHttpRequest(request);
 
+  /* whatever a handler wrote to the stream goes ahead of error pages */
+  fflush(fp);
   if (!isError(error)) {
+  } else if (connTimedOut(&stats)) {
+    LOG_INFO("timed out reading request body");
+    send408Page(out);
+  } else if (error->errCode == 400) {
+    send400Page(out);
+  } else if (error->errCode == 413) {
+    send413Page(out);
   } else if (error->errCode == 403) {
-    send403Page(fp);
+    send403Page(out);
   } else if (error->errCode == 404) {
-    send404Page(fp);
+    send404Page(out);
+  } else if (error->errCode == 429) {
+    send429Page(out);
+  } else if (error->errCode == 502 || error->errCode == 504) {
+    /* upstream details are for the log, not for the client */
+    LOG_WARN("%s:%zi: %s",
+             error->sourceInfo.sourceFile,
+             error->sourceInfo.line,
+             error->errorBuffer);
+    if (error->errCode == 502) {
+      send502Page(out);
+    } else {
+      send504Page(out);
+    }
   } else {
-    send500Page(fp, error);
+    send500Page(out, error);
   }
 
-  dropError(error);
-
 close_fp_ret:
   fflush(fp);
+  outFlush(out);
+  if (request != NULL) {
+    markPhase(&timing, PHASE_WRITE);
+    recordTiming(config->metrics, routeIndex, &stats, &timing);
+  }
+  if (accessLogEnabled()) {
+    logAccess(inputContext, request, &stats, &timing.start);
+  }
   fclose(fp);
+  releaseArena(arena);
+  unpinConfig(&pin);
+  releaseConnSlot(inputContext->clientAddr);
   free(inputContext->clientAddr);
   free(inputContext);
   return NULL;
 }
 
-static void routeAndHandle(const Config *config,
-                           HttpRequest *request,
-                           FILE *fp,
-                           Error *error) {
+/* returns the index of the route taken, or the route count if none */
+static size_t routeAndHandle(const Config *config,
+                             const char *clientAddr,
+                             HttpRequest *request,
+                             FILE *fp,
+                             OutBuf *out,
+                             RequestTiming *timing,
+                             Error *error) {
   UrlCompare *urlCompare = 
     config->ignoreCase ? urlcmp_icase : urlcmp;
 
-  size_t routeCount = ccVecLen(&config->routes);
-  for (size_t i = 0; i < routeCount; i++) {
+  const VirtualHost *host = findVirtualHost(config, request->host);
+  size_t hostRouteCount = ccVecLen(&host->routes);
+  for (size_t j = 0; j < hostRouteCount; j++) {
+    size_t i = *(const size_t*)ccVecNth(&host->routes, j);
     const Route *route = (Route*)ccVecNth(&config->routes, i);
     if (urlCompare(request->requestPath, route->path)
         && request->method == route->httpMethod) {
+      markPhase(timing, PHASE_ROUTE);
+      if (!takeToken(clientAddr, i, &route->rateLimit)) {
+        QUICK_ERROR(error, 429, "");
+        return i;
+      }
       switch (route->handlerType) {
       case HDLR_STATIC:
-        handleStatic(route->handlerPath, fp, config->cacheTime, error);
+        handleStatic(route->handlerPath, out, config->cacheTime, error);
         break;
       case HDLR_DCGI:
         handleDCGI(route->handlerPath,
                    (DCGIModule*)route->extra,
+                   config->dcgiTimeout,
+                   request,
+                   out,
+                   error);
+        break;
+      case HDLR_FCGI:
+        handleFCGI((FCGIUpstream*)route->extra,
+                   config->upstreamTimeout,
                    request,
                    fp,
                    error);
         break;
+      case HDLR_PROXY:
+        handleProxy((ProxyUpstream*)route->extra,
+                    config->upstreamTimeout,
+                    request,
+                    fp,
+                    error);
+        break;
       case HDLR_INTERN:
-        handleIntern(route->handlerPath, error);
+        handleIntern(config, route->handlerPath, out, error);
         break;
       case HDLR_DIR:
         QUICK_ERROR(error, 500, "DIR not supported yet");
         break;
       }
-      return;
+      return i;
     }
   }
 
+  markPhase(timing, PHASE_ROUTE);
   QUICK_ERROR(error, 404, "");
+  return ccVecLen(&config->routes);
 }
 
 static void respondToOptionsRequest(const Config *config,
-                                    FILE *fp,
+                                    OutBuf *out,
                                     unsigned allowedMethods) {
   if (allowedMethods == 0) {
-    send405Page(fp);
+    send405Page(out);
   }
 
 
 }
 
+static void logAccess(const HttpInputContext *inputContext,
+                      const HttpRequest *request,
+                      const ConnStats *stats,
+                      const struct timespec *startTime) {
+  struct timespec now, wallNow;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  clock_gettime(CLOCK_REALTIME, &wallNow);
+  uint64_t latencyNs = elapsedNs(startTime, &now);
+
+  AccessRecord record;
+  memset(&record, 0, sizeof(record));
+  record.timeNs = (uint64_t)wallNow.tv_sec * 1000000000ull
+                  + wallNow.tv_nsec - latencyNs;
+  record.bytesOut = stats->bytesOut;
+  record.workerId = inputContext->workerId;
+  record.latencyUs = (uint32_t)(latencyNs / 1000);
+  record.status = (uint16_t)stats->status;
+  snprintf(record.clientAddr,
+           sizeof(record.clientAddr),
+           "%s",
+           inputContext->clientAddr);
+  if (request != NULL) {
+    record.method = (uint8_t)request->method;
+    snprintf(record.path, sizeof(record.path), "%s", request->requestPath);
+  }
+  writeAccessRecord(&record);
+}
+
+static uint64_t elapsedNs(const struct timespec *from,
+                          const struct timespec *to) {
+  return (uint64_t)(to->tv_sec - from->tv_sec) * 1000000000ull
+         + to->tv_nsec - from->tv_nsec;
+}
+
+static void markPhase(RequestTiming *timing, RequestPhase phase) {
+  clock_gettime(CLOCK_MONOTONIC, &timing->marks[phase]);
+}
+
+static void recordTiming(const Metrics *metrics,
+                         size_t routeIndex,
+                         const ConnStats *stats,
+                         const RequestTiming *timing) {
+  uint64_t phaseNs[PHASE_COUNT];
+  const struct timespec *from = &timing->start;
+  for (size_t i = 0; i < PHASE_COUNT; i++) {
+    phaseNs[i] = elapsedNs(from, &timing->marks[i]);
+    from = &timing->marks[i];
+  }
+
+  recordRequest(metrics,
+                routeIndex,
+                stats->status,
+                stats->bytesOut,
+                elapsedNs(&timing->start, &timing->marks[PHASE_WRITE]),
+                phaseNs);
+}
+
+/* runs as the status line goes out, so the handler is timed up to here */
+static size_t renderServerTiming(void *context, char *buffer, size_t size) {
+  const RequestTiming *timing = (const RequestTiming*)context;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  int len = snprintf(buffer, size,
+                     "Server-Timing: read;dur=%.3f, route;dur=%.3f, "
+                     "handler;dur=%.3f\r\n",
+                     elapsedNs(&timing->start,
+                               &timing->marks[PHASE_READ]) / 1e6,
+                     elapsedNs(&timing->marks[PHASE_READ],
+                               &timing->marks[PHASE_ROUTE]) / 1e6,
+                     elapsedNs(&timing->marks[PHASE_ROUTE], &now) / 1e6);
+  return len > 0 && (size_t)len < size ? (size_t)len : 0;
+}
+
 static _Bool isCorsRequest(const HttpRequest *request) {
   _Bool hasReferer = 0;
   _Bool hasOrigin = 0;
@@ -0,0 +1,420 @@
+#include "metrics.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "conn_limit.h"
+#include "rate_limit.h"
+#include "util.h"
+
+/* histogram PHASE_COUNT covers the whole request */
+typedef struct st_route_metrics {
+  _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t responses[6];
+  _Atomic uint64_t bytesOut;
+  _Atomic uint64_t latencySumUs[PHASE_COUNT + 1];
+  _Atomic uint64_t latency[PHASE_COUNT + 1][METRICS_BUCKETS];
+} RouteMetrics;
+
+typedef struct st_shard_head {
+  _Alignas(CACHE_LINE_SIZE) _Atomic int busy;
+} ShardHead;
+
+/* the counters of one route label, one block per shard */
+typedef struct st_route_series {
+  char *label;
+  RouteMetrics *shards;
+  struct st_route_series *next;
+} RouteSeries;
+
+struct st_metrics {
+  size_t routeCount;
+  RouteSeries **routes;
+};
+
+/* exposed histogram bounds, in microseconds */
+static const uint64_t EXPOSED_BOUNDS[] = {
+  100, 250, 500,
+  1000, 2500, 5000,
+  10000, 25000, 50000,
+  100000, 250000, 500000,
+  1000000, 2500000, 5000000,
+  10000000
+};
+
+const char *REQUEST_PHASE_NAMES[] = {
+  [PHASE_READ]    = "read",
+  [PHASE_ROUTE]   = "route",
+  [PHASE_HANDLER] = "handler",
+  [PHASE_WRITE]   = "write"
+};
+
+static const char *STATUS_CLASS_NAMES[] = {
+  "none", "1xx", "2xx", "3xx", "4xx", "5xx"
+};
+
+static ShardHead shardHeads[METRICS_SHARDS];
+static RouteSeries *allSeries;
+static pthread_mutex_t seriesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static RouteSeries *findSeries(char *label, Error *error);
+static size_t claimShard(void);
+static void bump(_Atomic uint64_t *counter, uint64_t delta);
+static size_t bucketOf(uint64_t us);
+static uint64_t bucketUpperBound(size_t bucket);
+static void bumpHistogram(RouteMetrics *metrics, size_t which, uint64_t ns);
+static void writeHistogram(FILE *fp,
+                           const char *name,
+                           const char *labels,
+                           const RouteSeries *series,
+                           size_t which);
+static char *makeRouteLabel(const Route *route);
+
+Metrics *createMetrics(const Config *config, Error *error) {
+  Metrics *metrics = (Metrics*)malloc(sizeof(Metrics));
+  if (metrics == NULL) {
+    QUICK_ERROR(error, 500, "failed allocating metrics");
+    return NULL;
+  }
+  metrics->routeCount = ccVecLen(&config->routes);
+  metrics->routes =
+    (RouteSeries**)malloc((metrics->routeCount + 1) * sizeof(RouteSeries*));
+  if (metrics->routes == NULL) {
+    QUICK_ERROR(error, 500, "failed allocating metrics");
+    free(metrics);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&seriesLock);
+  for (size_t i = 0; i <= metrics->routeCount; i++) {
+    char *label = i < metrics->routeCount
+      ? makeRouteLabel((const Route*)ccVecNth(&config->routes, i))
+      : copyString("unmatched");
+    metrics->routes[i] = findSeries(label, error);
+    if (isError(error)) {
+      pthread_mutex_unlock(&seriesLock);
+      dropMetrics(metrics);
+      return NULL;
+    }
+  }
+  pthread_mutex_unlock(&seriesLock);
+  return metrics;
+}
+
+void dropMetrics(Metrics *metrics) {
+  if (metrics == NULL) {
+    return;
+  }
+  free(metrics->routes);
+  free(metrics);
+}
+
+void dropMetricSeries(void) {
+  pthread_mutex_lock(&seriesLock);
+  while (allSeries != NULL) {
+    RouteSeries *series = allSeries;
+    allSeries = series->next;
+    munmap(series->shards, METRICS_SHARDS * sizeof(RouteMetrics));
+    free(series->label);
+    free(series);
+  }
+  pthread_mutex_unlock(&seriesLock);
+}
+
+void recordRequest(const Metrics *metrics,
+                   size_t routeIndex,
+                   int status,
+                   size_t bytesOut,
+                   uint64_t latencyNs,
+                   const uint64_t phaseNs[PHASE_COUNT]) {
+  if (metrics == NULL) {
+    return;
+  }
+
+  size_t shard = claimShard();
+  RouteMetrics *route = metrics->routes[routeIndex]->shards + shard;
+
+  int statusClass = status / 100;
+  if (statusClass < 1 || statusClass > 5) {
+    statusClass = 0;
+  }
+  bump(&route->responses[statusClass], 1);
+  bump(&route->bytesOut, bytesOut);
+  bumpHistogram(route, PHASE_COUNT, latencyNs);
+  for (size_t i = 0; i < PHASE_COUNT; i++) {
+    bumpHistogram(route, i, phaseNs[i]);
+  }
+
+  atomic_store_explicit(&shardHeads[shard].busy, 0, memory_order_release);
+}
+
+void writeMetrics(const Metrics *metrics, FILE *fp) {
+  if (metrics == NULL) {
+    return;
+  }
+
+  fprintf(fp, "# HELP chttpd_connections_active "
+          "Connections being served.\n"
+          "# TYPE chttpd_connections_active gauge\n"
+          "chttpd_connections_active %zu\n"
+          "# HELP chttpd_connections_rejected_total "
+          "Connections turned away by connection limits.\n"
+          "# TYPE chttpd_connections_rejected_total counter\n"
+          "chttpd_connections_rejected_total %zu\n"
+          "# HELP chttpd_rate_limited_total "
+          "Requests refused by rate limits.\n"
+          "# TYPE chttpd_rate_limited_total counter\n"
+          "chttpd_rate_limited_total %zu\n",
+          activeConnections(),
+          rejectedConnections(),
+          rateLimitedRequests());
+
+  uint64_t responses[6];
+  uint64_t bytesOut;
+
+  fputs("# HELP chttpd_requests_total "
+        "Requests handled, by route and status class.\n"
+        "# TYPE chttpd_requests_total counter\n", fp);
+  for (size_t i = 0; i <= metrics->routeCount; i++) {
+    const RouteSeries *series = metrics->routes[i];
+    memset(responses, 0, sizeof(responses));
+    for (size_t shard = 0; shard < METRICS_SHARDS; shard++) {
+      for (size_t j = 0; j < 6; j++) {
+        responses[j] +=
+          atomic_load_explicit(&series->shards[shard].responses[j],
+                                             memory_order_relaxed);
+      }
+    }
+    for (size_t j = 0; j < 6; j++) {
+      if (responses[j] != 0) {
+        fprintf(fp, "chttpd_requests_total{route=\"%s\",code=\"%s\"} "
+                "%llu\n",
+                series->label,
+                STATUS_CLASS_NAMES[j],
+                (unsigned long long)responses[j]);
+      }
+    }
+  }
+
+  fputs("# HELP chttpd_response_bytes_total "
+        "Bytes sent in responses, by route.\n"
+        "# TYPE chttpd_response_bytes_total counter\n", fp);
+  for (size_t i = 0; i <= metrics->routeCount; i++) {
+    const RouteSeries *series = metrics->routes[i];
+    bytesOut = 0;
+    for (size_t shard = 0; shard < METRICS_SHARDS; shard++) {
+      bytesOut += atomic_load_explicit(&series->shards[shard].bytesOut,
+                                       memory_order_relaxed);
+    }
+    fprintf(fp, "chttpd_response_bytes_total{route=\"%s\"} %llu\n",
+            series->label,
+            (unsigned long long)bytesOut);
+  }
+
+  char labels[64];
+  fputs("# HELP chttpd_request_duration_seconds "
+        "Time from accepting a connection to closing it, by route.\n"
+        "# TYPE chttpd_request_duration_seconds histogram\n", fp);
+  for (size_t i = 0; i <= metrics->routeCount; i++) {
+    writeHistogram(fp, "chttpd_request_duration_seconds", "",
+                   metrics->routes[i], PHASE_COUNT);
+  }
+
+  fputs("# HELP chttpd_request_phase_seconds "
+        "Time spent in each phase of a request, by route.\n"
+        "# TYPE chttpd_request_phase_seconds histogram\n", fp);
+  for (size_t i = 0; i <= metrics->routeCount; i++) {
+    for (size_t j = 0; j < PHASE_COUNT; j++) {
+      snprintf(labels, sizeof(labels), ",phase=\"%s\"",
+               REQUEST_PHASE_NAMES[j]);
+      writeHistogram(fp, "chttpd_request_phase_seconds", labels,
+                     metrics->routes[i], j);
+    }
+  }
+}
+
+static void writeHistogram(FILE *fp,
+                           const char *name,
+                           const char *labels,
+                           const RouteSeries *series,
+                           size_t which) {
+  uint64_t sumUs = 0;
+  uint64_t latency[METRICS_BUCKETS];
+  memset(latency, 0, sizeof(latency));
+  for (size_t shard = 0; shard < METRICS_SHARDS; shard++) {
+    const RouteMetrics *metrics = series->shards + shard;
+    sumUs += atomic_load_explicit(&metrics->latencySumUs[which],
+                                  memory_order_relaxed);
+    for (size_t j = 0; j < METRICS_BUCKETS; j++) {
+      latency[j] += atomic_load_explicit(&metrics->latency[which][j],
+                                         memory_order_relaxed);
+    }
+  }
+
+  /* an HDR bucket counts towards a bound once it lies wholly below */
+  uint64_t cumulative = 0;
+  size_t bucket = 0;
+  for (size_t j = 0;
+       j < sizeof(EXPOSED_BOUNDS) / sizeof(EXPOSED_BOUNDS[0]);
+       j++) {
+    while (bucket < METRICS_BUCKETS
+           && bucketUpperBound(bucket) - 1 <= EXPOSED_BOUNDS[j]) {
+      cumulative += latency[bucket];
+      bucket++;
+    }
+    fprintf(fp, "%s_bucket{route=\"%s\"%s,le=\"%g\"} %llu\n",
+            name,
+            series->label,
+            labels,
+            (double)EXPOSED_BOUNDS[j] / 1e6,
+            (unsigned long long)cumulative);
+  }
+  for (; bucket < METRICS_BUCKETS; bucket++) {
+    cumulative += latency[bucket];
+  }
+  fprintf(fp, "%s_bucket{route=\"%s\"%s,le=\"+Inf\"} %llu\n",
+          name, series->label, labels,
+          (unsigned long long)cumulative);
+  fprintf(fp, "%s_sum{route=\"%s\"%s} %.6f\n",
+          name, series->label, labels,
+          (double)sumUs / 1e6);
+  fprintf(fp, "%s_count{route=\"%s\"%s} %llu\n",
+          name, series->label, labels,
+          (unsigned long long)cumulative);
+}
+
+/* takes ownership of `label`, called with seriesLock held */
+static RouteSeries *findSeries(char *label, Error *error) {
+  if (label == NULL) {
+    QUICK_ERROR(error, 500, "failed allocating metric labels");
+    return NULL;
+  }
+  for (RouteSeries *series = allSeries;
+       series != NULL;
+       series = series->next) {
+    if (!strcmp(series->label, label)) {
+      free(label);
+      return series;
+    }
+  }
+
+  RouteSeries *series = (RouteSeries*)malloc(sizeof(RouteSeries));
+  if (series == NULL) {
+    QUICK_ERROR(error, 500, "failed allocating metrics");
+    free(label);
+    return NULL;
+  }
+  /* anonymous pages come zeroed and are only backed once touched */
+  void *map = mmap(NULL, METRICS_SHARDS * sizeof(RouteMetrics),
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+  if (map == MAP_FAILED) {
+    QUICK_ERROR2(error, 500, "failed mapping %zu bytes for metrics",
+                 METRICS_SHARDS * sizeof(RouteMetrics));
+    free(series);
+    free(label);
+    return NULL;
+  }
+  series->label = label;
+  series->shards = (RouteMetrics*)map;
+  series->next = allSeries;
+  allSeries = series;
+  return series;
+}
+
+static size_t claimShard(void) {
+  /* spread threads by their id, then probe for a shard nobody holds */
+  uint64_t hash = (uint64_t)(uintptr_t)pthread_self()
+                  * 0x9E3779B97F4A7C15ull;
+  size_t shard = (size_t)(hash >> 58) % METRICS_SHARDS;
+  for (;;) {
+    for (size_t i = 0; i < METRICS_SHARDS; i++) {
+      ShardHead *head = &shardHeads[shard];
+      int expected = 0;
+      if (atomic_load_explicit(&head->busy, memory_order_relaxed) == 0
+          && atomic_compare_exchange_strong_explicit(&head->busy,
+                                                     &expected,
+                                                     1,
+                                                     memory_order_acquire,
+                                                     memory_order_relaxed)) {
+        return shard;
+      }
+      shard = (shard + 1) % METRICS_SHARDS;
+    }
+    sched_yield();
+  }
+}
+
+/* only the shard owner writes, so no locked read-modify-write needed */
+static void bump(_Atomic uint64_t *counter, uint64_t delta) {
+  uint64_t value = atomic_load_explicit(counter, memory_order_relaxed);
+  atomic_store_explicit(counter, value + delta, memory_order_relaxed);
+}
+
+static void bumpHistogram(RouteMetrics *metrics, size_t which, uint64_t ns) {
+  uint64_t us = ns / 1000;
+  bump(&metrics->latencySumUs[which], us);
+  bump(&metrics->latency[which][bucketOf(us)], 1);
+}
+
+static size_t bucketOf(uint64_t us) {
+  if (us < METRICS_SUB_COUNT) {
+    return (size_t)us;
+  }
+
+  int msb = 63 - __builtin_clzll(us);
+  if (msb >= METRICS_MAX_BITS) {
+    return METRICS_BUCKETS - 1;
+  }
+  int shift = msb - METRICS_SUB_BITS;
+  return (size_t)(shift + 1) * METRICS_SUB_COUNT
+         + (size_t)((us >> shift) & (METRICS_SUB_COUNT - 1));
+}
+
+static uint64_t bucketUpperBound(size_t bucket) {
+  if (bucket < METRICS_SUB_COUNT) {
+    return bucket + 1;
+  }
+
+  size_t shift = bucket / METRICS_SUB_COUNT - 1;
+  uint64_t sub = bucket % METRICS_SUB_COUNT;
+  return (METRICS_SUB_COUNT + sub + 1) << shift;
+}
+
+/* "GET /path", or "GET example.com/path" inside a server block */
+static char *makeRouteLabel(const Route *route) {
+  const char *method = HTTP_METHOD_NAMES[route->httpMethod];
+  const char *host = route->host != NULL ? route->host : "";
+  size_t len = strlen(method) + 1
+               + 2 * (strlen(host) + strlen(route->path)) + 1;
+  char *label = (char*)malloc(len);
+  if (label == NULL) {
+    return NULL;
+  }
+
+  /* label values escape backslashes, quotes and line feeds */
+  char *dest = label + sprintf(label, "%s ", method);
+  for (const char *src = host; *src != '\0'; src++) {
+    if (*src == '\\' || *src == '"') {
+      *dest++ = '\\';
+    }
+    *dest++ = *src;
+  }
+  for (const char *src = route->path; *src != '\0'; src++) {
+    if (*src == '\\' || *src == '"') {
+      *dest++ = '\\';
+      *dest++ = *src;
+    } else if (*src == '\n') {
+      *dest++ = '\\';
+      *dest++ = 'n';
+    } else {
+      *dest++ = *src;
+    }
+  }
+  *dest = '\0';
+  return label;
+}
@@ -0,0 +1,223 @@
+#include "net_util.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util.h"
+
+void parseSockAddress(const char *spec, SockAddress *dest, Error *error) {
+  memset(dest, 0, sizeof(SockAddress));
+
+  if (!strncmp(spec, "unix:", 5)) {
+    const char *path = spec + 5;
+    struct sockaddr_un *un = (struct sockaddr_un*)&dest->addr;
+    if (strlen(path) == 0 || strlen(path) >= sizeof(un->sun_path)) {
+      QUICK_ERROR2(error, 500, "invalid unix socket path: %s", spec);
+      return;
+    }
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, path);
+    dest->addrLen = sizeof(struct sockaddr_un);
+    return;
+  }
+
+  char host[256];
+  const char *portStr = NULL;
+  if (spec[0] == '[') {
+    const char *close = strchr(spec, ']');
+    if (close == NULL || close[1] != ':'
+        || (size_t)(close - spec - 1) >= sizeof(host)) {
+      QUICK_ERROR2(error, 500, "invalid address: %s", spec);
+      return;
+    }
+    memcpy(host, spec + 1, close - spec - 1);
+    host[close - spec - 1] = '\0';
+    portStr = close + 2;
+  } else {
+    const char *colon = strrchr(spec, ':');
+    if (colon == NULL || (size_t)(colon - spec) >= sizeof(host)) {
+      QUICK_ERROR2(error, 500, "invalid address: %s", spec);
+      return;
+    }
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+    portStr = colon + 1;
+  }
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *result = NULL;
+  int res = getaddrinfo(host, portStr, &hints, &result);
+  if (res != 0 || result == NULL) {
+    QUICK_ERROR2(error, 500, "cannot resolve \"%s\": %s",
+                 spec, gai_strerror(res));
+    return;
+  }
+
+  memcpy(&dest->addr, result->ai_addr, result->ai_addrlen);
+  dest->addrLen = result->ai_addrlen;
+  freeaddrinfo(result);
+}
+
+int connectSockAddress(const SockAddress *address,
+                       uint32_t timeoutMs,
+                       Error *error) {
+  int fd = socket(address->addr.ss_family, SOCK_STREAM, 0);
+  if (fd < 0) {
+    QUICK_ERROR2(error, 500, "cannot create upstream socket: %d", errno);
+    return -1;
+  }
+  if (timeoutMs != 0 && !setSocketTimeout(fd, timeoutMs)) {
+    QUICK_ERROR2(error, 500, "cannot set upstream timeout: %d", errno);
+    close(fd);
+    return -1;
+  }
+
+  int res;
+  do {
+    res = connect(fd, (const struct sockaddr*)&address->addr,
+                  address->addrLen);
+  } while (res < 0 && errno == EINTR);
+  if (res < 0 && errno == EINPROGRESS) {
+    QUICK_ERROR2(error, 504, "timed out connecting to upstream after %u ms",
+                 timeoutMs);
+    close(fd);
+    return -1;
+  }
+  if (res < 0) {
+    QUICK_ERROR2(error, 502, "cannot connect to upstream: %s",
+                 strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+void formatSockAddress(const struct sockaddr *addr,
+                       socklen_t addrLen,
+                       _Bool withPort,
+                       char *buffer,
+                       size_t size) {
+  char host[INET6_ADDRSTRLEN];
+  int port = 0;
+  _Bool bracket = 0;
+
+  switch (addr->sa_family) {
+    case AF_INET: {
+      const struct sockaddr_in *in = (const struct sockaddr_in*)addr;
+      inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+      port = ntohs(in->sin_port);
+      break;
+    }
+    case AF_INET6: {
+      const struct sockaddr_in6 *in6 = (const struct sockaddr_in6*)addr;
+      if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+        inet_ntop(AF_INET, &in6->sin6_addr.s6_addr[12], host, sizeof(host));
+      } else {
+        inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+        bracket = 1;
+      }
+      port = ntohs(in6->sin6_port);
+      break;
+    }
+    case AF_UNIX: {
+      /* the path need not be terminated if it fills sun_path */
+      const struct sockaddr_un *un = (const struct sockaddr_un*)addr;
+      size_t offset = offsetof(struct sockaddr_un, sun_path);
+      int len = addrLen > offset ? (int)strnlen(un->sun_path,
+                                                addrLen - offset) : 0;
+      snprintf(buffer, size, "unix:%.*s", len, un->sun_path);
+      return;
+    }
+    default:
+      snprintf(buffer, size, "unknown");
+      return;
+  }
+
+  if (!withPort) {
+    snprintf(buffer, size, "%s", host);
+  } else if (bracket) {
+    snprintf(buffer, size, "[%s]:%d", host, port);
+  } else {
+    snprintf(buffer, size, "%s:%d", host, port);
+  }
+}
+
+_Bool sameSockAddress(const struct sockaddr *a, const struct sockaddr *b) {
+  if (a->sa_family != b->sa_family) {
+    return 0;
+  }
+
+  switch (a->sa_family) {
+    case AF_INET: {
+      const struct sockaddr_in *inA = (const struct sockaddr_in*)a;
+      const struct sockaddr_in *inB = (const struct sockaddr_in*)b;
+      return inA->sin_port == inB->sin_port
+             && inA->sin_addr.s_addr == inB->sin_addr.s_addr;
+    }
+    case AF_INET6: {
+      const struct sockaddr_in6 *inA = (const struct sockaddr_in6*)a;
+      const struct sockaddr_in6 *inB = (const struct sockaddr_in6*)b;
+      return inA->sin6_port == inB->sin6_port
+             && IN6_ARE_ADDR_EQUAL(&inA->sin6_addr, &inB->sin6_addr);
+    }
+    case AF_UNIX: {
+      const struct sockaddr_un *unA = (const struct sockaddr_un*)a;
+      const struct sockaddr_un *unB = (const struct sockaddr_un*)b;
+      return !strncmp(unA->sun_path, unB->sun_path, sizeof(unA->sun_path));
+    }
+    default:
+      return 0;
+  }
+}
+
+_Bool setSocketTimeout(int fd, uint32_t timeoutMs) {
+  struct timeval tv;
+  tv.tv_sec = timeoutMs / 1000;
+  tv.tv_usec = (timeoutMs % 1000) * 1000;
+  return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0
+         && setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0;
+}
+
+_Bool writeAllFd(int fd, const void *buffer, size_t size) {
+  const char *src = (const char*)buffer;
+  while (size > 0) {
+    ssize_t written = write(fd, src, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return 0;
+    }
+    src += written;
+    size -= written;
+  }
+  return 1;
+}
+
+_Bool readAllFd(int fd, void *buffer, size_t size) {
+  char *dest = (char*)buffer;
+  while (size > 0) {
+    ssize_t bytesRead = read(fd, dest, size);
+    if (bytesRead < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytesRead <= 0) {
+      return 0;
+    }
+    dest += bytesRead;
+    size -= bytesRead;
+  }
+  return 1;
+}
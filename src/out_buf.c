@@ -0,0 +1,331 @@
+#include "out_buf.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/* a blocking send only returns once all is out, so bound what it gets */
+#define OUT_SEND_CHUNK (256 * 1024)
+
+static void makeRoom(OutBuf *out, size_t copySize);
+static void addPiece(OutBuf *out,
+                     const char *data,
+                     int fd,
+                     off_t offset,
+                     size_t size);
+static void addCopied(OutBuf *out, size_t size);
+static _Bool sendPieces(OutBuf *out);
+static _Bool sendMemory(OutBuf *out, struct iovec *iov, int iovCount);
+static _Bool sendFileRange(OutBuf *out, const OutPiece *piece);
+static void advanceIov(struct iovec **iov, int *iovCount, size_t bytes);
+static void madeProgress(OutBuf *out);
+static void sniffStatus(OutBuf *out);
+
+void initOutBuf(OutBuf *out, int fd, ConnStats *stats) {
+  out->fd = fd;
+  out->stats = stats;
+  out->pieceCount = 0;
+  out->copyUsed = 0;
+  out->failed = 0;
+}
+
+void outStatic(OutBuf *out, const char *str) {
+  outRef(out, str, strlen(str));
+}
+
+void outRef(OutBuf *out, const char *data, size_t size) {
+  if (size == 0 || out->failed) {
+    return;
+  }
+  makeRoom(out, 0);
+  addPiece(out, data, -1, 0, size);
+}
+
+void outFile(OutBuf *out, int fd, off_t offset, size_t size) {
+  if (size == 0 || out->failed) {
+    return;
+  }
+  makeRoom(out, 0);
+  addPiece(out, NULL, fd, offset, size);
+}
+
+void outWrite(OutBuf *out, const char *data, size_t size) {
+  if (size == 0 || out->failed) {
+    return;
+  }
+
+  /* not worth copying, send it while the caller still has it */
+  if (size > OUT_BUF_COPY_SIZE / 4) {
+    outRef(out, data, size);
+    outFlush(out);
+    return;
+  }
+
+  makeRoom(out, size);
+  memcpy(out->copy + out->copyUsed, data, size);
+  addCopied(out, size);
+}
+
+void outPrintf(OutBuf *out, const char *fmt, ...) {
+  if (out->failed) {
+    return;
+  }
+
+  makeRoom(out, 0);
+  va_list args;
+  va_start(args, fmt);
+  size_t room = OUT_BUF_COPY_SIZE - out->copyUsed;
+  int len = vsnprintf(out->copy + out->copyUsed, room, fmt, args);
+  va_end(args);
+  if (len < 0) {
+    return;
+  }
+
+  if ((size_t)len >= room) {
+    outFlush(out);
+    if (out->failed) {
+      return;
+    }
+
+    if ((size_t)len < OUT_BUF_COPY_SIZE) {
+      va_start(args, fmt);
+      vsnprintf(out->copy, OUT_BUF_COPY_SIZE, fmt, args);
+      va_end(args);
+    } else {
+      char *buffer = (char*)malloc((size_t)len + 1);
+      if (buffer == NULL) {
+        out->failed = 1;
+        return;
+      }
+      va_start(args, fmt);
+      vsnprintf(buffer, (size_t)len + 1, fmt, args);
+      va_end(args);
+      outRef(out, buffer, (size_t)len);
+      outFlush(out);
+      free(buffer);
+      return;
+    }
+  }
+  addCopied(out, (size_t)len);
+}
+
+_Bool outFlush(OutBuf *out) {
+  if (out->pieceCount == 0 || out->failed) {
+    out->pieceCount = 0;
+    out->copyUsed = 0;
+    return !out->failed;
+  }
+
+  ConnStats *stats = out->stats;
+  if (stats->headLen < sizeof(stats->head)) {
+    sniffStatus(out);
+  }
+
+  /* re-armed by every send that gets anywhere, see madeProgress */
+  _Bool timed = stats->timeouts.write != 0;
+  if (timed) {
+    armTimer(&stats->timer, stats->timeouts.write, SHUT_RDWR);
+  }
+  _Bool ok = sendPieces(out);
+  if (timed) {
+    cancelTimer(&stats->timer);
+  }
+
+  out->pieceCount = 0;
+  out->copyUsed = 0;
+  out->failed = !ok;
+  return ok;
+}
+
+static void makeRoom(OutBuf *out, size_t copySize) {
+  if (out->pieceCount == OUT_BUF_PIECES
+      || out->copyUsed + copySize > OUT_BUF_COPY_SIZE) {
+    outFlush(out);
+  }
+}
+
+static void addPiece(OutBuf *out,
+                     const char *data,
+                     int fd,
+                     off_t offset,
+                     size_t size) {
+  OutPiece *piece = &out->pieces[out->pieceCount++];
+  piece->data = data;
+  piece->fd = fd;
+  piece->offset = offset;
+  piece->size = size;
+}
+
+/* `size` bytes just written at the end of the copy buffer */
+static void addCopied(OutBuf *out, size_t size) {
+  const char *data = out->copy + out->copyUsed;
+  out->copyUsed += size;
+
+  /* consecutive copies stay one piece */
+  if (out->pieceCount != 0) {
+    OutPiece *last = &out->pieces[out->pieceCount - 1];
+    if (last->data != NULL && last->data + last->size == data) {
+      last->size += size;
+      return;
+    }
+  }
+  addPiece(out, data, -1, 0, size);
+}
+
+static _Bool sendPieces(OutBuf *out) {
+  ConnStats *stats = out->stats;
+  /* one piece may be split around the head hook's lines */
+  struct iovec iov[OUT_BUF_PIECES + 2];
+  int iovCount = 0;
+  char extra[CONN_HEAD_HOOK_SIZE];
+
+  for (size_t i = 0; i < out->pieceCount; i++) {
+    const OutPiece *piece = &out->pieces[i];
+    if (piece->data == NULL) {
+      if (!sendMemory(out, iov, iovCount)
+          || !sendFileRange(out, piece)) {
+        return 0;
+      }
+      iovCount = 0;
+      continue;
+    }
+
+    if (stats->headHook != NULL && !stats->headHookDone) {
+      const char *lineEnd =
+        (const char*)memchr(piece->data, '\n', piece->size);
+      if (lineEnd != NULL) {
+        stats->headHookDone = 1;
+
+        size_t lineSize = lineEnd + 1 - piece->data;
+        size_t extraSize = stats->headHook(stats->headHookContext,
+                                           extra,
+                                           sizeof(extra));
+        iov[iovCount++] = (struct iovec) {
+          (void*)piece->data, lineSize
+        };
+        iov[iovCount++] = (struct iovec) { extra, extraSize };
+        iov[iovCount++] = (struct iovec) {
+          (void*)(lineEnd + 1), piece->size - lineSize
+        };
+        continue;
+      }
+    }
+    iov[iovCount++] = (struct iovec) { (void*)piece->data, piece->size };
+  }
+
+  return sendMemory(out, iov, iovCount);
+}
+
+/* all of `iov` or fails, gathered into one sendmsg per chunk */
+static _Bool sendMemory(OutBuf *out, struct iovec *iov, int iovCount) {
+  while (iovCount > 0) {
+    /* the iovecs making up the chunk, the last one cut short */
+    int chunkCount = 0;
+    size_t chunkSize = 0;
+    while (chunkCount < iovCount && chunkSize < OUT_SEND_CHUNK) {
+      chunkSize += iov[chunkCount++].iov_len;
+    }
+    struct iovec *last = &iov[chunkCount - 1];
+    size_t lastLen = last->iov_len;
+    if (chunkSize > OUT_SEND_CHUNK) {
+      last->iov_len -= chunkSize - OUT_SEND_CHUNK;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size_t)chunkCount;
+
+    ssize_t sent = sendmsg(out->fd, &msg, MSG_NOSIGNAL);
+    last->iov_len = lastLen;
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent < 0) {
+      return 0;
+    }
+    out->stats->bytesOut += (size_t)sent;
+    madeProgress(out);
+    advanceIov(&iov, &iovCount, (size_t)sent);
+  }
+  return 1;
+}
+
+static _Bool sendFileRange(OutBuf *out, const OutPiece *piece) {
+  off_t offset = piece->offset;
+  size_t left = piece->size;
+  while (left > 0) {
+    ssize_t res = sendfile(out->fd,
+                           piece->fd,
+                           &offset,
+                           left < OUT_SEND_CHUNK ? left : OUT_SEND_CHUNK);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return 0;
+    }
+    left -= (size_t)res;
+    out->stats->bytesOut += (size_t)res;
+    madeProgress(out);
+  }
+  return 1;
+}
+
+static void advanceIov(struct iovec **iov, int *iovCount, size_t bytes) {
+  while (*iovCount > 0 && bytes >= (*iov)->iov_len) {
+    bytes -= (*iov)->iov_len;
+    (*iov)++;
+    (*iovCount)--;
+  }
+  if (*iovCount > 0) {
+    (*iov)->iov_base = (char*)(*iov)->iov_base + bytes;
+    (*iov)->iov_len -= bytes;
+  }
+}
+
+/*
+ * The write timeout is for a client that stopped reading, not for a
+ * slow one, so it starts over whenever some of the response got out.
+ */
+static void madeProgress(OutBuf *out) {
+  ConnStats *stats = out->stats;
+  if (stats->timeouts.write != 0) {
+    armTimer(&stats->timer, stats->timeouts.write, SHUT_RDWR);
+  }
+}
+
+/* "HTTP/1.1 200", from the first memory pieces */
+static void sniffStatus(OutBuf *out) {
+  ConnStats *stats = out->stats;
+  for (size_t i = 0; i < out->pieceCount; i++) {
+    const OutPiece *piece = &out->pieces[i];
+    if (piece->data == NULL
+        || stats->headLen == sizeof(stats->head)) {
+      break;
+    }
+
+    size_t room = sizeof(stats->head) - stats->headLen;
+    size_t chunk = piece->size < room ? piece->size : room;
+    memcpy(stats->head + stats->headLen, piece->data, chunk);
+    stats->headLen += chunk;
+  }
+
+  if (stats->headLen >= 12 && stats->status == 0
+      && !memcmp(stats->head, "HTTP/", 5)) {
+    const char *code = stats->head + 9;
+    if (code[0] >= '1' && code[0] <= '5'
+        && code[1] >= '0' && code[1] <= '9'
+        && code[2] >= '0' && code[2] <= '9') {
+      stats->status = (code[0] - '0') * 100
+                      + (code[1] - '0') * 10
+                      + (code[2] - '0');
+    }
+  }
+}
@@ -0,0 +1,552 @@
+#define _GNU_SOURCE
+
+#include "proxy.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "net_util.h"
+#include "util.h"
+
+#define PROXY_MAX_IDLE    64
+#define PROXY_BUFFER_SIZE 16384
+#define PROXY_LINE_SIZE   8192
+#define PROXY_REPLAY_SIZE 65536
+
+typedef struct st_proxy_server {
+  char *address;
+  SockAddress sockAddress;
+  size_t active;
+  size_t idleCount;
+  int idleFds[PROXY_MAX_IDLE];
+} ProxyServer;
+
+struct st_proxy_upstream {
+  char *name;
+  ProxyBalance balance;
+  size_t maxIdle;
+  size_t serverCount;
+  size_t next;
+  pthread_mutex_t lock;
+  ProxyServer servers[PROXY_MAX_SERVERS];
+};
+
+typedef struct st_upstream_reader {
+  int fd;
+  _Bool timedOut;
+  size_t pos;
+  size_t len;
+  char buffer[PROXY_BUFFER_SIZE];
+} UpstreamReader;
+
+static ProxyServer *pickServer(ProxyUpstream *upstream);
+static int takeConn(ProxyUpstream *upstream,
+                    ProxyServer *server,
+                    uint32_t timeoutMs,
+                    _Bool *reused,
+                    Error *error);
+static void releaseConn(ProxyUpstream *upstream,
+                        ProxyServer *server,
+                        int fd,
+                        _Bool keepAlive);
+static _Bool sendUpstreamRequest(int fd,
+                                 HttpRequest *request,
+                                 Error *error);
+static _Bool relayResponse(UpstreamReader *reader,
+                           FILE *response,
+                           _Bool *keepAlive,
+                           Error *error);
+
+static _Bool readerFill(UpstreamReader *reader);
+static ssize_t readerLine(UpstreamReader *reader, char *line, size_t cap);
+static _Bool readerCopy(UpstreamReader *reader, FILE *response, size_t n);
+static const char *readerFailure(const UpstreamReader *reader);
+static _Bool isHopByHop(const char *begin, const char *end);
+
+ProxyUpstream *createProxyUpstream(const char *name, Error *error) {
+  ProxyUpstream *upstream = (ProxyUpstream*)malloc(sizeof(ProxyUpstream));
+  if (upstream == NULL) {
+    QUICK_ERROR(error, 500, "failed allocating proxy upstream");
+    return NULL;
+  }
+  memset(upstream, 0, sizeof(ProxyUpstream));
+  upstream->name = copyString(name);
+  upstream->balance = PROXY_ROUND_ROBIN;
+  upstream->maxIdle = 8;
+  pthread_mutex_init(&upstream->lock, NULL);
+  return upstream;
+}
+
+void addProxyServer(ProxyUpstream *upstream,
+                    const char *address,
+                    Error *error) {
+  if (upstream->serverCount == PROXY_MAX_SERVERS) {
+    QUICK_ERROR2(error, 500, "upstream %s: too many servers",
+                 upstream->name);
+    return;
+  }
+
+  ProxyServer *server = &upstream->servers[upstream->serverCount];
+  memset(server, 0, sizeof(ProxyServer));
+  parseSockAddress(address, &server->sockAddress, error);
+  if (isError(error)) {
+    return;
+  }
+  server->address = copyString(address);
+  upstream->serverCount++;
+}
+
+void setProxyBalance(ProxyUpstream *upstream, ProxyBalance balance) {
+  upstream->balance = balance;
+}
+
+void setProxyKeepAlive(ProxyUpstream *upstream, int maxIdle) {
+  upstream->maxIdle = maxIdle > PROXY_MAX_IDLE ? PROXY_MAX_IDLE : maxIdle;
+}
+
+const char *proxyUpstreamName(const ProxyUpstream *upstream) {
+  return upstream->name;
+}
+
+void dropProxyUpstream(ProxyUpstream *upstream) {
+  for (size_t i = 0; i < upstream->serverCount; i++) {
+    ProxyServer *server = &upstream->servers[i];
+    for (size_t j = 0; j < server->idleCount; j++) {
+      close(server->idleFds[j]);
+    }
+    free(server->address);
+  }
+  pthread_mutex_destroy(&upstream->lock);
+  free(upstream->name);
+  free(upstream);
+}
+
+void handleProxy(ProxyUpstream *upstream,
+                 int timeout,
+                 HttpRequest *request,
+                 FILE *response,
+                 Error *error) {
+  if (upstream->serverCount == 0) {
+    QUICK_ERROR2(error, 502, "upstream %s has no servers",
+                 upstream->name);
+    return;
+  }
+
+  UpstreamReader *reader = (UpstreamReader*)malloc(sizeof(UpstreamReader));
+  if (reader == NULL) {
+    QUICK_ERROR(error, 500, "failed allocating upstream reader");
+    return;
+  }
+
+  /* Small bodies are collected up front so that they can be replayed,
+     larger ones and chunked ones are streamed straight through */
+  if (!request->chunked
+      && request->contentLength != 0
+      && request->contentLength <= PROXY_REPLAY_SIZE
+      && readHttpBodyAll(request, error) == NULL) {
+    free(reader);
+    return;
+  }
+
+  /* A pooled connection may have been closed by the upstream while
+     idle, in which case the request is retried once on a fresh one,
+     unless part of a streamed body is already gone */
+  for (int attempt = 0; attempt < 2; attempt++) {
+    ProxyServer *server = pickServer(upstream);
+    _Bool reused = 0;
+    int fd = takeConn(upstream,
+                      server,
+                      (uint32_t)timeout * 1000,
+                      &reused,
+                      error);
+    if (fd < 0) {
+      releaseConn(upstream, server, -1, 0);
+      break;
+    }
+
+    _Bool replayable = request->body != NULL || request->bodyRead == 0;
+    if (!sendUpstreamRequest(fd, request, error)) {
+      _Bool timedOut = errno == EAGAIN || errno == EWOULDBLOCK;
+      releaseConn(upstream, server, fd, 0);
+      if (isError(error)) {
+        break;
+      }
+      if (timedOut) {
+        QUICK_ERROR2(error, 504, "timed out sending request to %s",
+                     server->address);
+        break;
+      }
+      if (reused && replayable) {
+        continue;
+      }
+      QUICK_ERROR2(error, 502, "cannot send request to %s: %d",
+                   server->address, errno);
+      break;
+    }
+
+    reader->fd = fd;
+    reader->timedOut = 0;
+    reader->pos = 0;
+    reader->len = 0;
+    if (!readerFill(reader)) {
+      releaseConn(upstream, server, fd, 0);
+      if (reader->timedOut) {
+        QUICK_ERROR2(error, 504, "upstream %s timed out after %d seconds",
+                     server->address, timeout);
+        break;
+      }
+      if (reused && replayable) {
+        continue;
+      }
+      QUICK_ERROR2(error, 502, "upstream %s sent no response",
+                   server->address);
+      break;
+    }
+
+    _Bool keepAlive = 1;
+    if (!relayResponse(reader, response, &keepAlive, error)) {
+      keepAlive = 0;
+    }
+    /* only a connection whose response was read to its end, and not
+       past it, may serve another client */
+    if (reader->pos != reader->len) {
+      keepAlive = 0;
+    }
+    releaseConn(upstream, server, fd, keepAlive);
+    break;
+  }
+
+  free(reader);
+}
+
+static ProxyServer *pickServer(ProxyUpstream *upstream) {
+  pthread_mutex_lock(&upstream->lock);
+
+  size_t count = upstream->serverCount;
+  size_t start = upstream->next++ % count;
+  ProxyServer *picked = &upstream->servers[start];
+  if (upstream->balance == PROXY_LEAST_CONN) {
+    for (size_t i = 1; i < count; i++) {
+      ProxyServer *server = &upstream->servers[(start + i) % count];
+      if (server->active < picked->active) {
+        picked = server;
+      }
+    }
+  }
+  picked->active++;
+
+  pthread_mutex_unlock(&upstream->lock);
+  return picked;
+}
+
+static int takeConn(ProxyUpstream *upstream,
+                    ProxyServer *server,
+                    uint32_t timeoutMs,
+                    _Bool *reused,
+                    Error *error) {
+  pthread_mutex_lock(&upstream->lock);
+  if (server->idleCount != 0) {
+    int fd = server->idleFds[--server->idleCount];
+    pthread_mutex_unlock(&upstream->lock);
+    *reused = 1;
+    /* the timeout may have changed with a reload since it was pooled */
+    if (!setSocketTimeout(fd, timeoutMs)) {
+      QUICK_ERROR2(error, 500, "cannot set upstream timeout: %d", errno);
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+  pthread_mutex_unlock(&upstream->lock);
+
+  *reused = 0;
+  return connectSockAddress(&server->sockAddress, timeoutMs, error);
+}
+
+static void releaseConn(ProxyUpstream *upstream,
+                        ProxyServer *server,
+                        int fd,
+                        _Bool keepAlive) {
+  pthread_mutex_lock(&upstream->lock);
+  server->active--;
+  if (fd >= 0 && keepAlive && server->idleCount < upstream->maxIdle) {
+    server->idleFds[server->idleCount++] = fd;
+    fd = -1;
+  }
+  pthread_mutex_unlock(&upstream->lock);
+
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+static _Bool sendUpstreamRequest(int fd,
+                                 HttpRequest *request,
+                                 Error *error) {
+  char *head = NULL;
+  size_t headSize = 0;
+  FILE *fp = open_memstream(&head, &headSize);
+  if (fp == NULL) {
+    return 0;
+  }
+
+  fprintf(fp, "%s %s%s%s HTTP/1.1\r\n",
+          HTTP_METHOD_NAMES[request->method],
+          request->requestPath,
+          request->queryString ? "?" : "",
+          request->queryString ? request->queryString : "");
+  for (size_t i = 0; i < ccVecLen(&request->headers); i++) {
+    StringPair *header = (StringPair*)ccVecNth(&request->headers, i);
+    const char *name = header->first;
+    /* the body is on its way regardless, no 100 Continue is waited for */
+    if (isHopByHop(name, name + strlen(name))
+        || strcmp_icase(name, "Content-Length")
+        || strcmp_icase(name, "Transfer-Encoding")
+        || strcmp_icase(name, "Expect")) {
+      continue;
+    }
+    fprintf(fp, "%s: %s\r\n", name, header->second);
+  }
+  _Bool streamChunked = request->chunked && request->body == NULL;
+  if (streamChunked) {
+    fputs("Transfer-Encoding: chunked\r\n", fp);
+  } else if (request->contentLength != 0 || request->method == HTTP_POST) {
+    fprintf(fp, "Content-Length: %zu\r\n", request->contentLength);
+  }
+  fputs("Connection: keep-alive\r\n\r\n", fp);
+  fclose(fp);
+
+  _Bool ret = writeAllFd(fd, head, headSize);
+  free(head);
+  if (!ret) {
+    return 0;
+  }
+
+  if (request->body != NULL) {
+    return writeAllFd(fd, request->body, request->contentLength);
+  }
+
+  /* a chunked body is passed on one chunk per read */
+  char buffer[PROXY_BUFFER_SIZE];
+  for (;;) {
+    ssize_t bytesRead = readHttpBody(request, buffer, sizeof(buffer), error);
+    if (bytesRead < 0) {
+      return 0;
+    }
+
+    if (streamChunked) {
+      char chunkHead[32];
+      int headLen = snprintf(chunkHead, sizeof(chunkHead), "%zx\r\n",
+                             (size_t)bytesRead);
+      if (!writeAllFd(fd, chunkHead, headLen)
+          || !writeAllFd(fd, buffer, bytesRead)
+          || !writeAllFd(fd, "\r\n", 2)) {
+        return 0;
+      }
+    } else if (!writeAllFd(fd, buffer, bytesRead)) {
+      return 0;
+    }
+
+    if (bytesRead == 0) {
+      return 1;
+    }
+  }
+}
+
+static _Bool relayResponse(UpstreamReader *reader,
+                           FILE *response,
+                           _Bool *keepAlive,
+                           Error *error) {
+  char line[PROXY_LINE_SIZE];
+  ssize_t lineLen;
+  int code;
+  /* interim responses are dropped, the client only gets the final one */
+  for (;;) {
+    lineLen = readerLine(reader, line, sizeof(line));
+    if (lineLen < 0 && reader->timedOut) {
+      QUICK_ERROR(error, 504, "upstream timed out before its status line");
+      return 0;
+    }
+    if (lineLen < 12 || strncmp(line, "HTTP/1.", 7)) {
+      QUICK_ERROR(error, 502, "malformed upstream status line");
+      return 0;
+    }
+    code = atoi(line + 9);
+    if (code < 100 || code >= 200) {
+      break;
+    }
+    if (code == 101) {
+      QUICK_ERROR(error, 502, "upstream switched protocols");
+      return 0;
+    }
+    do {
+      lineLen = readerLine(reader, line, sizeof(line));
+      if (lineLen < 0) {
+        QUICK_ERROR2(error, reader->timedOut ? 504 : 502,
+                     "upstream closed connection after %d", code);
+        return 0;
+      }
+    } while (lineLen > 2);
+  }
+  if (line[7] == '0') {
+    *keepAlive = 0;
+  }
+  fwrite(line, 1, lineLen, response);
+
+  _Bool chunked = 0;
+  _Bool hasLength = 0;
+  size_t contentLength = 0;
+  for (;;) {
+    lineLen = readerLine(reader, line, sizeof(line));
+    if (lineLen < 0) {
+      LOG_WARN("upstream %s inside headers", readerFailure(reader));
+      return 0;
+    }
+    if (lineLen <= 2) {
+      break;
+    }
+
+    const char *colon = (const char*)memchr(line, ':', lineLen);
+    if (colon == NULL) {
+      continue;
+    }
+    const char *value = colon + 1;
+    while (*value == ' ' || *value == '\t') {
+      value++;
+    }
+    if (slicecmp_icase(line, colon, "Content-Length")) {
+      contentLength = strtoull(value, NULL, 10);
+      hasLength = 1;
+    } else if (slicecmp_icase(line, colon, "Transfer-Encoding")) {
+      chunked = strstr(value, "chunked") != NULL;
+    } else if (slicecmp_icase(line, colon, "Connection")) {
+      if (strstr(value, "close") != NULL) {
+        *keepAlive = 0;
+      } else if (strstr(value, "keep-alive") != NULL) {
+        *keepAlive = 1;
+      }
+    }
+    if (!isHopByHop(line, colon)) {
+      fwrite(line, 1, lineLen, response);
+    }
+  }
+  fputs("Connection: close\r\n\r\n", response);
+
+  if (code == 204 || code == 304) {
+    return 1;
+  }
+
+  if (chunked) {
+    for (;;) {
+      lineLen = readerLine(reader, line, sizeof(line));
+      if (lineLen < 0) {
+        LOG_WARN("upstream %s inside chunked body", readerFailure(reader));
+        return 0;
+      }
+      fwrite(line, 1, lineLen, response);
+      size_t chunkSize = strtoull(line, NULL, 16);
+      if (chunkSize == 0) {
+        break;
+      }
+      if (!readerCopy(reader, response, chunkSize + 2)) {
+        LOG_WARN("upstream %s inside chunk", readerFailure(reader));
+        return 0;
+      }
+    }
+    /* trailers, terminated by an empty line */
+    do {
+      lineLen = readerLine(reader, line, sizeof(line));
+      if (lineLen < 0) {
+        return 0;
+      }
+      fwrite(line, 1, lineLen, response);
+    } while (lineLen > 2);
+    return 1;
+  }
+
+  if (hasLength) {
+    if (!readerCopy(reader, response, contentLength)) {
+      LOG_WARN("upstream %s inside a body of %zu bytes",
+               readerFailure(reader), contentLength);
+      return 0;
+    }
+    return 1;
+  }
+
+  /* Delimited by connection close, cannot be reused afterwards */
+  *keepAlive = 0;
+  while (reader->pos < reader->len || readerFill(reader)) {
+    fwrite(reader->buffer + reader->pos, 1,
+           reader->len - reader->pos, response);
+    reader->pos = reader->len;
+  }
+  return 1;
+}
+
+static _Bool readerFill(UpstreamReader *reader) {
+  ssize_t bytesRead;
+  do {
+    bytesRead = read(reader->fd, reader->buffer, PROXY_BUFFER_SIZE);
+  } while (bytesRead < 0 && errno == EINTR);
+  if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    reader->timedOut = 1;
+  }
+  if (bytesRead <= 0) {
+    return 0;
+  }
+  reader->pos = 0;
+  reader->len = (size_t)bytesRead;
+  return 1;
+}
+
+static ssize_t readerLine(UpstreamReader *reader, char *line, size_t cap) {
+  size_t lineLen = 0;
+  for (;;) {
+    if (reader->pos == reader->len && !readerFill(reader)) {
+      return -1;
+    }
+    char ch = reader->buffer[reader->pos++];
+    if (lineLen + 1 >= cap) {
+      return -1;
+    }
+    line[lineLen++] = ch;
+    if (ch == '\n') {
+      line[lineLen] = '\0';
+      return (ssize_t)lineLen;
+    }
+  }
+}
+
+static _Bool readerCopy(UpstreamReader *reader, FILE *response, size_t n) {
+  while (n > 0) {
+    if (reader->pos == reader->len && !readerFill(reader)) {
+      return 0;
+    }
+    size_t chunk = reader->len - reader->pos;
+    if (chunk > n) {
+      chunk = n;
+    }
+    if (fwrite(reader->buffer + reader->pos, 1, chunk, response) != chunk) {
+      return 0;
+    }
+    reader->pos += chunk;
+    n -= chunk;
+  }
+  return 1;
+}
+
+static const char *readerFailure(const UpstreamReader *reader) {
+  return reader->timedOut ? "timed out" : "closed connection";
+}
+
+static _Bool isHopByHop(const char *begin, const char *end) {
+  return slicecmp_icase(begin, end, "Connection")
+         || slicecmp_icase(begin, end, "Keep-Alive")
+         || slicecmp_icase(begin, end, "Proxy-Connection")
+         || slicecmp_icase(begin, end, "TE")
+         || slicecmp_icase(begin, end, "Upgrade");
+}
@@ -2,78 +2,63 @@
 
 #include <config.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
 #include "file_util.h"
+#include "http_head.h"
 #include "util.h"
 
-static const char *mimeGuess(const char *filePath);
-
 void handleStatic(const char *filePath,
-                  FILE *fp,
+                  OutBuf *out,
                   int cacheTime,
                   Error *error) {
-  FILE *fpFile = fopen(filePath, "r");
-  if (fpFile == NULL) {
+  int fdFile = open(filePath, O_RDONLY | O_CLOEXEC);
+  if (fdFile < 0) {
     QUICK_ERROR2(error, 500, "handleStatic: cannot open file: %s",
                  filePath);
     return;
   }
 
-  ssize_t fileSize = readAll(fpFile, NULL, 0);
-  if (fileSize < 0) {
+  struct stat fileStat;
+  if (fstat(fdFile, &fileStat) < 0) {
     QUICK_ERROR2(error, 500, "handleStatic: cannot get size of file: %s",
                  filePath);
-    goto close_fp_ret;
-  }
-
-  char *buffer = (char*)malloc(fileSize);
-  if (buffer == NULL) {
-    QUICK_ERROR2(error, 500, "handleStatic: cannot allocate %zi bytes",
-                 fileSize);
-    goto close_fp_ret;
+    goto close_fd_ret;
   }
+  size_t fileSize = (size_t)fileStat.st_size;
 
-  ssize_t bytesRead = readAll(fpFile, buffer, fileSize);
-  if (bytesRead != fileSize) {
-    QUICK_ERROR2(error, 500,
-                 "handleStatic: cannot read %zi bytes from %s",
-                 fileSize, filePath);
-    goto free_buf_ret;
-  }
-
-  fprintf(fp,
-          "HTTP/1.1 200 OK\r\n"
-          "Server: %s\r\n"
-          "Connection: close\r\n"
-          "Content-Encoding: identity\r\n"
-          "Content-Type: %s\r\n"
-          "Content-Length: %zi\r\n",
-          CHTTPD_SERVER_NAME,
-          mimeGuess(filePath),
-          fileSize);
+  outStatic(out,
+            "HTTP/1.1 200 OK\r\n"
+            "Server: " CHTTPD_SERVER_NAME "\r\n"
+            "Connection: close\r\n"
+            "Content-Encoding: identity\r\n");
+  outDateHeader(out);
+  outHeader(out, "Content-Type", mimeGuess(filePath));
+  outHeaderUint(out, "Content-Length", fileSize);
   if (cacheTime >= 0) {
-    fprintf(fp, "Cache-Control: public, max-age=%d\r\n\r\n", cacheTime);
+    char maxAge[UINT_DIGITS_MAX];
+    outStatic(out, "Cache-Control: public, max-age=");
+    outWrite(out, maxAge, formatUint(maxAge, (uint64_t)cacheTime));
+    outStatic(out, "\r\n\r\n");
   } else {
-    fprintf(fp, "Cache-Control: no-cache\r\n\r\n");
-  }
-  if (errno != 0) {
-    LOG_WARN("failed to write response header: %d", errno);
-    goto free_buf_ret;
+    outStatic(out, "Cache-Control: no-cache\r\n\r\n");
   }
 
-  ssize_t bytesWrite = fwrite(buffer, 1, fileSize, fp);
-  if (bytesWrite != fileSize) {
-    LOG_WARN("failed to respond %zi bytes: %d", fileSize, errno);
+  /* the file goes out with sendfile, and must stay open until then */
+  outFile(out, fdFile, 0, fileSize);
+  if (!outFlush(out)) {
+    LOG_WARN("failed to respond %zu bytes: %d", fileSize, errno);
   }
 
-free_buf_ret:
-  free(buffer);
-
-close_fp_ret:
-  fclose(fpFile);
+close_fd_ret:
+  close(fdFile);
 }
 
-static const char *mimeGuess(const char *filePath) {
+const char *mimeGuess(const char *filePath) {
   const char *postfix = strrchr(filePath, '.');
   if (postfix == NULL) {
     return "application/octet-stream";
@@ -0,0 +1,186 @@
+#include "timer_wheel.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/socket.h>
+
+#include "util.h"
+
+static Timer *wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static uint64_t currentTick;
+static pthread_mutex_t wheelLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t wheelThread;
+static TickHook *wheelTickHook;
+static _Atomic _Bool running;
+
+static void *wheelMain(void *context);
+static void tick(void);
+static void place(Timer *timer);
+static void unlinkTimer(Timer *timer);
+
+void startTimerWheel(TickHook *tickHook, Error *error) {
+  memset(wheel, 0, sizeof(wheel));
+  currentTick = 0;
+  wheelTickHook = tickHook;
+  atomic_store(&running, 1);
+
+  int res = pthread_create(&wheelThread, NULL, wheelMain, NULL);
+  if (res != 0) {
+    atomic_store(&running, 0);
+    QUICK_ERROR2(error, 500, "cannot start timer thread: %d", res);
+  }
+}
+
+void stopTimerWheel(void) {
+  if (!atomic_exchange(&running, 0)) {
+    return;
+  }
+  pthread_join(wheelThread, NULL);
+}
+
+_Bool timerWheelRunning(void) {
+  return atomic_load_explicit(&running, memory_order_relaxed);
+}
+
+void initTimer(Timer *timer, int fd) {
+  timer->next = NULL;
+  timer->pprev = NULL;
+  timer->expires = 0;
+  timer->fd = fd;
+  timer->how = SHUT_RDWR;
+  atomic_init(&timer->fired, 0);
+}
+
+void armTimer(Timer *timer, uint32_t timeoutMs, int how) {
+  if (!timerWheelRunning()) {
+    return;
+  }
+
+  pthread_mutex_lock(&wheelLock);
+  if (timer->pprev != NULL) {
+    unlinkTimer(timer);
+  }
+  if (timeoutMs != 0) {
+    /* the current tick is partly gone already, so round up */
+    timer->expires = currentTick + 1
+                     + (timeoutMs + TIMER_WHEEL_TICK_MS - 1)
+                       / TIMER_WHEEL_TICK_MS;
+    timer->how = how;
+    place(timer);
+  }
+  pthread_mutex_unlock(&wheelLock);
+}
+
+void cancelTimer(Timer *timer) {
+  pthread_mutex_lock(&wheelLock);
+  if (timer->pprev != NULL) {
+    unlinkTimer(timer);
+  }
+  pthread_mutex_unlock(&wheelLock);
+}
+
+static void *wheelMain(void *context) {
+  (void)context;
+
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while (atomic_load(&running)) {
+    next.tv_nsec += TIMER_WHEEL_TICK_MS * 1000000L;
+    if (next.tv_nsec >= 1000000000L) {
+      next.tv_sec += next.tv_nsec / 1000000000L;
+      next.tv_nsec %= 1000000000L;
+    }
+    int res;
+    do {
+      res = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    } while (res == EINTR);
+
+    pthread_mutex_lock(&wheelLock);
+    tick();
+    pthread_mutex_unlock(&wheelLock);
+
+    if (wheelTickHook != NULL) {
+      wheelTickHook();
+    }
+  }
+  return NULL;
+}
+
+static void tick(void) {
+  currentTick++;
+
+  /* when a level wraps around, spread its next slot over lower levels */
+  for (size_t level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+    unsigned shift = TIMER_WHEEL_BITS * level;
+    if ((currentTick & ((1ull << shift) - 1)) != 0) {
+      break;
+    }
+
+    size_t slot = (currentTick >> shift) & (TIMER_WHEEL_SLOTS - 1);
+    Timer *timer = wheel[level][slot];
+    wheel[level][slot] = NULL;
+    while (timer != NULL) {
+      Timer *next = timer->next;
+      place(timer);
+      timer = next;
+    }
+  }
+
+  size_t slot = currentTick & (TIMER_WHEEL_SLOTS - 1);
+  Timer *timer = wheel[0][slot];
+  wheel[0][slot] = NULL;
+  while (timer != NULL) {
+    Timer *next = timer->next;
+    timer->next = NULL;
+    timer->pprev = NULL;
+
+    atomic_store(&timer->fired, 1);
+    if (shutdown(timer->fd, timer->how) < 0 && errno != ENOTCONN) {
+      LOG_WARN("cannot shut down timed out connection %d: %d",
+               timer->fd, errno);
+    }
+    timer = next;
+  }
+}
+
+static void place(Timer *timer) {
+  if (timer->expires <= currentTick) {
+    timer->expires = currentTick;
+  }
+
+  /* the lowest level on which the timer lies less than a round ahead */
+  size_t level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1
+         && (timer->expires >> (TIMER_WHEEL_BITS * level))
+            - (currentTick >> (TIMER_WHEEL_BITS * level))
+            >= TIMER_WHEEL_SLOTS) {
+    level++;
+  }
+
+  unsigned shift = TIMER_WHEEL_BITS * level;
+  if ((timer->expires >> shift) - (currentTick >> shift)
+      >= TIMER_WHEEL_SLOTS) {
+    timer->expires =
+      ((currentTick >> shift) + TIMER_WHEEL_SLOTS - 1) << shift;
+  }
+
+  size_t slot = (timer->expires >> shift) & (TIMER_WHEEL_SLOTS - 1);
+  timer->next = wheel[level][slot];
+  if (timer->next != NULL) {
+    timer->next->pprev = &timer->next;
+  }
+  timer->pprev = &wheel[level][slot];
+  wheel[level][slot] = timer;
+}
+
+static void unlinkTimer(Timer *timer) {
+  *timer->pprev = timer->next;
+  if (timer->next != NULL) {
+    timer->next->pprev = timer->pprev;
+  }
+  timer->next = NULL;
+  timer->pprev = NULL;
+}
@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+
+#include "workers.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "lifecycle.h"
+#include "util.h"
+
+#define WORKER_ERROR_SIZE 4096
+#define NODE_SYSFS        "/sys/devices/system/node"
+#define CPU_LIST_MAX      4096
+
+typedef struct st_worker_slot {
+  pid_t pid; /* 0 while the worker is down */
+  struct timespec started;
+} WorkerSlot;
+
+static WorkerSlot *workers;
+static size_t workerCount;
+static size_t runningWorkers;
+static const int *listenFds;
+static size_t listenFdCount;
+static size_t listenerFdCount;
+static cpu_set_t allowedCpus;
+
+static pid_t startWorker(const Config *config, size_t index, int fdReady);
+static int becomeWorker(size_t index);
+static _Bool waitWorkersReady(int fd, size_t count);
+static ssize_t superviseWorkers(Config **config, const char *configPath);
+static void reapWorkers(_Bool stopping);
+static void signalWorkers(int sig);
+static void killWorkers(void);
+static void reloadMasterConfig(Config **config, const char *configPath);
+static long msSince(const struct timespec *from);
+static void placeWorker(CpuAffinity affinity, size_t index);
+static int pickCpu(size_t index, cpu_set_t *cpus);
+static int pickNode(size_t index, cpu_set_t *cpus);
+static int nodeOfCpu(int cpu);
+static size_t onlineNodeCount(void);
+static _Bool nodeCpus(int node, cpu_set_t *cpus);
+static _Bool readCpuList(const char *path, cpu_set_t *dest);
+static void preferNode(int node);
+
+size_t workerProcessCount(const Config *config) {
+  if (config->workerProcesses != WORKER_PROCESSES_AUTO) {
+    return (size_t)config->workerProcesses;
+  }
+
+  cpu_set_t cpus;
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) < 0) {
+    return 1;
+  }
+  size_t count = (size_t)CPU_COUNT(&cpus);
+  return count < MAX_WORKER_PROCESSES ? count : MAX_WORKER_PROCESSES;
+}
+
+int runWorkerProcesses(Config **config,
+                       const char *configPath,
+                       const int *fdsListen,
+                       size_t listenCount,
+                       size_t listenerCount,
+                       int *status) {
+  *status = -1;
+  workerCount = workerProcessCount(*config);
+  listenFds = fdsListen;
+  listenFdCount = listenCount;
+  listenerFdCount = listenerCount;
+  if (sched_getaffinity(0, sizeof(allowedCpus), &allowedCpus) < 0) {
+    LOG_WARN("cannot get CPU affinity: %d", errno);
+    CPU_ZERO(&allowedCpus);
+  }
+
+  workers = (WorkerSlot*)calloc(workerCount, sizeof(WorkerSlot));
+  int readyPipe[2];
+  if (workers == NULL || pipe2(readyPipe, O_CLOEXEC) < 0) {
+    LOG_FATAL("cannot start worker processes: %d", errno);
+    free(workers);
+    return -1;
+  }
+
+  LOG_INFO("master process %d, starting %zu worker processes",
+           (int)getpid(),
+           workerCount);
+  for (size_t i = 0; i < workerCount; i++) {
+    pid_t pid = startWorker(*config, i, readyPipe[1]);
+    if (pid == 0) {
+      close(readyPipe[0]);
+      return becomeWorker(i);
+    }
+  }
+  close(readyPipe[1]);
+
+  _Bool ready = waitWorkersReady(readyPipe[0], runningWorkers);
+  close(readyPipe[0]);
+  if (!ready || runningWorkers != workerCount) {
+    LOG_FATAL("worker processes failed to start");
+    killWorkers();
+    free(workers);
+    return -1;
+  }
+  notifyUpgradeReady();
+
+  ssize_t index = superviseWorkers(config, configPath);
+  if (index >= 0) {
+    return becomeWorker((size_t)index);
+  }
+  free(workers);
+  *status = 0;
+  return -1;
+}
+
+/* returns 0 in the worker, -1 if forking fails */
+static pid_t startWorker(const Config *config, size_t index, int fdReady) {
+  pid_t master = getpid();
+  clock_gettime(CLOCK_MONOTONIC, &workers[index].started);
+  pid_t pid = fork();
+  if (pid < 0) {
+    LOG_ERR("cannot fork worker process %zu: %d", index, errno);
+    return -1;
+  }
+  if (pid == 0) {
+    /* a terminal's ^C goes to the master, which passes it on once */
+    setpgid(0, 0);
+    becomeWorkerProcess(master, fdReady);
+    placeWorker(config->cpuAffinity, index);
+    return 0;
+  }
+
+  workers[index].pid = pid;
+  runningWorkers++;
+  LOG_DBG("worker process %zu is pid %d", index, (int)pid);
+  return pid;
+}
+
+/* in the worker, keeps its own sockets and lets go of the rest */
+static int becomeWorker(size_t index) {
+  size_t first = index % (listenFdCount / listenerFdCount) * listenerFdCount;
+  for (size_t i = 0; i < listenFdCount; i++) {
+    if (i < first || i >= first + listenerFdCount) {
+      close(listenFds[i]);
+    }
+  }
+  free(workers);
+  workers = NULL;
+  return (int)first;
+}
+
+static _Bool waitWorkersReady(int fd, size_t count) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  size_t ready = 0;
+  while (ready < count) {
+    long left = UPGRADE_READY_TIMEOUT_MS - msSince(&start);
+    if (left <= 0) {
+      return 0;
+    }
+
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int res = poll(&pfd, 1, (int)left);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    char buffer[64];
+    ssize_t got = res > 0 ? read(fd, buffer, sizeof(buffer)) : -1;
+    if (got <= 0) {
+      /* with every worker gone or ready, all ends are closed */
+      return 0;
+    }
+    ready += (size_t)got;
+  }
+  return 1;
+}
+
+/* returns the index of a worker respawned in its place, -1 otherwise */
+static ssize_t superviseWorkers(Config **config, const char *configPath) {
+  _Bool stopping = 0;
+  for (;;) {
+    reapWorkers(stopping);
+    if (stopping && runningWorkers == 0) {
+      LOG_INFO("worker processes stopped");
+      return -1;
+    }
+
+    for (size_t i = 0; i < workerCount && !stopping; i++) {
+      if (workers[i].pid == 0
+          && msSince(&workers[i].started) >= WORKER_RESPAWN_DELAY_MS) {
+        LOG_INFO("respawning worker process %zu", i);
+        if (startWorker(*config, i, -1) == 0) {
+          return (ssize_t)i;
+        }
+      }
+    }
+
+    struct timespec pause = { 0, WORKER_POLL_MS * 1000000L };
+    ppoll(NULL, 0, &pause, lifecycleWaitMask());
+    for (LifecycleEvent event = takeLifecycleEvent();
+         event != LIFECYCLE_NONE;
+         event = takeLifecycleEvent()) {
+      switch (event) {
+        case LIFECYCLE_STOP:
+          /* for workers already draining, a second one cuts it short */
+          LOG_INFO("stopping %zu worker processes", runningWorkers);
+          stopping = 1;
+          signalWorkers(SIGTERM);
+          break;
+        case LIFECYCLE_UPGRADE:
+          if (stopping) {
+            break;
+          }
+          if (!startUpgrade(listenFds, listenFdCount)) {
+            LOG_WARN("upgrade failed, carrying on");
+            break;
+          }
+          LOG_INFO("handed over, stopping %zu worker processes",
+                   runningWorkers);
+          stopping = 1;
+          signalWorkers(SIGTERM);
+          break;
+        case LIFECYCLE_RELOAD:
+          if (!stopping) {
+            reloadMasterConfig(config, configPath);
+            signalWorkers(SIGHUP);
+          }
+          break;
+        case LIFECYCLE_NONE:
+          break;
+      }
+    }
+  }
+}
+
+static void reapWorkers(_Bool stopping) {
+  int wstatus;
+  pid_t pid;
+  while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+    for (size_t i = 0; i < workerCount; i++) {
+      if (workers[i].pid != pid) {
+        continue;
+      }
+      workers[i].pid = 0;
+      runningWorkers--;
+      if (stopping) {
+        LOG_DBG("worker process %zu exited", i);
+      } else if (WIFSIGNALED(wstatus)) {
+        LOG_ERR("worker process %zu killed by signal %d",
+                i,
+                WTERMSIG(wstatus));
+      } else {
+        LOG_ERR("worker process %zu exited with status %d",
+                i,
+                WEXITSTATUS(wstatus));
+      }
+    }
+  }
+}
+
+static void signalWorkers(int sig) {
+  for (size_t i = 0; i < workerCount; i++) {
+    if (workers[i].pid != 0) {
+      kill(workers[i].pid, sig);
+    }
+  }
+}
+
+static void killWorkers(void) {
+  signalWorkers(SIGKILL);
+  for (size_t i = 0; i < workerCount; i++) {
+    if (workers[i].pid != 0) {
+      waitpid(workers[i].pid, NULL, 0);
+      workers[i].pid = 0;
+    }
+  }
+  runningWorkers = 0;
+}
+
+/* the master's copy only serves the workers forked from now on */
+static void reloadMasterConfig(Config **config, const char *configPath) {
+  Config *fresh = (Config*)malloc(sizeof(Config));
+  Error *error = errorBuffer(WORKER_ERROR_SIZE);
+  if (fresh == NULL || error == NULL) {
+    LOG_ERR("cannot reload config, out of memory");
+    free(fresh);
+    dropError(error);
+    return;
+  }
+
+  loadConfig(fresh, configPath, error);
+  if (isError(error)) {
+    LOG_ERR("%s, keeping the running config", error->errorBuffer);
+    dropConfig(fresh);
+    free(fresh);
+  } else {
+    dropConfig(*config);
+    free(*config);
+    *config = fresh;
+  }
+  dropError(error);
+}
+
+static long msSince(const struct timespec *from) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - from->tv_sec) * 1000
+         + (now.tv_nsec - from->tv_nsec) / 1000000;
+}
+
+static void placeWorker(CpuAffinity affinity, size_t index) {
+  if (affinity == CPU_AFFINITY_NONE || CPU_COUNT(&allowedCpus) == 0) {
+    return;
+  }
+
+  cpu_set_t cpus;
+  int node;
+  if (affinity == CPU_AFFINITY_CPU) {
+    int cpu = pickCpu(index, &cpus);
+    node = nodeOfCpu(cpu);
+    LOG_INFO("worker process %zu on CPU %d", index, cpu);
+  } else {
+    node = pickNode(index, &cpus);
+    if (node < 0) {
+      LOG_WARN("no NUMA nodes found, worker process %zu not pinned",
+               index);
+      return;
+    }
+    LOG_INFO("worker process %zu on NUMA node %d", index, node);
+  }
+
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+    LOG_WARN("cannot set CPU affinity: %d", errno);
+    return;
+  }
+  if (node >= 0 && onlineNodeCount() > 1) {
+    preferNode(node);
+  }
+}
+
+/* the index-th CPU we may run on, round robin */
+static int pickCpu(size_t index, cpu_set_t *cpus) {
+  size_t wanted = index % (size_t)CPU_COUNT(&allowedCpus);
+  int cpu = 0;
+  for (; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowedCpus) && wanted-- == 0) {
+      break;
+    }
+  }
+  CPU_ZERO(cpus);
+  CPU_SET(cpu, cpus);
+  return cpu;
+}
+
+/* the index-th node with CPUs we may run on, round robin */
+static int pickNode(size_t index, cpu_set_t *cpus) {
+  cpu_set_t online;
+  if (!readCpuList(NODE_SYSFS "/online", &online)) {
+    return -1;
+  }
+
+  size_t usable = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    size_t wanted = usable != 0 ? index % usable : 0;
+    for (int node = 0; node < CPU_SETSIZE; node++) {
+      if (!CPU_ISSET(node, &online) || !nodeCpus(node, cpus)) {
+        continue;
+      }
+      CPU_AND(cpus, cpus, &allowedCpus);
+      if (CPU_COUNT(cpus) == 0) {
+        continue;
+      }
+      if (pass == 0) {
+        usable++;
+      } else if (wanted-- == 0) {
+        return node;
+      }
+    }
+    if (usable == 0) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+static int nodeOfCpu(int cpu) {
+  cpu_set_t online;
+  cpu_set_t cpus;
+  if (!readCpuList(NODE_SYSFS "/online", &online)) {
+    return -1;
+  }
+  for (int node = 0; node < CPU_SETSIZE; node++) {
+    if (CPU_ISSET(node, &online) && nodeCpus(node, &cpus)
+        && CPU_ISSET(cpu, &cpus)) {
+      return node;
+    }
+  }
+  return -1;
+}
+
+static size_t onlineNodeCount(void) {
+  cpu_set_t online;
+  return readCpuList(NODE_SYSFS "/online", &online)
+         ? (size_t)CPU_COUNT(&online)
+         : 0;
+}
+
+static _Bool nodeCpus(int node, cpu_set_t *cpus) {
+  char path[64];
+  snprintf(path, sizeof(path), NODE_SYSFS "/node%d/cpulist", node);
+  return readCpuList(path, cpus);
+}
+
+/* "0-3,8-11" as sysfs has it, which is also how it lists nodes */
+static _Bool readCpuList(const char *path, cpu_set_t *dest) {
+  CPU_ZERO(dest);
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    return 0;
+  }
+  char line[CPU_LIST_MAX];
+  _Bool read = fgets(line, sizeof(line), fp) != NULL;
+  fclose(fp);
+  if (!read) {
+    return 0;
+  }
+
+  char *p = line;
+  while (*p != '\0' && *p != '\n') {
+    char *end;
+    unsigned long first = strtoul(p, &end, 10);
+    unsigned long last = first;
+    if (end == p) {
+      return 0;
+    }
+    p = end;
+    if (*p == '-') {
+      last = strtoul(p + 1, &end, 10);
+      if (end == p + 1) {
+        return 0;
+      }
+      p = end;
+    }
+    for (unsigned long i = first; i <= last && i < CPU_SETSIZE; i++) {
+      CPU_SET(i, dest);
+    }
+    if (*p == ',') {
+      p++;
+    }
+  }
+  return 1;
+}
+
+/* what the worker allocates from here on comes from `node` if it can */
+static void preferNode(int node) {
+  unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+  const size_t bits = 8 * sizeof(unsigned long);
+  if (node >= MAX_NUMA_NODES) {
+    return;
+  }
+  memset(mask, 0, sizeof(mask));
+  mask[(size_t)node / bits] |= 1UL << ((size_t)node % bits);
+
+  /* no wrapper in glibc, and the kernel wants one more than the bits */
+  if (syscall(SYS_set_mempolicy,
+              MPOL_PREFERRED,
+              mask,
+              (unsigned long)(sizeof(mask) * 8 + 1)) < 0) {
+    LOG_WARN("cannot set NUMA memory policy: %d", errno);
+  }
+}
@@ -0,0 +1,297 @@
+#include "cc_list.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CC_LIST ccList
+#define CC_LIST_ITER ccListIter
+
+typedef struct st_list_node {
+    struct st_list_node *prev;
+    struct st_list_node *next;
+    uint8_t data[0];
+} list_node;
+
+void
+ccListInit (CC_LIST *list, size_t elem_size) {
+    list_node *head_node = (list_node*)list;
+    head_node->prev = head_node;
+    head_node->next = head_node;
+    
+    list->elem_size = elem_size;
+}
+
+void
+ccListDestroy (CC_LIST *list) {
+    list_node *head_node = (list_node*)list;
+    list_node *iter_node = head_node->next;
+    while (iter_node != head_node) {
+        list_node *t = iter_node;
+        iter_node = iter_node->next;
+        free (t);
+    }
+}
+
+void
+ccListPushBack (CC_LIST *list, const void *data) {
+    list_node *new_node = 
+        (list_node*)malloc(sizeof(list_node) + list->elem_size);
+    memcpy (CC_VPTR_ADD(new_node, CC_OFFSETOF(list_node, data)),
+            data,
+            list->elem_size);
+    
+    list_node *head_node = (list_node*)list;
+    new_node->prev = head_node->prev;
+    new_node->next = head_node;
+    head_node->prev->next = new_node;
+    head_node->prev = new_node;
+}
+
+void
+ccListPushFront (CC_LIST *list, const void *data) {
+    list_node *new_node = 
+        (list_node*)malloc(sizeof(list_node) + list->elem_size);
+    memcpy (CC_VPTR_ADD(new_node, CC_OFFSETOF(list_node, data)),
+            data,
+            list->elem_size);
+    
+    list_node *head_node = (list_node*)list;
+    new_node->prev = head_node;
+    new_node->next = head_node->next;
+    head_node->next->prev = new_node;
+    head_node->next = new_node;
+}
+
+void
+ccListPopBack (CC_LIST *list) {
+    assert(!ccListEmpty(list));
+    
+    list_node *head_node = (list_node*)list;
+    list_node *back_node = head_node->prev;
+    back_node->prev->next = back_node->next;
+    back_node->next->prev = back_node->prev;
+    free(back_node);
+}
+
+void
+ccListPopFront (CC_LIST *list) {
+    assert(!ccListEmpty(list));
+    
+    list_node *head_node = (list_node*)list;
+    list_node *front_node = head_node->next;
+    front_node->next->prev = front_node->prev;
+    front_node->prev->next = front_node->next;
+    free(front_node);
+}
+
+void*
+ccListFront (const CC_LIST *list) {
+    assert(!ccListEmpty(list));
+
+    list_node *head_node = (list_node*)list;
+    list_node *front_node = head_node->next;
+    return CC_VPTR_ADD(front_node, CC_OFFSETOF(list_node, data));
+}
+
+void*
+ccListBack (const CC_LIST *list) {
+    assert(!ccListEmpty(list));
+    
+    list_node *head_node = (list_node*)list;
+    list_node *back_node = head_node->prev;
+    return CC_VPTR_ADD(back_node, CC_OFFSETOF(list_node, data));
+}
+
+size_t
+ccListLen (const CC_LIST *list) {
+    return ccListSize (list);
+}
+
+size_t
+ccListSize (const CC_LIST *list) {
+    size_t ret = 0;
+    list_node *head_node = (list_node*)list;
+    list_node *iter_node = head_node->next;
+    while (iter_node != head_node) {
+        iter_node = iter_node->next;
+        ret++;
+    }
+    return ret;
+}
+
+_Bool
+ccListEmpty (const CC_LIST *list) {
+    list_node *head_node = (list_node*)list;
+    return head_node->next == head_node;
+}
+
+CC_LIST_ITER
+ccListBegin (const CC_LIST *list) {
+    CC_LIST_ITER ret;
+    list_node *head_node = (list_node*)list;
+    ret.node = head_node->next;
+    return ret;
+}
+
+CC_LIST_ITER
+ccListEnd (const CC_LIST *list) {
+    CC_LIST_ITER ret;
+    ret.node = (CC_LIST*)list;
+    return ret;
+}
+
+void
+ccListInsert (const CC_LIST *list,
+                      CC_LIST_ITER pos,
+                      const void *data) {
+    list_node *new_node = 
+        (list_node*)malloc(sizeof(list_node) + list->elem_size);
+    memcpy (CC_VPTR_ADD(new_node, CC_OFFSETOF(list_node, data)),
+            data,
+            list->elem_size);
+    list_node *node = (list_node*)pos.node;
+    new_node->prev = node->prev;
+    new_node->next = node;
+    node->prev->next = new_node;
+    node->prev = new_node;
+}
+
+void
+ccListInsertAfter (const CC_LIST *list,
+                            CC_LIST_ITER pos,
+                            const void *data) {
+    ccListInsert (list,
+                          ccListIterNext (pos),
+                          data);
+}
+
+void
+ccListRemove (const CC_LIST *list,
+                      CC_LIST_ITER pos) {
+    (void)list;
+    list_node *node = (list_node*)pos.node;
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    free (node);
+}
+
+void
+ccListRemoveRange (const CC_LIST *list,
+                            CC_LIST_ITER first,
+                            CC_LIST_ITER last) {
+    (void)list;
+    list_node *first_node = (list_node*)first.node;
+    list_node *last_node = (list_node*)last.node;
+    first_node->prev->next = last_node;
+    last_node->prev = first_node->prev;
+    
+    while (first_node != last_node) {
+        list_node *t = first_node;
+        first_node = first_node->next;
+        free (t);
+    }
+}
+
+void*
+ccListIterDeref (CC_LIST_ITER iter) {
+    list_node *node = (list_node*)iter.node;
+    return CC_VPTR_ADD(node, CC_OFFSETOF(list_node, data));
+}
+
+CC_LIST_ITER
+ccListIterPrev (CC_LIST_ITER iter) {
+    CC_LIST_ITER ret;
+    list_node *node = (list_node*)iter.node;
+    ret.node = node->prev;
+    return ret;
+}
+
+CC_LIST_ITER
+ccListIterNext (CC_LIST_ITER iter) {
+    CC_LIST_ITER ret;
+    list_node *node = (list_node*)iter.node;
+    ret.node = node->next;
+    return ret;
+}
+
+_Bool
+ccListIterEq (CC_LIST_ITER iter1, CC_LIST_ITER iter2) {
+    return iter1.node == iter2.node;
+}
+
+CC_LIST_ITER
+ccListFind (const CC_LIST *list,
+                    const void *value,
+                    _Bool (*cmp)(const void*, const void*)) {
+    list_node *head_node = (list_node*)list;
+    for (list_node *node = head_node->next;
+         node != head_node;
+         node = node->next) {
+        if (cmp(node->data, value)) {
+            CC_LIST_ITER ret;
+            ret.node = node;
+            return ret;
+        }
+    }
+
+    CC_LIST_ITER ret;
+    ret.node = head_node;
+    return ret;
+}
+
+CC_LIST_ITER
+ccListFindValue (const CC_LIST *list,
+                          const void *value) {
+    size_t elem_size = list->elem_size;
+    list_node *head_node = (list_node*)list;
+    for (list_node *node = head_node->next;
+         node != head_node;
+         node = node->next) {
+        if (memcmp(node->data, value, elem_size) == 0) {
+            CC_LIST_ITER ret;
+            ret.node = node;
+            return ret;
+        }
+    }
+
+    CC_LIST_ITER ret;
+    ret.node = head_node;
+    return ret;
+}
+
+CC_LIST_ITER
+ccListIterFind (CC_LIST *list,
+                         CC_LIST_ITER first,
+                         CC_LIST_ITER last,
+                         const void *value,
+                         _Bool (*cmp)(const void*, const void*)) {
+    (void)list;
+    for(; !ccListIterEq (first, last);
+        first = ccListIterNext (first)) {
+        if (cmp(ccListIterDeref (first), value)) {
+            return first;
+        }
+    }
+    return first;
+}
+
+CC_LIST_ITER
+ccListIterFindValue (CC_LIST *list,
+                               CC_LIST_ITER first,
+                               CC_LIST_ITER last,
+                               const void *value) {
+    size_t elem_size = list->elem_size;
+    for(; !ccListIterEq (first, last);
+        first = ccListIterNext (first)) {
+        if (memcmp(ccListIterDeref (first),
+                      value,
+                      elem_size) == 0) {
+            return first;
+        }
+    }
+    return first;
+}
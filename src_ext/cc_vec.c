@@ -0,0 +1,254 @@
+#include "cc_vec.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CC_VEC ccVec
+
+static void cc_vec_grow(CC_VEC *vec) {
+    assert(vec->end == vec->usage);
+    const ccAllocator *allocator = vec->allocator;
+    size_t length = CC_VPTR_DIFF(vec->end, vec->start);
+    size_t target =
+        (length == 0) ? CC_VEC_INIT_SIZE * vec->elem_size : length * 2;
+    void * start;
+    if (vec->start != NULL && vec->start == vec->inline_buf) {
+        start = allocator ? allocator->alloc(allocator->ctx, target)
+                          : malloc(target);
+        assert(start != NULL);
+        memcpy(start, vec->start, length);
+    } else if (allocator != NULL) {
+        start = vec->start == NULL
+                ? allocator->alloc(allocator->ctx, target)
+                : allocator->realloc(allocator->ctx,
+                                     vec->start,
+                                     length,
+                                     target);
+    } else {
+        start = realloc (vec->start, target);
+    }
+    assert(start != NULL);
+    vec->start = start;
+    vec->usage = CC_VPTR_ADD(start, length);
+    vec->end   = CC_VPTR_ADD(start, target);
+}
+
+void
+ccVecInit (CC_VEC *vec, size_t elem_size) {
+    ccVecInitAlloc (vec, elem_size, NULL);
+}
+
+void
+ccVecInitAlloc (CC_VEC *vec,
+                         size_t elem_size,
+                         const ccAllocator *allocator) {
+    assert(elem_size > 0);
+    vec->start      = NULL;
+    vec->usage      = NULL;
+    vec->end        = NULL;
+    vec->elem_size  = elem_size;
+    vec->allocator  = allocator;
+    vec->inline_buf = NULL;
+}
+
+void
+ccVecInitInline (CC_VEC *vec,
+                          size_t elem_size,
+                          void *storage,
+                          size_t capacity,
+                          const ccAllocator *allocator) {
+    assert(elem_size > 0);
+    assert(storage != NULL && capacity > 0);
+    vec->start      = storage;
+    vec->usage      = storage;
+    vec->end        = CC_VPTR_ADD(storage, capacity * elem_size);
+    vec->elem_size  = elem_size;
+    vec->allocator  = allocator;
+    vec->inline_buf = storage;
+}
+
+void
+ccVecDestroy (CC_VEC *vec) {
+    if (vec->start != NULL && vec->start != vec->inline_buf) {
+        if (vec->allocator != NULL) {
+            vec->allocator->free(vec->allocator->ctx,
+                                 vec->start,
+                                 CC_VPTR_DIFF(vec->end, vec->start));
+        } else {
+            free(vec->start);
+        }
+    }
+    vec->start      = NULL;
+    vec->usage      = NULL;
+    vec->end        = NULL;
+    vec->elem_size  = 0;
+    vec->allocator  = NULL;
+    vec->inline_buf = NULL;
+}
+
+void
+ccVecPushBack (CC_VEC *vec, const void *data) {
+    assert(data != NULL);
+    assert(vec != NULL);
+    if (vec->usage == vec->end) cc_vec_grow(vec);
+    assert(vec->usage < vec->end);
+    memcpy(vec->usage, data, vec->elem_size);
+    vec->usage = CC_VPTR_ADD(vec->usage, vec->elem_size);
+};
+
+void
+ccVecPushFront (CC_VEC *vec, const void *data) {
+    assert(data != NULL);
+    assert(vec != NULL);
+    if (vec->usage == vec->end) cc_vec_grow(vec);
+    assert(vec->usage < vec->end);
+    memmove(CC_VPTR_ADD(vec->start, vec->elem_size),
+               vec->start,
+               CC_VPTR_DIFF(vec->usage, vec->start));
+    memcpy(vec->start, data, vec->elem_size);
+    vec->usage = CC_VPTR_ADD(vec->usage, vec->elem_size);
+}
+
+void
+ccVecPopBack (CC_VEC *vec) {
+    assert(vec->usage != vec->start);
+    vec->usage = CC_VPTR_SUB(vec->usage, vec->elem_size);
+}
+
+void
+ccVecPopFront (CC_VEC *vec) {
+    assert(vec->usage != vec->start);
+    memmove(vec->start,
+               CC_VPTR_ADD(vec->start, vec->elem_size),
+               CC_VPTR_DIFF(vec->usage, vec->start) - vec->elem_size);
+    vec->usage = CC_VPTR_SUB(vec->usage, vec->elem_size);
+}
+
+void*
+ccVecFront (const CC_VEC *vec) {
+    assert(vec->usage != vec->start);
+    return vec->start;
+}
+
+void*
+ccVecBack (const CC_VEC *vec) {
+    assert(vec->usage != vec->start);
+    return CC_VPTR_SUB(vec->usage, vec->elem_size);
+}
+
+void*
+ccVecNth (const CC_VEC *vec, size_t idx) {
+    assert(vec->usage != vec->start);
+    assert(CC_VPTR_ADD(vec->start, idx * vec->elem_size)
+              <= vec->usage);
+    return CC_VPTR_ADD(vec->start, idx * vec->elem_size);
+}
+
+void
+ccVecInsert (CC_VEC *vec, size_t idx, const void *data) {
+    assert(data != NULL);
+    assert(vec != NULL);
+    assert(CC_VPTR_ADD(vec->start, idx * vec->elem_size)
+              <= vec->usage);
+    if (vec->usage == vec->end) cc_vec_grow(vec);
+    void * start_pos = CC_VPTR_ADD(vec->start, idx * vec->elem_size);
+    memmove(CC_VPTR_ADD(start_pos, vec->elem_size),
+               start_pos,
+               CC_VPTR_DIFF(vec->usage, start_pos));
+    memcpy(start_pos, data, vec->elem_size);
+    vec->usage = CC_VPTR_ADD(vec->usage, vec->elem_size);
+}
+
+void
+ccVecRemove (CC_VEC *vec, size_t idx) {
+    assert(vec != NULL);
+    assert(CC_VPTR_ADD(vec->start, idx * vec->elem_size)
+              <= vec->usage);
+    void *start_pos = CC_VPTR_ADD(vec->start, idx * vec->elem_size);
+    void *next_pos  = CC_VPTR_ADD(start_pos, vec->elem_size);
+    memmove(start_pos,
+               next_pos,
+               CC_VPTR_DIFF(vec->usage, next_pos));
+    vec->usage = CC_VPTR_SUB(vec->usage, vec->elem_size);
+}
+
+void
+ccVecRemoveN (CC_VEC *vec, size_t first, size_t n) {
+    assert(vec != NULL);
+    assert(CC_VPTR_ADD(vec->start, (first + n) * vec->elem_size)
+              <= vec->usage);
+    if (n == 0) return;
+    void *start_pos = CC_VPTR_ADD(vec->start, first * vec->elem_size);
+    void *end_pos   = CC_VPTR_ADD(start_pos, n * vec->elem_size);
+    memmove(start_pos,
+               end_pos,
+               CC_VPTR_DIFF(vec->usage, end_pos));
+    vec->usage = CC_VPTR_SUB(vec->usage, n * vec->elem_size);
+}
+
+ssize_t
+ccVecFindIn (const ccVec *vec,
+                      size_t first,
+                      ssize_t last,
+                      const void *data,
+                      _Bool (*cmp)(const void*, const void*)) {
+    if (last < 0) {
+        last = ccVecLen (vec);
+    }
+    (void)first;
+    (void)last;
+    (void)data;
+    (void)cmp;
+    return -1;
+}
+
+ssize_t
+ccVecFind (const ccVec *vec,
+                   const void *data,
+                   _Bool (*cmp)(const void*, const void*)) {
+    return ccVecFindIn (vec,
+                                 0,
+                                 ccVecLen (vec),
+                                 data,
+                                 cmp);
+}
+
+ssize_t
+ccVecFindValueIn (const ccVec *vec,
+                            size_t first,
+                            ssize_t last,
+                            const void *data);
+
+ssize_t
+ccVecFindValue (const ccVec *vec,
+                         const void *data);
+
+size_t
+ccVecLen (const CC_VEC *vec) {
+    return CC_VPTR_DIFF(vec->usage, vec->start) / vec->elem_size;
+}
+
+size_t
+ccVecSize (const CC_VEC *vec) {
+    return ccVecLen (vec);
+}
+
+_Bool
+ccVecEmpty (const CC_VEC *vec) {
+    return vec->usage == vec->start;
+}
+
+void*
+ccVecData (CC_VEC *vec) {
+  return vec->start;
+}
+
+const void*
+ccVecDataConst (const CC_VEC *vec) {
+  return vec->start;
+}
+
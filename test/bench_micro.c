@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+
+#include "vkbench.h"
+
+#include <string.h>
+
+#include "arena.h"
+#include "cc_vec.h"
+#include "config.h"
+#include "http.h"
+#include "http_head.h"
+#include "log.h"
+#include "static.h"
+#include "util.h"
+
+#define ROUTE_TABLE_SIZE 1000
+
+static const char *REQUEST_SIMPLE =
+  "GET /index.html HTTP/1.1\r\n"
+  "Host: localhost\r\n"
+  "\r\n";
+
+static const char *REQUEST_BROWSER =
+  "GET /api/v1/blog?blogId=114514&reply=1919810&page=3 HTTP/1.1\r\n"
+  "Host: example.com\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) "
+    "Gecko/20100101 Firefox/120.0\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9\r\n"
+  "Accept-Language: en-US,en;q=0.5\r\n"
+  "Accept-Encoding: gzip, deflate, br\r\n"
+  "Referer: https://example.com/blog\r\n"
+  "Connection: keep-alive\r\n"
+  "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "Sec-Fetch-Dest: document\r\n"
+  "Sec-Fetch-Mode: navigate\r\n"
+  "\r\n";
+
+static const char *REQUEST_POST =
+  "POST /api/login HTTP/1.1\r\n"
+  "Host: example.com\r\n"
+  "Content-Type: application/x-www-form-urlencoded\r\n"
+  "Content-Length: 29\r\n"
+  "\r\n"
+  "username=chuigda&password=114";
+
+static void benchParse(const char *name, const char *corpus);
+static void benchRouting(void);
+static void benchHead(void);
+static void benchLog(void);
+static void benchVec(void);
+
+int main(void) {
+  VK_BENCH_BEGIN
+
+  VK_BENCH_SECTION("readHttpRequest")
+  benchParse("parse/simple", REQUEST_SIMPLE);
+  benchParse("parse/browser", REQUEST_BROWSER);
+  benchParse("parse/post", REQUEST_POST);
+
+  VK_BENCH_SECTION("routing")
+  benchRouting();
+
+  VK_BENCH_SECTION("mimeGuess")
+  VK_BENCH("mime/html", {
+    VK_BENCH_KEEP(mimeGuess("/srv/www/index.html"));
+  })
+  VK_BENCH("mime/unknown", {
+    VK_BENCH_KEEP(mimeGuess("/srv/www/archive.tar.gz"));
+  })
+
+  VK_BENCH_SECTION("httpHead")
+  benchHead();
+
+  VK_BENCH_SECTION("chttpdLog")
+  benchLog();
+
+  VK_BENCH_SECTION("ccVec")
+  benchVec();
+
+  VK_BENCH_END
+  return 0;
+}
+
+static void benchParse(const char *name, const char *corpus) {
+  size_t corpusSize = strlen(corpus);
+  FILE *fp = fmemopen((void*)corpus, corpusSize, "r");
+  Arena *arena = acquireArena();
+
+  VK_BENCH(name, {
+    fseek(fp, 0, SEEK_SET);
+    HttpRequest *request = readHttpRequest(fp, 1024, arena);
+    VK_BENCH_KEEP(request);
+    dropHttpRequest(request);
+    resetArena(arena);
+  })
+
+  releaseArena(arena);
+  fclose(fp);
+}
+
+static void benchRouting(void) {
+  ccVec routes;
+  ccVecInit(&routes, sizeof(Route));
+  char *paths[ROUTE_TABLE_SIZE];
+  for (size_t i = 0; i < ROUTE_TABLE_SIZE; i++) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/api/v1/resource%zu",
+             i % 2 == 0 ? "!" : "", i);
+    paths[i] = copyString(path);
+
+    Route route;
+    route.httpMethod = i % 3 == 0 ? HTTP_POST : HTTP_GET;
+    route.path = paths[i];
+    route.handlerType = HDLR_STATIC;
+    route.handlerPath = "/dev/null";
+    route.extra = NULL;
+    ccVecPushBack(&routes, &route);
+  }
+
+  VK_BENCH("urlcmp/prefix", {
+    VK_BENCH_KEEP(urlcmp("/api/v1/resource999/items", "/api/v1/resource9"));
+  })
+  VK_BENCH("urlcmp/exact", {
+    VK_BENCH_KEEP(urlcmp("/api/v1/resource998", "!/api/v1/resource998"));
+  })
+  VK_BENCH("urlcmp_icase/prefix", {
+    VK_BENCH_KEEP(urlcmp_icase("/API/v1/Resource999/items",
+                               "/api/v1/resource9"));
+  })
+
+  /* the same linear scan as routeAndHandle, hitting the last route */
+  VK_BENCH("route/1000-last", {
+    size_t found = ROUTE_TABLE_SIZE;
+    for (size_t j = 0; j < ROUTE_TABLE_SIZE; j++) {
+      const Route *route = (const Route*)ccVecNth(&routes, j);
+      if (urlcmp("/api/v1/resource999", route->path)
+          && route->httpMethod == HTTP_GET) {
+        found = j;
+        break;
+      }
+    }
+    VK_BENCH_KEEP(found);
+  })
+
+  for (size_t i = 0; i < ROUTE_TABLE_SIZE; i++) {
+    free(paths[i]);
+  }
+  ccVecDestroy(&routes);
+}
+
+static void benchHead(void) {
+  char buffer[128];
+  char statusLine[STATUS_LINE_MAX];
+
+  VK_BENCH("head/snprintf", {
+    VK_BENCH_KEEP(snprintf(buffer, sizeof(buffer),
+                           "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n",
+                           404, "Not Found", (size_t)1048576));
+  })
+  VK_BENCH("head/builder", {
+    const char *line = httpStatusLine(404, statusLine);
+    size_t size = strlen(line);
+    memcpy(buffer, line, size);
+    memcpy(buffer + size, "Content-Length: ", 16);
+    size += 16;
+    size += formatUint(buffer + size, 1048576);
+    memcpy(buffer + size, "\r\n", 2);
+    VK_BENCH_KEEP(size + 2);
+  })
+}
+
+static void benchLog(void) {
+  Error *error = errorBuffer(256);
+  setLogLevel(LL_INFO);
+  setLogOutput("/dev/null", error);
+  if (isError(error)) {
+    fprintf(stderr, "cannot log to /dev/null: %s\n", error->errorBuffer);
+    dropError(error);
+    return;
+  }
+
+  VK_BENCH("log/filtered", {
+    LOG_DBG("accepting HTTP request: %s %s", "GET", "/index.html");
+  })
+  VK_BENCH("log/sync", {
+    LOG_INFO("accepting HTTP request: %s %s", "GET", "/index.html");
+  })
+
+  /* messages finding the ring full are dropped, which is counted too */
+  startLogger(error);
+  if (!isError(error)) {
+    VK_BENCH("log/ring", {
+      LOG_INFO("accepting HTTP request: %s %s", "GET", "/index.html");
+    })
+    stopLogger();
+  }
+  dropError(error);
+}
+
+static void benchVec(void) {
+  VK_BENCH("vec/push-1024", {
+    ccVec vec;
+    ccVecInit(&vec, sizeof(int));
+    for (int j = 0; j < 1024; j++) {
+      ccVecPushBack(&vec, &j);
+    }
+    ccVecDestroy(&vec);
+  })
+
+  VK_BENCH("vec/inline-push-16", {
+    int storage[CC_VEC_INLINE_SIZE];
+    ccVec vec;
+    ccVecInitInline(&vec, sizeof(int), storage, CC_VEC_INLINE_SIZE, NULL);
+    for (int j = 0; j < CC_VEC_INLINE_SIZE; j++) {
+      ccVecPushBack(&vec, &j);
+    }
+    ccVecDestroy(&vec);
+  })
+
+  VK_BENCH("vec/inline-grow-64", {
+    int storage[CC_VEC_INLINE_SIZE];
+    ccVec vec;
+    ccVecInitInline(&vec, sizeof(int), storage, CC_VEC_INLINE_SIZE, NULL);
+    for (int j = 0; j < 64; j++) {
+      ccVecPushBack(&vec, &j);
+    }
+    ccVecDestroy(&vec);
+  })
+}
@@ -0,0 +1,99 @@
+"""
+Runs ./chttpd on a config of its own for the integration tests under
+test/, and keeps count of their checks. Standard library only.
+"""
+
+import http.client
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def free_port():
+    with socket.socket() as sock:
+        sock.bind(('127.0.0.1', 0))
+        return sock.getsockname()[1]
+
+
+class Chttpd:
+    def __init__(self, config_lines):
+        self.dir = tempfile.mkdtemp(prefix='chttpd-test-')
+        self.port = free_port()
+        self.config = os.path.join(self.dir, 'chttpd.cfg')
+        with open(self.config, 'w') as f:
+            f.write('listen-port %d\n' % self.port)
+            for line in config_lines:
+                f.write(line + '\n')
+
+        self.log_path = os.path.join(self.dir, 'chttpd.log')
+        self.log = open(self.log_path, 'w')
+        self.proc = subprocess.Popen(['./chttpd', self.config],
+                                     stdout=self.log,
+                                     stderr=subprocess.STDOUT)
+        deadline = time.time() + 5
+        while True:
+            try:
+                socket.create_connection(('127.0.0.1', self.port), 1).close()
+                return
+            except OSError:
+                if self.proc.poll() is not None or time.time() > deadline:
+                    self.stop(show_log=True)
+                    raise RuntimeError('chttpd did not come up')
+                time.sleep(0.05)
+
+    def request(self, method, path, body=None, headers=None, chunks=None):
+        """Returns status, headers (lower case names) and body."""
+        conn = http.client.HTTPConnection('127.0.0.1', self.port, timeout=10)
+        try:
+            if chunks is not None:
+                conn.request(method, path, body=iter(chunks),
+                             headers=headers or {}, encode_chunked=True)
+            else:
+                conn.request(method, path, body=body, headers=headers or {})
+            resp = conn.getresponse()
+            data = resp.read()
+            return (resp.status,
+                    {k.lower(): v for k, v in resp.getheaders()},
+                    data)
+        finally:
+            conn.close()
+
+    def stop(self, show_log=False):
+        if self.proc.poll() is None:
+            self.proc.terminate()
+            try:
+                self.proc.wait(10)
+            except subprocess.TimeoutExpired:
+                self.proc.kill()
+                self.proc.wait()
+        self.log.close()
+        if show_log:
+            with open(self.log_path) as f:
+                sys.stderr.write(f.read())
+        shutil.rmtree(self.dir, ignore_errors=True)
+
+
+class Checks:
+    def __init__(self, name):
+        self.name = name
+        self.passed = 0
+        self.failed = 0
+        print('Running %s' % name)
+
+    def check(self, what, cond, detail=''):
+        if cond:
+            self.passed += 1
+            print('  ok    %s' % what)
+        else:
+            self.failed += 1
+            print('  FAIL  %s %s' % (what, detail))
+        return cond
+
+    def finish(self):
+        print('%s: %d of %d passing' % (self.name, self.passed,
+                                        self.passed + self.failed))
+        return 1 if self.failed else 0
@@ -0,0 +1,179 @@
+"""
+A FastCGI responder standing in for a real backend, answering requests
+on one connection concurrently (FCGI_MPXS_CONNS). The script name picks
+the behaviour:
+
+  /redir  answers with only a Location header
+  /slow   answers after half a second
+  /hang   answers only after 3 seconds, or never once aborted
+  other   201 with the request echoed back as text
+
+Run on its own with `python3 test/fcgi_standin.py unix:/path` or
+`python3 test/fcgi_standin.py PORT`.
+"""
+
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+
+BEGIN_REQUEST = 1
+ABORT_REQUEST = 2
+END_REQUEST = 3
+PARAMS = 4
+STDIN = 5
+STDOUT = 6
+
+
+def read_exact(sock, n):
+    data = b''
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return data
+
+
+def parse_params(data):
+    params = {}
+    i = 0
+
+    def length():
+        nonlocal i
+        if data[i] < 128:
+            i += 1
+            return data[i - 1]
+        value = struct.unpack('>I', data[i:i + 4])[0] & 0x7fffffff
+        i += 4
+        return value
+
+    while i < len(data):
+        name_len = length()
+        value_len = length()
+        name = data[i:i + name_len].decode()
+        params[name] = data[i + name_len:i + name_len + value_len].decode()
+        i += name_len + value_len
+    return params
+
+
+class FcgiStandin:
+    def __init__(self, address):
+        """`address` is "unix:/path" or a TCP port on 127.0.0.1."""
+        if address.startswith('unix:'):
+            path = address[5:]
+            if os.path.exists(path):
+                os.unlink(path)
+            self.sock = socket.socket(socket.AF_UNIX)
+            self.sock.bind(path)
+        else:
+            self.sock = socket.socket()
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            self.sock.bind(('127.0.0.1', int(address)))
+        self.sock.listen(64)
+
+        self.lock = threading.Lock()
+        self.connections = 0
+        self.max_in_flight = 0  # on any single connection
+        self.aborted = 0
+
+    def start(self):
+        threading.Thread(target=self.serve, daemon=True).start()
+        return self
+
+    def serve(self):
+        while True:
+            conn, _ = self.sock.accept()
+            with self.lock:
+                self.connections += 1
+            threading.Thread(target=self.handle, args=(conn,),
+                             daemon=True).start()
+
+    def handle(self, conn):
+        requests = {}
+        aborted = set()
+        state = {'in_flight': 0}
+        write_lock = threading.Lock()
+
+        def send(record_type, rid, data):
+            with write_lock:
+                offset = 0
+                while True:
+                    chunk = data[offset:offset + 65535]
+                    conn.sendall(struct.pack('>BBHHBB', 1, record_type, rid,
+                                             len(chunk), 0, 0) + chunk)
+                    offset += len(chunk)
+                    if offset >= len(data):
+                        break
+
+        def end(rid):
+            send(END_REQUEST, rid, struct.pack('>IB3x', 0, 0))
+            with self.lock:
+                state['in_flight'] -= 1
+
+        def respond(rid, params, body):
+            try:
+                answer(rid, params, body)
+            except OSError:
+                pass
+
+        def answer(rid, params, body):
+            script = params.get('SCRIPT_NAME', '')
+            if script == '/slow':
+                time.sleep(0.5)
+            if script == '/hang':
+                time.sleep(3)
+                if rid in aborted:
+                    return
+            if script == '/redir':
+                out = b'Location: /elsewhere\r\n\r\n'
+            else:
+                text = ('method=%s path=%s qs=%s len=%d body=%s\n' % (
+                    params.get('REQUEST_METHOD'), script,
+                    params.get('QUERY_STRING'), len(body),
+                    body[:32].decode(errors='replace'))).encode()
+                out = (b'Status: 201 Created\r\n'
+                       b'Content-Type: text/plain\r\n'
+                       b'X-Request-Id: %d\r\n\r\n' % rid) + text
+            send(STDOUT, rid, out)
+            send(STDOUT, rid, b'')
+            end(rid)
+
+        try:
+            while True:
+                _, record_type, rid, content_len, padding_len, _ = \
+                    struct.unpack('>BBHHBB', read_exact(conn, 8))
+                content = read_exact(conn, content_len + padding_len)
+                content = content[:content_len]
+                if record_type == BEGIN_REQUEST:
+                    requests[rid] = {'params': b'', 'stdin': b''}
+                    with self.lock:
+                        state['in_flight'] += 1
+                        self.max_in_flight = max(self.max_in_flight,
+                                                 state['in_flight'])
+                elif record_type == ABORT_REQUEST:
+                    with self.lock:
+                        self.aborted += 1
+                    aborted.add(rid)
+                    requests.pop(rid, None)
+                    end(rid)
+                elif record_type == PARAMS:
+                    requests[rid]['params'] += content
+                elif record_type == STDIN and content:
+                    requests[rid]['stdin'] += content
+                elif record_type == STDIN and rid in requests:
+                    request = requests.pop(rid)
+                    threading.Thread(
+                        target=respond,
+                        args=(rid, parse_params(request['params']),
+                              request['stdin']),
+                        daemon=True).start()
+        except (EOFError, OSError):
+            conn.close()
+
+
+if __name__ == '__main__':
+    standin = FcgiStandin(sys.argv[1])
+    standin.serve()
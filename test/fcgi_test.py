@@ -0,0 +1,120 @@
+"""
+Runs requests through chttpd to test/fcgi_standin.py: plain and chunked
+bodies, CGI style responses, multiplexed concurrent requests and the
+upstream timeout. Run from the repository root, `make test_fcgi`.
+"""
+
+import os
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from chttpd_harness import Chttpd, Checks
+from fcgi_standin import FcgiStandin
+
+
+def concurrently(server, path, count):
+    results = [None] * count
+
+    def run(i):
+        results[i] = server.request('GET', path)
+
+    threads = [threading.Thread(target=run, args=(i,)) for i in range(count)]
+    start = time.time()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    return results, time.time() - start
+
+
+def main():
+    checks = Checks('FastCGI test')
+    socket_path = os.path.join(tempfile.mkdtemp(prefix='chttpd-fcgi-'),
+                               'fcgi.sock')
+    standin = FcgiStandin('unix:' + socket_path).start()
+    backend = 'unix:' + socket_path
+
+    server = Chttpd([
+        'upstream-timeout 1',
+        'fcgi-connections 1',
+        'fcgi-multiplex 4',
+        'get /app fcgi ' + backend,
+        'post /app fcgi ' + backend,
+        'get /redir fcgi ' + backend,
+        'get /slow fcgi ' + backend,
+        'get /hang fcgi ' + backend,
+        'get /down fcgi unix:' + socket_path + '.missing',
+    ])
+    try:
+        status, headers, body = server.request('GET', '/app?a=1&b=2')
+        checks.check('status from Status header', status == 201, status)
+        checks.check('CGI headers passed on',
+                     headers.get('x-request-id') is not None
+                     and headers.get('content-type') == 'text/plain',
+                     headers)
+        checks.check('request passed on',
+                     body.startswith(b'method=GET path=/app qs=a=1&b=2 '),
+                     body)
+        checks.check('Content-Length matches body',
+                     int(headers.get('content-length', -1)) == len(body))
+
+        status, _, body = server.request('POST', '/app', body=b'x' * 100000)
+        checks.check('Content-Length body sent as STDIN',
+                     status == 201 and b' len=100000 ' in body, body)
+
+        status, _, body = server.request('POST', '/app',
+                                         chunks=[b'hello ', b'chunked'])
+        checks.check('chunked body sent as STDIN',
+                     status == 201 and b' len=13 body=hello chunked' in body,
+                     body)
+
+        status, headers, _ = server.request('GET', '/redir')
+        checks.check('Location alone implies 302',
+                     status == 302 and headers.get('location') == '/elsewhere',
+                     (status, headers))
+
+        results, elapsed = concurrently(server, '/slow', 4)
+        ids = set(headers.get('x-request-id') for _, headers, _ in results)
+        checks.check('concurrent requests all answered',
+                     all(status == 201 for status, _, _ in results),
+                     [status for status, _, _ in results])
+        checks.check('concurrent requests share one connection',
+                     standin.connections == 1 and standin.max_in_flight >= 2,
+                     (standin.connections, standin.max_in_flight))
+        checks.check('multiplexed requests run in parallel',
+                     elapsed < 1.5 and len(ids) >= 2, (elapsed, ids))
+
+        start = time.time()
+        status, _, _ = server.request('GET', '/hang')
+        elapsed = time.time() - start
+        checks.check('stalled upstream answers 504 in time',
+                     status == 504 and elapsed < 2.5, (status, elapsed))
+        status, _, _ = server.request('GET', '/app')
+        checks.check('connection of a lone timed out request replaced',
+                     status == 201 and standin.connections == 2,
+                     (status, standin.connections))
+
+        results, elapsed = concurrently(server, '/hang', 2)
+        checks.check('timed out request on a shared connection aborted',
+                     all(status == 504 for status, _, _ in results)
+                     and standin.aborted == 1 and elapsed < 2.5,
+                     ([status for status, _, _ in results],
+                      standin.aborted, elapsed))
+        status, _, _ = server.request('GET', '/app')
+        checks.check('requests go on after timeouts', status == 201, status)
+
+        status, _, body = server.request('GET', '/down')
+        checks.check('unreachable upstream answers 502 page',
+                     status == 502 and b'.missing' not in body, status)
+    finally:
+        server.stop(show_log=checks.failed != 0)
+
+    return checks.finish()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
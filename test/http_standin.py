@@ -0,0 +1,152 @@
+"""
+An HTTP/1.1 server standing in for a proxy upstream. It keeps connections
+alive, counts them, and tells in every answer which server and which of
+its connections took the request. The last part of the path picks the
+behaviour:
+
+  chunked  answers with a chunked body
+  interim  sends 100 Continue and 102 Processing before the answer
+  slow     answers after one second
+  hang     answers only after 5 seconds
+  other    200 with the request echoed back as text
+
+Run on its own with `python3 test/http_standin.py NAME PORT`.
+"""
+
+import socket
+import sys
+import threading
+import time
+
+
+class Request:
+    def __init__(self, method, path, headers, body, chunked):
+        self.method = method
+        self.path = path
+        self.headers = headers
+        self.body = body
+        self.chunked = chunked
+
+
+class Reader:
+    def __init__(self, conn):
+        self.conn = conn
+        self.buffer = b''
+
+    def fill(self):
+        data = self.conn.recv(65536)
+        if not data:
+            raise EOFError
+        self.buffer += data
+
+    def line(self):
+        while b'\r\n' not in self.buffer:
+            self.fill()
+        line, self.buffer = self.buffer.split(b'\r\n', 1)
+        return line.decode('latin-1')
+
+    def exact(self, n):
+        while len(self.buffer) < n:
+            self.fill()
+        data, self.buffer = self.buffer[:n], self.buffer[n:]
+        return data
+
+    def request(self):
+        method, path, _ = self.line().split(' ', 2)
+        headers = {}
+        while True:
+            line = self.line()
+            if not line:
+                break
+            name, value = line.split(':', 1)
+            headers[name.strip().lower()] = value.strip()
+
+        chunked = 'chunked' in headers.get('transfer-encoding', '')
+        if chunked:
+            body = b''
+            while True:
+                size = int(self.line().split(';')[0], 16)
+                if size == 0:
+                    while self.line():
+                        pass
+                    break
+                body += self.exact(size)
+                self.exact(2)
+        else:
+            body = self.exact(int(headers.get('content-length', 0)))
+        return Request(method, path, headers, body, chunked)
+
+
+class HttpStandin:
+    def __init__(self, name, port=0):
+        self.name = name
+        self.sock = socket.socket()
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind(('127.0.0.1', port))
+        self.sock.listen(64)
+        self.address = '127.0.0.1:%d' % self.sock.getsockname()[1]
+
+        self.lock = threading.Lock()
+        self.connections = 0
+        self.requests = 0
+        self.last = None
+
+    def start(self):
+        threading.Thread(target=self.serve, daemon=True).start()
+        return self
+
+    def serve(self):
+        while True:
+            conn, _ = self.sock.accept()
+            with self.lock:
+                self.connections += 1
+                number = self.connections
+            threading.Thread(target=self.handle, args=(conn, number),
+                             daemon=True).start()
+
+    def handle(self, conn, number):
+        reader = Reader(conn)
+        try:
+            while True:
+                request = reader.request()
+                with self.lock:
+                    self.requests += 1
+                    self.last = request
+                self.answer(conn, number, request)
+        except (EOFError, OSError):
+            conn.close()
+
+    def answer(self, conn, number, request):
+        kind = request.path.split('?')[0].rsplit('/', 1)[-1]
+        if kind == 'slow':
+            time.sleep(1)
+        elif kind == 'hang':
+            time.sleep(5)
+        elif kind == 'interim':
+            conn.sendall(b'HTTP/1.1 100 Continue\r\n\r\n'
+                         b'HTTP/1.1 102 Processing\r\n'
+                         b'X-Interim: yes\r\n\r\n')
+
+        text = ('server=%s conn=%d method=%s path=%s len=%d chunked=%d '
+                'expect=%s body=%s\n' % (
+                    self.name, number, request.method, request.path,
+                    len(request.body), request.chunked,
+                    request.headers.get('expect', '-'),
+                    request.body[:32].decode(errors='replace'))).encode()
+        if kind == 'chunked':
+            parts = [text[:10], text[10:20], text[20:]]
+            conn.sendall(b'HTTP/1.1 200 OK\r\n'
+                         b'Content-Type: text/plain\r\n'
+                         b'Transfer-Encoding: chunked\r\n\r\n'
+                         + b''.join(b'%x\r\n%s\r\n' % (len(part), part)
+                                    for part in parts)
+                         + b'0\r\n\r\n')
+        else:
+            conn.sendall(b'HTTP/1.1 200 OK\r\n'
+                         b'Content-Type: text/plain\r\n'
+                         b'Content-Length: %d\r\n\r\n' % len(text) + text)
+
+
+if __name__ == '__main__':
+    standin = HttpStandin(sys.argv[1], int(sys.argv[2]))
+    standin.serve()
@@ -0,0 +1,157 @@
+"""
+Runs requests through chttpd to servers from test/http_standin.py:
+connection reuse, both balancing policies, chunked bodies both ways,
+interim responses and the upstream timeout. Run from the repository
+root, `make test_proxy`.
+"""
+
+import os
+import re
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from chttpd_harness import Chttpd, Checks, free_port
+from http_standin import HttpStandin
+
+
+def served_by(body):
+    """Returns the server name and connection number in an answer."""
+    match = re.match(rb'server=(\w+) conn=(\d+) ', body)
+    if match is None:
+        return None, None
+    return match.group(1).decode(), int(match.group(2))
+
+
+def main():
+    checks = Checks('proxy test')
+    single = HttpStandin('single').start()
+    left = HttpStandin('left').start()
+    right = HttpStandin('right').start()
+    busy = HttpStandin('busy').start()
+    idle = HttpStandin('idle').start()
+
+    server = Chttpd([
+        'upstream-timeout 1',
+        'upstream single ' + single.address,
+        'upstream pair %s %s' % (left.address, right.address),
+        'upstream lc %s %s' % (busy.address, idle.address),
+        'upstream-balance lc least-conn',
+        'get /single/echo proxy single',
+        'post /single/echo proxy single',
+        'get /single/chunked proxy single',
+        'get /single/interim proxy single',
+        'get /single/hang proxy single',
+        'get /pair/echo proxy pair',
+        'get /lc/echo proxy lc',
+        'get /lc/slow proxy lc',
+        'get /dead/echo proxy 127.0.0.1:%d' % free_port(),
+    ])
+    try:
+        status, headers, body = server.request('GET', '/single/echo?a=1')
+        checks.check('request passed on',
+                     status == 200
+                     and b' method=GET path=/single/echo?a=1 ' in body,
+                     (status, body))
+        checks.check('Content-Length matches body',
+                     int(headers.get('content-length', -1)) == len(body))
+
+        conns = set()
+        for _ in range(5):
+            _, _, body = server.request('GET', '/single/echo')
+            conns.add(served_by(body))
+        checks.check('sequential requests reuse one upstream connection',
+                     conns == {('single', 1)} and single.connections == 1,
+                     (conns, single.connections))
+
+        names = []
+        for _ in range(4):
+            _, _, body = server.request('GET', '/pair/echo')
+            names.append(served_by(body)[0])
+        checks.check('round-robin alternates between servers',
+                     names[0] != names[1]
+                     and names[0::2] == [names[0]] * 2
+                     and names[1::2] == [names[1]] * 2,
+                     names)
+
+        slow = {}
+
+        def run_slow():
+            slow['answer'] = server.request('GET', '/lc/slow')
+
+        thread = threading.Thread(target=run_slow)
+        thread.start()
+        deadline = time.time() + 2
+        while busy.requests + idle.requests == 0 and time.time() < deadline:
+            time.sleep(0.01)
+        slow_server = 'busy' if busy.requests else 'idle'
+        names = []
+        for _ in range(3):
+            _, _, body = server.request('GET', '/lc/echo')
+            names.append(served_by(body)[0])
+        thread.join()
+        checks.check('least-conn avoids the busy server',
+                     slow['answer'][0] == 200
+                     and all(name != slow_server for name in names),
+                     (slow_server, names))
+
+        status, _, body = server.request('POST', '/single/echo',
+                                         chunks=[b'hello ', b'chunked'])
+        checks.check('chunked request body relayed',
+                     status == 200 and b' len=13 ' in body
+                     and b'body=hello chunked' in body, (status, body))
+
+        status, _, body = server.request('POST', '/single/echo',
+                                         body=b'x' * 100000)
+        checks.check('Content-Length request body relayed',
+                     status == 200 and b' len=100000 ' in body,
+                     (status, body[:64]))
+
+        status, headers, body = server.request('GET', '/single/chunked')
+        checks.check('chunked response relayed',
+                     status == 200
+                     and headers.get('transfer-encoding') == 'chunked'
+                     and body.startswith(b'server=single ')
+                     and body.endswith(b'\n'), (status, headers, body))
+
+        status, headers, body = server.request('GET', '/single/interim')
+        checks.check('interim responses dropped',
+                     status == 200 and 'x-interim' not in headers
+                     and body.startswith(b'server=single '),
+                     (status, headers, body))
+
+        status, _, body = server.request('POST', '/single/echo', body=b'x',
+                                         headers={'Expect': '100-continue'})
+        checks.check('Expect not passed on',
+                     status == 200 and b' expect=- ' in body, (status, body))
+
+        _, _, body = server.request('GET', '/single/echo')
+        checks.check('connection still reused after all of the above',
+                     served_by(body) == ('single', 1)
+                     and single.connections == 1,
+                     (served_by(body), single.connections))
+
+        start = time.time()
+        status, _, _ = server.request('GET', '/single/hang')
+        elapsed = time.time() - start
+        checks.check('stalled upstream answers 504 in time',
+                     status == 504 and elapsed < 2.5, (status, elapsed))
+
+        status, _, body = server.request('GET', '/single/echo')
+        checks.check('timed out connection not reused',
+                     status == 200 and served_by(body) == ('single', 2),
+                     (status, served_by(body)))
+
+        status, _, body = server.request('GET', '/dead/echo')
+        checks.check('unreachable upstream answers 502 page',
+                     status == 502 and b'502' in body, status)
+    finally:
+        server.stop(show_log=checks.failed != 0)
+
+    return checks.finish()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
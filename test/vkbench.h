@@ -0,0 +1,103 @@
+/**
+ * VK-Bench is a tiny header-only microbenchmark framework for C, in the
+ * spirit of VK-Test. Each benchmark body is run in batches of growing
+ * size until a batch takes at least VK_BENCH_MIN_NS, and that batch is
+ * reported as ns/op and allocs/op.
+ *
+ * Allocations are counted by replacing malloc, calloc, realloc and
+ * free with wrappers around the glibc implementations, so this file
+ * should only be included in one file, and it counts the allocations
+ * of every thread.
+ */
+
+#ifndef VKBENCH_H
+#define VKBENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifndef VK_BENCH_MIN_NS
+#define VK_BENCH_MIN_NS 200000000ull
+#endif
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t __g_vk_allocs;
+
+void *malloc(size_t size) {
+  __atomic_fetch_add(&__g_vk_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  __atomic_fetch_add(&__g_vk_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  __atomic_fetch_add(&__g_vk_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+  __libc_free(ptr);
+}
+
+static uint64_t __vk_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#define VK_BENCH_BEGIN \
+  fprintf(stderr, "VKBench starting...\n"); \
+  fprintf(stderr, "%-36s %12s %12s %12s\n", \
+          "benchmark", "iterations", "ns/op", "allocs/op");
+
+#define VK_BENCH_END fprintf(stderr, "All benchmarks finished\n");
+
+#define VK_BENCH_SECTION(section_name) \
+  fprintf(stderr, "-- %s\n", section_name);
+
+/*
+ * The body goes after the name, so that commas in it need no extra
+ * parentheses. A batch runs it `__vk_n` times, counting `__vk_i`.
+ */
+#define VK_BENCH(bench_name, ...) \
+  { \
+    uint64_t __vk_n = 1; \
+    for (;;) { \
+      size_t __vk_allocs_start = \
+        __atomic_load_n(&__g_vk_allocs, __ATOMIC_RELAXED); \
+      uint64_t __vk_start = __vk_now_ns(); \
+      for (uint64_t __vk_i = 0; __vk_i < __vk_n; __vk_i++) { \
+        __VA_ARGS__ \
+      } \
+      uint64_t __vk_elapsed = __vk_now_ns() - __vk_start; \
+      size_t __vk_allocs = \
+        __atomic_load_n(&__g_vk_allocs, __ATOMIC_RELAXED) \
+        - __vk_allocs_start; \
+      if (__vk_elapsed >= VK_BENCH_MIN_NS || __vk_n >= (1ull << 40)) { \
+        fprintf(stderr, "%-36s %12llu %12.1f %12.2f\n", \
+                bench_name, \
+                (unsigned long long)__vk_n, \
+                (double)__vk_elapsed / (double)__vk_n, \
+                (double)__vk_allocs / (double)__vk_n); \
+        break; \
+      } \
+      __vk_n *= 2; \
+    } \
+  }
+
+/* keeps the compiler from optimizing away a computed value */
+#define VK_BENCH_KEEP(value) \
+  __asm__ volatile("" : : "g"(value) : "memory")
+
+#else
+  #error Multiple inclusion for vkbench?
+#endif